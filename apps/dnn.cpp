@@ -1,18 +1,46 @@
+#include "ml_models/DNN/batchnorm_layer.hpp"
+#include "ml_models/DNN/conv_layer.hpp"
+#include "ml_models/DNN/inference_graph.hpp"
 #include "ml_models/DNN/network.hpp"
 #include "ml_models/DNN/parameters.hpp"
+#include "ml_models/DNN/pooling_layer.hpp"
+#include "ml_models/DNN/quantized_network.hpp"
 
 #include "math/matrix.hpp"
 #include "math/linearalgebra.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/sparse.hpp"
+#include "data_processing/dataset_view.hpp"
 #include "data_processing/XOR/XOR_preprocessor.hpp"
 #include "data_processing/MNIST/mnist_data.hpp"
 #include "data_processing/MNIST/mnist_data_handler.hpp"
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <memory>
 
 using namespace std;
 
+batchMatrix toBatch(vector<MNISTData> &data, int count, bool labels)
+{
+    /*
+    Stacks the feature vectors (or class vectors) of the first 'count'
+    samples into a matrix with one sample per row.
+    */
+
+    count = std::min<int>(count, data.size());
+    const int width { labels ? int(data.at(0).getClassVector().size()) : int(data.at(0).getFeatureVector().size()) };
+    batchMatrix batch(count, width);
+    for (int n=0; n<count; ++n)
+    {
+        const vector<double> &values { labels ? data.at(n).getClassVector() : data.at(n).getFeatureVector() };
+        std::copy(values.begin(), values.end(), batch.data() + n*width);
+    }
+    return batch;
+}
+
 int main(int argc, char *argv[]) {
     /*
     TODO/RULES:
@@ -27,18 +55,31 @@ int main(int argc, char *argv[]) {
        cout <<"Usage: dnn EXAMPLE"<<endl
             <<"Current available examples:"<<endl
             <<"XOR"<<endl
-            <<"MNIST"<<endl;
+            <<"MNIST"<<endl
+            <<"MNIST_CONV"<<endl;
    } else
    {
           printf("ScratchNet");
+        memtrack::dumpAtExit();
 
         /* Get training data and network parameters */
         vector<vector<vector<double>>> trainingData;
         vector<int> layerSizes;
         vector<Activation> activationTypes;
+        vector<unique_ptr<BatchLayer>> featureLayers;
+        int batchSize {1};
+        vector<double> dropoutRates;
+        double firstLayerSparsity {0.0};
+        vector<linalg::SparseVector> sparseInputs; // MNIST pixels are mostly zero, so the dense example trains on sparse inputs
+        vector<vector<double>> sparseTargets;
+        batchMatrix calibrationInputs, testInputs, testTargets;
+        MNISTDataHandler dataHandler;  // Owns the MNIST samples that testData views.
+        DatasetView testData;
+        DatasetView validationData;
 
         if(!strcmp(argv[1], "XOR"))
         {
+            memtrack::Scope datasetScope(memtrack::Subsystem::DATASET);
             XORPreprocessor trainingClass("./data/XOR_train.txt"); 
             const int inputLayerSize  = trainingClass.getInputSize();
             const int outputLayerSize = trainingClass.getOutputSize();
@@ -46,9 +87,9 @@ int main(int argc, char *argv[]) {
             layerSizes = {inputLayerSize, 5, outputLayerSize};
             activationTypes = {Activation::TANH, Activation::TANH, Activation::TANH};
         }
-        else if (!strcmp(argv[1], "MNIST"))
+        else if (!strcmp(argv[1], "MNIST") || !strcmp(argv[1], "MNIST_CONV"))
         {
-            MNISTDataHandler dataHandler{MNISTDataHandler()};
+            memtrack::Scope datasetScope(memtrack::Subsystem::DATASET);
             dataHandler.readFeatureVector("data/train-images-idx3-ubyte");
             dataHandler.readLabels("data/train-labels-idx1-ubyte");
             dataHandler.splitData();
@@ -63,13 +104,84 @@ int main(int argc, char *argv[]) {
                 };
                 trainingData.at(i) = currentSample;
             }
-            layerSizes = {784, 32, 32, 10};
-            activationTypes = {Activation::RELU, Activation::RELU, Activation::RELU, Activation::FAST_SIGMOID};
+            calibrationInputs = toBatch(dataHandler.getTrainingData(), 1000, false);
+            testData    = DatasetView(dataHandler.getTestData());
+            validationData = DatasetView(dataHandler.getValidationData());
+            testInputs  = toBatch(dataHandler.getTestData(), 2000, false);
+            testTargets = toBatch(dataHandler.getTestData(), 2000, true);
+            if (!strcmp(argv[1], "MNIST_CONV"))
+            {
+                // 8 5x5 kernels give 8x24x24 feature maps, batch normalized before the RELU,
+                // which 2x2 max pooling reduces to 8x12x12.
+                featureLayers.push_back(unique_ptr<BatchLayer>(new Conv2DLayer(1, 28, 28, 8, 5, 1, 0, Activation::LINEAR)));
+                featureLayers.push_back(unique_ptr<BatchLayer>(new BatchNormLayer(8, 24*24, Activation::RELU)));
+                featureLayers.push_back(unique_ptr<BatchLayer>(new Pool2DLayer(Pooling::MAX, 8, 24, 24, 2)));
+                layerSizes = {featureLayers.back()->getOutputSize(), 32, 10};
+                activationTypes = {Activation::RELU, Activation::RELU, Activation::FAST_SIGMOID};
+                dropoutRates = {0.0, 0.25};
+                batchSize = 32;
+            }
+            else
+            {
+                layerSizes = {784, 32, 32, 10};
+                firstLayerSparsity = 0.8; // most of the 784x32 input weights are pruned away
+                for (const vector<vector<double>> &sample : trainingData)
+                {
+                    sparseInputs.push_back(linalg::SparseVector::fromDense(sample.at(0)));
+                    sparseTargets.push_back(sample.at(1));
+                }
+                activationTypes = {Activation::RELU, Activation::RELU, Activation::RELU, Activation::FAST_SIGMOID};
+            }
         }
         
         /* Initialize network, then train */
         Network neuralNetwork {Network(layerSizes, activationTypes)};
-        neuralNetwork.train(trainingData);
+        for (unique_ptr<BatchLayer> &layer : featureLayers)
+        {
+            neuralNetwork.addFeatureLayer(std::move(layer));
+        }
+        neuralNetwork.setBatchSize(batchSize);
+        for (int layerNum=0; layerNum<dropoutRates.size(); ++layerNum)
+        {
+            neuralNetwork.setDropout(layerNum, dropoutRates.at(layerNum));
+        }
+        if (firstLayerSparsity > 0.0)
+        {
+            neuralNetwork.setPruning(0, firstLayerSparsity, 1000, 20000, 1000);
+        }
+        if (!sparseInputs.empty())
+        {
+            neuralNetwork.train(sparseInputs, sparseTargets);
+        }
+        else if (validationData.size() > 0)
+        {
+            neuralNetwork.trainEpochs(trainingData, validationData, 10, 2);
+        }
+        else
+        {
+            neuralNetwork.train(trainingData);
+        }
+
+        /* Evaluate on the held-out test split */
+        if (testData.size() > 0)
+        {
+            neuralNetwork.evaluate(testData).printToConsole();
+        }
+
+        /* Quantize for serving and compare against the float model */
+        if (testInputs.numRows() > 0)
+        {
+            QuantizedNetwork quantizedNetwork(neuralNetwork, calibrationInputs);
+            quantizedNetwork.compare(neuralNetwork, testInputs, testTargets).printToConsole();
+        }
+
+        /* Fuse the inference graph and compare against the unfused one on a serving-sized batch */
+        if (testInputs.numRows() > 0)
+        {
+            batchMatrix servingBatch(32, testInputs.numCols());
+            std::copy(testInputs.data(), testInputs.data() + servingBatch.size(), servingBatch.data());
+            InferenceGraph::benchmarkFusion(neuralNetwork, servingBatch, 50).printToConsole();
+        }
     }
 
     return 0;
@@ -0,0 +1,585 @@
+#include "harness.hpp"
+
+#include "ml_models/DNN/activation.hpp"
+#include "ml_models/DNN/network.hpp"
+#include "ml_models/DNN/parameters.hpp"
+#include "ml_models/KMeans/kmeans.hpp"
+#include "ml_models/KNN/knn.hpp"
+#include "data_processing/MNIST/mnist_data.hpp"
+#include "data_processing/MNIST/mnist_data_handler.hpp"
+#include "math/autotune.hpp"
+#include "math/gemm.hpp"
+#include "math/hugepages.hpp"
+#include "math/linearalgebra.hpp"
+#include "math/matrix.hpp"
+#include "math/numerical.hpp"
+#include "math/parallel.hpp"
+#include "math/profiler.hpp"
+#include "math/qgemm.hpp"
+#include "math/roofline.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    class SilenceStdout
+    {
+        /*
+        Sends everything written to stdout (printf and cout alike) to
+        /dev/null while alive, so the progress logs of the code being timed
+        don't swamp the results.
+        */
+
+        public:
+            SilenceStdout()
+            {
+                cout.flush();
+                fflush(stdout);
+                m_savedFd = dup(STDOUT_FILENO);
+                const int nullFd { open("/dev/null", O_WRONLY) };
+                dup2(nullFd, STDOUT_FILENO);
+                close(nullFd);
+            }
+
+            ~SilenceStdout()
+            {
+                cout.flush();
+                fflush(stdout);
+                dup2(m_savedFd, STDOUT_FILENO);
+                close(m_savedFd);
+            }
+
+        private:
+            int m_savedFd;
+    };
+
+    double uniform(uint64_t seed, uint64_t index)
+    {
+        // Inputs come from the counter-based generator so every run (and commit) times the same data.
+        return (numerical::counterRandom(seed, index) >> 11) / 9007199254740992.0; // top 53 bits over 2^53
+    }
+
+    linalg::Matrix<double> randomMatrix(int rows, int cols, uint64_t seed)
+    {
+        linalg::Matrix<double> M(rows, cols);
+        for (int i=0; i<M.size(); ++i)
+        {
+            M.getValues()[i] = 2.0*uniform(seed, i) - 1.0;
+        }
+        return M;
+    }
+
+    vector<MNISTData> syntheticSamples(int count, int featureSize, int numClasses, uint64_t seed)
+    {
+        vector<MNISTData> samples(count);
+        for (int n=0; n<count; ++n)
+        {
+            vector<double> features(featureSize);
+            for (int d=0; d<featureSize; ++d)
+            {
+                features[d] = uniform(seed, static_cast<uint64_t>(n)*featureSize + d);
+            }
+            samples[n].setFeatureVector(features);
+            samples[n].setLabel(n % numClasses);
+        }
+        return samples;
+    }
+
+    void writeBigEndian(ofstream &file, uint32_t value)
+    {
+        const unsigned char bytes[4] { static_cast<unsigned char>(value >> 24), static_cast<unsigned char>(value >> 16),
+                                       static_cast<unsigned char>(value >> 8),  static_cast<unsigned char>(value) };
+        file.write(reinterpret_cast<const char*>(bytes), 4);
+    }
+
+    void benchCalibration(bench::Harness &harness)
+    {
+        /*
+        Fixed mix of dependent arithmetic and a streaming read over 8 MB,
+        independent of the library code: how fast it runs measures the
+        machine (clock, load, memory bandwidth) rather than any change to
+        the kernels, and the perf tests scale their baselines by it.
+        */
+
+        static vector<double> buffer(1 << 20, 1.0);
+        harness.run(bench::Harness::CALIBRATION, 0.0, 8.0*buffer.size(), [&]()
+        {
+            double chain {1.0}, sum {0.0};
+            for (int i=0; i<(1 << 20); ++i)
+            {
+                chain = chain*1.0000001 + 1e-9;
+            }
+            for (double value : buffer)
+            {
+                sum += value;
+            }
+            const double result { chain + sum };
+            bench::keep(result);
+        });
+    }
+
+    void benchGemm(bench::Harness &harness)
+    {
+        const int shapes[][3] { {64, 128, 784},   // MNIST minibatch through a 784-128 layer
+                                {128, 128, 128},
+                                {256, 256, 256},
+                                {1024, 64, 64} };  // tall and skinny
+        for (const auto &shape : shapes)
+        {
+            const int M { shape[0] }, N { shape[1] }, K { shape[2] };
+            linalg::Matrix<double> A { randomMatrix(M, K, 1) }, B { randomMatrix(N, K, 2) }, C(M, N);
+            harness.run("gemm " + to_string(M) + "x" + to_string(N) + "x" + to_string(K),
+                        2.0*M*N*K, 8.0*(double(M)*K + double(K)*N + double(M)*N), [&]()
+            {
+                linalg::gemm(A, false, B, true, C);
+            });
+        }
+
+        // Matrix-vector products: one sample through a 784-128 layer.
+        const int rows {128}, cols {784};
+        linalg::Matrix<double> W { randomMatrix(rows, cols, 3) };
+        vector<double> x(cols, 0.5), y(rows);
+        harness.run("gemv 128x784 (gemm)", 2.0*rows*cols, 8.0*(rows*cols + rows + cols), [&]()
+        {
+            linalg::gemm(false, false, rows, 1, cols, 1.0, W.data(), cols, x.data(), 1, 0.0, y.data(), 1);
+        });
+        harness.run("gemv 128x784 (operator*)", 2.0*rows*cols, 8.0*(rows*cols + rows + cols), [&]()
+        {
+            y = W * x;
+        });
+        vector<int8_t> Wq(rows*cols), xq(cols);
+        for (size_t i=0; i<Wq.size(); ++i) { Wq[i] = static_cast<int8_t>(i*37 % 255 - 127); }
+        for (size_t i=0; i<xq.size(); ++i) { xq[i] = static_cast<int8_t>(i*11 % 255 - 127); }
+        vector<int32_t> yq(rows);
+        harness.run("gemv int8 128x784", 2.0*rows*cols, double(rows*cols + cols) + 4.0*rows, [&]()
+        {
+            linalg::gemvInt8(rows, cols, xq.data(), Wq.data(), cols, yq.data());
+        });
+    }
+
+    void benchTranspose(bench::Harness &harness)
+    {
+        const int shapes[][2] { {784, 128}, {1024, 1024} };
+        for (const auto &shape : shapes)
+        {
+            linalg::Matrix<double> A { randomMatrix(shape[0], shape[1], 4) };
+            linalg::Matrix<double> AT;
+            harness.run("transpose " + to_string(shape[0]) + "x" + to_string(shape[1]),
+                        0.0, 16.0*A.size(), [&]()
+            {
+                AT = A.transpose();
+            });
+        }
+    }
+
+    void benchActivations(bench::Harness &harness)
+    {
+        const int size {1 << 20};
+        vector<double> input(size), output(size);
+        for (int i=0; i<size; ++i)
+        {
+            input[i] = (i % 2001 - 1000) * 0.003;
+        }
+        const pair<Activation, string> types[] { {Activation::TANH, "tanh"}, {Activation::RELU, "relu"},
+                                                 {Activation::FAST_SIGMOID, "fast sigmoid"} };
+        for (const auto &type : types)
+        {
+            harness.run("activation " + type.second + " 1M", double(size), 16.0*size, [&]()
+            {
+                for (int i=0; i<size; ++i)
+                {
+                    output[i] = activation::apply(type.first, input[i]);
+                }
+            });
+        }
+    }
+
+    void benchNetwork(bench::Harness &harness, roofline::RooflineReport *layerReport)
+    {
+        vector<int> layerSizes {784, 128, 64, 10};
+        vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH, Activation::TANH};
+        Network network(layerSizes, activationTypes);
+        const int batchSize {64};
+        network.setBatchSize(batchSize);
+
+        vector<vector<vector<double>>> batch;
+        batchMatrix inputs(batchSize, layerSizes.front()), outputs;
+        for (int n=0; n<batchSize; ++n)
+        {
+            vector<double> target(10, 0.0);
+            target[n % 10] = 1.0;
+            batch.push_back({randomMatrix(1, 784, 100+n).getValues(), target});
+            std::copy(batch.back()[0].begin(), batch.back()[0].end(), inputs.data() + n*layerSizes.front());
+        }
+
+        double weights {0.0}, neurons {0.0};
+        for (size_t l=0; l<layerSizes.size(); ++l)
+        {
+            neurons += layerSizes[l];
+            weights += (l+1 < layerSizes.size()) ? double(layerSizes[l]) * layerSizes[l+1] : 0.0;
+        }
+        double predictFlops {0.0}, predictBytes {0.0};
+        for (const roofline::KernelCost &layer : network.layerCosts(batchSize))
+        {
+            predictFlops += layer.flops;
+            predictBytes += layer.bytes;
+        }
+        harness.run("network predict 784-128-64-10 b64", predictFlops, predictBytes, [&]()
+        {
+            network.predict(inputs, outputs);
+        });
+        if (layerReport)
+        {
+            *layerReport = network.rooflineReport(inputs);
+        }
+        // Forward 2, backward 4 flops per weight and sample; weights are read
+        // forward and backward and read and written by the update.
+        harness.run("network train step 784-128-64-10 b64", 6.0*batchSize*weights,
+                    8.0*(4.0*weights + 3.0*batchSize*neurons), [&]()
+        {
+            SilenceStdout silence;
+            network.train(batch);
+        });
+    }
+
+    void benchKNN(bench::Harness &harness)
+    {
+        const int numPoints {2000}, featureSize {784};
+        KNN knn(5);
+        knn.setTrainingData(syntheticSamples(numPoints, featureSize, 10, 5));
+        vector<MNISTData> queries { syntheticSamples(1, featureSize, 10, 6) };
+        const roofline::KernelCost cost { knn.queryCost() };
+        harness.run("knn query k=5 2000x784", cost.flops, cost.bytes, [&]()
+        {
+            knn.findKNearest(&queries[0]);
+            knn.predictClass();
+        });
+    }
+
+    void benchKMeans(bench::Harness &harness)
+    {
+        const int numPoints {2000}, featureSize {784}, numClusters {10};
+        KMeans kmeans(numClusters);
+        kmeans.setTrainingData(syntheticSamples(numPoints, featureSize, 10, 7));
+        kmeans.initClusters();
+        const roofline::KernelCost cost { kmeans.iterationCost() };
+        harness.run("kmeans iteration k=10 2000x784", cost.flops, cost.bytes, [&]()
+        {
+            kmeans.iterate();
+        });
+    }
+
+    void benchPageSizes(bench::Harness &harness)
+    {
+        /*
+        One read from each 4 KB page of a 64 MB buffer, visiting the pages
+        in a random order: nearly every read misses the TLB on 4 KB pages,
+        while the buffer's 32 huge pages all fit in the TLB at once. The
+        same buffer is timed on 4 KB pages and, after collapsing it, on
+        huge pages; with --counters the dTLB misses per read show the
+        difference directly.
+        */
+
+        const size_t bytes { 64 << 20 }, pageBytes {4096};
+        const int numPages { static_cast<int>(bytes / pageBytes) };
+        vector<int> order(numPages);
+        for (int p=0; p<numPages; ++p)
+        {
+            order[p] = p;
+        }
+        for (int p=numPages-1; p>0; --p)
+        {
+            std::swap(order[p], order[numerical::counterRandom(8, p) % (p+1)]);
+        }
+
+        char *buffer { static_cast<char*>(hugepages::allocate(bytes)) };
+        auto scan = [&]()
+        {
+            long sum {0};
+            for (int page : order)
+            {
+                sum += buffer[size_t(page) * pageBytes + (page & 511) * 8];
+            }
+            bench::keep(sum);
+        };
+
+        hugepages::adviseSmall(buffer, bytes);
+        std::fill(buffer, buffer + bytes, 1);
+        harness.run("page walk 64MB (4 KB pages)", 0.0, 64.0*numPages, scan);
+
+        hugepages::collapse(buffer, bytes);
+        harness.run("page walk 64MB (huge pages)", 0.0, 64.0*numPages, scan);
+        cout << "Huge pages: " << (hugepages::hugeBytes(buffer, bytes) >> 20) << " of 64 MB in the page walk buffer"
+             << " (transparent huge pages: " << hugepages::systemMode() << ")" << endl;
+        hugepages::deallocate(buffer, bytes);
+    }
+
+    void benchIdxLoading(bench::Harness &harness)
+    {
+        /*
+        Writes a synthetic MNIST-format image and label file pair and times
+        reading them back through MNISTDataHandler.
+        */
+
+        const int numImages {2000}, rows {28}, cols {28};
+        const string imagePath { "bench-synthetic-images-idx3-ubyte" };
+        const string labelPath { "bench-synthetic-labels-idx1-ubyte" };
+        {
+            ofstream images(imagePath, ios::binary);
+            writeBigEndian(images, 0x00000803);
+            writeBigEndian(images, numImages);
+            writeBigEndian(images, rows);
+            writeBigEndian(images, cols);
+            for (int i=0; i<numImages*rows*cols; ++i)
+            {
+                images.put(static_cast<char>(i*31 % 256));
+            }
+            ofstream labels(labelPath, ios::binary);
+            writeBigEndian(labels, 0x00000801);
+            writeBigEndian(labels, numImages);
+            for (int i=0; i<numImages; ++i)
+            {
+                labels.put(static_cast<char>(i % 10));
+            }
+        }
+
+        harness.run("idx load 2000 images", 0.0, 16.0 + numImages*(rows*cols + 1.0) + 8.0, [&]()
+        {
+            SilenceStdout silence;
+            MNISTDataHandler handler;
+            handler.readFeatureVector(imagePath);
+            handler.readLabels(labelPath);
+        });
+
+        std::remove(imagePath.c_str());
+        std::remove(labelPath.c_str());
+    }
+
+    bench::Harness runSuite(const bench::Options &options, roofline::RooflineReport *layerReport=nullptr)
+    {
+        bench::Harness harness(options);
+        benchCalibration(harness);
+        benchGemm(harness);
+        benchTranspose(harness);
+        benchActivations(harness);
+        benchNetwork(harness, layerReport);
+        benchKNN(harness);
+        benchKMeans(harness);
+        benchPageSizes(harness);
+        benchIdxLoading(harness);
+        return harness;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    /*
+    Usage: bench [--quick] [--filter <substring>] [--threads <n>] [--pin] [--pin-nodes] [--deterministic] [--autotune] [--json <path>] [--counters] [--roofline]
+                 [--baseline <path> [--tolerance <fraction>] [--update-baseline]]
+
+    --counters reads the hardware performance counters around each timed
+    repetition and the instrumented library regions (see math/profiler.hpp)
+    and reports IPC and cache, branch and TLB misses per sample at the end.
+    --pin pins the scheduler's workers to one CPU each (see math/parallel.hpp),
+    --pin-nodes confines them to the CPUs of one NUMA node each, round robin.
+    --deterministic turns on deterministic reductions, so that the gradient
+    and centroid sums are the same for any --threads.
+    --autotune tunes the gemm tiling per shape class on first use (during
+    the warm-up runs) and caches it per CPU model; see math/autotune.hpp.
+    --roofline measures the machine's peak GFLOP/s and GB/s and places the
+    benchmarks, and each layer of the benchmarked network, on the roofline.
+
+    With --baseline only the benchmarks listed in the baseline file run, and
+    their median times are compared against it: the exit code is 1 if any is
+    more than the tolerance (default 0.25) slower, and 77 (CTest's skip code)
+    if the baseline was recorded for another build type. Regressions are
+    rerun once and only fail if the rerun confirms them, since a busy machine
+    easily slows a single run by the tolerance. --update-baseline rewrites
+    the file instead, with the median of three runs of each benchmark.
+    */
+
+    const char *usage { " [--quick] [--filter <substring>] [--threads <n>] [--pin] [--pin-nodes] [--deterministic] [--autotune] [--json <path>] [--counters] [--roofline]"
+                        " [--baseline <path> [--tolerance <fraction>] [--update-baseline]]" };
+    bench::Options options;
+    string jsonPath, baselinePath;
+    double tolerance {0.25};
+    bool updateBaseline {false}, showRoofline {false};
+    for (int i=1; i<argc; ++i)
+    {
+        if (strcmp(argv[i], "--quick") == 0)
+        {
+            options.warmup = 1;
+            options.minRepetitions = 3;
+            options.minSeconds = 0.02;
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i+1 < argc)
+        {
+            options.filter = argv[++i];
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc)
+        {
+            parallel::setNumThreads(atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--pin") == 0)
+        {
+            parallel::setCorePinning(true);
+        }
+        else if (strcmp(argv[i], "--pin-nodes") == 0)
+        {
+            parallel::setNodePinning(true);
+        }
+        else if (strcmp(argv[i], "--deterministic") == 0)
+        {
+            parallel::setDeterministicReductions(true);
+        }
+        else if (strcmp(argv[i], "--autotune") == 0)
+        {
+            autotune::setEnabled(true);
+        }
+        else if (strcmp(argv[i], "--json") == 0 && i+1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--counters") == 0)
+        {
+            profiler::setEnabled(true);
+        }
+        else if (strcmp(argv[i], "--roofline") == 0)
+        {
+            showRoofline = true;
+        }
+        else if (strcmp(argv[i], "--baseline") == 0 && i+1 < argc)
+        {
+            baselinePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--tolerance") == 0 && i+1 < argc)
+        {
+            tolerance = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--update-baseline") == 0)
+        {
+            updateBaseline = true;
+        }
+        else
+        {
+            cerr << "Usage: " << argv[0] << usage << endl;
+            return 1;
+        }
+    }
+
+    bench::Baseline baseline;
+    if (!baselinePath.empty())
+    {
+        if (!baseline.read(baselinePath))
+        {
+            cerr << "Could not read any results from baseline " << baselinePath << endl;
+            return 1;
+        }
+        if (baseline.buildType != SCRATCHNET_BUILD_TYPE && !updateBaseline)
+        {
+            cout << "Skipping: baseline " << baselinePath << " was recorded for a " << baseline.buildType
+                 << " build, this is a " << SCRATCHNET_BUILD_TYPE << " build" << endl;
+            return 77;
+        }
+        options.only = baseline.names();
+    }
+
+    if (updateBaseline)
+    {
+        const int passes {3};
+        vector<vector<bench::Result>> runs;
+        for (int pass=0; pass<passes; ++pass)
+        {
+            runs.push_back(runSuite(options).results());
+        }
+        baseline.buildType = SCRATCHNET_BUILD_TYPE;
+        baseline.results = runs[0];
+        for (size_t b=0; b<baseline.results.size(); ++b)
+        {
+            vector<bench::Result> samples;
+            for (const auto &run : runs)
+            {
+                samples.push_back(run[b]);
+            }
+            std::sort(samples.begin(), samples.end(), [](const bench::Result &x, const bench::Result &y)
+                      { return x.medianSeconds < y.medianSeconds; });
+            baseline.results[b] = samples[passes/2];
+        }
+        baseline.write(baselinePath);
+        cout << "Updated " << baseline.results.size() << " results in " << baselinePath << endl;
+        return 0;
+    }
+
+    roofline::RooflineReport layerReport;
+    const bench::Harness harness { runSuite(options, showRoofline ? &layerReport : nullptr) };
+    harness.printToConsole();
+    if (autotune::enabled())
+    {
+        cout << "Gemm tilings: " << autotune::numTuned() << " shape classes tuned now, " << autotune::numCached()
+             << " cached in " << autotune::cachePath() << " for " << autotune::cpuModel() << endl;
+    }
+    if (profiler::enabled())
+    {
+        profiler::printToConsole();
+    }
+    if (showRoofline)
+    {
+        roofline::RooflineReport report;
+        report.peak = roofline::machinePeak();
+        for (const bench::Result &result : harness.results())
+        {
+            if (result.bytes > 0 && result.name != bench::Harness::CALIBRATION)
+            {
+                report.kernels.push_back({ result.name, result.flops, result.bytes, result.medianSeconds });
+            }
+        }
+        report.printToConsole();
+        if (!layerReport.kernels.empty())
+        {
+            cout << "Layers of the benchmarked network (batch of 64):" << endl;
+            layerReport.printToConsole();
+        }
+    }
+
+    if (!jsonPath.empty())
+    {
+        ofstream json(jsonPath);
+        harness.writeJson(json);
+        cout << "Wrote " << harness.results().size() << " results to " << jsonPath << endl;
+    }
+
+    if (!baselinePath.empty())
+    {
+        vector<string> regressions { harness.compareWith(baseline, tolerance) };
+        if (!regressions.empty())
+        {
+            cout << endl << "Rerunning the regressions to rule out noise" << endl;
+            options.only = regressions;
+            options.only.push_back(bench::Harness::CALIBRATION);
+            bench::Baseline regressed;
+            regressed.buildType = baseline.buildType;
+            for (const bench::Result &result : baseline.results)
+            {
+                if (std::find(options.only.begin(), options.only.end(), result.name) != options.only.end())
+                {
+                    regressed.results.push_back(result);
+                }
+            }
+            regressions = runSuite(options).compareWith(regressed, tolerance);
+        }
+        return regressions.empty() ? 0 : 1;
+    }
+    return 0;
+}
@@ -0,0 +1,251 @@
+#include "harness.hpp"
+#include "math/parallel.hpp"
+#include "math/profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#ifndef SCRATCHNET_BUILD_TYPE
+#define SCRATCHNET_BUILD_TYPE "unknown"
+#endif
+
+namespace bench
+{
+    namespace
+    {
+        string jsonEscape(const string &text)
+        {
+            string escaped;
+            for (char c : text)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    escaped += '\\';
+                }
+                escaped += c;
+            }
+            return escaped;
+        }
+
+        bool readJsonString(const string &line, const string &key, string &value)
+        {
+            const string pattern { "\"" + key + "\": \"" };
+            const size_t start { line.find(pattern) };
+            if (start == string::npos)
+            {
+                return false;
+            }
+            value.clear();
+            for (size_t i=start + pattern.size(); i<line.size() && line[i] != '"'; ++i)
+            {
+                if (line[i] == '\\' && i+1 < line.size())
+                {
+                    ++i;
+                }
+                value += line[i];
+            }
+            return true;
+        }
+
+        bool readJsonNumber(const string &line, const string &key, double &value)
+        {
+            const string pattern { "\"" + key + "\": " };
+            const size_t start { line.find(pattern) };
+            if (start == string::npos)
+            {
+                return false;
+            }
+            istringstream number(line.substr(start + pattern.size()));
+            return static_cast<bool>(number >> value);
+        }
+
+        void writeResults(ostream &out, const string &buildType, const vector<Result> &results)
+        {
+            out << "{" << endl
+                << "  \"build_type\": \"" << jsonEscape(buildType) << "\"," << endl
+                << "  \"compiler\": \"" << jsonEscape(__VERSION__) << "\"," << endl
+                << "  \"threads\": " << parallel::numThreads() << "," << endl
+                << "  \"results\": [" << endl;
+            out << setprecision(9);
+            for (size_t i=0; i<results.size(); ++i)
+            {
+                const Result &result { results[i] };
+                out << "    {\"name\": \"" << jsonEscape(result.name) << "\""
+                    << ", \"repetitions\": " << result.repetitions
+                    << ", \"median_s\": " << result.medianSeconds
+                    << ", \"p99_s\": " << result.p99Seconds
+                    << ", \"min_s\": " << result.minSeconds
+                    << ", \"gflops\": " << result.gflops()
+                    << ", \"gbps\": " << result.gbps() << "}"
+                    << (i+1 < results.size() ? "," : "") << endl;
+            }
+            out << "  ]" << endl << "}" << endl;
+        }
+    }
+
+    void Harness::run(const string &name, double flops, double bytes, const function<void()> &body,
+                      const function<void()> &setup)
+    {
+        if ((!m_options.filter.empty() && name.find(m_options.filter) == string::npos)
+            || (!m_options.only.empty() && std::find(m_options.only.begin(), m_options.only.end(), name) == m_options.only.end()))
+        {
+            return;
+        }
+
+        for (int i=0; i<m_options.warmup; ++i)
+        {
+            if (setup) setup();
+            body();
+        }
+
+        vector<double> seconds;
+        double total {0.0};
+        while ((int(seconds.size()) < m_options.minRepetitions || total < m_options.minSeconds)
+               && int(seconds.size()) < m_options.maxRepetitions)
+        {
+            if (setup) setup();
+            profiler::Region region(name.c_str()); // Counters per repetition, with --counters
+            const auto start { chrono::steady_clock::now() };
+            body();
+            const double elapsed { chrono::duration<double>(chrono::steady_clock::now() - start).count() };
+            seconds.push_back(elapsed);
+            total += elapsed;
+        }
+
+        std::sort(seconds.begin(), seconds.end());
+        Result result;
+        result.name          = name;
+        result.repetitions   = seconds.size();
+        result.medianSeconds = seconds[seconds.size()/2];
+        result.p99Seconds    = seconds[std::min(seconds.size()-1, static_cast<size_t>(std::ceil(0.99*seconds.size())) - 1)];
+        result.minSeconds    = seconds.front();
+        result.flops         = flops;
+        result.bytes         = bytes;
+        m_results.push_back(result);
+
+        cout << left << setw(36) << name << right
+             << " median " << setw(11) << result.medianSeconds*1e6 << " us"
+             << "  p99 " << setw(11) << result.p99Seconds*1e6 << " us"
+             << "  " << setw(8) << setprecision(3) << result.gflops() << " GFLOP/s"
+             << "  " << setw(8) << result.gbps() << " GB/s"
+             << "  (" << result.repetitions << " reps)" << setprecision(6) << endl;
+    }
+
+    void Harness::printToConsole() const
+    {
+        cout << endl << "Benchmark summary (" << SCRATCHNET_BUILD_TYPE << " build, "
+             << parallel::numThreads() << " threads)" << endl;
+        for (const Result &result : m_results)
+        {
+            cout << "  " << left << setw(36) << result.name << right
+                 << setw(12) << result.medianSeconds*1e6 << " us  "
+                 << setw(8) << setprecision(3) << result.gflops() << " GFLOP/s  "
+                 << setw(8) << result.gbps() << " GB/s" << setprecision(6) << endl;
+        }
+        cout << endl;
+    }
+
+    void Harness::writeJson(ostream &out) const
+    {
+        writeResults(out, SCRATCHNET_BUILD_TYPE, m_results);
+    }
+
+    const string Harness::CALIBRATION { "calibration" };
+
+    vector<string> Harness::compareWith(const Baseline &baseline, double tolerance) const
+    {
+        auto findResult = [](const vector<Result> &results, const string &name)
+        {
+            return std::find_if(results.begin(), results.end(), [&](const Result &result) { return result.name == name; });
+        };
+
+        double speed {1.0};
+        const auto expectedCalibration = findResult(baseline.results, CALIBRATION);
+        const auto currentCalibration = findResult(m_results, CALIBRATION);
+        if (expectedCalibration != baseline.results.end() && currentCalibration != m_results.end()
+            && expectedCalibration->medianSeconds > 0)
+        {
+            speed = currentCalibration->medianSeconds / expectedCalibration->medianSeconds;
+        }
+
+        cout << "Comparison against the " << baseline.buildType << " baseline (tolerance "
+             << 100.0*tolerance << "%, baseline times scaled by " << speed << " for machine speed)" << endl
+             << "  " << left << setw(36) << "benchmark" << right << setw(14) << "baseline us"
+             << setw(14) << "current us" << setw(10) << "change" << "  status" << endl;
+
+        vector<string> regressions;
+        for (const Result &expected : baseline.results)
+        {
+            if (expected.name == CALIBRATION)
+            {
+                continue;
+            }
+            const double expectedSeconds { expected.medianSeconds * speed };
+            const auto current = findResult(m_results, expected.name);
+            cout << "  " << left << setw(36) << expected.name << right << setw(14) << expectedSeconds*1e6;
+            if (current == m_results.end())
+            {
+                cout << setw(14) << "-" << setw(10) << "-" << "  MISSING" << endl;
+                regressions.push_back(expected.name);
+                continue;
+            }
+
+            const double change { expectedSeconds > 0 ? current->medianSeconds / expectedSeconds - 1.0 : 0.0 };
+            const char *status { change > tolerance ? "REGRESSION" : change < -tolerance ? "faster (consider updating the baseline)" : "ok" };
+            if (change > tolerance)
+            {
+                regressions.push_back(expected.name);
+            }
+            cout << setw(14) << current->medianSeconds*1e6 << setw(9) << setprecision(3) << showpos << 100.0*change
+                 << noshowpos << setprecision(6) << "%  " << status << endl;
+        }
+        cout << endl << (regressions.empty() ? string("No regressions") : to_string(regressions.size()) + " regression(s)") << endl;
+        return regressions;
+    }
+
+    bool Baseline::read(const string &path)
+    {
+        ifstream file(path);
+        if (!file)
+        {
+            return false;
+        }
+        results.clear();
+        string line;
+        while (getline(file, line))
+        {
+            Result result {};
+            if (readJsonString(line, "name", result.name) && readJsonNumber(line, "median_s", result.medianSeconds))
+            {
+                readJsonNumber(line, "p99_s", result.p99Seconds);
+                readJsonNumber(line, "min_s", result.minSeconds);
+                results.push_back(result);
+            }
+            else
+            {
+                readJsonString(line, "build_type", buildType);
+            }
+        }
+        return !results.empty();
+    }
+
+    void Baseline::write(const string &path) const
+    {
+        ofstream file(path);
+        writeResults(file, buildType, results);
+    }
+
+    vector<string> Baseline::names() const
+    {
+        vector<string> names;
+        for (const Result &result : results)
+        {
+            names.push_back(result.name);
+        }
+        return names;
+    }
+}
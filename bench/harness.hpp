@@ -0,0 +1,96 @@
+#ifndef BENCH_HARNESS_HPP
+#define BENCH_HARNESS_HPP
+
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace bench
+{
+    using namespace std;
+
+    // Makes the compiler assume 'value' is read, so the work computing it isn't optimized away.
+    template <class T>
+    inline void keep(const T &value)
+    {
+        asm volatile("" : : "r"(&value) : "memory");
+    }
+
+    struct Result
+    {
+        string name;
+        int repetitions;
+        double medianSeconds;
+        double p99Seconds;      // Nearest-rank 99th percentile.
+        double minSeconds;
+        double flops;           // Floating-point operations per repetition (0 if not meaningful).
+        double bytes;           // Bytes moved per repetition, counting each operand once.
+
+        double gflops() const { return medianSeconds > 0 ? flops / medianSeconds * 1e-9 : 0.0; }
+        double gbps()   const { return medianSeconds > 0 ? bytes / medianSeconds * 1e-9 : 0.0; }
+    };
+
+    struct Options
+    {
+        int warmup {2};            // Untimed runs before measuring.
+        int minRepetitions {5};
+        int maxRepetitions {1000};
+        double minSeconds {0.25};  // Keep repeating until this much time has been measured.
+        string filter;             // Only run benchmarks whose name contains this...
+        vector<string> only;       // ...and, if not empty, is one of these.
+    };
+
+    struct Baseline
+    {
+        /*
+        Results of an earlier run, read back from the JSON written by
+        Harness::writeJson (only build_type, name and median_s are used).
+        */
+
+        string buildType;
+        vector<Result> results;
+
+        bool read(const string &path);              // False if the file can't be opened or holds no results.
+        void write(const string &path) const;       // Same format as Harness::writeJson.
+        vector<string> names() const;
+    };
+
+    class Harness
+    {
+        /*
+        Minimal benchmark runner. Each benchmark body is run 'warmup' times
+        untimed, then timed one call at a time until both minRepetitions and
+        minSeconds are reached (or maxRepetitions). Reported rates use the
+        median time, which is robust to the odd descheduled repetition.
+        */
+
+        public:
+            explicit Harness(const Options &options) : m_options(options) {}
+
+            // Times body(); 'setup', if given, runs untimed before every call (e.g. to reset state).
+            void run(const string &name, double flops, double bytes, const function<void()> &body,
+                     const function<void()> &setup=function<void()>());
+
+            const vector<Result>& results() const { return m_results; }
+
+            void printToConsole() const;                 // One aligned line per benchmark.
+            void writeJson(ostream &out) const;          // Results plus build information, for diffing between commits.
+
+            // Prints a per-benchmark comparison of the median times against a baseline and returns
+            // the names of the regressions: benchmarks more than 'tolerance' (a fraction) slower
+            // than their baseline, or missing from this run. If both runs include the benchmark
+            // named CALIBRATION, the baseline times are first scaled by how much slower or faster
+            // it ran, so a machine that is uniformly busier (or another model) doesn't fail them all.
+            vector<string> compareWith(const Baseline &baseline, double tolerance) const;
+
+            static const string CALIBRATION;
+
+        private:
+            Options m_options;
+            vector<Result> m_results;
+    };
+}
+
+#endif
@@ -11,9 +11,9 @@ class commonData {
         std::vector<MNISTData> validationData;
 
     public:
-        void setTrainingData(std::vector<MNISTData> data);
-        void setTestData(std::vector<MNISTData> data);
-        void setValidationData(std::vector<MNISTData> data);
+        void setTrainingData(const std::vector<MNISTData> &data);
+        void setTestData(const std::vector<MNISTData> &data);
+        void setValidationData(const std::vector<MNISTData> &data);
 };
 
 
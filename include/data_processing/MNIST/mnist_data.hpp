@@ -23,8 +23,8 @@ class MNISTData {
         int featureVectorSize();
         int getLabel();
         int getEnumLabel();
-        std::vector<double> getFeatureVector();
-        std::vector<double> getClassVector();
+        const std::vector<double>& getFeatureVector() const;
+        const std::vector<double>& getClassVector() const;
 
         // KNN
         void setDistance(double);
@@ -33,4 +33,7 @@ class MNISTData {
         
 };
 
+// Backs the feature vectors of a loaded set with huge pages where they're large and contiguous enough.
+void adviseHugePages(std::vector<MNISTData> &samples);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef DATASET_VIEW_HPP
+#define DATASET_VIEW_HPP
+
+#include "MNIST/mnist_data.hpp"
+
+#include <vector>
+
+class DatasetView {
+    /*
+    Non-owning view of a labelled dataset: one pointer to the features and
+    one to the targets (one-hot class vectors) of every sample. Building a
+    view copies no sample data, so splits and subsets are cheap; the data
+    it was made from must outlive it and stay in place.
+    */
+
+    public:
+        DatasetView() {}
+        DatasetView(const std::vector<MNISTData> &data);                      // MNISTDataHandler splits.
+        DatasetView(const std::vector<std::vector<std::vector<double>>> &data); // {features, targets} pairs, as Network::train takes them.
+
+        DatasetView slice(int first, int count) const; // Samples [first, first+count), clamped to the view.
+
+        int size()        const { return m_features.size(); }
+        int featureSize() const { return m_featureSize; }
+        int targetSize()  const { return m_targetSize; }
+
+        const double* features(int index) const { return m_features[index]; }
+        const double* target(int index)   const { return m_targets[index]; }
+        int label(int index) const;                   // Index of the largest target value.
+
+    private:
+        std::vector<const double*> m_features;
+        std::vector<const double*> m_targets;
+        int m_featureSize {0};
+        int m_targetSize {0};
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef AUTODIFF_H
+#define AUTODIFF_H
+
+#include "./matrix.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace autodiff
+{
+    /*
+    Tape-based reverse-mode automatic differentiation over row-major double
+    matrices. Each operation on a Tape computes its result immediately and
+    records a node; backward() then walks the nodes in reverse, applying each
+    operation's adjoint. Nodes, their values and their gradients all live in
+    the tape's bump arena, which reset() rewinds without freeing, so after the
+    first step a training loop records and differentiates its graph without
+    touching the heap.
+    */
+
+    using std::size_t;
+
+    class Arena
+    {
+        /*
+        Bump allocator over a list of blocks. allocate() hands out the next
+        aligned chunk of the current block, moving to the next block (or
+        adding one) when it runs out; reset() rewinds to the first block and
+        keeps every block for reuse. Nothing allocated from the arena is ever
+        destroyed, so it only holds trivially destructible objects.
+        */
+
+        public:
+            explicit Arena(size_t blockBytes=1<<20);
+
+            void* allocate(size_t bytes, size_t alignment=alignof(std::max_align_t));
+
+            template <class T>
+            T* allocateArray(size_t count) { return static_cast<T*>(allocate(count * sizeof(T), alignof(T))); }
+
+            void reset();                               // Makes all memory available again, keeping the blocks.
+            size_t bytesUsed() const;                   // Bytes handed out since the last reset (including alignment padding).
+            size_t capacity() const;                    // Total size of the blocks held.
+
+        private:
+            size_t m_blockBytes;                        // Size of newly added blocks (larger requests get a block of their own size).
+            std::vector<std::unique_ptr<char[]>> m_blocks;
+            std::vector<size_t> m_blockSizes;
+            size_t m_currentBlock;                      // Block currently being bumped.
+            size_t m_offset;                            // Next free byte in the current block.
+            size_t m_usedBefore;                        // Bytes used in the blocks before the current one.
+    };
+
+    enum class Op {LEAF, MATMUL, ADD_ROW, ADD, SUBTRACT, HADAMARD, SCALE, TANH, SIGMOID, SOFTSIGN, RELU, HALF_SUM_SQUARES};
+
+    struct Node
+    {
+        /*
+        One recorded operation. 'value' and 'grad' are rows x cols buffers;
+        grad is null for nodes that don't depend on any parameter. Leaves point
+        straight at the caller's value and gradient storage.
+        */
+
+        Op op;
+        int rows;
+        int cols;
+        const double *value;
+        double *grad;
+        Node *a;               // First operand (null for leaves).
+        Node *b;               // Second operand, if any.
+        double scalar;         // Factor of SCALE.
+        bool transB;           // MATMUL multiplies by b transposed.
+        Node *previous;        // Node recorded before this one.
+    };
+
+    class Var
+    {
+        /*
+        Handle to a node on a tape; cheap to copy, valid until the tape is reset.
+        */
+
+        public:
+            Var() : m_node(nullptr) {}
+            explicit Var(Node *node) : m_node(node) {}
+
+            int rows() const { return m_node->rows; }
+            int cols() const { return m_node->cols; }
+            double operator() (int i, int j) const { return m_node->value[i*m_node->cols + j]; }
+            const double* value() const { return m_node->value; }
+            const double* grad() const { return m_node->grad; }  // Null unless the node depends on a parameter.
+            Node* node() const { return m_node; }
+
+        private:
+            Node *m_node;
+    };
+
+    class Tape
+    {
+        /*
+        Records operations for one step, e.g. the forward pass of a minibatch,
+        and back-propagates through them. Typical use:
+
+            tape.reset();
+            Var X { tape.constant(inputs) };
+            Var W { tape.parameter(weights, weightGrads) };
+            Var b { tape.parameter(1, n, biases.data(), biasGrads.data()) };
+            Var cost { tape.halfSumSquares(tape.subtract(tape.tanh(tape.addRow(tape.matmul(X, W, true), b)), T)) };
+            tape.backward(cost);   // weightGrads and biasGrads now hold d cost / d parameters
+
+        Parameter gradients are accumulated into the caller's buffers, which must
+        stay alive (as must constant and parameter values) until the next reset.
+        */
+
+        public:
+            explicit Tape(size_t arenaBlockBytes=1<<20);
+
+            Var constant(const linalg::Matrix<double> &value);                                  // No gradient.
+            Var constant(int rows, int cols, const double *value);
+            Var parameter(const linalg::Matrix<double> &value, linalg::Matrix<double> &gradient); // Gradient accumulated (+=) into 'gradient', which is resized and zeroed if its shape differs.
+            Var parameter(int rows, int cols, const double *value, double *gradient);
+
+            Var matmul(Var A, Var B, bool transB=false); // A * B, or A * B^T.
+            Var addRow(Var X, Var row);                  // Adds a 1 x cols row vector to every row of X.
+            Var add(Var X, Var Y);
+            Var subtract(Var X, Var Y);
+            Var hadamard(Var X, Var Y);                  // Elementwise product.
+            Var scale(Var X, double factor);
+            Var tanh(Var X);
+            Var sigmoid(Var X);
+            Var softsign(Var X);                         // x / (1 + |x|), the "fast sigmoid".
+            Var relu(Var X);
+            Var halfSumSquares(Var X);                   // 1 x 1: 0.5 * sum of squared elements (the quadratic cost).
+
+            void backward(Var output);                   // Seeds d output = 1 (output must be 1 x 1) and back-propagates.
+            void backward(Var output, const double *outputGrad); // Seeds d output with outputGrad (rows x cols of output): a vector-Jacobian product.
+            void reset();                                // Forgets every node and rewinds the arena.
+
+            size_t numNodes() const { return m_numNodes; }
+            const Arena& getArena() const { return m_arena; }
+
+        private:
+            Arena m_arena;
+            Node *m_last;
+            size_t m_numNodes;
+
+            Node* record(Op op, int rows, int cols, Node *a, Node *b); // Allocates a node and its value (and a zeroed gradient if an operand has one).
+            double* mutableValue(Node *node) { return const_cast<double*>(node->value); } // Values of non-leaf nodes are arena buffers.
+            void checkSameShape(const char *opName, Var X, Var Y) const;
+            void propagate(Node *node);                  // Adds node's contribution to its operands' gradients.
+    };
+}
+
+#endif
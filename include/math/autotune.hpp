@@ -0,0 +1,49 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "./gemm.hpp"
+
+#include <string>
+
+namespace autotune
+{
+    /*
+    Per-machine tuning of the gemm kernel (which also serves the
+    matrix-vector products, as M = 1). With autotuning on, the first
+    product of each shape class times a series of candidate tilings -
+    thread counts, the 1- and 4-row inner kernels, then the tile rows,
+    columns and depth, each step keeping the fastest so far - and uses the
+    winner from then on. Winners are saved to a cache file keyed by the CPU
+    model, so a machine tunes each class once; one file can serve a whole
+    heterogeneous fleet from a shared home directory.
+
+    A shape class is whether A and B are transposed, with M, N and K rounded
+    up to powers of two and anything over 1024 in one class. Tuning runs on a copy of the shape capped at 1024 x
+    1024 x 512, on scratch buffers, and takes from milliseconds to a few
+    seconds. Products started while another thread is tuning use the
+    default tiling rather than wait. Tilings never change the results (see
+    linalg::GemmTiling), only the speed.
+    */
+
+    // Off by default, so the kernels use the default tiling. Turning it on loads the cache file.
+    void setEnabled(bool enabled);
+    bool enabled();
+
+    // Defaults to $XDG_CACHE_HOME/scratchnet/kernels.tsv, or ~/.cache/scratchnet/kernels.tsv.
+    // Setting it while enabled loads the new file.
+    void setCachePath(const std::string &path);
+    std::string cachePath();
+
+    std::string cpuModel();                         // The cache key: the CPU model name and the number of hardware threads.
+    std::string shapeClass(bool transA, bool transB, int M, int N, int K); // Such as "NT:64x256x1024" (transposes: M x N x K).
+
+    // The tiling for a product of this shape: the cached one, tuned now if the class is new, or the
+    // default when autotuning is off.
+    linalg::GemmTiling gemmTiling(bool transA, bool transB, int M, int N, int K);
+    linalg::GemmTiling tune(bool transA, bool transB, int M, int N, int K); // Times the candidates for this shape and returns the fastest, caching nothing.
+
+    int numCached();  // Shape classes with a tiling for this machine, loaded or tuned.
+    int numTuned();   // Shape classes tuned by this process.
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include "./matrix.hpp"
+#include "./tensor.hpp"
+
+#include <functional>
+
+namespace linalg
+{
+    /*
+    General matrix multiply on row-major double buffers:
+        C = alpha * op(A) * op(B) + beta * C
+    where op(X) is X or its transpose. op(A) is M x K, op(B) is K x N and C is M x N;
+    lda, ldb and ldc are the row strides of the buffers as stored.
+
+    The product is computed tile by tile: panels of A and B are packed into
+    contiguous buffers so the inner loop streams through memory, and the tiles
+    of C are shared out between threads. The blocking is a GemmTiling: the
+    defaults below, or the autotuner's choice for the shape when it is on
+    (see autotune.hpp).
+    */
+    void gemm(bool transA, bool transB, int M, int N, int K,
+              double alpha, const double *A, int lda,
+              const double *B, int ldb,
+              double beta, double *C, int ldc);
+
+    // Called on each finished mc x nc tile of C, whose top-left element C(i0, j0) is at
+    // cTile, while the tile is still in cache. Lets callers fuse elementwise work
+    // (bias, activation, ...) into the product instead of making another pass over C.
+    using GemmEpilogue = std::function<void(int i0, int j0, int mc, int nc, double *cTile, int ldc)>;
+
+    // Raw gemm as above, running 'epilogue' on every tile of C once its product is complete.
+    void gemm(bool transA, bool transB, int M, int N, int K,
+              double alpha, const double *A, int lda,
+              const double *B, int ldb,
+              double beta, double *C, int ldc,
+              const GemmEpilogue &epilogue);
+
+    // How the kernel blocks and parallelizes one product. Every tiling gives bitwise the same C,
+    // since each element is always summed in k order.
+    struct GemmTiling
+    {
+        int mc {64};          // Rows of op(A) per tile (fewer when there are too few tiles to keep the threads busy).
+        int nc {256};         // Columns of op(B) per tile.
+        int kc {256};         // Depth of the packed panels.
+        int threads {0};      // Threads to share the tiles between, at most; 0 for parallel::numThreads().
+        int rowsPerPass {1};  // Rows of C updated per pass over a packed row of B: 1, or 4 to reuse each load of B.
+    };
+
+    // Raw gemm with an explicit tiling instead of the autotuned one.
+    void gemm(const GemmTiling &tiling, bool transA, bool transB, int M, int N, int K,
+              double alpha, const double *A, int lda,
+              const double *B, int ldb,
+              double beta, double *C, int ldc,
+              const GemmEpilogue &epilogue=GemmEpilogue());
+
+    // Matrix convenience overload: C = alpha * op(A) * op(B) + beta * C, resizing C when beta is 0.
+    void gemm(const Matrix<double> &A, bool transA,
+              const Matrix<double> &B, bool transB,
+              Matrix<double> &C, double alpha=1.0, double beta=0.0);
+
+    // 2-D view overload: C = alpha * A * B + beta * C. Transpose flags and row strides are
+    // read off the view strides, so transposed and sliced views go straight to the kernel;
+    // only operands strided along both dimensions are copied first. C needs unit column stride.
+    void gemm(const TensorView<const double> &A, const TensorView<const double> &B,
+              const TensorView<double> &C, double alpha=1.0, double beta=0.0);
+}
+
+#endif
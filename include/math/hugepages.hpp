@@ -0,0 +1,42 @@
+#ifndef HUGEPAGES_H
+#define HUGEPAGES_H
+
+#include <cstddef>
+#include <string>
+
+namespace hugepages
+{
+    /*
+    2 MB pages for large buffers, so that scans over them (GEMM operands,
+    the KNN training set) need one TLB entry per 2 MB instead of per 4 KB.
+    Buffers from the ordinary allocator are marked with madvise so the
+    kernel backs them with transparent huge pages; only the whole, aligned
+    huge pages inside a buffer can be. allocate() maps dedicated buffers,
+    trying the reserved hugetlbfs pool (MAP_HUGETLB) first.
+
+    All of it is advice: with transparent huge pages set to "never", off
+    Linux, or when the kernel has no 2 MB pages to spare, the memory simply
+    stays on 4 KB pages.
+    */
+
+    const size_t HUGE_PAGE_BYTES { 2 << 20 };
+    const size_t MIN_HUGE_PAGE_BYTES { 2 * HUGE_PAGE_BYTES }; // Smaller buffers keep 4 KB pages (they'd hold at most one huge page).
+
+    void setEnabled(bool enabled);  // On by default; when off, the calls below do nothing.
+    bool enabled();
+    std::string systemMode();       // The kernel's transparent huge page setting: "always", "madvise", "never" or "unknown".
+
+    // Advice on the whole huge pages inside [address, address+bytes). False if there are none or the kernel refused.
+    bool advise(void *address, size_t bytes);     // Before first touch: the range faults in huge pages.
+    bool collapse(void *address, size_t bytes);   // Already populated: merged now if the kernel can (MADV_COLLAPSE), else by khugepaged later.
+    bool adviseSmall(void *address, size_t bytes); // Keeps the range on 4 KB pages (for comparisons).
+
+    size_t hugeBytes(const void *address, size_t bytes); // Bytes of the mappings overlapping the range that are on huge pages (from /proc/self/smaps).
+
+    // Page-aligned buffers of at least MIN_HUGE_PAGE_BYTES: hugetlbfs pages if reserved, else advised
+    // transparent huge pages (2 MB aligned), else ordinary pages. Contents start zeroed.
+    void* allocate(size_t bytes);
+    void deallocate(void *buffer, size_t bytes);  // 'bytes' as passed to allocate().
+}
+
+#endif
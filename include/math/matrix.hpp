@@ -1,8 +1,11 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include "hugepages.hpp"
+#include "numa.hpp"
 #include "numerical.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <vector>
@@ -17,12 +20,15 @@ namespace linalg
         /* NOTE: randomize() currently only expected to work with matrices of doubles. */
 
         public:
-            // CONSTRUCTOR
+            // CONSTRUCTORS
+            Matrix() : Matrix(0, 0) {} // Empty matrix, to be sized later with resize().
+
             Matrix(const int numRows, const int numCols, bool random=false)
             {
                 m_numRows = numRows;
                 m_numCols = numCols;
                 m_size    = m_numRows * m_numCols;
+                reserveStorage();
                 m_values.resize(m_size); // Elements are initialized to default class type (0 for int).
                 if (random)
                 {
@@ -32,6 +38,7 @@ namespace linalg
 
             // MATRIX PROPERTIES AND ACCESSOR FUNCTIONS
             T& operator() (const int i, const int j) { return m_values[i*m_numCols + j]; } // Element at row i-1 and column j-1.
+            const T& operator() (const int i, const int j) const { return m_values[i*m_numCols + j]; }
             
             vector<int> shape() const // Matrix dimensions.
             { 
@@ -42,9 +49,26 @@ namespace linalg
             int numRows() const { return m_numRows; }
             int numCols() const { return m_numCols; }
             
-            int size()  { return m_size; } // Number of elements in the array.
+            int size() const { return m_size; } // Number of elements in the array.
 
             vector<T>& getValues() { return m_values; }
+            const vector<T>& getValues() const { return m_values; }
+
+            T* data() { return m_values.data(); }             // Row-major storage, for passing to the GEMM kernels.
+            const T* data() const { return m_values.data(); }
+
+            void resize(const int numRows, const int numCols)
+            {
+                /*
+                Changes the matrix dimensions, reusing the existing storage where possible.
+                Contents are unspecified afterwards: callers overwrite every element.
+                */
+                m_numRows = numRows;
+                m_numCols = numCols;
+                m_size    = m_numRows * m_numCols;
+                reserveStorage();
+                m_values.resize(m_size);
+            }
 
             // WHOLE-MATRIX OPERATIONS (transpose, randomize)
             Matrix<T> transpose()
@@ -87,6 +111,27 @@ namespace linalg
 
 
         private:
+            void reserveStorage()
+            {
+                /*
+                Large buffers get their NUMA placement (see math/numa.hpp) and
+                huge page advice (math/hugepages.hpp) before anything touches them,
+                so the zero fill already lands on every node, in 2 MB pages.
+                */
+                const size_t bytes { static_cast<size_t>(m_size) * sizeof(T) };
+                if (m_values.capacity() < static_cast<size_t>(m_size)
+                    && bytes >= std::min(numa::MIN_PLACEMENT_BYTES, hugepages::MIN_HUGE_PAGE_BYTES))
+                {
+                    m_values.reserve(m_size);
+                    const size_t capacityBytes { m_values.capacity() * sizeof(T) };
+                    numa::placeSharedBuffer(m_values.data(), capacityBytes);
+                    if (capacityBytes >= hugepages::MIN_HUGE_PAGE_BYTES)
+                    {
+                        hugepages::advise(m_values.data(), capacityBytes);
+                    }
+                }
+            }
+
             int m_numRows;
             int m_numCols;
             int m_size;
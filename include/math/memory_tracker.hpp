@@ -0,0 +1,73 @@
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <cstddef>
+
+namespace memtrack
+{
+    /*
+    Heap accounting by subsystem. The global operator new and delete are
+    replaced by versions that keep a small header in front of each block
+    and count its bytes against the subsystem of the innermost Scope alive
+    on the allocating thread (parallelFor hands the caller's subsystem on to
+    its workers). Frees are counted against the subsystem the block was
+    allocated under, wherever they happen, so the current bytes of each
+    subsystem are exact and its peak is the most it ever held at once.
+
+    Allocations outside any Scope count as OTHER. Only operator new is
+    seen; memory from malloc or mmap directly is not.
+
+    The replacement costs a header and some counting on every allocation,
+    so it is only compiled in with -DSCRATCHNET_MEMTRACK=ON. Without it,
+    scopes are still kept but every usage reads zero.
+    */
+
+    enum class Subsystem
+    {
+        OTHER,        // Anything not attributed, including kernel scratch space.
+        DATASET,      // Loaded samples and every copy of them.
+        WEIGHTS,      // Model parameters, dense and sparse.
+        ACTIVATIONS,  // Minibatch buffers: inputs, activations, derivatives and errors.
+        OPTIMIZER,    // Gradient accumulators.
+        INDEXES       // Search structures of KNN and KMeans.
+    };
+    const int NUM_SUBSYSTEMS {6};
+
+    struct Usage
+    {
+        size_t currentBytes;
+        size_t peakBytes;
+        size_t allocations;   // Number of allocations made so far.
+    };
+
+    bool enabled();                             // Whether the allocations are counted (built with SCRATCHNET_MEMTRACK).
+    Usage usage(Subsystem subsystem);
+    Usage totalUsage();                         // All subsystems together (its peak isn't the sum of theirs).
+    const char* name(Subsystem subsystem);
+    Subsystem currentSubsystem();               // The calling thread's innermost scope.
+
+    void setBudget(Subsystem subsystem, size_t bytes); // Warns once on stderr when the subsystem first exceeds it (0 for no budget).
+    void resetPeaks();                                  // Peaks restart from the current usage.
+    void printToConsole();                              // Current and peak bytes per subsystem.
+    void dumpAtExit();                                  // Calls printToConsole() when the program exits.
+
+    class Scope
+    {
+        /*
+        Attributes the calling thread's allocations to 'subsystem' while
+        alive. Scopes nest; the innermost one wins.
+        */
+
+        public:
+            explicit Scope(Subsystem subsystem);
+            ~Scope();
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            Subsystem m_previous;
+    };
+}
+
+#endif
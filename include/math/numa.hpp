@@ -0,0 +1,82 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace numa
+{
+    /*
+    NUMA placement without libnuma: the topology is read from sysfs and
+    memory policies are set with the mbind and get_mempolicy system calls.
+    On a single-node machine (and off Linux) placement is a no-op and
+    Replicated keeps the one original, so none of this costs anything
+    there.
+
+    Pages belong to whichever node first touches them, which for data
+    loaded or initialized by one thread is all one socket. Large shared
+    buffers (Matrix storage) are therefore interleaved across the nodes,
+    so every thread sees the same average distance and all the memory
+    controllers share the traffic. Read-mostly data that every thread
+    scans is better replicated, one copy per node.
+    */
+
+    const std::vector<int>& nodes();         // Ids of the nodes with memory, ascending ({0} if unknown).
+    int numNodes();
+    std::vector<int> cpusOfNode(int node);   // From sysfs; empty if unknown.
+    int nodeOfCpu(int cpu);                  // -1 if unknown.
+    int currentNode();                       // Node of the CPU the calling thread runs on (0 if unknown).
+    int nodeOfAddress(const void *address);  // Node holding the page at 'address' (-1 if unknown).
+
+    // Set the policy of the whole pages inside [address, address+bytes), migrating pages already
+    // touched. False if the kernel refused (no NUMA support, seccomp) or there was nothing to do.
+    bool interleave(void *address, size_t bytes);
+    bool bindToNode(void *address, size_t bytes, int node);
+
+    const size_t MIN_PLACEMENT_BYTES { 1 << 20 };        // Smaller buffers stay where first touched.
+    void placeSharedBuffer(void *address, size_t bytes);  // Interleaves it if large enough and there are several nodes.
+
+    void runOnNode(int node, const std::function<void()> &work); // On a thread confined to the node's CPUs; waits for it.
+
+    template <class T>
+    class Replicated
+    {
+        /*
+        One copy of read-mostly data per node, each made by a thread
+        running on its node so that first touch puts it there; local()
+        returns the copy on the calling thread's node. With a single node
+        it only refers to the original, which must outlive it either way.
+        */
+
+        public:
+            explicit Replicated(const T &original)
+                : m_original(&original)
+            {
+                if (numNodes() > 1)
+                {
+                    m_replicas.resize(nodes().back() + 1);
+                    for (int node : nodes())
+                    {
+                        runOnNode(node, [&]() { m_replicas[node].reset(new T(original)); });
+                    }
+                }
+            }
+
+            const T& local() const
+            {
+                const int node { m_replicas.empty() ? -1 : currentNode() };
+                return node >= 0 && node < static_cast<int>(m_replicas.size()) && m_replicas[node]
+                       ? *m_replicas[node] : *m_original;
+            }
+
+            int numCopies() const { return m_replicas.empty() ? 1 : numNodes(); }
+
+        private:
+            const T *m_original;
+            std::vector<std::unique_ptr<const T>> m_replicas; // Indexed by node id.
+    };
+}
+
+#endif
@@ -1,4 +1,22 @@
+#ifndef NUMERICAL_H
+#define NUMERICAL_H
+
+#include <cstdint>
+
 namespace numerical
 {
     double randomDouble();
-}
\ No newline at end of file
+
+    // Stateless counter-based generator: 64 random bits that depend only on (key, counter).
+    // Any element of a random stream can be produced independently, in any order or thread.
+    inline uint64_t counterRandom(uint64_t key, uint64_t counter)
+    {
+        // SplitMix64 finalizer applied to a Weyl sequence position.
+        uint64_t z { key + (counter + 1) * 0x9E3779B97F4A7C15ULL };
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+}
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <atomic>
+#include <functional>
+
+namespace parallel
+{
+    /*
+    The one thread pool shared by the linalg kernels and the models: a
+    work-stealing scheduler with numThreads()-1 persistent workers, each
+    owning a Chase-Lev deque. Work is pushed on the spawning worker's own
+    deque (threads outside the pool use a shared queue) and idle workers
+    steal the oldest, largest pieces from the others. A thread waiting for
+    its tasks runs queued tasks meanwhile instead of blocking, so parallel
+    calls nest (a parallel k-sweep whose models each run a parallel
+    assignment step) without deadlocking or starting more threads than
+    numThreads().
+
+    Waiting threads may run any queued task on their own stack, so don't
+    hold a lock across a parallel call that another task could also take.
+
+    Three places start threads of their own instead, because work there
+    must not be a task:
+      - Network::trainPipelined: the stages block on each other's queues
+        and must all run at once, which tasks only do when enough workers
+        are idle; with fewer workers than stages the pipeline would hang.
+      - Network::trainEpochs: validation runs alongside the next epoch. As
+        a task it could be picked up by the training thread while it waits
+        for a kernel, stalling training for the whole evaluation.
+      - numa::runOnNode: the thread changes its CPU affinity and memory
+        policy, which must not stick to a pool worker, and the scheduler
+        can't send a task to a particular worker anyway.
+    */
+
+    int  numThreads();                   // Number of threads used by parallelFor (defaults to the hardware concurrency).
+    void setNumThreads(int numThreads);  // Overrides the thread count; values below 1 are clamped to 1.
+    void setCorePinning(bool pin);       // Pins worker i to the (i+1)th CPU the process may run on (Linux only).
+    bool corePinning();
+    void setNodePinning(bool pin);       // Confines worker i to the CPUs of NUMA node (i+1) mod numNodes(); core pinning wins if both are set.
+    bool nodePinning();
+    void setWorkerStartHook(void (*hook)()); // Run by each worker as it starts (the profiler opens its counters).
+
+    // Stops and joins the workers; the next parallel call starts new ones. Never call it (or the
+    // setters above, which use it) while parallel work is running.
+    void stopWorkers();
+
+    // Calls body(chunkBegin, chunkEnd) on disjoint, contiguous sub-ranges covering [begin, end), the range
+    // being halved until the pieces are at most grainSize long. The first overload picks a grain giving a
+    // few pieces per thread, for load balancing.
+    void parallelFor(int begin, int end, const std::function<void(int, int)> &body);
+    void parallelFor(int begin, int end, int grainSize, const std::function<void(int, int)> &body);
+
+    /*
+    Parallel sums of floating-point vectors. By default partial sums are
+    merged as the threads finish them, so the rounding, and with it the
+    result, varies from run to run and with the thread count. With
+    deterministic reductions on, the range is cut into blocks of exactly
+    grainSize items whatever the thread count, and the block sums are
+    combined in a fixed pairwise tree, so the result is bitwise the same
+    for any number of threads (and usually a little more accurate).
+    */
+    void setDeterministicReductions(bool deterministic);
+    bool deterministicReductions();
+
+    // Sets result[0, width) to the sum over pieces of [begin, end) of what accumulate(pieceBegin, pieceEnd, partial)
+    // adds into a zeroed partial[0, width). Pieces are at most grainSize items long.
+    void parallelReduce(int begin, int end, int grainSize, int width,
+                        const std::function<void(int, int, double*)> &accumulate, double *result);
+
+    class TaskGroup
+    {
+        /*
+        A set of tasks that may run in parallel with the caller, who waits
+        for all of them with wait() (or on destruction). Tasks may run
+        further parallel work themselves.
+        */
+
+        public:
+            TaskGroup();
+            ~TaskGroup();
+
+            TaskGroup(const TaskGroup&) = delete;
+            TaskGroup& operator=(const TaskGroup&) = delete;
+
+            void run(std::function<void()> task); // Runs at once on the caller if parallelism is off.
+            void wait();                           // Returns when every task run so far has finished.
+
+        private:
+            std::atomic<int> m_pending;
+    };
+
+    class SerialScope
+    {
+        /*
+        While alive, parallelFor calls (and TaskGroup tasks) made on the
+        constructing thread run serially on it. Background work (such as
+        validation during training) uses this to stay on its own thread
+        instead of competing with the foreground kernels for the workers.
+        */
+
+        public:
+            SerialScope();
+            ~SerialScope();
+
+        private:
+            bool m_wasSerial;
+    };
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace profiler
+{
+    /*
+    Named, instrumented regions (feedForward, backPropagate, the KNN scan,
+    ...) that accumulate wall time and, on Linux, hardware counters read
+    with perf_event_open: cycles, instructions, L1 data and last-level
+    cache misses, branch misses and data TLB misses, plus the task clock (CPU time over all
+    threads). Every thread that profiles, and every worker of the parallel
+    scheduler, opens its own counters, and a region's totals are the sum
+    over all of them, so they cover the whole parallel kernel (and anything
+    else the process ran meanwhile).
+
+    Profiling is off until setEnabled(true), and a disabled Region costs
+    one flag check. Counters the kernel or container doesn't expose (no
+    PMU in a VM, a restrictive perf_event_paranoid, seccomp) are reported
+    as unavailable and only the timings are kept.
+    */
+
+    enum Counter
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_MISSES,      // L1 data cache read misses.
+        LLC_MISSES,      // Last-level cache misses.
+        BRANCH_MISSES,
+        DTLB_MISSES,     // Data TLB read misses (page walks).
+        TASK_CLOCK,      // Nanoseconds of CPU time (a software counter, usually available in containers too).
+        NUM_COUNTERS
+    };
+
+    struct RegionStats
+    {
+        std::string name;
+        long calls;
+        long samples;                        // Sum of the sample counts the regions were opened with.
+        double seconds;                      // Wall time.
+        double counts[NUM_COUNTERS];         // Totals, scaled up if the kernel had to multiplex the counters.
+
+        double ipc() const { return counts[CYCLES] > 0 ? counts[INSTRUCTIONS] / counts[CYCLES] : 0.0; }
+        double perSample(Counter counter) const { return samples > 0 ? counts[counter] / samples : 0.0; }
+    };
+
+    void setEnabled(bool enabled);   // Opens the counters of this thread and of the scheduler's workers.
+    bool enabled();
+
+    bool counterAvailable(Counter counter);
+    std::string counterStatus();     // Which counters are unavailable, and why.
+
+    std::vector<RegionStats> regions();  // In the order they first completed.
+    void reset();
+    void printToConsole();               // Per region: calls, time, IPC and misses per sample.
+
+    class Region
+    {
+        /*
+        Attributes the wall time and counter deltas between construction
+        and destruction to the region 'name', counting 'samples' samples.
+        Regions may nest; each reports inclusive totals.
+        */
+
+        public:
+            explicit Region(const char *name, long samples=1);
+            ~Region();
+
+            Region(const Region&) = delete;
+            Region& operator=(const Region&) = delete;
+
+        private:
+            const char *m_name;
+            long m_samples;
+            bool m_active;
+            std::chrono::steady_clock::time_point m_start;
+            double m_startCounts[NUM_COUNTERS];
+    };
+}
+
+#endif
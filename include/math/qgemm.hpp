@@ -0,0 +1,28 @@
+#ifndef QGEMM_H
+#define QGEMM_H
+
+#include <cstdint>
+
+namespace linalg
+{
+    /*
+    Integer kernels for quantized inference. Operands are signed 8-bit and
+    products are accumulated exactly in 32 bits:
+        C[i][j] = sum_k A[i][k] * W[j][k]
+    A is M x K (one sample per row) and W is N x K (one output per row, as
+    the dense weight matrices are stored), so both operands are read along
+    contiguous rows. lda, ldw and ldc are row strides.
+
+    With AVX2 the dot products sign-extend to 16 bits and use vpmaddwd,
+    which is exact for int8 inputs; pmaddubsw would need unsigned
+    activations and can saturate its 16-bit pair sums.
+    */
+    int32_t dotInt8(const int8_t *a, const int8_t *w, int K); // Exact int8 dot product of length K.
+
+    void gemvInt8(int N, int K, const int8_t *a, const int8_t *W, int ldw, int32_t *c); // c = W * a
+
+    void gemmInt8(int M, int N, int K, const int8_t *A, int lda,
+                  const int8_t *W, int ldw, int32_t *C, int ldc);   // C = A * W^T, rows shared out between threads.
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef ROOFLINE_H
+#define ROOFLINE_H
+
+#include <string>
+#include <vector>
+
+namespace roofline
+{
+    /*
+    Roofline model: a kernel doing F floating-point operations while moving
+    B bytes has arithmetic intensity F/B, and can run no faster than
+    min(peak GFLOP/s, intensity * peak GB/s). Kernels left of the ridge
+    point (peak GFLOP/s / peak GB/s) are memory bound, those right of it
+    compute bound; the fraction of that roof a kernel achieves says how
+    much there is left to gain from optimizing it.
+    */
+
+    struct MachinePeak
+    {
+        double gflops;   // Best rate of independent multiply-adds on all threads, as this build compiles them.
+        double gbps;     // Best STREAM triad bandwidth on all threads, on arrays far larger than the caches.
+
+        double ridgeIntensity() const { return gbps > 0 ? gflops / gbps : 0.0; } // Flops per byte.
+        double attainableGflops(double intensity) const;
+    };
+
+    // Measures the peaks, running each probe for about 'seconds'. Takes the best of its repetitions,
+    // as STREAM does, since any slower run was disturbed by something else.
+    MachinePeak measurePeak(double seconds=0.1);
+    const MachinePeak& machinePeak(); // Measured on first use with the current thread count, then cached.
+
+    struct KernelCost
+    {
+        std::string name;
+        double flops;    // Per call, counting a multiply-add as 2.
+        double bytes;    // Lower bound on the memory traffic per call: every operand read or written once.
+        double seconds;  // Measured time per call (0 if not measured).
+
+        double intensity() const { return bytes > 0 ? flops / bytes : 0.0; }
+        double gflops()    const { return seconds > 0 ? flops / seconds * 1e-9 : 0.0; }
+        double gbps()      const { return seconds > 0 ? bytes / seconds * 1e-9 : 0.0; }
+    };
+
+    struct RooflineReport
+    {
+        MachinePeak peak;
+        std::vector<KernelCost> kernels;
+
+        double fractionOfRoof(const KernelCost &kernel) const; // Achieved over attainable GFLOP/s (or GB/s if flops is 0).
+        void printToConsole() const;                           // One line per kernel, with its bound and % of roof.
+    };
+}
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "./matrix.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace linalg
+{
+    using namespace std;
+
+    enum class SparseFormat { DENSE, CSR, BSR };
+
+    const int BSR_MAX_BLOCK {16}; // Largest supported BSR block side.
+
+    struct SparseVector
+    {
+        /*
+        A vector stored as its nonzero entries: indices in increasing order
+        and the matching values, plus the full length.
+        */
+
+        int size {0};
+        vector<int> indices;
+        vector<double> values;
+
+        static SparseVector fromDense(const vector<double> &dense); // Keeps the entries that are not exactly zero.
+    };
+
+    class CSRMatrix
+    {
+        /*
+        Compressed sparse row matrix of doubles: the nonzeros of row i are
+        values[rowPointers[i] .. rowPointers[i+1]), in column order, with
+        their columns in columnIndices.
+        */
+
+        public:
+            CSRMatrix() {}
+            explicit CSRMatrix(const Matrix<double> &dense); // Keeps the entries of 'dense' that are not exactly zero.
+            CSRMatrix(const vector<SparseVector> &rows, int first, int count); // Stacks rows[first, first+count) as the rows.
+
+            int numRows() const { return m_numRows; }
+            int numCols() const { return m_numCols; }
+            int numNonZeros() const { return m_values.size(); }
+            double density() const;        // Fraction of entries stored.
+            size_t bytes() const;          // Storage of the arrays.
+
+            const vector<int>& getRowPointers() const   { return m_rowPointers; }
+            const vector<int>& getColumnIndices() const { return m_columnIndices; }
+            const vector<double>& getValues() const     { return m_values; }
+            vector<double>& getValues()                 { return m_values; } // Values can be changed in place; the pattern can't.
+
+        private:
+            int m_numRows {0};
+            int m_numCols {0};
+            vector<int> m_rowPointers {0};
+            vector<int> m_columnIndices;
+            vector<double> m_values;
+    };
+
+    class BSRMatrix
+    {
+        /*
+        Block compressed sparse row matrix: the matrix is tiled into
+        blockSize x blockSize blocks and only blocks holding a nonzero are
+        stored, each as a dense row-major block. Suits structured (block)
+        sparsity, where the dense blocks give the inner loops fixed-length,
+        vectorizable work. Edge blocks are padded with zeros.
+        */
+
+        public:
+            BSRMatrix() {}
+            BSRMatrix(const Matrix<double> &dense, int blockSize);
+
+            int numRows() const { return m_numRows; }
+            int numCols() const { return m_numCols; }
+            int getBlockSize() const { return m_blockSize; }
+            int numBlocks() const { return m_blockColumns.size(); }
+            double density() const;        // Fraction of entries covered by stored blocks.
+            size_t bytes() const;
+
+            const vector<int>& getBlockRowPointers() const { return m_blockRowPointers; }
+            const vector<int>& getBlockColumns() const     { return m_blockColumns; }
+            const vector<double>& getValues() const        { return m_values; }
+
+        private:
+            int m_numRows {0};
+            int m_numCols {0};
+            int m_blockSize {1};
+            vector<int> m_blockRowPointers {0};
+            vector<int> m_blockColumns;    // First column of each stored block, divided by the block size.
+            vector<double> m_values;       // blockSize*blockSize values per stored block.
+    };
+
+    // y = W * x for a sparse W (numRows x numCols), x of length numCols.
+    void spmv(const CSRMatrix &W, const double *x, double *y);
+    void spmv(const BSRMatrix &W, const double *x, double *y);
+
+    // Y = X * W^T for a sparse W, i.e. the product with one sample per row of X and
+    // one output per row of W, as the dense layers store their weights. Y is resized;
+    // samples are shared out between threads.
+    void spmm(const CSRMatrix &W, const Matrix<double> &X, Matrix<double> &Y);
+    void spmm(const BSRMatrix &W, const Matrix<double> &X, Matrix<double> &Y);
+
+    // Y = X * W^T for sparse samples X (one per row) and dense W: only the columns of W
+    // at nonzero inputs are read. Y is resized; samples are shared out between threads.
+    void spmmSparseInput(const CSRMatrix &X, const Matrix<double> &W, Matrix<double> &Y);
+
+    // Weight gradient E^T * X for sparse X, restricted to the columns where X has a
+    // nonzero: 'columns' receives those columns in increasing order, and row c of the
+    // resized G holds the gradient of column columns[c] (i.e. G is the transposed,
+    // compacted gradient). Costs O(nnz(X) * E.numCols()).
+    void sparseInputGradient(const Matrix<double> &E, const CSRMatrix &X, vector<int> &columns, Matrix<double> &G);
+}
+
+#endif
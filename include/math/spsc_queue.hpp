@@ -0,0 +1,81 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace parallel
+{
+    template <class T>
+    class SPSCQueue
+    {
+        /*
+        Bounded lock-free queue for exactly one producer thread and one
+        consumer thread. The producer only writes the tail index and the
+        consumer only the head index, each published with release ordering,
+        so no locks or read-modify-write atomics are needed. The two indices
+        sit on separate cache lines to keep the threads from false sharing.
+        */
+
+        public:
+            explicit SPSCQueue(size_t capacity) : m_slots(capacity + 1) {}
+
+            bool tryPush(T &&value) // Producer only; false if the queue is full (value is left untouched).
+            {
+                const size_t tail { m_tail.load(std::memory_order_relaxed) };
+                const size_t next { (tail + 1) % m_slots.size() };
+                if (next == m_head.load(std::memory_order_acquire))
+                {
+                    return false;
+                }
+                m_slots[tail] = std::move(value);
+                m_tail.store(next, std::memory_order_release);
+                return true;
+            }
+
+            bool tryPop(T &value) // Consumer only; false if the queue is empty.
+            {
+                const size_t head { m_head.load(std::memory_order_relaxed) };
+                if (head == m_tail.load(std::memory_order_acquire))
+                {
+                    return false;
+                }
+                value = std::move(m_slots[head]);
+                m_head.store((head + 1) % m_slots.size(), std::memory_order_release);
+                return true;
+            }
+
+            void push(T &&value) // Waits (yielding) while the queue is full.
+            {
+                while (!tryPush(std::move(value)))
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            T pop() // Waits (yielding) while the queue is empty.
+            {
+                T value;
+                while (!tryPop(value))
+                {
+                    std::this_thread::yield();
+                }
+                return value;
+            }
+
+        private:
+            static const size_t CACHE_LINE {64};
+
+            std::vector<T> m_slots;             // One slot more than the capacity, so full and empty differ.
+            char m_padding0[CACHE_LINE];
+            std::atomic<size_t> m_head {0};     // Next slot to pop, written by the consumer.
+            char m_padding1[CACHE_LINE];
+            std::atomic<size_t> m_tail {0};     // Next slot to fill, written by the producer.
+            char m_padding2[CACHE_LINE];
+    };
+}
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef TENSOR_H
+#define TENSOR_H
+
+#include "./matrix.hpp"
+
+#include <assert.h>
+#include <iostream>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+namespace linalg
+{
+    using namespace std;
+
+    template <class T>
+    class TensorView
+    {
+        /*
+        Non-owning, N-dimensional view onto a buffer: a data pointer plus a
+        shape and a stride (in elements) for each dimension. Slicing, selecting,
+        transposing and reshaping only produce new shape/stride metadata, so
+        batches, rows and transposed operands can be handed to the kernels
+        without copying.
+
+        The viewed buffer must outlive the view. A TensorView<const T> is a
+        read-only view; any TensorView<T> converts to one implicitly.
+        */
+
+        public:
+            TensorView() : m_data(nullptr) {}
+
+            TensorView(T *data, const vector<int> &shape, const vector<long> &strides)
+                : m_data(data), m_shape(shape), m_strides(strides)
+            {
+                if (m_shape.size() != m_strides.size())
+                {
+                    cerr << "Tensor view has " << m_shape.size() << " dimensions," << endl
+                    << "...but " << m_strides.size() << " strides!" << endl;
+                    assert(false);
+                }
+            }
+
+            TensorView(T *data, const vector<int> &shape) // Contiguous, row-major view.
+                : TensorView(data, shape, contiguousStrides(shape)) {}
+
+            template <class U, class = typename enable_if<is_convertible<U*, T*>::value>::type>
+            TensorView(const TensorView<U> &other) // e.g. TensorView<double> -> TensorView<const double>
+                : m_data(other.data()), m_shape(other.shape()), m_strides(other.strides()) {}
+
+            // PROPERTIES AND ACCESSOR FUNCTIONS
+            T* data() const { return m_data; }
+            int rank() const { return m_shape.size(); }
+            const vector<int>&  shape()   const { return m_shape; }
+            const vector<long>& strides() const { return m_strides; }
+            int  shape(int dim)  const { return m_shape.at(dim); }
+            long stride(int dim) const { return m_strides.at(dim); }
+
+            long size() const // Number of elements in the view.
+            {
+                return accumulate(m_shape.begin(), m_shape.end(), 1L, [](long a, int b) { return a*b; });
+            }
+
+            template <typename... Indices>
+            T& operator() (Indices... indices) const // Element at the given index along each dimension.
+            {
+                const int index[] { 0, static_cast<int>(indices)... }; // leading 0 keeps the array non-empty for rank 0
+                if (static_cast<int>(sizeof...(indices)) != rank())
+                {
+                    cerr << "Tensor view of rank " << rank() << " indexed with "
+                    << sizeof...(indices) << " indices!" << endl;
+                    assert(false);
+                }
+                long offset {0};
+                for (int dim=0; dim<rank(); ++dim)
+                {
+                    offset += index[dim+1] * m_strides[dim];
+                }
+                return m_data[offset];
+            }
+
+            bool isContiguous() const
+            {
+                /*
+                True when the elements are laid out densely in row-major order,
+                so the view can be treated as a flat array of size() elements.
+                */
+                long expected {1};
+                for (int dim=rank()-1; dim>=0; --dim)
+                {
+                    if (m_shape[dim] != 1 && m_strides[dim] != expected)
+                    {
+                        return false;
+                    }
+                    expected *= m_shape[dim];
+                }
+                return true;
+            }
+
+            // VIEW TRANSFORMATIONS (no data is copied)
+            TensorView<T> slice(int dim, int begin, int end) const
+            {
+                /*
+                Elements [begin, end) along dimension dim.
+                */
+                checkDim(dim);
+                if (begin < 0 || end > m_shape[dim] || begin > end)
+                {
+                    cerr << "Slice [" << begin << "," << end << ") is out of range for dimension "
+                    << dim << " of size " << m_shape[dim] << "!" << endl;
+                    assert(false);
+                }
+                vector<int> shape {m_shape};
+                shape[dim] = end - begin;
+                return TensorView<T>(m_data + begin*m_strides[dim], shape, m_strides);
+            }
+
+            TensorView<T> select(int dim, int index) const
+            {
+                /*
+                The sub-tensor at 'index' along dimension dim, with that dimension
+                removed (e.g. one sample of a batch, or one row of a matrix).
+                */
+                checkDim(dim);
+                if (index < 0 || index >= m_shape[dim])
+                {
+                    cerr << "Index " << index << " is out of range for dimension "
+                    << dim << " of size " << m_shape[dim] << "!" << endl;
+                    assert(false);
+                }
+                vector<int>  shape   {m_shape};
+                vector<long> strides {m_strides};
+                shape.erase(shape.begin() + dim);
+                strides.erase(strides.begin() + dim);
+                return TensorView<T>(m_data + index*m_strides[dim], shape, strides);
+            }
+
+            TensorView<T> permute(const vector<int> &order) const
+            {
+                /*
+                Reorders the dimensions: dimension i of the result is dimension
+                order[i] of this view.
+                */
+                if (static_cast<int>(order.size()) != rank())
+                {
+                    cerr << "Permutation of " << order.size() << " dimensions applied to a view of rank " << rank() << "!" << endl;
+                    assert(false);
+                }
+                vector<int>  shape(rank());
+                vector<long> strides(rank());
+                for (int dim=0; dim<rank(); ++dim)
+                {
+                    checkDim(order[dim]);
+                    shape[dim]   = m_shape[order[dim]];
+                    strides[dim] = m_strides[order[dim]];
+                }
+                return TensorView<T>(m_data, shape, strides);
+            }
+
+            TensorView<T> transpose(int dim0=0, int dim1=1) const // Swaps two dimensions.
+            {
+                vector<int> order(rank());
+                iota(order.begin(), order.end(), 0);
+                swap(order.at(dim0), order.at(dim1));
+                return permute(order);
+            }
+
+            TensorView<T> reshape(const vector<int> &shape) const
+            {
+                /*
+                Reinterprets a contiguous view with a new shape of the same size.
+                Non-contiguous views must be copied with contiguous() first.
+                */
+                const long newSize { accumulate(shape.begin(), shape.end(), 1L, [](long a, int b) { return a*b; }) };
+                if (newSize != size() || !isContiguous())
+                {
+                    cerr << "Cannot reshape a " << (isContiguous() ? "" : "non-contiguous ")
+                    << "view of " << size() << " elements into " << newSize << " elements!" << endl;
+                    assert(false);
+                }
+                return TensorView<T>(m_data, shape);
+            }
+
+            static vector<long> contiguousStrides(const vector<int> &shape)
+            {
+                vector<long> strides(shape.size());
+                long stride {1};
+                for (int dim=static_cast<int>(shape.size())-1; dim>=0; --dim)
+                {
+                    strides[dim] = stride;
+                    stride *= shape[dim];
+                }
+                return strides;
+            }
+
+        private:
+            T *m_data;
+            vector<int>  m_shape;
+            vector<long> m_strides;
+
+            void checkDim(int dim) const
+            {
+                if (dim < 0 || dim >= rank())
+                {
+                    cerr << "Dimension " << dim << " does not exist in a view of rank " << rank() << "!" << endl;
+                    assert(false);
+                }
+            }
+    };
+
+    template <class T>
+    class Tensor
+    {
+        /*
+        Owning, contiguous N-dimensional array. All slicing and reshaping goes
+        through view(), which never copies.
+        */
+
+        public:
+            Tensor() {}
+
+            explicit Tensor(const vector<int> &shape)
+                : m_shape(shape),
+                  m_values(accumulate(shape.begin(), shape.end(), 1L, [](long a, int b) { return a*b; })) {}
+
+            TensorView<T>       view()       { return TensorView<T>(m_values.data(), m_shape); }
+            TensorView<const T> view() const { return TensorView<const T>(m_values.data(), m_shape); }
+
+            template <typename... Indices>
+            T& operator() (Indices... indices) { return view()(indices...); }
+            template <typename... Indices>
+            const T& operator() (Indices... indices) const { return view()(indices...); }
+
+            const vector<int>& shape() const { return m_shape; }
+            int  rank() const { return m_shape.size(); }
+            long size() const { return m_values.size(); }
+
+            T* data() { return m_values.data(); }
+            const T* data() const { return m_values.data(); }
+            vector<T>& getValues() { return m_values; }
+
+        private:
+            vector<int> m_shape;
+            vector<T> m_values;
+    };
+
+    template <class T>
+    TensorView<T> asView(Matrix<T> &M) // 2-D view onto a matrix's storage.
+    {
+        return TensorView<T>(M.data(), {M.numRows(), M.numCols()});
+    }
+
+    template <class T>
+    TensorView<const T> asView(const Matrix<T> &M)
+    {
+        return TensorView<const T>(M.data(), {M.numRows(), M.numCols()});
+    }
+
+    template <class T>
+    Tensor<typename remove_const<T>::type> contiguous(const TensorView<T> &view)
+    {
+        /*
+        Copies a (possibly strided) view into a new contiguous tensor.
+        */
+        Tensor<typename remove_const<T>::type> copy(view.shape());
+        if (view.size() == 0)
+        {
+            return copy;
+        }
+        vector<int> index(view.rank(), 0);
+        for (long i=0; i<copy.size(); ++i)
+        {
+            long offset {0};
+            for (int dim=0; dim<view.rank(); ++dim)
+            {
+                offset += index[dim] * view.stride(dim);
+            }
+            copy.data()[i] = view.data()[offset];
+            for (int dim=view.rank()-1; dim>=0; --dim) // advance the row-major index
+            {
+                if (++index[dim] < view.shape(dim))
+                {
+                    break;
+                }
+                index[dim] = 0;
+            }
+        }
+        return copy;
+    }
+}
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef _ACTIVATION_HPP_
+#define _ACTIVATION_HPP_
+
+#include "parameters.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace activation
+{
+    /*
+    Activation functions and their derivatives, shared by the neuron-level
+    code and the batched layers so that both compute the same thing.
+    */
+
+    inline double apply(Activation type, double x)
+    {
+        switch(type)
+        {
+            case Activation::RELU:
+                return std::max(0.0, x);
+            case Activation::FAST_SIGMOID:
+                return x / (1 + std::abs(x));
+            case Activation::LINEAR:
+                return x;
+            case Activation::TANH:
+            default:
+                return std::tanh(x);
+        }
+    }
+
+    inline double derivative(Activation type, double x, double fx)
+    {
+        /*
+        Derivative of the activation at x, given fx = apply(type, x).
+
+        Fast sigmoid: f'(x) = 1 / (1 + |x|)^2
+        d/dx(tanh(x)) = 1 - tanh^2(x)
+        */
+
+        switch(type)
+        {
+            case Activation::RELU:
+                return x > 0 ? 1.0 : 0.0;
+            case Activation::LINEAR:
+                return 1.0;
+            case Activation::FAST_SIGMOID:
+            {
+                const double denominator { 1 + std::abs(x) };
+                return 1 / (denominator * denominator);
+            }
+            case Activation::TANH:
+            default:
+                return 1 - fx * fx;
+        }
+    }
+
+    inline double derivativeFromOutput(Activation type, double fx)
+    {
+        /*
+        Same derivative, recovered from the activation alone so batched layers
+        need not keep their pre-activation values around.
+        */
+
+        switch(type)
+        {
+            case Activation::RELU:
+                return fx > 0 ? 1.0 : 0.0;
+            case Activation::LINEAR:
+                return 1.0;
+            case Activation::FAST_SIGMOID:
+            {
+                const double complement { 1 - std::abs(fx) };
+                return complement * complement;
+            }
+            case Activation::TANH:
+            default:
+                return 1 - fx * fx;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef _BATCH_LAYER_HPP_
+#define _BATCH_LAYER_HPP_
+
+#include "math/matrix.hpp"
+#include "parameters.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+using batchMatrix = linalg::Matrix<double>;
+
+class BatchLayer
+{
+    /*
+    Interface for layers that process a whole minibatch at once. Inputs and
+    outputs hold one sample per row; spatial layers flatten each sample as
+    (channel, row, column) with the column index varying fastest.
+
+    Network runs these feature layers in front of its dense stack.
+    */
+
+    public:
+        virtual ~BatchLayer() {}
+
+        // Inference-mode forward pass. Must not modify the layer, so it is safe to call concurrently.
+        virtual void infer(const batchMatrix &input, batchMatrix &output) const = 0;
+
+        // Training-mode forward pass; layers may cache whatever backward() needs.
+        virtual void forward(const batchMatrix &input, batchMatrix &output) { infer(input, output); }
+
+        // Given the forward input/output and the loss gradient w.r.t. the output, accumulates
+        // parameter gradients and writes the loss gradient w.r.t. the input into inputGrad.
+        virtual void backward(const batchMatrix &input, const batchMatrix &output,
+                              const batchMatrix &outputGrad, batchMatrix &inputGrad) = 0;
+
+        // Applies the accumulated gradients (scaled by learningCoefficient) and clears them.
+        virtual void update(double /*learningCoefficient*/) {}
+
+        // Deep copy of the layer, parameters included.
+        virtual unique_ptr<BatchLayer> clone() const = 0;
+
+        // Absorbs a per-channel affine transform y = f(scale*x + shift) applied to this layer's
+        // output (e.g. a following batch norm) into its own parameters. Returns false if the
+        // layer cannot, which is the default.
+        virtual bool foldAffine(const vector<double> &/*scale*/, const vector<double> &/*shift*/, Activation /*activationType*/) { return false; }
+
+        // Analytic cost of infer() on batchSize samples for roofline reports: floating-point
+        // operations, and bytes of parameters read (the caller counts the inputs and outputs).
+        virtual double inferenceFlops(int batchSize) const { return double(batchSize) * getOutputSize(); }
+        virtual double parameterBytes() const { return 0.0; }
+
+        virtual int getInputSize()  const = 0; // Number of values per input sample.
+        virtual int getOutputSize() const = 0; // Number of values per output sample.
+        virtual string getName()    const = 0; // Short description for printing.
+};
+
+#endif
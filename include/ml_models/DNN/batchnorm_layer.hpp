@@ -0,0 +1,72 @@
+#ifndef _BATCHNORM_LAYER_HPP_
+#define _BATCHNORM_LAYER_HPP_
+
+#include "batch_layer.hpp"
+#include "parameters.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class BatchNormLayer : public BatchLayer
+{
+    /*
+    Batch normalization followed by an activation:
+        y = f(gamma * (x - mean) / sqrt(variance + epsilon) + beta)
+    with one (gamma, beta) pair per channel. Each sample holds 'channels'
+    blocks of 'spatialSize' values (spatialSize 1 for dense features), and
+    statistics are taken per channel over the batch and spatial positions.
+
+    Training uses the batch statistics and updates running averages of them;
+    inference uses the running averages, which reduces the layer to a fixed
+    per-channel scale and shift. Network::inferenceModel() folds that into
+    the preceding layer where possible. Network::setBatchNorm uses one per
+    dense layer, with one channel per neuron.
+    */
+
+    public:
+        BatchNormLayer(int channels, int spatialSize, Activation activationType=Activation::LINEAR,
+                       double momentum=0.9, double epsilon=1e-5);
+
+        void infer(const batchMatrix &input, batchMatrix &output) const override;
+        void forward(const batchMatrix &input, batchMatrix &output) override { forward(input, output, true); }
+        void forward(const batchMatrix &input, batchMatrix &output, bool updateStatistics); // Without updating the running statistics, for recomputed passes.
+        void backward(const batchMatrix &input, const batchMatrix &output,
+                      const batchMatrix &outputGrad, batchMatrix &inputGrad) override;
+        void update(double learningCoefficient) override;
+        unique_ptr<BatchLayer> clone() const override { return unique_ptr<BatchLayer>(new BatchNormLayer(*this)); }
+
+        double inferenceFlops(int batchSize) const override { return 3.0 * batchSize * getOutputSize(); } // Scale, shift, activation.
+        double parameterBytes() const override { return 2.0 * sizeof(double) * m_channels; }            // The folded scale and shift.
+
+        int getInputSize()  const override { return m_channels * m_spatialSize; }
+        int getOutputSize() const override { return m_channels * m_spatialSize; }
+        string getName()    const override;
+
+        vector<double> getFoldedScale() const; // gamma / sqrt(running variance + epsilon), per channel.
+        vector<double> getFoldedShift() const; // beta - running mean * folded scale, per channel.
+        Activation getActivationType() const { return m_activationType; }
+
+    private:
+        int m_channels;
+        int m_spatialSize;
+        Activation m_activationType;
+        double m_momentum;             // Weight of the old value when updating the running statistics.
+        double m_epsilon;
+
+        vector<double> m_gamma;        // Per-channel scale.
+        vector<double> m_beta;         // Per-channel shift.
+        vector<double> m_gammaGrads;
+        vector<double> m_betaGrads;
+        vector<double> m_runningMean;
+        vector<double> m_runningVariance;
+
+        batchMatrix m_normalized;      // (x - mean) / sqrt(variance + epsilon) from the last training batch.
+        vector<double> m_inverseStd;   // 1 / sqrt(variance + epsilon) per channel, from the last training batch.
+
+        void normalize(const batchMatrix &input, batchMatrix &output,
+                       const vector<double> &scale, const vector<double> &shift) const; // output = f(scale*x + shift)
+};
+
+#endif
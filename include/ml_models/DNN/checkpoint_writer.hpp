@@ -0,0 +1,84 @@
+#ifndef _CHECKPOINT_WRITER_HPP_
+#define _CHECKPOINT_WRITER_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class Network;
+
+class CheckpointWriter
+{
+    /*
+    Model checkpoints written without stalling training. save() copies the
+    network's dense weights, biases and training step (the only optimizer
+    state plain SGD keeps) into one of two staging buffers and returns; a
+    background thread writes the buffer to
+    "<directory>/<prefix>-<training step>.ckpt" through a temporary file
+    that is fsynced and then renamed over, so a crash leaves complete
+    checkpoints only. The newest numRetained checkpoints written are kept,
+    older ones deleted.
+
+    While one buffer is being written the other takes the next snapshot,
+    so training only waits if it saves twice within one write.
+
+    Only that state is stored, so networks with more - feature layers,
+    dense batch norm or pruning masks - are refused by save() and load()
+    rather than restored in part.
+    */
+
+    public:
+        CheckpointWriter(const string &directory, const string &prefix="checkpoint", int numRetained=3);
+        ~CheckpointWriter(); // Finishes the pending writes.
+
+        CheckpointWriter(const CheckpointWriter&) = delete;
+        CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+        bool save(const Network &network); // False (with the reason on stderr) if the network has state checkpoints don't hold.
+        void flush();                    // Returns when every checkpoint saved so far is on disk (or failed).
+
+        vector<string> files() const;    // Paths of the retained checkpoints, oldest first.
+        int numWritten() const;
+        int numFailed() const;           // Writes that failed; the reason goes to stderr.
+        double stagingSeconds() const;   // Total time save() has taken, copying and waiting for a buffer.
+
+        // Restores a checkpoint into a network of the same layer sizes. False (with the reason on
+        // stderr) if the file can't be read, isn't a checkpoint, has other layer sizes or the
+        // network has state checkpoints don't hold.
+        static bool load(const string &path, Network &network);
+
+    private:
+        struct Staging
+        {
+            vector<double> parameters;
+            vector<int> layerSizes;
+            uint64_t trainingStep {0};
+            bool busy {false};           // Queued or being written.
+        };
+
+        string m_directory;
+        string m_prefix;
+        int m_numRetained;
+
+        mutable mutex m_mutex;           // Guards everything below.
+        condition_variable m_changed;    // Signalled when a buffer is queued or written.
+        Staging m_staging[2];
+        deque<int> m_queue;              // Staging buffers to write, oldest first.
+        deque<string> m_files;
+        int m_numWritten {0};
+        int m_numFailed {0};
+        double m_stagingSeconds {0.0};
+        bool m_stop {false};
+        thread m_writer;
+
+        void writeLoop();
+        bool write(const Staging &staging, const string &path) const;
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef _CONV_LAYER_HPP_
+#define _CONV_LAYER_HPP_
+
+#include "batch_layer.hpp"
+#include "parameters.hpp"
+#include "math/matrix.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Conv2DLayer : public BatchLayer
+{
+    /*
+    2-D convolution over a batch of (channels, height, width) volumes, followed
+    by an activation. Each sample is unrolled with im2col so that the whole
+    convolution becomes a single GEMM against the kernel matrix, whose rows are
+    the output channels and whose columns run over (input channel, ky, kx).
+    Samples within a batch are processed in parallel.
+    */
+
+    public:
+        Conv2DLayer(int inChannels, int inHeight, int inWidth,
+                    int outChannels, int kernelSize, int stride=1, int padding=0,
+                    Activation activationType=Activation::RELU);
+
+        void infer(const batchMatrix &input, batchMatrix &output) const override;
+        void backward(const batchMatrix &input, const batchMatrix &output,
+                      const batchMatrix &outputGrad, batchMatrix &inputGrad) override;
+        void update(double learningCoefficient) override;
+        unique_ptr<BatchLayer> clone() const override { return unique_ptr<BatchLayer>(new Conv2DLayer(*this)); }
+        bool foldAffine(const vector<double> &scale, const vector<double> &shift, Activation activationType) override;
+
+        double inferenceFlops(int batchSize) const override; // The GEMM, plus bias and activation.
+        double parameterBytes() const override { return sizeof(double) * (m_kernels.size() + m_biases.size()); }
+
+        int getInputSize()  const override { return m_inChannels * m_inHeight * m_inWidth; }
+        int getOutputSize() const override { return m_outChannels * m_outHeight * m_outWidth; }
+        string getName()    const override;
+
+        int getOutChannels() const { return m_outChannels; }
+        int getOutHeight()   const { return m_outHeight; }
+        int getOutWidth()    const { return m_outWidth; }
+
+        linalg::Matrix<double>& getKernels() { return m_kernels; } // outChannels x (inChannels*kernelSize*kernelSize)
+        vector<double>& getBiases()          { return m_biases; }  // One bias per output channel.
+
+    private:
+        int m_inChannels;
+        int m_inHeight;
+        int m_inWidth;
+        int m_outChannels;
+        int m_kernelSize;
+        int m_stride;
+        int m_padding;
+        int m_outHeight;
+        int m_outWidth;
+        Activation m_activationType;
+
+        linalg::Matrix<double> m_kernels;     // Convolution kernels, one output channel per row.
+        vector<double> m_biases;              // Output channel biases.
+        linalg::Matrix<double> m_kernelGrads; // Kernel gradients accumulated since the last update().
+        vector<double> m_biasGrads;           // Bias gradients accumulated since the last update().
+
+        int columnRows() const { return m_inChannels * m_kernelSize * m_kernelSize; }
+        int columnCols() const { return m_outHeight * m_outWidth; }
+
+        void im2col(const double *image, double *columns) const;  // Unrolls one input volume into a columnRows() x columnCols() buffer.
+        void col2im(const double *columns, double *image) const;  // Scatters (adds) a column buffer back onto a zeroed input volume.
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef _DENSE_LAYER_HPP_
+#define _DENSE_LAYER_HPP_
+
+#include "batch_layer.hpp"
+#include "parameters.hpp"
+#include "math/autodiff.hpp"
+#include "math/matrix.hpp"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class DenseLayer : public BatchLayer
+{
+    /*
+    Fully connected feature layer, f(X W^T + b), whose gradients come from
+    an autodiff::Tape instead of a hand-derived backward pass: forward()
+    records the product, bias and activation on the layer's tape, and
+    backward() seeds the tape with the output gradient and reads the
+    weight, bias and input gradients off it. After the first minibatch of
+    a given size the tape reuses its arena, so training allocates nothing.
+
+    backward() differentiates the most recent forward(), as Network calls
+    them.
+    */
+
+    public:
+        DenseLayer(int numInputs, int numOutputs, Activation activationType=Activation::TANH);
+        DenseLayer(const DenseLayer &other); // Parameters and gradients; the copy starts with an empty tape.
+
+        void infer(const batchMatrix &input, batchMatrix &output) const override;
+        void forward(const batchMatrix &input, batchMatrix &output) override;
+        void backward(const batchMatrix &input, const batchMatrix &output,
+                      const batchMatrix &outputGrad, batchMatrix &inputGrad) override;
+        void update(double learningCoefficient) override;
+        unique_ptr<BatchLayer> clone() const override { return unique_ptr<BatchLayer>(new DenseLayer(*this)); }
+
+        double inferenceFlops(int batchSize) const override { return batchSize * (2.0 * m_numInputs + 2.0) * m_numOutputs; }
+        double parameterBytes() const override { return sizeof(double) * (m_weights.size() + m_biases.size()); }
+
+        int getInputSize()  const override { return m_numInputs; }
+        int getOutputSize() const override { return m_numOutputs; }
+        string getName()    const override;
+
+        linalg::Matrix<double>& getWeights() { return m_weights; } // numOutputs x numInputs
+        vector<double>& getBiases()          { return m_biases; }
+        const autodiff::Tape& getTape() const { return m_tape; }
+
+    private:
+        int m_numInputs;
+        int m_numOutputs;
+        Activation m_activationType;
+
+        linalg::Matrix<double> m_weights;     // One output neuron per row.
+        vector<double> m_biases;
+        linalg::Matrix<double> m_weightGrads; // Gradients accumulated since the last update().
+        vector<double> m_biasGrads;
+
+        autodiff::Tape m_tape;                // The last forward() pass.
+        autodiff::Var m_output;               // Its output node.
+        batchMatrix m_inputGrads;             // Where the tape accumulates the input gradient.
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _DROPOUT_HPP_
+#define _DROPOUT_HPP_
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+class DropoutMask
+{
+    /*
+    Keep/drop decisions for a minibatch, packed 64 per word with one run of
+    words per sample. Bits come from numerical::counterRandom keyed by
+    (seed, step) and indexed by position, so a mask is reproducible from its
+    seed and step alone and rows can be generated in parallel without any
+    shared generator state. Each 64-bit draw yields four 16-bit uniforms,
+    so the drop rate has a resolution of 1/65536.
+    */
+
+    public:
+        void generate(uint64_t seed, uint64_t step, int numRows, int numCols, double rate); // Draws a fresh mask for a numRows x numCols batch.
+
+        bool keep(int row, int col) const { return (m_bits[row*m_wordsPerRow + col/64] >> (col%64)) & 1; }
+        const uint64_t* rowBits(int row) const { return m_bits.data() + row*m_wordsPerRow; }
+        double getKeepScale() const { return m_keepScale; } // 1/(1-rate): kept values are scaled so the expected activation is unchanged.
+
+    private:
+        vector<uint64_t> m_bits;
+        int m_wordsPerRow {0};
+        double m_keepScale {1.0};
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef _INFERENCE_GRAPH_HPP_
+#define _INFERENCE_GRAPH_HPP_
+
+#include "batch_layer.hpp"
+#include "network.hpp"
+#include "parameters.hpp"
+#include "math/matrix.hpp"
+#include "math/sparse.hpp"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum class GraphOp
+{
+    LAYER,        // Opaque feature layer, run with BatchLayer::infer.
+    MATMUL,       // X * W^T, in the weight matrix's dense or sparse format.
+    BIAS_ADD,     // Adds a per-column bias.
+    AFFINE,       // Per-channel scale and shift (an inference-mode batch norm).
+    ACTIVATION,
+    ELEMENTWISE,  // Fused chain of BIAS_ADD, AFFINE and ACTIVATION steps, one pass over memory.
+    FUSED_MATMUL  // MATMUL with an elementwise chain applied to each output tile while it is in cache.
+};
+
+struct FusionReport
+{
+    /*
+    An inference graph before and after InferenceGraph::fuse() on the same inputs.
+    */
+
+    int batchSize;
+    int nodesBefore;
+    int nodesAfter;
+    size_t bytesBefore;          // Estimated memory traffic of one batch (see InferenceGraph::trafficBytes).
+    size_t bytesAfter;
+    double secondsBefore;        // Median wall time of one batch.
+    double secondsAfter;
+    double predictSeconds;       // Network::predict on the same batch, for reference.
+    double maxOutputDifference;  // Largest absolute difference between the two graphs' outputs.
+
+    void printToConsole() const;
+};
+
+class InferenceGraph
+{
+    /*
+    Inference model of a Network as a graph of primitive operations, in
+    evaluation order; each node consumes the previous node's output. Built
+    unfused, a dense layer is three nodes (MATMUL, BIAS_ADD, ACTIVATION) and
+    a batch norm two (AFFINE, ACTIVATION), each a separate pass over its
+    batch. fuse() then rewrites the graph:
+
+      - batch norm folding: AFFINE (+ ACTIVATION) after a feature layer that
+        can absorb it (BatchLayer::foldAffine) disappears into that layer,
+      - elementwise chains: runs of BIAS_ADD / AFFINE / ACTIVATION merge into
+        one ELEMENTWISE node, dropping identity steps,
+      - GEMM epilogues: an ELEMENTWISE node after a MATMUL is applied inside
+        the GEMM to each finished tile (linalg::GemmEpilogue).
+
+    At small batch sizes inference is bound by memory traffic rather than
+    arithmetic, so cutting passes over the activations is what pays.
+    */
+
+    public:
+        explicit InferenceGraph(const Network &network);
+
+        void fuse();                                                          // Applies all fusion passes.
+        void predict(const batchMatrix &inputs, batchMatrix &outputs) const; // Same contract as Network::predict.
+
+        int numNodes() const { return m_nodes.size(); }
+        size_t trafficBytes(int batchSize) const; // Activation reads/writes plus parameter reads of one batch.
+        void printToConsole() const;              // One line per node.
+
+        // Times the unfused and fused graphs of 'network' (and Network::predict) on a batch of inputs.
+        static FusionReport benchmarkFusion(const Network &network, const batchMatrix &inputs, int repetitions=10);
+
+    private:
+        struct ElementwiseStep
+        {
+            GraphOp op;                       // BIAS_ADD, AFFINE or ACTIVATION.
+            vector<double> values;            // Per-column biases (BIAS_ADD) or per-channel scales (AFFINE).
+            vector<double> shifts;            // Per-channel shifts (AFFINE).
+            int spatialSize {1};              // Columns per channel (AFFINE).
+            Activation activationType {Activation::LINEAR};
+        };
+
+        struct GraphNode
+        {
+            GraphOp op;
+            int inputSize;
+            int outputSize;
+            unique_ptr<BatchLayer> layer;     // LAYER
+            linalg::SparseFormat format {linalg::SparseFormat::DENSE}; // MATMUL and FUSED_MATMUL weights...
+            weightMatrix weights;             // ...dense,
+            linalg::CSRMatrix csrWeights;     // ...in CSR,
+            linalg::BSRMatrix bsrWeights;     // ...or in BSR format.
+            vector<ElementwiseStep> steps;    // Elementwise nodes: their steps; FUSED_MATMUL: the epilogue.
+
+            string describe() const;
+            size_t parameterBytes() const;
+        };
+
+        vector<GraphNode> m_nodes;
+
+        void addElementwise(GraphOp op, int size, const ElementwiseStep &step);
+        static bool isElementwise(GraphOp op) { return op == GraphOp::BIAS_ADD || op == GraphOp::AFFINE
+                                                    || op == GraphOp::ACTIVATION || op == GraphOp::ELEMENTWISE; }
+        static bool isIdentity(const ElementwiseStep &step); // LINEAR activations and all-zero biases.
+        static void applySteps(const vector<ElementwiseStep> &steps, double *values, int numRows, int numCols,
+                               int ld, int firstCol); // Applies a chain to a block of rows, column firstCol first.
+
+        void foldBatchNorms();
+        void mergeElementwise();
+        void fuseMatmulEpilogues();
+};
+
+#endif
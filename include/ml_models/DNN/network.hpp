@@ -1,50 +1,219 @@
 #ifndef _NETWORK_HPP_
 #define _NETWORK_HPP_
 
+#include "data_processing/dataset_view.hpp"
 #include "math/matrix.hpp"
+#include "math/roofline.hpp"
+#include "math/sparse.hpp"
+#include "batch_layer.hpp"
+#include "batchnorm_layer.hpp"
+#include "dropout.hpp"
 #include "layer.hpp"
 #include "neuron.hpp"
 #include "parameters.hpp"
 
+#include <cstdint>
+#include <ctime>
+#include <memory>
 #include <vector>
 
 using namespace std;
 using weightMatrix = linalg::Matrix<double>;
 
+class CheckpointWriter;
+
+struct Evaluation
+{
+    /*
+    Result of Network::evaluate over a labelled dataset.
+    */
+
+    int numSamples {0};
+    double accuracy {0.0};          // Fraction of samples whose largest output is at the target class.
+    double loss {0.0};              // Mean quadratic cost, as minimized in training.
+    vector<vector<int>> confusion;  // confusion[target class][predicted class] sample counts.
+
+    void printToConsole() const;
+};
+
+struct TrainingHistory
+{
+    /*
+    Outcome of Network::trainEpochs.
+    */
+
+    int epochsRun {0};
+    int bestEpoch {0};              // Epoch whose weights were restored (0 if none was validated).
+    bool stoppedEarly {false};
+    vector<Evaluation> validation;  // Validation result of each epoch, in order.
+
+    void printToConsole() const;
+};
+
+struct PipelineStats
+{
+    /*
+    Per-stage timings of Network::trainPipelined.
+    */
+
+    vector<int> firstLayers;       // First weight matrix of each stage.
+    vector<double> busySeconds;    // Time each stage spent computing...
+    vector<double> stageSeconds;   // ...out of the time its thread ran.
+    double wallSeconds {0.0};
+
+    void printToConsole() const;   // Busy time and utilization (busy / wall time) per stage.
+};
+
 class Network {
     /*
     Class that embodies the whole network, given a vector 'layerSizes',
     whose length is the number of layers, and whose elements dictate the
     number of neurons in each layer.
+
+    Optional feature layers (convolutions etc.) can be placed in front of the
+    dense layers; the last of them must output as many values as there are
+    input neurons. Training runs on minibatches: every layer processes the
+    whole batch as a matrix with one sample per row.
     */
 
     public:
         Network(vector<int> &layerSizes, vector<Activation> &activationTypes);
+        Network(const Network &other);  // Deep copy, feature layers included.
+        Network(Network &&other) = default;
 
         void printToConsole() const; // Displays the structure of the network in the console
 
+        void addFeatureLayer(unique_ptr<BatchLayer> layer); // Appends a batched layer to the feature stack in front of the dense layers.
+        void setBatchSize(int batchSize);                   // Number of samples per weight update.
+        void setDropout(int layerNum, double rate);         // Drops each activation of dense layer layerNum with probability 'rate' during training.
+        void setDropoutSeed(uint64_t seed) { m_dropoutSeed = seed; } // Seed of the dropout masks; training is reproducible for a given seed.
+        void setPruning(int layerNum, double finalSparsity, int beginBatch, int endBatch,
+                        int frequency=1, int blockSize=1); // Gradually prunes the weights from layer layerNum to layerNum+1 during training.
+        void setBatchNorm(int layerNum, bool enabled=true); // Batch normalizes dense layer layerNum (1 onwards) between its weights and its activation.
+        void setCheckpointInterval(int interval);           // Keeps only every interval-th dense layer's activations for backprop, recomputing the rest.
+        void setAutoSave(CheckpointWriter *writer, int intervalBatches); // Saves a checkpoint every intervalBatches minibatches (null to stop); the writer must outlive training.
+
         void setInput(vector<double> &input);   // Sets the input values of the input neurons.
         void setTarget(vector<double> &target) { m_targetOutput = target; }  // Sets the target output for the current element of the training set.
         
-        void train(vector<vector<vector<double>>> trainingData);  // Trains the network on appropiately-typed data vector.   
+        void train(const vector<vector<vector<double>>> &trainingData);  // Trains the network on appropiately-typed data vector.
+        TrainingHistory trainEpochs(const vector<vector<vector<double>>> &trainingData, const DatasetView &validation,
+                                    int maxEpochs, int patience=3); // Multi-epoch training with background validation and early stopping.
+        PipelineStats trainPipelined(const vector<vector<vector<double>>> &trainingData,
+                                     int numStages, int numMicrobatches); // One pass with the dense layers split into pipeline stages on separate threads.
+        void train(const vector<linalg::SparseVector> &inputs, const vector<vector<double>> &targets); // Trains on sparse inputs (no feature layers).
+
+        void predict(const batchMatrix &inputs, batchMatrix &outputs) const; // Inference-only forward pass, one sample per row.
+        void predict(const linalg::CSRMatrix &inputs, batchMatrix &outputs) const; // The same for sparse inputs (no feature layers).
+        Network inferenceModel() const; // Copy for serving, with batch norm folded into the preceding layers.
+        Evaluation evaluate(const DatasetView &data, int batchSize=256) const; // Accuracy, loss and confusion matrix over a dataset.
+        vector<roofline::KernelCost> layerCosts(int batchSize) const; // Analytic FLOPs and bytes of predict() per feature and dense layer.
+        roofline::RooflineReport rooflineReport(const batchMatrix &inputs, int repetitions=10) const; // layerCosts with each layer's measured time.
+
+        int getInputSize() const; // Number of values per input sample (of the first feature layer, if any).
+
+        size_t numParameters() const;                   // Dense weights and biases, as saved in checkpoints.
+        void copyParameters(double *destination) const; // numParameters() values: each weight matrix row-major, then the biases of layers 1 onwards.
+        void loadParameters(const double *source);      // The inverse of copyParameters.
+        uint64_t getTrainingStep() const { return m_trainingStep; } // Minibatches trained so far.
+        void setTrainingStep(uint64_t step) { m_trainingStep = step; }
+        const vector<int>& getLayerSizes() const { return m_layerSizes; }
+
+        int getNumLayers() const { return m_numLayers; }
+        const Layer& getLayer(int layerNum) const { return m_layers.at(layerNum); }
+        const weightMatrix& getWeightMatrix(int layerNum) const { return m_weightMatrices.at(layerNum); } // Weights from layer layerNum to layerNum+1 (empty if stored sparse only, see inferenceModel()).
+        double getWeightDensity(int layerNum) const;            // Fraction of nonzero weights from layer layerNum to layerNum+1.
+        linalg::SparseFormat getWeightFormat(int layerNum) const { return m_weightFormats.at(layerNum); } // Format predict() uses for those weights.
+        const linalg::CSRMatrix& getCSRWeights(int layerNum) const { return m_csrWeights.at(layerNum); } // The weights in CSR format, when that's the format...
+        const linalg::BSRMatrix& getBSRWeights(int layerNum) const { return m_bsrWeights.at(layerNum); } // ...or in BSR format.
+        size_t getPeakActivationBytes() const { return m_peakBufferBytes; } // Peak memory of the dense stack's minibatch buffers in the last train().
+        int getNumFeatureLayers() const { return m_featureLayers.size(); }
+        const BatchLayer& getFeatureLayer(int index) const { return *m_featureLayers.at(index); }
+        const BatchNormLayer* getBatchNorm(int layerNum) const { return m_batchNorms.at(layerNum).get(); } // Null if the dense layer has none.
+        bool isPruned(int layerNum) const { return !m_pruningMasks.at(layerNum).empty(); } // Whether weight matrix layerNum has a pruning mask.
     
     private:
+        struct PruningSchedule
+        {
+            double finalSparsity {0.0}; // Fraction of weights pruned by endBatch.
+            int beginBatch {0};
+            int endBatch {0};
+            int frequency {1};          // Batches between pruning steps.
+            int blockSize {1};          // Side of the square blocks pruned as a unit.
+        };
+
         const double m_LEARNINGRATE{0.3};     // Learning rate
-        const int    m_BATCHSIZE{1};
+        const double m_SPARSE_DENSITY{0.35};  // Weight density below which predict() switches to the sparse kernels.
+        int          m_batchSize{1};          // Samples per minibatch
+        int          m_checkpointInterval{1}; // Dense layers per checkpoint segment; 1 keeps every layer.
+        size_t       m_peakBufferBytes{0};    // Peak memory of the dense minibatch buffers during the last train().
+        clock_t      m_recomputeTime{0};      // Time spent recomputing checkpointed segments during the last train().
+        CheckpointWriter *m_autoSave{nullptr}; // Receives a checkpoint every m_autoSaveInterval minibatches (not copied with the network).
+        int          m_autoSaveInterval{0};
 
         vector<int> m_layerSizes;              // A vector of integers containing the number of neurons in each layer.
         int m_numLayers;                       // A separate variable equal to the length of layerSizes, for more concise code.
         vector<Layer> m_layers;                // A vector containing the actual layer objects of the network. 
         vector<weightMatrix> m_weightMatrices; // A vector of weight matrices for the connections between adjacent layers.
-        vector<vector<double>> m_errors;       // A multidimensional vector containing the errors from the most recent backpropagation.
+        vector<unique_ptr<BatchLayer>> m_featureLayers; // Batched layers applied to the input before the dense layers.
+        vector<unique_ptr<BatchNormLayer>> m_batchNorms; // Batch norm of each dense layer, null for none.
+        vector<double> m_dropoutRates;         // Dropout rate of each dense layer, 0 for none.
+        uint64_t m_dropoutSeed{0x5C7A7C4E7ULL}; // Key of the counter-based dropout RNG.
+        uint64_t m_trainingStep{0};            // Minibatches trained so far; the counter of the dropout RNG.
+        vector<PruningSchedule> m_pruning;     // Pruning schedule of each weight matrix (final sparsity 0 for none).
+        vector<vector<uint8_t>> m_pruningMasks; // 1 for weights still in use; empty until a matrix is first pruned.
+        vector<linalg::SparseFormat> m_weightFormats; // Storage used by predict() for each weight matrix.
+        vector<linalg::CSRMatrix> m_csrWeights;       // Sparse copies of the weight matrices in CSR format,
+        vector<linalg::BSRMatrix> m_bsrWeights;       // ...or in BSR format for block-pruned ones.
         
         vector<double> m_input;               // Inputs of the input neurons.
         vector<double> m_targetOutput;        // Target activations.
 
+        // Minibatch state, one sample per row.
+        batchMatrix m_batchInput;                // Inputs of the current minibatch.
+        batchMatrix m_batchTargets;              // Target activations of the current minibatch.
+        linalg::CSRMatrix m_sparseBatchInput;    // Inputs of the current minibatch when training on sparse inputs,
+        bool m_sparseBatch{false};               // ...which is the case when this is set.
+        vector<int> m_sparseInputColumns;        // Input columns with a nonzero in the current sparse minibatch.
+        weightMatrix m_sparseInputGradients;     // First-layer weight gradients of those columns, one column per row.
+        vector<batchMatrix> m_featureOutputs;    // Output of each feature layer.
+        vector<batchMatrix> m_featureGrads;      // Cost gradient w.r.t. the input of each feature layer.
+        vector<batchMatrix> m_activations;       // Activations of each dense layer.
+        vector<batchMatrix> m_derivatives;       // Activation derivatives of each dense layer.
+        vector<DropoutMask> m_dropoutMasks;      // Dropout mask of each dense layer for the current minibatch.
+        vector<batchMatrix> m_errors;            // Errors from the most recent backpropagation; entry l belongs to layer l+1.
+        batchMatrix m_inputError;                // Error at the input layer, passed back into the feature layers.
+        batchMatrix m_batchNormScratch;          // Batch norm output (forward) or input error (backward) of the layer at hand.
+        vector<weightMatrix> m_weightGradients;  // Cost gradient w.r.t. each weight matrix.
+        vector<vector<double>> m_biasGradients;  // Cost gradient w.r.t. the biases of layers 1 onwards.
+
+        void allocateBatchBuffers();          // (Re)creates the per-layer minibatch buffers.
+        void restoreParameters(const Network &snapshot); // Copies the weights, biases and feature layers of a same-shaped network.
+        vector<int> pipelineStages(int numStages) const; // First weight matrix of each pipeline stage, plus the end.
+        void loadBatch(const vector<vector<vector<double>>> &data, int first, int count); // Copies samples [first, first+count) into the minibatch matrices.
+        void activateLayer(int layerNum, batchMatrix &values, batchMatrix *derivatives,
+                           const DropoutMask *mask=nullptr) const; // Adds biases and applies layer layerNum's activation (and dropout) to 'values' in place.
+        void normalizeLayer(int layerNum, batchMatrix &values) const; // Applies layer layerNum's batch norm, if any, with its running statistics.
+        void activateSparseInput(linalg::CSRMatrix &inputs, const DropoutMask *mask=nullptr) const; // The input layer's activation (and dropout) on sparse inputs.
+        void forwardDense(batchMatrix &activations, batchMatrix &outputs, int firstLayer) const; // Inference through the dense layers from firstLayer+1 on.
+
+        void trainBatch(int batchNum, clock_t loadTime); // Feedforward, backpropagation and update on the loaded minibatch.
         void feedForward();                   // Implements feed forward part of learning.
-        void backPropagate(bool isNewBatch);  // Implements back propagtion part of learning.
+        void forwardLayer(int layerNum, bool recompute=false); // Computes the activations and derivatives of layer layerNum+1 from layer layerNum.
+        const DropoutMask* dropoutMaskOf(int layerNum) const; // The minibatch's dropout mask of a layer, or null.
+        bool isCheckpoint(int layerNum) const; // Whether a layer keeps its activations through the forward pass.
+        void releaseLayer(int layerNum);      // Frees the activations and derivatives of a layer.
+        void trackBufferBytes();              // Updates m_peakBufferBytes.
+        void printMemoryReport() const;       // Prints the peak activation memory (and recompute time) of the last train().
+        void backPropagateLayer(int l);       // Gradients of weight matrix l and the error of layer l.
+        void backPropagate();                 // Implements back propagtion part of learning.
         void update();                        // Updates the weight matrices and neuron biases using current error.
+        void updateWeights(int l, double learningCoefficient, const weightMatrix &gradients);     // Gradient step on weight matrix l, keeping pruned weights at zero.
+        void updateBiases(int l, double learningCoefficient, const vector<double> &biasGradients); // Gradient step on the biases of layer l+1.
+        void prune(int layerNum);             // Masks the weights of matrix layerNum to its scheduled sparsity for the current batch.
+        void refreshSparseWeights();          // Rebuilds the sparse weight copies used by predict().
+        double batchCost() const;             // Mean quadratic cost over the current minibatch.
 
 };
 
-#endif
\ No newline at end of file
+#endif
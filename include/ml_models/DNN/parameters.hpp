@@ -5,7 +5,14 @@ enum class Activation
 {
     TANH,
     RELU,
-    FAST_SIGMOID
+    FAST_SIGMOID,
+    LINEAR
+};
+
+enum class Pooling
+{
+    MAX,
+    AVERAGE
 };
 
 #endif
\ No newline at end of file
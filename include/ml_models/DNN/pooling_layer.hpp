@@ -0,0 +1,58 @@
+#ifndef _POOLING_LAYER_HPP_
+#define _POOLING_LAYER_HPP_
+
+#include "batch_layer.hpp"
+#include "parameters.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class Pool2DLayer : public BatchLayer
+{
+    /*
+    2-D max or average pooling over a batch of (channels, height, width)
+    volumes, with square poolSize x poolSize windows and no padding.
+
+    In training, max pooling records which element of each window won as a
+    one-byte offset (ky*poolSize + kx), so backward() is a single scatter
+    over the outputs instead of a second search through the windows.
+    */
+
+    public:
+        Pool2DLayer(Pooling type, int channels, int inHeight, int inWidth, int poolSize, int stride=0); // stride 0 means stride = poolSize
+
+        void infer(const batchMatrix &input, batchMatrix &output) const override;
+        void forward(const batchMatrix &input, batchMatrix &output) override;
+        void backward(const batchMatrix &input, const batchMatrix &output,
+                      const batchMatrix &outputGrad, batchMatrix &inputGrad) override;
+        unique_ptr<BatchLayer> clone() const override { return unique_ptr<BatchLayer>(new Pool2DLayer(*this)); }
+
+        double inferenceFlops(int batchSize) const override { return double(batchSize) * getOutputSize() * m_poolSize * m_poolSize; }
+
+        int getInputSize()  const override { return m_channels * m_inHeight * m_inWidth; }
+        int getOutputSize() const override { return m_channels * m_outHeight * m_outWidth; }
+        string getName()    const override;
+
+        int getChannels()  const { return m_channels; }
+        int getOutHeight() const { return m_outHeight; }
+        int getOutWidth()  const { return m_outWidth; }
+
+    private:
+        Pooling m_type;
+        int m_channels;
+        int m_inHeight;
+        int m_inWidth;
+        int m_poolSize;
+        int m_stride;
+        int m_outHeight;
+        int m_outWidth;
+
+        vector<uint8_t> m_argmax; // Winning window offset of every output in the last training batch (max pooling only).
+
+        void pool(const batchMatrix &input, batchMatrix &output, uint8_t *argmax) const; // Shared by infer() and forward(); argmax may be null.
+};
+
+#endif
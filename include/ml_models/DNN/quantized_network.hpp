@@ -0,0 +1,81 @@
+#ifndef _QUANTIZED_NETWORK_HPP_
+#define _QUANTIZED_NETWORK_HPP_
+
+#include "batch_layer.hpp"
+#include "network.hpp"
+#include "parameters.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+struct QuantizationReport
+{
+    /*
+    Float model versus its int8 quantization on the same labelled inputs.
+    */
+
+    int numSamples;
+    double floatAccuracy;        // Fraction of samples whose largest output matches the target's.
+    double quantizedAccuracy;
+    double maxOutputDifference;  // Largest absolute difference between corresponding outputs.
+    double meanOutputDifference;
+    size_t floatBytes;           // Storage of the dense weights and biases.
+    size_t quantizedBytes;
+    double floatSeconds;         // Wall time of one predict() over all samples.
+    double quantizedSeconds;
+
+    void printToConsole() const;
+};
+
+class QuantizedNetwork
+{
+    /*
+    Post-training int8 quantization of a trained Network for serving.
+
+    The dense weights are quantized symmetrically per output neuron (one
+    scale per weight matrix row). The inputs of each dense layer are
+    quantized with one scale per layer, calibrated from the largest
+    activation seen while running the float model over a sample of inputs.
+    Products are accumulated exactly in int32 (linalg::gemmInt8) and scaled
+    back to double before the bias and activation are applied.
+
+    Feature layers stay in double precision; batch norm is folded first,
+    as in Network::inferenceModel().
+    */
+
+    public:
+        QuantizedNetwork(const Network &network, const batchMatrix &calibrationInputs);
+        QuantizedNetwork(const QuantizedNetwork &other);
+
+        void predict(const batchMatrix &inputs, batchMatrix &outputs) const; // Same contract as Network::predict.
+
+        size_t getDenseBytes() const; // Storage of the quantized dense weights, scales and biases.
+
+        // Runs both models over labelled inputs (one sample per row) and compares them.
+        QuantizationReport compare(const Network &reference, const batchMatrix &inputs, const batchMatrix &targets) const;
+
+    private:
+        struct QuantizedLayer
+        {
+            int numInputs;
+            int numOutputs;
+            vector<int8_t> weights;      // numOutputs x numInputs, row-major.
+            vector<float> weightScales;  // One per output neuron.
+            float inputScale;            // Real value of one step of the quantized input.
+            vector<double> biases;       // Biases of the receiving layer.
+            Activation activationType;   // Activation of the receiving layer.
+        };
+
+        vector<unique_ptr<BatchLayer>> m_featureLayers;
+        vector<double> m_inputBiases;  // Biases and activation of the input layer, applied in float.
+        Activation m_inputActivation;
+        vector<QuantizedLayer> m_layers;
+
+        void runFeatures(const batchMatrix &inputs, batchMatrix &activations) const; // Feature layers and the input layer's activation.
+};
+
+#endif
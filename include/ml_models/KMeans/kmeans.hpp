@@ -1,8 +1,9 @@
 #ifndef KMEANS_HPP
 #define KMEANS_HPP
 
-#include "common.hpp"
-#include "MNIST/mnist_data_handler.hpp"
+#include "data_processing/MNIST/common.hpp"
+#include "data_processing/MNIST/mnist_data_handler.hpp"
+#include "math/roofline.hpp"
 
 #include <cmath>
 #include <cstdlib>
@@ -22,7 +23,7 @@ typedef struct cluster
         centroid = new std::vector<double>;
         clusterPoints = new std::vector<MNISTData*>;
 
-        for (auto value : *(initialPoint->getFeatureVector()))
+        for (auto value : initialPoint->getFeatureVector())
         {
             centroid->push_back(value);
         }
@@ -33,14 +34,14 @@ typedef struct cluster
 
     void addToCluster(MNISTData* newPoint)
     {
-        int previousSize { clusterPoints->size() };
+        int previousSize { static_cast<int>(clusterPoints->size()) };
         clusterPoints->push_back(newPoint);
         for (int i=0; i<centroid->size(); ++i)
         {
             double value { centroid->at(i) };
             value *= previousSize;
-            value += newPoint->getFeatureVector()->at(i);
-            value /= double { clusterPoints->size() };
+            value += newPoint->getFeatureVector().at(i);
+            value /= static_cast<double>(clusterPoints->size());
             centroid->at(i) = value;
         }
         if (classCounts.find(newPoint->getLabel()) == classCounts.end())
@@ -84,6 +85,8 @@ class KMeans : public commonData
         void initClusters();
         void initClustersForEachClass();
         void train();
+        double iterate();   // One batch (Lloyd) iteration over the training data; returns the mean squared distance to the assigned centroids.
+        roofline::KernelCost iterationCost() const; // Analytic FLOPs and bytes of one iterate().
         double euclideanDistance(std::vector<double>*, MNISTData*);
         double validate();
         double test();
@@ -3,6 +3,9 @@
 
 #include "data_processing/MNIST/common.hpp"
 #include "data_processing/MNIST/mnist_data.hpp"
+#include "math/numa.hpp"
+#include "math/roofline.hpp"
+#include <memory>
 #include <vector>
 
 class KNN : public commonData {
@@ -10,11 +13,13 @@ class KNN : public commonData {
         int k;
         std::vector<MNISTData*> neighbours;
         double distance;
+        std::unique_ptr<numa::Replicated<std::vector<MNISTData>>> trainingReplicas; // Per-node copies of trainingData, made on the first query.
         
     public:
         KNN(int initialK);
 
         void findKNearest(MNISTData* queryPoint);
+        roofline::KernelCost queryCost() const;   // Analytic FLOPs and bytes of one findKNearest() scan.
         void setK(int value);
 
         int predictClass();
@@ -1,7 +1,15 @@
 #include "data_processing/MNIST/common.hpp"
 #include "data_processing/MNIST/mnist_data.hpp"
+#include "math/memory_tracker.hpp"
 #include <vector>
 
-void commonData::setTrainingData(std::vector<MNISTData> data)   { trainingData = data; }
-void commonData::setTestData(std::vector<MNISTData> data)       { testData = data; }
-void commonData::setValidationData(std::vector<MNISTData> data) { validationData = data; }
\ No newline at end of file
+void commonData::setTrainingData(const std::vector<MNISTData> &data)
+{
+    // The training set is what KNN and KMeans scan over and over, so it gets huge pages.
+    memtrack::Scope scope(memtrack::Subsystem::DATASET);
+    trainingData = data;
+    adviseHugePages(trainingData);
+}
+
+void commonData::setTestData(const std::vector<MNISTData> &data)        { memtrack::Scope scope(memtrack::Subsystem::DATASET); testData = data; }
+void commonData::setValidationData(const std::vector<MNISTData> &data)  { memtrack::Scope scope(memtrack::Subsystem::DATASET); validationData = data; }
\ No newline at end of file
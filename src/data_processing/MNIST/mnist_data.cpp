@@ -1,5 +1,8 @@
 #include "data_processing/MNIST/mnist_data.hpp"
+#include "math/hugepages.hpp"
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 #include "stdint.h"
 
@@ -18,8 +21,35 @@ void MNISTData::setDistance(double value) { distance = value; }
 
 int MNISTData::featureVectorSize() { return featureVector.size(); }
 int MNISTData::getLabel() { return label; }
-std::vector<double> MNISTData::getFeatureVector() { return featureVector; }
-std::vector<double> MNISTData::getClassVector()   { return classVector; }
+const std::vector<double>& MNISTData::getFeatureVector() const { return featureVector; }
+const std::vector<double>& MNISTData::getClassVector() const   { return classVector; }
 
 // KNN
-double MNISTData::getDistance() { return distance; }
\ No newline at end of file
+double MNISTData::getDistance() { return distance; }
+
+void adviseHugePages(std::vector<MNISTData> &samples)
+{
+    /*
+    The feature vectors are separate heap blocks, but loaded one after the
+    other they sit back to back, so the span from the first to the last is
+    almost all features. Spans much larger than the features themselves
+    are mostly other data and left alone.
+    */
+
+    uintptr_t first { UINTPTR_MAX }, last {0};
+    size_t featureBytes {0};
+    for (const MNISTData &sample : samples)
+    {
+        const std::vector<double> &features { sample.getFeatureVector() };
+        if (!features.empty())
+        {
+            first = std::min(first, reinterpret_cast<uintptr_t>(features.data()));
+            last = std::max(last, reinterpret_cast<uintptr_t>(features.data() + features.size()));
+            featureBytes += features.size() * sizeof(double);
+        }
+    }
+    if (featureBytes >= hugepages::MIN_HUGE_PAGE_BYTES && last - first < 2 * featureBytes)
+    {
+        hugepages::collapse(reinterpret_cast<void*>(first), last - first);
+    }
+}
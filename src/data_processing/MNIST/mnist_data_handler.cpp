@@ -1,4 +1,5 @@
 #include "data_processing/MNIST/mnist_data_handler.hpp"
+#include "math/memory_tracker.hpp"
 
 #include <fstream>
 #include <map>
@@ -9,6 +10,7 @@
 
 void MNISTDataHandler::readFeatureVector(std::string path)
 {
+    memtrack::Scope scope(memtrack::Subsystem::DATASET);
     uint32_t header[4]; // MAGIC|NUMIMAGES|ROWSIZE|COLSIZE
     unsigned char bytes[4];
     FILE* f = fopen(path.c_str(), "r");
@@ -27,23 +29,27 @@ void MNISTDataHandler::readFeatureVector(std::string path)
         int imageSize = header[2]*header[3];
         printf("Num samples: %d\n", header[1]);
         printf("Image size: %d pixels\n", imageSize);
+        // One exactly-sized allocation per image, so the images lie back to back on the heap.
+        allData.reserve(allData.size() + header[1]);
+        std::vector<double> features(imageSize);
         for (int i=0; i<header[1]; ++i)
         {
-            allData.push_back(MNISTData());
             uint8_t element[1];
             for (int j=0; j<imageSize; ++j)
             {
                 if (fread(element, sizeof(element), 1, f))
                 {
-                    allData.back().appendToFeatureVector(double{element[0]/255.0});
+                    features[j] = double{element[0]/255.0};
                 } else
                 {
                     printf("Error reading from file.\n");
                     exit(1);
                 }
             }
-            ;
+            allData.push_back(MNISTData());
+            allData.back().setFeatureVector(features);
         }
+        adviseHugePages(allData);
         printf("Successfully read and stored %lu feature vectors.\n", allData.size());
     } else
     {
@@ -92,6 +98,7 @@ void MNISTDataHandler::readLabels(std::string path)
 
 void MNISTDataHandler::splitData()
 {
+    memtrack::Scope scope(memtrack::Subsystem::DATASET);
     std::unordered_set<int> usedIndices;
     int trainingSetSize = allData.size()*TRAIN_SET_PERCENT;
     int testSetSize = allData.size()*TEST_SET_PERCENT;
@@ -134,6 +141,10 @@ void MNISTDataHandler::splitData()
         }
     }
 
+    adviseHugePages(trainingData);
+    adviseHugePages(testData);
+    adviseHugePages(validationData);
+
     printf("Training data size: %lu\n", trainingData.size());
     printf("Test data size: %lu\n", testData.size());
     printf("Validation data size: %lu\n", validationData.size());
@@ -1,4 +1,5 @@
 #include "data_processing/XOR/XOR_preprocessor.hpp"
+#include "math/memory_tracker.hpp"
 
 #include <fstream>
 #include <iostream>
@@ -15,6 +16,7 @@ XORPreprocessor::XORPreprocessor(string filePath)
     correspond to training sample, input/output vector, and neuron index respectively.
     */
 
+    memtrack::Scope scope(memtrack::Subsystem::DATASET);
     ifstream inFile(filePath);
 
     // first line dictates required input and output layer sizes
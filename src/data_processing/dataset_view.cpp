@@ -0,0 +1,59 @@
+#include "data_processing/dataset_view.hpp"
+#include "data_processing/MNIST/mnist_data.hpp"
+#include "math/memory_tracker.hpp"
+
+#include <algorithm>
+#include <vector>
+
+DatasetView::DatasetView(const std::vector<MNISTData> &data)
+{
+    memtrack::Scope scope(memtrack::Subsystem::DATASET);
+    m_features.reserve(data.size());
+    m_targets.reserve(data.size());
+    for (const MNISTData &sample : data)
+    {
+        m_features.push_back(sample.getFeatureVector().data());
+        m_targets.push_back(sample.getClassVector().data());
+    }
+    if (!data.empty())
+    {
+        m_featureSize = data.front().getFeatureVector().size();
+        m_targetSize  = data.front().getClassVector().size();
+    }
+}
+
+DatasetView::DatasetView(const std::vector<std::vector<std::vector<double>>> &data)
+{
+    memtrack::Scope scope(memtrack::Subsystem::DATASET);
+    m_features.reserve(data.size());
+    m_targets.reserve(data.size());
+    for (const std::vector<std::vector<double>> &sample : data)
+    {
+        m_features.push_back(sample.at(0).data());
+        m_targets.push_back(sample.at(1).data());
+    }
+    if (!data.empty())
+    {
+        m_featureSize = data.front().at(0).size();
+        m_targetSize  = data.front().at(1).size();
+    }
+}
+
+DatasetView DatasetView::slice(int first, int count) const
+{
+    first = std::max(0, std::min(first, size()));
+    count = std::max(0, std::min(count, size() - first));
+
+    DatasetView view;
+    view.m_features.assign(m_features.begin() + first, m_features.begin() + first + count);
+    view.m_targets.assign(m_targets.begin() + first, m_targets.begin() + first + count);
+    view.m_featureSize = m_featureSize;
+    view.m_targetSize  = m_targetSize;
+    return view;
+}
+
+int DatasetView::label(int index) const
+{
+    const double *target { m_targets[index] };
+    return std::max_element(target, target + m_targetSize) - target;
+}
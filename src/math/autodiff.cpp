@@ -0,0 +1,423 @@
+#include "math/autodiff.hpp"
+#include "math/gemm.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+
+using namespace std;
+
+namespace autodiff
+{
+    Arena::Arena(size_t blockBytes)
+    {
+        m_blockBytes   = blockBytes;
+        m_currentBlock = 0;
+        m_offset       = 0;
+        m_usedBefore   = 0;
+    }
+
+    void* Arena::allocate(size_t bytes, size_t alignment)
+    {
+        /*
+        Tries the current block, then any blocks kept from earlier steps, and
+        only then adds a new block.
+        */
+
+        while (m_currentBlock < m_blocks.size())
+        {
+            const uintptr_t base { reinterpret_cast<uintptr_t>(m_blocks[m_currentBlock].get()) };
+            const size_t aligned { ((base + m_offset + alignment - 1) & ~(uintptr_t(alignment) - 1)) - base };
+            if (aligned + bytes <= m_blockSizes[m_currentBlock])
+            {
+                m_offset = aligned + bytes;
+                return m_blocks[m_currentBlock].get() + aligned;
+            }
+            m_usedBefore += m_offset;
+            ++m_currentBlock;
+            m_offset = 0;
+        }
+
+        const size_t blockSize { std::max(m_blockBytes, bytes + alignment) };
+        m_blocks.emplace_back(new char[blockSize]);
+        m_blockSizes.push_back(blockSize);
+        return allocate(bytes, alignment);
+    }
+
+    void Arena::reset()
+    {
+        m_currentBlock = 0;
+        m_offset       = 0;
+        m_usedBefore   = 0;
+    }
+
+    size_t Arena::bytesUsed() const
+    {
+        return m_usedBefore + m_offset;
+    }
+
+    size_t Arena::capacity() const
+    {
+        size_t total {0};
+        for (size_t size : m_blockSizes)
+        {
+            total += size;
+        }
+        return total;
+    }
+
+    Tape::Tape(size_t arenaBlockBytes) : m_arena(arenaBlockBytes)
+    {
+        m_last     = nullptr;
+        m_numNodes = 0;
+    }
+
+    void Tape::reset()
+    {
+        m_arena.reset();
+        m_last     = nullptr;
+        m_numNodes = 0;
+    }
+
+    Node* Tape::record(Op op, int rows, int cols, Node *a, Node *b)
+    {
+        Node *node { m_arena.allocateArray<Node>(1) };
+        const size_t size { static_cast<size_t>(rows) * cols };
+        node->op       = op;
+        node->rows     = rows;
+        node->cols     = cols;
+        node->a        = a;
+        node->b        = b;
+        node->scalar   = 1.0;
+        node->transB   = false;
+        node->value    = (op == Op::LEAF) ? nullptr : m_arena.allocateArray<double>(size);
+        node->grad     = nullptr;
+        if ((a && a->grad) || (b && b->grad))
+        {
+            node->grad = m_arena.allocateArray<double>(size);
+            std::fill(node->grad, node->grad + size, 0.0);
+        }
+        node->previous = m_last;
+        m_last = node;
+        ++m_numNodes;
+        return node;
+    }
+
+    void Tape::checkSameShape(const char *opName, Var X, Var Y) const
+    {
+        if (X.rows() != Y.rows() || X.cols() != Y.cols())
+        {
+            cerr << "Shapes " << X.rows() << "x" << X.cols() << " and " << Y.rows() << "x" << Y.cols()
+            << " don't match in " << opName << "!" << endl;
+            assert(false);
+        }
+    }
+
+    Var Tape::constant(const linalg::Matrix<double> &value)
+    {
+        return constant(value.numRows(), value.numCols(), value.data());
+    }
+
+    Var Tape::constant(int rows, int cols, const double *value)
+    {
+        Node *node { record(Op::LEAF, rows, cols, nullptr, nullptr) };
+        node->value = value;
+        return Var(node);
+    }
+
+    Var Tape::parameter(const linalg::Matrix<double> &value, linalg::Matrix<double> &gradient)
+    {
+        if (gradient.numRows() != value.numRows() || gradient.numCols() != value.numCols())
+        {
+            gradient.resize(value.numRows(), value.numCols());
+            std::fill(gradient.getValues().begin(), gradient.getValues().end(), 0.0);
+        }
+        return parameter(value.numRows(), value.numCols(), value.data(), gradient.data());
+    }
+
+    Var Tape::parameter(int rows, int cols, const double *value, double *gradient)
+    {
+        Node *node { record(Op::LEAF, rows, cols, nullptr, nullptr) };
+        node->value = value;
+        node->grad  = gradient;
+        return Var(node);
+    }
+
+    Var Tape::matmul(Var A, Var B, bool transB)
+    {
+        const int innerB { transB ? B.cols() : B.rows() };
+        const int N      { transB ? B.rows() : B.cols() };
+        if (A.cols() != innerB)
+        {
+            cerr << "Can't multiply " << A.rows() << "x" << A.cols() << " by " << B.rows() << "x" << B.cols()
+            << (transB ? " transposed" : "") << "!" << endl;
+            assert(false);
+        }
+        Node *node { record(Op::MATMUL, A.rows(), N, A.node(), B.node()) };
+        node->transB = transB;
+        linalg::gemm(false, transB, A.rows(), N, A.cols(), 1.0, A.value(), A.cols(),
+                     B.value(), B.cols(), 0.0, mutableValue(node), N);
+        return Var(node);
+    }
+
+    Var Tape::addRow(Var X, Var row)
+    {
+        if (row.rows() != 1 || row.cols() != X.cols())
+        {
+            cerr << "addRow needs a 1x" << X.cols() << " row, got " << row.rows() << "x" << row.cols() << "!" << endl;
+            assert(false);
+        }
+        Node *node { record(Op::ADD_ROW, X.rows(), X.cols(), X.node(), row.node()) };
+        double *out { mutableValue(node) };
+        for (int i=0; i<X.rows(); ++i)
+        {
+            for (int j=0; j<X.cols(); ++j)
+            {
+                out[i*X.cols() + j] = X(i,j) + row.value()[j];
+            }
+        }
+        return Var(node);
+    }
+
+    Var Tape::add(Var X, Var Y)
+    {
+        checkSameShape("add", X, Y);
+        Node *node { record(Op::ADD, X.rows(), X.cols(), X.node(), Y.node()) };
+        double *out { mutableValue(node) };
+        for (int i=0; i<X.rows()*X.cols(); ++i)
+        {
+            out[i] = X.value()[i] + Y.value()[i];
+        }
+        return Var(node);
+    }
+
+    Var Tape::subtract(Var X, Var Y)
+    {
+        checkSameShape("subtract", X, Y);
+        Node *node { record(Op::SUBTRACT, X.rows(), X.cols(), X.node(), Y.node()) };
+        double *out { mutableValue(node) };
+        for (int i=0; i<X.rows()*X.cols(); ++i)
+        {
+            out[i] = X.value()[i] - Y.value()[i];
+        }
+        return Var(node);
+    }
+
+    Var Tape::hadamard(Var X, Var Y)
+    {
+        checkSameShape("hadamard", X, Y);
+        Node *node { record(Op::HADAMARD, X.rows(), X.cols(), X.node(), Y.node()) };
+        double *out { mutableValue(node) };
+        for (int i=0; i<X.rows()*X.cols(); ++i)
+        {
+            out[i] = X.value()[i] * Y.value()[i];
+        }
+        return Var(node);
+    }
+
+    Var Tape::scale(Var X, double factor)
+    {
+        Node *node { record(Op::SCALE, X.rows(), X.cols(), X.node(), nullptr) };
+        node->scalar = factor;
+        double *out { mutableValue(node) };
+        for (int i=0; i<X.rows()*X.cols(); ++i)
+        {
+            out[i] = factor * X.value()[i];
+        }
+        return Var(node);
+    }
+
+    Var Tape::tanh(Var X)
+    {
+        Node *node { record(Op::TANH, X.rows(), X.cols(), X.node(), nullptr) };
+        double *out { mutableValue(node) };
+        for (int i=0; i<X.rows()*X.cols(); ++i)
+        {
+            out[i] = std::tanh(X.value()[i]);
+        }
+        return Var(node);
+    }
+
+    Var Tape::sigmoid(Var X)
+    {
+        Node *node { record(Op::SIGMOID, X.rows(), X.cols(), X.node(), nullptr) };
+        double *out { mutableValue(node) };
+        for (int i=0; i<X.rows()*X.cols(); ++i)
+        {
+            out[i] = 1.0 / (1.0 + std::exp(-X.value()[i]));
+        }
+        return Var(node);
+    }
+
+    Var Tape::softsign(Var X)
+    {
+        Node *node { record(Op::SOFTSIGN, X.rows(), X.cols(), X.node(), nullptr) };
+        double *out { mutableValue(node) };
+        for (int i=0; i<X.rows()*X.cols(); ++i)
+        {
+            out[i] = X.value()[i] / (1.0 + std::abs(X.value()[i]));
+        }
+        return Var(node);
+    }
+
+    Var Tape::relu(Var X)
+    {
+        Node *node { record(Op::RELU, X.rows(), X.cols(), X.node(), nullptr) };
+        double *out { mutableValue(node) };
+        for (int i=0; i<X.rows()*X.cols(); ++i)
+        {
+            out[i] = std::max(0.0, X.value()[i]);
+        }
+        return Var(node);
+    }
+
+    Var Tape::halfSumSquares(Var X)
+    {
+        Node *node { record(Op::HALF_SUM_SQUARES, 1, 1, X.node(), nullptr) };
+        double sum {0.0};
+        for (int i=0; i<X.rows()*X.cols(); ++i)
+        {
+            sum += X.value()[i] * X.value()[i];
+        }
+        mutableValue(node)[0] = 0.5 * sum;
+        return Var(node);
+    }
+
+    void Tape::backward(Var output)
+    {
+        if (output.rows() != 1 || output.cols() != 1)
+        {
+            cerr << "backward() needs a 1x1 output, or the gradient of a larger one!" << endl;
+            assert(false);
+        }
+        const double seed {1.0};
+        backward(output, &seed);
+    }
+
+    void Tape::backward(Var output, const double *outputGrad)
+    {
+        /*
+        Nodes were recorded in evaluation order, so walking the list backwards
+        from the last node visits every node after all of its consumers.
+        */
+
+        if (!output.node()->grad)
+        {
+            cerr << "backward() needs an output that depends on a parameter!" << endl;
+            assert(false);
+        }
+        for (int i=0; i<output.rows()*output.cols(); ++i)
+        {
+            output.node()->grad[i] += outputGrad[i];
+        }
+        for (Node *node=output.node(); node; node=node->previous)
+        {
+            if (node->grad && node->op != Op::LEAF)
+            {
+                propagate(node);
+            }
+        }
+    }
+
+    void Tape::propagate(Node *node)
+    {
+        const int size { node->rows * node->cols };
+        const double *dOut { node->grad };
+        Node *a { node->a };
+        Node *b { node->b };
+
+        switch (node->op)
+        {
+            case Op::MATMUL:
+            {
+                // C = A op(B):  dA += dC op(B)^T,  dB += A^T dC  (or dC^T A when B was transposed)
+                const int M { node->rows };
+                const int N { node->cols };
+                const int K { a->cols };
+                if (a->grad)
+                {
+                    linalg::gemm(false, !node->transB, M, K, N, 1.0, dOut, N, b->value, b->cols, 1.0, a->grad, K);
+                }
+                if (b->grad && node->transB)
+                {
+                    linalg::gemm(true, false, N, K, M, 1.0, dOut, N, a->value, K, 1.0, b->grad, K);
+                }
+                else if (b->grad)
+                {
+                    linalg::gemm(true, false, K, N, M, 1.0, a->value, K, dOut, N, 1.0, b->grad, N);
+                }
+                break;
+            }
+            case Op::ADD_ROW:
+                for (int i=0; i<node->rows; ++i)
+                {
+                    for (int j=0; j<node->cols; ++j)
+                    {
+                        const double d { dOut[i*node->cols + j] };
+                        if (a->grad) a->grad[i*node->cols + j] += d;
+                        if (b->grad) b->grad[j] += d;
+                    }
+                }
+                break;
+            case Op::ADD:
+            case Op::SUBTRACT:
+            {
+                const double sign { node->op == Op::ADD ? 1.0 : -1.0 };
+                for (int i=0; i<size; ++i)
+                {
+                    if (a->grad) a->grad[i] += dOut[i];
+                    if (b->grad) b->grad[i] += sign * dOut[i];
+                }
+                break;
+            }
+            case Op::HADAMARD:
+                for (int i=0; i<size; ++i)
+                {
+                    if (a->grad) a->grad[i] += dOut[i] * b->value[i];
+                    if (b->grad) b->grad[i] += dOut[i] * a->value[i];
+                }
+                break;
+            case Op::SCALE:
+                for (int i=0; i<size; ++i)
+                {
+                    a->grad[i] += node->scalar * dOut[i];
+                }
+                break;
+            case Op::TANH:
+                for (int i=0; i<size; ++i)
+                {
+                    a->grad[i] += dOut[i] * (1.0 - node->value[i]*node->value[i]);
+                }
+                break;
+            case Op::SIGMOID:
+                for (int i=0; i<size; ++i)
+                {
+                    a->grad[i] += dOut[i] * node->value[i] * (1.0 - node->value[i]);
+                }
+                break;
+            case Op::SOFTSIGN:
+                for (int i=0; i<size; ++i)
+                {
+                    const double denominator { 1.0 + std::abs(a->value[i]) };
+                    a->grad[i] += dOut[i] / (denominator * denominator);
+                }
+                break;
+            case Op::RELU:
+                for (int i=0; i<size; ++i)
+                {
+                    a->grad[i] += (a->value[i] > 0.0) ? dOut[i] : 0.0;
+                }
+                break;
+            case Op::HALF_SUM_SQUARES:
+                for (int i=0; i<a->rows*a->cols; ++i)
+                {
+                    a->grad[i] += dOut[0] * a->value[i];
+                }
+                break;
+            case Op::LEAF:
+                break;
+        }
+    }
+}
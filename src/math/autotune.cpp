@@ -0,0 +1,387 @@
+#include "math/autotune.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+namespace autotune
+{
+    namespace
+    {
+        const int MAX_CLASS_DIMENSION {1024}; // Larger dimensions share one class.
+        const int MAX_TUNING_MN {1024};       // Caps on the shape tuned, to bound the tuning time.
+        const int MAX_TUNING_K {512};
+        const double SECONDS_PER_CANDIDATE {0.005}; // Repeat a candidate for this long (at least once after a warm-up).
+        const int MAX_REPETITIONS {200};
+
+        std::atomic<bool> g_enabled { false };
+
+        std::mutex g_cacheMutex;    // Guards the three below; never held across a parallel call.
+        std::string g_cachePath;    // Empty for the default.
+        std::map<std::string, linalg::GemmTiling> g_tilings; // This machine's tilings, by shape class.
+        int g_numTuned {0};
+
+        // Held while tuning, and only ever try_locked: a thread waiting on its tuning runs could
+        // pick up another product, which must not block on the tuning it is part of.
+        std::mutex g_tuningMutex;
+        thread_local bool t_tuning { false };
+
+        std::string defaultCachePath()
+        {
+            const char *cacheHome { std::getenv("XDG_CACHE_HOME") };
+            if (cacheHome && *cacheHome)
+            {
+                return std::string(cacheHome) + "/scratchnet/kernels.tsv";
+            }
+            const char *home { std::getenv("HOME") };
+            if (home && *home)
+            {
+                return std::string(home) + "/.cache/scratchnet/kernels.tsv";
+            }
+            return "scratchnet_kernels.tsv";
+        }
+
+        std::string pathLocked()
+        {
+            return g_cachePath.empty() ? defaultCachePath() : g_cachePath;
+        }
+
+        // A cache line: CPU model, shape class and the tiling, tab separated. Lines from before the
+        // transposes were part of the class (no "NN:" style prefix) are dropped.
+        bool parseLine(const std::string &line, std::string &cpu, std::string &shape, linalg::GemmTiling &tiling)
+        {
+            if (line.empty() || line[0] == '#')
+            {
+                return false;
+            }
+            const size_t firstTab { line.find('\t') };
+            const size_t secondTab { firstTab == std::string::npos ? firstTab : line.find('\t', firstTab+1) };
+            if (secondTab == std::string::npos)
+            {
+                return false;
+            }
+            cpu = line.substr(0, firstTab);
+            shape = line.substr(firstTab+1, secondTab-firstTab-1);
+            if (shape.size() < 3 || shape[2] != ':')
+            {
+                return false;
+            }
+            std::istringstream fields(line.substr(secondTab+1));
+            return static_cast<bool>(fields >> tiling.mc >> tiling.nc >> tiling.kc >> tiling.threads >> tiling.rowsPerPass);
+        }
+
+        std::string formatLine(const std::string &cpu, const std::string &shape, const linalg::GemmTiling &tiling)
+        {
+            return cpu + "\t" + shape + "\t" + std::to_string(tiling.mc) + " " + std::to_string(tiling.nc) + " "
+                   + std::to_string(tiling.kc) + " " + std::to_string(tiling.threads) + " " + std::to_string(tiling.rowsPerPass);
+        }
+
+        void loadLocked()
+        {
+            g_tilings.clear();
+            std::ifstream file(pathLocked());
+            std::string line, cpu, shape;
+            linalg::GemmTiling tiling;
+            while (std::getline(file, line))
+            {
+                if (parseLine(line, cpu, shape, tiling) && cpu == cpuModel())
+                {
+                    g_tilings[shape] = tiling;
+                }
+            }
+        }
+
+        void makeParentDirectories(const std::string &path)
+        {
+            for (size_t slash=path.find('/', 1); slash!=std::string::npos; slash=path.find('/', slash+1))
+            {
+                mkdir(path.substr(0, slash).c_str(), 0755); // Fails harmlessly on existing directories.
+            }
+        }
+
+        void saveLocked()
+        {
+            /*
+            Rewrites the file with the other machines' lines as they are now
+            on disk and all of ours, adopting any of our classes another
+            process has added meanwhile. The file is replaced by a rename, so
+            readers never see half of it; two processes saving at once can
+            lose one's new classes, which are then just tuned again.
+            */
+
+            const std::string path { pathLocked() };
+            std::vector<std::string> otherLines;
+            {
+                std::ifstream file(path);
+                std::string line, cpu, shape;
+                linalg::GemmTiling tiling;
+                while (std::getline(file, line))
+                {
+                    if (!parseLine(line, cpu, shape, tiling))
+                    {
+                        continue;
+                    }
+                    if (cpu != cpuModel())
+                    {
+                        otherLines.push_back(line);
+                    }
+                    else if (g_tilings.find(shape) == g_tilings.end())
+                    {
+                        g_tilings[shape] = tiling;
+                    }
+                }
+            }
+
+            makeParentDirectories(path);
+            const std::string temporaryPath { path + ".tmp" };
+            {
+                std::ofstream file(temporaryPath);
+                file << "# Kernel tilings chosen by the autotuner: CPU model, shape class (transposes of A and B: M x N x K), mc nc kc threads rowsPerPass" << std::endl;
+                for (const std::string &line : otherLines)
+                {
+                    file << line << std::endl;
+                }
+                for (const auto &entry : g_tilings)
+                {
+                    file << formatLine(cpuModel(), entry.first, entry.second) << std::endl;
+                }
+                if (!file)
+                {
+                    std::cerr << "Could not write the autotuning cache " << temporaryPath << std::endl;
+                    std::remove(temporaryPath.c_str());
+                    return;
+                }
+            }
+            if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+            {
+                std::cerr << "Could not replace the autotuning cache " << path << std::endl;
+                std::remove(temporaryPath.c_str());
+            }
+        }
+
+        std::string classOf(int dimension)
+        {
+            if (dimension > MAX_CLASS_DIMENSION)
+            {
+                return ">" + std::to_string(MAX_CLASS_DIMENSION);
+            }
+            int rounded {1};
+            while (rounded < dimension)
+            {
+                rounded *= 2;
+            }
+            return std::to_string(dimension <= 0 ? 0 : rounded);
+        }
+    }
+
+    void setEnabled(bool enabled)
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        if (enabled && !g_enabled)
+        {
+            loadLocked();
+        }
+        g_enabled = enabled;
+    }
+
+    bool enabled() { return g_enabled; }
+
+    void setCachePath(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        g_cachePath = path;
+        if (g_enabled)
+        {
+            loadLocked();
+        }
+    }
+
+    std::string cachePath()
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        return pathLocked();
+    }
+
+    std::string cpuModel()
+    {
+        static const std::string model { []()
+        {
+            // x86 names the model in "model name"; other architectures use one of the other keys, if any.
+            std::ifstream cpuinfo("/proc/cpuinfo");
+            std::string line, name;
+            while (std::getline(cpuinfo, line) && name.empty())
+            {
+                const size_t colon { line.find(':') };
+                std::string key { line.substr(0, colon) };
+                key.erase(key.find_last_not_of(" \t") + 1);
+                if (colon != std::string::npos && (key == "model name" || key == "Model" || key == "cpu model" || key == "uarch"))
+                {
+                    const size_t valueStart { line.find_first_not_of(" \t", colon+1) };
+                    name = valueStart == std::string::npos ? "" : line.substr(valueStart);
+                }
+            }
+            std::replace(name.begin(), name.end(), '\t', ' ');
+            return (name.empty() ? std::string("unknown CPU") : name)
+                   + " (hardware threads: " + std::to_string(std::thread::hardware_concurrency()) + ")";
+        }() };
+        return model;
+    }
+
+    std::string shapeClass(bool transA, bool transB, int M, int N, int K)
+    {
+        return std::string(transA ? "T" : "N") + (transB ? "T" : "N") + ":" + classOf(M) + "x" + classOf(N) + "x" + classOf(K);
+    }
+
+    linalg::GemmTiling gemmTiling(bool transA, bool transB, int M, int N, int K)
+    {
+        if (!g_enabled)
+        {
+            return linalg::GemmTiling();
+        }
+
+        const std::string shape { shapeClass(transA, transB, M, N, K) };
+        {
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            const auto found { g_tilings.find(shape) };
+            if (found != g_tilings.end())
+            {
+                return found->second;
+            }
+        }
+
+        if (t_tuning || !g_tuningMutex.try_lock())
+        {
+            return linalg::GemmTiling();
+        }
+        std::lock_guard<std::mutex> tuningLock(g_tuningMutex, std::adopt_lock);
+        {
+            // Another thread may have tuned it between the lookup and the lock.
+            std::lock_guard<std::mutex> lock(g_cacheMutex);
+            const auto found { g_tilings.find(shape) };
+            if (found != g_tilings.end())
+            {
+                return found->second;
+            }
+        }
+
+        t_tuning = true;
+        const linalg::GemmTiling tuned { tune(transA, transB, M, N, K) };
+        t_tuning = false;
+
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        g_tilings[shape] = tuned;
+        ++g_numTuned;
+        saveLocked();
+        return tuned;
+    }
+
+    linalg::GemmTiling tune(bool transA, bool transB, int M, int N, int K)
+    {
+        /*
+        Coordinate descent from the default tiling: one parameter at a time,
+        over a handful of values, keeping whichever candidate is fastest.
+        Each candidate runs once to warm the caches and packing buffers,
+        then repeatedly for a few milliseconds; its time is the fastest run.
+        The operands are laid out as the caller's are, transposed or not,
+        since that changes how the kernel packs and walks them.
+        */
+
+        const int m { std::max(1, std::min(M, MAX_TUNING_MN)) };
+        const int n { std::max(1, std::min(N, MAX_TUNING_MN)) };
+        const int k { std::max(0, std::min(K, MAX_TUNING_K)) };
+        std::vector<double> A, B, C;
+        {
+            memtrack::Scope scratch(memtrack::Subsystem::OTHER);
+            A.resize(static_cast<size_t>(m) * k);
+            B.resize(static_cast<size_t>(k) * n);
+            C.resize(static_cast<size_t>(m) * n);
+        }
+        const int lda { transA ? m : k };
+        const int ldb { transB ? k : n };
+        for (size_t i=0; i<A.size(); ++i)
+        {
+            A[i] = 0.25 * (i % 7);
+        }
+        for (size_t i=0; i<B.size(); ++i)
+        {
+            B[i] = 0.5 * (i % 5);
+        }
+
+        const auto timeOf = [&](const linalg::GemmTiling &tiling)
+        {
+            const auto run = [&]() { linalg::gemm(tiling, transA, transB, m, n, k, 1.0, A.data(), lda, B.data(), ldb, 0.0, C.data(), n); };
+            run();
+            double fastest { std::numeric_limits<double>::max() }, total {0.0};
+            for (int repetition=0; repetition<MAX_REPETITIONS && (repetition == 0 || total < SECONDS_PER_CANDIDATE); ++repetition)
+            {
+                const auto start { std::chrono::steady_clock::now() };
+                run();
+                const double seconds { std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+                fastest = std::min(fastest, seconds);
+                total += seconds;
+            }
+            return fastest;
+        };
+
+        linalg::GemmTiling best;
+        double bestSeconds { timeOf(best) };
+        const auto tryValues = [&](int linalg::GemmTiling::*parameter, const std::vector<int> &values)
+        {
+            const linalg::GemmTiling start { best };
+            for (int value : values)
+            {
+                if (value == start.*parameter)
+                {
+                    continue;
+                }
+                linalg::GemmTiling candidate { start };
+                candidate.*parameter = value;
+                const double seconds { timeOf(candidate) };
+                if (seconds < bestSeconds)
+                {
+                    best = candidate;
+                    bestSeconds = seconds;
+                }
+            }
+        };
+
+        const int numThreads { parallel::numThreads() };
+        std::vector<int> threadCounts {1, 2, numThreads / 2};
+        threadCounts.erase(std::remove_if(threadCounts.begin(), threadCounts.end(), [&](int count) { return count >= numThreads; }),
+                           threadCounts.end());
+        std::sort(threadCounts.begin(), threadCounts.end());
+        threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+        tryValues(&linalg::GemmTiling::threads, threadCounts);
+        tryValues(&linalg::GemmTiling::rowsPerPass, {1, 4});
+        tryValues(&linalg::GemmTiling::mc, {16, 32, 64, 128, 256});
+        tryValues(&linalg::GemmTiling::nc, {64, 128, 256, 512, 1024});
+        tryValues(&linalg::GemmTiling::kc, {64, 128, 256, 512});
+        return best;
+    }
+
+    int numCached()
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        return static_cast<int>(g_tilings.size());
+    }
+
+    int numTuned()
+    {
+        std::lock_guard<std::mutex> lock(g_cacheMutex);
+        return g_numTuned;
+    }
+}
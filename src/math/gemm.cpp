@@ -0,0 +1,328 @@
+#include "math/gemm.hpp"
+#include "math/autotune.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <iostream>
+#include <vector>
+
+namespace linalg
+{
+    namespace
+    {
+        void packA(bool transA, const double *A, int lda, int i0, int mc, int k0, int kc, double *packed)
+        {
+            /*
+            Copies the mc x kc block of op(A) starting at (i0, k0) into a
+            row-major buffer with row stride kc.
+            */
+            if (!transA)
+            {
+                for (int i=0; i<mc; ++i)
+                {
+                    const double *row { A + static_cast<long>(i0+i)*lda + k0 };
+                    std::copy(row, row+kc, packed + i*kc);
+                }
+            }
+            else
+            {
+                for (int k=0; k<kc; ++k)
+                {
+                    const double *row { A + static_cast<long>(k0+k)*lda + i0 };
+                    for (int i=0; i<mc; ++i)
+                    {
+                        packed[i*kc + k] = row[i];
+                    }
+                }
+            }
+        }
+
+        void packB(bool transB, const double *B, int ldb, int k0, int kc, int j0, int nc, double *packed)
+        {
+            /*
+            Copies the kc x nc block of op(B) starting at (k0, j0) into a
+            row-major buffer with row stride nc.
+            */
+            if (!transB)
+            {
+                for (int k=0; k<kc; ++k)
+                {
+                    const double *row { B + static_cast<long>(k0+k)*ldb + j0 };
+                    std::copy(row, row+nc, packed + k*nc);
+                }
+            }
+            else
+            {
+                for (int j=0; j<nc; ++j)
+                {
+                    const double *row { B + static_cast<long>(j0+j)*ldb + k0 };
+                    for (int k=0; k<kc; ++k)
+                    {
+                        packed[k*nc + j] = row[k];
+                    }
+                }
+            }
+        }
+
+        void multiplyPanels(int mc, int nc, int kc, double alpha, const double *packedA, const double *packedB, double *C, int ldc)
+        {
+            /*
+            C += alpha * packedA * packedB for one tile. The innermost loop runs
+            along contiguous rows of both packed B and C.
+            */
+            for (int i=0; i<mc; ++i)
+            {
+                double *cRow { C + static_cast<long>(i)*ldc };
+                for (int k=0; k<kc; ++k)
+                {
+                    const double a { alpha * packedA[i*kc + k] };
+                    const double *bRow { packedB + k*nc };
+                    for (int j=0; j<nc; ++j)
+                    {
+                        cRow[j] += a * bRow[j];
+                    }
+                }
+            }
+        }
+
+        void multiplyPanelsByFour(int mc, int nc, int kc, double alpha, const double *packedA, const double *packedB, double *C, int ldc)
+        {
+            /*
+            As multiplyPanels, but updating four rows of C per pass over a
+            row of packed B, so each element of B is loaded once for four
+            multiply-adds. Every element of C still sees the same additions
+            in the same order.
+            */
+            int i {0};
+            for (; i+4<=mc; i+=4)
+            {
+                double *c0 { C + static_cast<long>(i)*ldc };
+                double *c1 { c0 + ldc };
+                double *c2 { c1 + ldc };
+                double *c3 { c2 + ldc };
+                for (int k=0; k<kc; ++k)
+                {
+                    const double a0 { alpha * packedA[i*kc + k] };
+                    const double a1 { alpha * packedA[(i+1)*kc + k] };
+                    const double a2 { alpha * packedA[(i+2)*kc + k] };
+                    const double a3 { alpha * packedA[(i+3)*kc + k] };
+                    const double *bRow { packedB + k*nc };
+                    for (int j=0; j<nc; ++j)
+                    {
+                        const double b { bRow[j] };
+                        c0[j] += a0 * b;
+                        c1[j] += a1 * b;
+                        c2[j] += a2 * b;
+                        c3[j] += a3 * b;
+                    }
+                }
+            }
+            multiplyPanels(mc - i, nc, kc, alpha, packedA + i*kc, packedB, C + static_cast<long>(i)*ldc, ldc);
+        }
+    }
+
+    void gemm(bool transA, bool transB, int M, int N, int K,
+              double alpha, const double *A, int lda,
+              const double *B, int ldb,
+              double beta, double *C, int ldc)
+    {
+        gemm(transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, GemmEpilogue());
+    }
+
+    void gemm(bool transA, bool transB, int M, int N, int K,
+              double alpha, const double *A, int lda,
+              const double *B, int ldb,
+              double beta, double *C, int ldc,
+              const GemmEpilogue &epilogue)
+    {
+        if (M <= 0 || N <= 0)
+        {
+            return;
+        }
+        gemm(autotune::gemmTiling(transA, transB, M, N, K), transA, transB, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc, epilogue);
+    }
+
+    void gemm(const GemmTiling &tiling, bool transA, bool transB, int M, int N, int K,
+              double alpha, const double *A, int lda,
+              const double *B, int ldb,
+              double beta, double *C, int ldc,
+              const GemmEpilogue &epilogue)
+    {
+        if (M <= 0 || N <= 0)
+        {
+            return;
+        }
+        const int mcMax { std::max(1, tiling.mc) };
+        const int ncMax { std::max(1, tiling.nc) };
+        const int kcMax { std::max(1, tiling.kc) };
+        const int numThreads { tiling.threads > 0 ? std::min(tiling.threads, parallel::numThreads()) : parallel::numThreads() };
+
+        // Shrink the row blocks when there are too few tiles to keep every thread busy.
+        const int numColBlocks { (N + ncMax - 1) / ncMax };
+        int rowBlock { mcMax };
+        if (((M + rowBlock - 1) / rowBlock) * numColBlocks < numThreads)
+        {
+            const int rowsPerThread { (M + numThreads - 1) / numThreads };
+            rowBlock = std::max(std::min(8, mcMax), std::min(mcMax, rowsPerThread));
+        }
+        const int numRowBlocks { (M + rowBlock - 1) / rowBlock };
+        const int numTiles { numRowBlocks*numColBlocks };
+
+        const auto multiplyTiles = [&](int tileBegin, int tileEnd)
+        {
+            // Per-thread packing buffers, kept between calls: the scheduler hands out a few
+            // pieces per thread, and allocating half a megabyte for each would fault in fresh pages.
+            thread_local std::vector<double> packedA, packedB;
+            memtrack::Scope scratch(memtrack::Subsystem::OTHER);
+            packedA.resize(static_cast<size_t>(rowBlock) * kcMax);
+            packedB.resize(static_cast<size_t>(kcMax) * ncMax);
+
+            for (int tile=tileBegin; tile<tileEnd; ++tile)
+            {
+                const int i0 { (tile / numColBlocks) * rowBlock };
+                const int j0 { (tile % numColBlocks) * ncMax };
+                const int mc { std::min(rowBlock, M - i0) };
+                const int nc { std::min(ncMax, N - j0) };
+                double *cTile { C + static_cast<long>(i0)*ldc + j0 };
+
+                for (int i=0; i<mc; ++i)
+                {
+                    double *cRow { cTile + static_cast<long>(i)*ldc };
+                    for (int j=0; j<nc; ++j)
+                    {
+                        cRow[j] = (beta == 0.0) ? 0.0 : beta * cRow[j];
+                    }
+                }
+
+                for (int k0=0; k0<K; k0+=kcMax)
+                {
+                    const int kc { std::min(kcMax, K - k0) };
+                    packA(transA, A, lda, i0, mc, k0, kc, packedA.data());
+                    packB(transB, B, ldb, k0, kc, j0, nc, packedB.data());
+                    if (tiling.rowsPerPass >= 4)
+                    {
+                        multiplyPanelsByFour(mc, nc, kc, alpha, packedA.data(), packedB.data(), cTile, ldc);
+                    }
+                    else
+                    {
+                        multiplyPanels(mc, nc, kc, alpha, packedA.data(), packedB.data(), cTile, ldc);
+                    }
+                }
+
+                if (epilogue)
+                {
+                    epilogue(i0, j0, mc, nc, cTile, ldc);
+                }
+            }
+        };
+
+        if (numThreads == 1)
+        {
+            multiplyTiles(0, numTiles);
+        }
+        else if (tiling.threads > 0)
+        {
+            // Pieces of numTiles/numThreads tiles, so that about numThreads threads take part.
+            parallel::parallelFor(0, numTiles, (numTiles + numThreads - 1) / numThreads, multiplyTiles);
+        }
+        else
+        {
+            parallel::parallelFor(0, numTiles, multiplyTiles);
+        }
+    }
+
+    namespace
+    {
+        bool gemmLayout(const TensorView<const double> &X, bool &trans, int &ld)
+        {
+            /*
+            Works out how a 2-D view maps onto the (trans, ld) convention of the
+            raw gemm. Returns false if neither dimension has unit stride.
+            */
+            if (X.stride(1) == 1 || X.shape(1) == 1)
+            {
+                trans = false;
+                ld = (X.shape(0) == 1) ? X.shape(1) : static_cast<int>(X.stride(0));
+                return true;
+            }
+            if (X.stride(0) == 1 || X.shape(0) == 1)
+            {
+                trans = true;
+                ld = (X.shape(1) == 1) ? X.shape(0) : static_cast<int>(X.stride(1));
+                return true;
+            }
+            return false;
+        }
+    }
+
+    void gemm(const TensorView<const double> &A, const TensorView<const double> &B,
+              const TensorView<double> &C, double alpha, double beta)
+    {
+        if (A.rank() != 2 || B.rank() != 2 || C.rank() != 2
+            || A.shape(1) != B.shape(0) || C.shape(0) != A.shape(0) || C.shape(1) != B.shape(1))
+        {
+            cerr << "gemm needs 2-D views with A (M,K), B (K,N) and C (M,N)!" << endl;
+            assert(false);
+        }
+        if (C.stride(1) != 1 && C.shape(1) != 1)
+        {
+            cerr << "gemm output view must have unit column stride!" << endl;
+            assert(false);
+        }
+
+        bool transA, transB;
+        int lda, ldb;
+        Tensor<double> copyA, copyB;
+        const double *a { A.data() };
+        const double *b { B.data() };
+        if (!gemmLayout(A, transA, lda))
+        {
+            copyA = contiguous(A);
+            a = copyA.data(); transA = false; lda = A.shape(1);
+        }
+        if (!gemmLayout(B, transB, ldb))
+        {
+            copyB = contiguous(B);
+            b = copyB.data(); transB = false; ldb = B.shape(1);
+        }
+        const int ldc { (C.shape(0) == 1) ? C.shape(1) : static_cast<int>(C.stride(0)) };
+
+        gemm(transA, transB, A.shape(0), B.shape(1), A.shape(1), alpha, a, lda, b, ldb, beta, C.data(), ldc);
+    }
+
+    void gemm(const Matrix<double> &A, bool transA,
+              const Matrix<double> &B, bool transB,
+              Matrix<double> &C, double alpha, double beta)
+    {
+        /*
+        Shape-checked wrapper around the raw gemm for whole matrices.
+        */
+
+        const int M  { transA ? A.numCols() : A.numRows() };
+        const int K  { transA ? A.numRows() : A.numCols() };
+        const int KB { transB ? B.numCols() : B.numRows() };
+        const int N  { transB ? B.numRows() : B.numCols() };
+
+        if (K != KB)
+        {
+            cerr << "op(A) is of dimensions (" << M << "," << K << ")," << endl
+            << "...but op(B) is of dimensions (" << KB << "," << N << ")!" << endl;
+            assert(false);
+        }
+
+        if (beta == 0.0)
+        {
+            C.resize(M, N);
+        }
+        else if (C.numRows() != M || C.numCols() != N)
+        {
+            cerr << "Matrix C is of dimensions (" << C.numRows() << "," << C.numCols() << ")," << endl
+            << "...but op(A)op(B) is of dimensions (" << M << "," << N << ")!" << endl;
+            assert(false);
+        }
+
+        gemm(transA, transB, M, N, K, alpha, A.data(), A.numCols(), B.data(), B.numCols(), beta, C.data(), C.numCols());
+    }
+}
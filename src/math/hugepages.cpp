@@ -0,0 +1,176 @@
+#include "math/hugepages.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <sstream>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+namespace hugepages
+{
+    namespace
+    {
+        std::atomic<bool> g_enabled { true };
+
+        const int MADV_COLLAPSE_ADVICE {25}; // Linux 6.1; older <sys/mman.h> don't define it.
+
+        size_t roundUp(size_t bytes)
+        {
+            return (bytes + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+        }
+
+#ifdef __linux__
+        bool adviseInner(void *address, size_t bytes, int advice)
+        {
+            const uintptr_t first { (reinterpret_cast<uintptr_t>(address) + HUGE_PAGE_BYTES - 1) & ~uintptr_t(HUGE_PAGE_BYTES - 1) };
+            const uintptr_t last { (reinterpret_cast<uintptr_t>(address) + bytes) & ~uintptr_t(HUGE_PAGE_BYTES - 1) };
+            return last > first && madvise(reinterpret_cast<void*>(first), last - first, advice) == 0;
+        }
+#endif
+    }
+
+    void setEnabled(bool enabled) { g_enabled = enabled; }
+    bool enabled() { return g_enabled; }
+
+    std::string systemMode()
+    {
+        // The file reads like "always [madvise] never", the current mode in brackets.
+        std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+        std::string text;
+        std::getline(file, text);
+        const size_t open { text.find('[') }, close { text.find(']') };
+        return open != std::string::npos && close > open ? text.substr(open+1, close-open-1) : "unknown";
+    }
+
+    bool advise(void *address, size_t bytes)
+    {
+#ifdef __linux__
+        return g_enabled && adviseInner(address, bytes, MADV_HUGEPAGE);
+#else
+        (void)address; (void)bytes;
+        return false;
+#endif
+    }
+
+    bool collapse(void *address, size_t bytes)
+    {
+#ifdef __linux__
+        if (!g_enabled)
+        {
+            return false;
+        }
+        const bool advised { adviseInner(address, bytes, MADV_HUGEPAGE) };
+        return adviseInner(address, bytes, MADV_COLLAPSE_ADVICE) || advised;
+#else
+        (void)address; (void)bytes;
+        return false;
+#endif
+    }
+
+    bool adviseSmall(void *address, size_t bytes)
+    {
+#ifdef __linux__
+        return adviseInner(address, bytes, MADV_NOHUGEPAGE);
+#else
+        (void)address; (void)bytes;
+        return false;
+#endif
+    }
+
+    size_t hugeBytes(const void *address, size_t bytes)
+    {
+        /*
+        smaps gives the huge page bytes per mapping, not per address, so
+        each overlapping mapping contributes at most its overlap with the
+        range.
+        */
+
+        const uintptr_t begin { reinterpret_cast<uintptr_t>(address) }, end { begin + bytes };
+        std::ifstream smaps("/proc/self/smaps");
+        std::string line;
+        size_t total {0};
+        size_t overlap {0};
+        while (std::getline(smaps, line))
+        {
+            std::istringstream fields(line);
+            std::string key;
+            fields >> key;
+            if (key.find('-') != std::string::npos && key.back() != ':')
+            {
+                // A mapping header: "start-end perms offset dev inode path".
+                const uintptr_t mapBegin { std::strtoull(key.c_str(), nullptr, 16) };
+                const uintptr_t mapEnd { std::strtoull(key.c_str() + key.find('-') + 1, nullptr, 16) };
+                overlap = mapBegin < end && begin < mapEnd ? std::min(end, mapEnd) - std::max(begin, mapBegin) : 0;
+            }
+            else if (overlap > 0 && (key == "AnonHugePages:" || key == "Private_Hugetlb:" || key == "Shared_Hugetlb:"))
+            {
+                size_t kilobytes {0};
+                fields >> kilobytes;
+                total += std::min(overlap, kilobytes * 1024);
+            }
+        }
+        return total;
+    }
+
+    void* allocate(size_t bytes)
+    {
+        const size_t length { roundUp(std::max<size_t>(bytes, 1)) };
+#ifdef __linux__
+        if (g_enabled)
+        {
+            void *buffer { mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0) };
+            if (buffer != MAP_FAILED)
+            {
+                return buffer;
+            }
+        }
+
+        // No hugetlbfs pages reserved: map a huge page more than needed and trim it to 2 MB alignment.
+        void *mapping { mmap(nullptr, length + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) };
+        if (mapping == MAP_FAILED)
+        {
+            throw std::bad_alloc();
+        }
+        const uintptr_t start { reinterpret_cast<uintptr_t>(mapping) };
+        const uintptr_t aligned { (start + HUGE_PAGE_BYTES - 1) & ~uintptr_t(HUGE_PAGE_BYTES - 1) };
+        if (aligned > start)
+        {
+            munmap(mapping, aligned - start);
+        }
+        const uintptr_t tail { aligned + length };
+        if (start + length + HUGE_PAGE_BYTES > tail)
+        {
+            munmap(reinterpret_cast<void*>(tail), start + length + HUGE_PAGE_BYTES - tail);
+        }
+        advise(reinterpret_cast<void*>(aligned), length);
+        return reinterpret_cast<void*>(aligned);
+#else
+        void *buffer { std::calloc(1, length) };
+        if (!buffer)
+        {
+            throw std::bad_alloc();
+        }
+        return buffer;
+#endif
+    }
+
+    void deallocate(void *buffer, size_t bytes)
+    {
+        if (!buffer)
+        {
+            return;
+        }
+#ifdef __linux__
+        munmap(buffer, roundUp(std::max<size_t>(bytes, 1)));
+#else
+        (void)bytes;
+        std::free(buffer);
+#endif
+    }
+}
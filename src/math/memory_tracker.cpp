@@ -0,0 +1,376 @@
+#include "math/memory_tracker.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+
+namespace memtrack
+{
+    namespace
+    {
+        thread_local int t_subsystem { static_cast<int>(Subsystem::OTHER) };
+
+        const char *NAMES[NUM_SUBSYSTEMS] { "other", "dataset", "weights", "activations", "optimizer", "indexes" };
+
+#ifdef SCRATCHNET_MEMTRACK
+        /*
+        Each thread counts into its own cache-line-aligned slot, which only
+        it writes, so allocating threads don't contend. Small blocks
+        accumulate there as pending bytes and are moved to the shared totals
+        (raising the peaks and checking the budgets) once a subsystem's
+        pending bytes reach FLUSH_BYTES; blocks of LARGE_BYTES or more go
+        straight through. Readers add the pending bytes of every slot, so
+        the current bytes are exact whenever no thread is allocating; peaks
+        can miss up to FLUSH_BYTES per thread of short-lived small blocks.
+        */
+        const long long FLUSH_BYTES { 64 * 1024 };
+        const size_t LARGE_BYTES { 4096 };
+
+        struct alignas(64) ThreadCounters
+        {
+            std::atomic<long long> pending[NUM_SUBSYSTEMS];
+            std::atomic<size_t> allocations[NUM_SUBSYSTEMS];
+            std::atomic<bool> inUse;
+            ThreadCounters *next;
+        };
+
+        // Slots are malloc'ed (operator new would recurse), never freed, and reused by later threads.
+        std::atomic<ThreadCounters*> g_slots { nullptr };
+
+        // Indexed by subsystem, plus a last entry for the total; each on its own cache line.
+        struct alignas(64) PaddedBytes
+        {
+            std::atomic<long long> value;
+        };
+        PaddedBytes g_current[NUM_SUBSYSTEMS+1];
+        PaddedBytes g_peak[NUM_SUBSYSTEMS+1];
+        std::atomic<size_t> g_budget[NUM_SUBSYSTEMS];
+        std::atomic<bool> g_budgetWarned[NUM_SUBSYSTEMS];
+
+        thread_local ThreadCounters *t_counters { nullptr };
+        thread_local bool t_exited { false };
+
+        void raisePeak(int index, long long current)
+        {
+            long long peak { g_peak[index].value.load(std::memory_order_relaxed) };
+            while (current > peak && !g_peak[index].value.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        void addShared(int subsystem, long long bytes)
+        {
+            for (int index : { subsystem, NUM_SUBSYSTEMS })
+            {
+                raisePeak(index, g_current[index].value.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+            }
+
+            const size_t budget { g_budget[subsystem].load(std::memory_order_relaxed) };
+            const long long current { g_current[subsystem].value.load(std::memory_order_relaxed) };
+            if (budget > 0 && current > static_cast<long long>(budget) && !g_budgetWarned[subsystem].exchange(true))
+            {
+                // fprintf rather than cerr: it doesn't allocate through operator new.
+                fprintf(stderr, "Memory budget of %s exceeded: %lld bytes in use, budget %zu bytes\n",
+                        NAMES[subsystem], current, budget);
+            }
+        }
+
+        void flush(ThreadCounters &counters, int subsystem)
+        {
+            const long long pending { counters.pending[subsystem].load(std::memory_order_relaxed) };
+            if (pending != 0)
+            {
+                addShared(subsystem, pending);
+                counters.pending[subsystem].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        ThreadCounters* claimSlot()
+        {
+            for (ThreadCounters *slot { g_slots.load() }; slot; slot = slot->next)
+            {
+                bool free { false };
+                if (slot->inUse.compare_exchange_strong(free, true))
+                {
+                    return slot;
+                }
+            }
+            ThreadCounters *slot { static_cast<ThreadCounters*>(std::malloc(sizeof(ThreadCounters))) };
+            if (!slot)
+            {
+                return nullptr;
+            }
+            for (int subsystem=0; subsystem<NUM_SUBSYSTEMS; ++subsystem)
+            {
+                new (&slot->pending[subsystem]) std::atomic<long long>(0);
+                new (&slot->allocations[subsystem]) std::atomic<size_t>(0);
+            }
+            new (&slot->inUse) std::atomic<bool>(true);
+            slot->next = g_slots.load();
+            while (!g_slots.compare_exchange_weak(slot->next, slot))
+            {
+            }
+            return slot;
+        }
+
+        struct SlotRelease // Hands the thread's pending bytes to the shared totals and frees its slot on exit.
+        {
+            ~SlotRelease()
+            {
+                if (t_counters)
+                {
+                    for (int subsystem=0; subsystem<NUM_SUBSYSTEMS; ++subsystem)
+                    {
+                        flush(*t_counters, subsystem);
+                    }
+                    t_counters->inUse = false;
+                }
+                t_counters = nullptr;
+                t_exited = true;
+            }
+        };
+
+        ThreadCounters* threadCounters() // Null once the thread is exiting: later frees go to the shared totals.
+        {
+            if (!t_counters && !t_exited)
+            {
+                thread_local SlotRelease release;
+                t_counters = claimSlot();
+            }
+            return t_counters;
+        }
+
+        void record(int subsystem, long long bytes, bool allocation)
+        {
+            ThreadCounters *counters { threadCounters() };
+            if (!counters)
+            {
+                addShared(subsystem, bytes);
+                return;
+            }
+            if (allocation)
+            {
+                counters->allocations[subsystem].store(counters->allocations[subsystem].load(std::memory_order_relaxed) + 1,
+                                                       std::memory_order_relaxed);
+            }
+            const long long pending { counters->pending[subsystem].load(std::memory_order_relaxed) + bytes };
+            counters->pending[subsystem].store(pending, std::memory_order_relaxed);
+            if (std::abs(bytes) >= static_cast<long long>(LARGE_BYTES) || std::abs(pending) >= FLUSH_BYTES)
+            {
+                flush(*counters, subsystem);
+            }
+        }
+
+        struct alignas(16) BlockHeader // Keeps the blocks 16-byte aligned, like malloc's.
+        {
+            size_t bytes;
+            int subsystem;
+        };
+
+        void* allocate(size_t bytes)
+        {
+            void *block;
+            while (!(block = std::malloc(sizeof(BlockHeader) + bytes)))
+            {
+                // As the standard operator new does: let the handler free some memory, or give up.
+                const std::new_handler handler { std::get_new_handler() };
+                if (!handler)
+                {
+                    throw std::bad_alloc();
+                }
+                handler();
+            }
+            BlockHeader *header { static_cast<BlockHeader*>(block) };
+            header->bytes = bytes;
+            header->subsystem = t_subsystem;
+            record(header->subsystem, static_cast<long long>(bytes), true);
+            return header + 1;
+        }
+
+        void deallocate(void *pointer) noexcept
+        {
+            if (!pointer)
+            {
+                return;
+            }
+            BlockHeader *header { static_cast<BlockHeader*>(pointer) - 1 };
+            record(header->subsystem, -static_cast<long long>(header->bytes), false);
+            std::free(header);
+        }
+
+        long long currentBytes(int subsystem) // Shared plus pending bytes.
+        {
+            long long current { g_current[subsystem].value.load(std::memory_order_relaxed) };
+            for (ThreadCounters *slot { g_slots.load() }; slot; slot = slot->next)
+            {
+                current += slot->pending[subsystem].load(std::memory_order_relaxed);
+            }
+            return current;
+        }
+
+        size_t numAllocations(int subsystem)
+        {
+            size_t allocations {0};
+            for (ThreadCounters *slot { g_slots.load() }; slot; slot = slot->next)
+            {
+                allocations += slot->allocations[subsystem].load(std::memory_order_relaxed);
+            }
+            return allocations;
+        }
+
+        Usage read(int index) // A subsystem, or NUM_SUBSYSTEMS for the total.
+        {
+            long long current {0};
+            size_t allocations {0};
+            for (int subsystem=0; subsystem<NUM_SUBSYSTEMS; ++subsystem)
+            {
+                if (index == subsystem || index == NUM_SUBSYSTEMS)
+                {
+                    current += currentBytes(subsystem);
+                    allocations += numAllocations(subsystem);
+                }
+            }
+            current = std::max(current, 0LL); // Frees can reach the totals before the allocations they match.
+            raisePeak(index, current);
+            return { static_cast<size_t>(current), static_cast<size_t>(g_peak[index].value.load()), allocations };
+        }
+#else
+        std::atomic<size_t> g_budget[NUM_SUBSYSTEMS];
+
+        Usage read(int)
+        {
+            return { 0, 0, 0 };
+        }
+#endif
+    }
+
+    bool enabled()
+    {
+#ifdef SCRATCHNET_MEMTRACK
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    Usage usage(Subsystem subsystem)
+    {
+        return read(static_cast<int>(subsystem));
+    }
+
+    Usage totalUsage()
+    {
+        return read(NUM_SUBSYSTEMS);
+    }
+
+    const char* name(Subsystem subsystem)
+    {
+        return NAMES[static_cast<int>(subsystem)];
+    }
+
+    Subsystem currentSubsystem()
+    {
+        return static_cast<Subsystem>(t_subsystem);
+    }
+
+    void setBudget(Subsystem subsystem, size_t bytes)
+    {
+        g_budget[static_cast<int>(subsystem)] = bytes;
+#ifdef SCRATCHNET_MEMTRACK
+        g_budgetWarned[static_cast<int>(subsystem)] = false;
+#endif
+    }
+
+    void resetPeaks()
+    {
+#ifdef SCRATCHNET_MEMTRACK
+        for (int index=0; index<=NUM_SUBSYSTEMS; ++index)
+        {
+            g_peak[index].value = 0;
+            read(index);
+        }
+#endif
+    }
+
+    void printToConsole()
+    {
+        if (!enabled())
+        {
+            std::cout << "Memory tracking is off (configure with -DSCRATCHNET_MEMTRACK=ON)" << std::endl << std::endl;
+            return;
+        }
+        const std::ios::fmtflags flags { std::cout.flags() };
+        const std::streamsize precision { std::cout.precision() };
+        std::cout << std::fixed << std::setprecision(2)
+                  << "Memory by subsystem (MB)" << std::endl
+                  << "  " << std::left << std::setw(14) << "subsystem" << std::right << std::setw(12) << "current"
+                  << std::setw(12) << "peak" << std::setw(14) << "allocations" << std::endl;
+        for (int index=0; index<=NUM_SUBSYSTEMS; ++index)
+        {
+            const Usage counted { read(index) };
+            std::cout << "  " << std::left << std::setw(14) << (index < NUM_SUBSYSTEMS ? NAMES[index] : "total") << std::right
+                      << std::setw(12) << counted.currentBytes / 1048576.0 << std::setw(12) << counted.peakBytes / 1048576.0
+                      << std::setw(14) << counted.allocations;
+            if (index < NUM_SUBSYSTEMS && g_budget[index].load() > 0)
+            {
+                std::cout << "  (budget " << g_budget[index].load() / 1048576.0 << ")";
+            }
+            std::cout << std::endl;
+        }
+        std::cout << std::endl;
+        std::cout.flags(flags);
+        std::cout.precision(precision);
+    }
+
+    void dumpAtExit()
+    {
+        static std::atomic<bool> registered { false };
+        if (!registered.exchange(true))
+        {
+            std::atexit(printToConsole);
+        }
+    }
+
+    Scope::Scope(Subsystem subsystem)
+        : m_previous(static_cast<Subsystem>(t_subsystem))
+    {
+        t_subsystem = static_cast<int>(subsystem);
+    }
+
+    Scope::~Scope()
+    {
+        t_subsystem = static_cast<int>(m_previous);
+    }
+}
+
+#ifdef SCRATCHNET_MEMTRACK
+
+// Replacements of the global allocation functions (all of them, so that
+// every block is allocated and freed through the tracking pair).
+
+void* operator new(size_t bytes)                                    { return memtrack::allocate(bytes); }
+void* operator new[](size_t bytes)                                  { return memtrack::allocate(bytes); }
+void  operator delete(void *pointer) noexcept                       { memtrack::deallocate(pointer); }
+void  operator delete[](void *pointer) noexcept                     { memtrack::deallocate(pointer); }
+void  operator delete(void *pointer, size_t) noexcept               { memtrack::deallocate(pointer); }
+void  operator delete[](void *pointer, size_t) noexcept             { memtrack::deallocate(pointer); }
+
+void* operator new(size_t bytes, const std::nothrow_t&) noexcept
+{
+    try { return memtrack::allocate(bytes); } catch (...) { return nullptr; }
+}
+
+void* operator new[](size_t bytes, const std::nothrow_t&) noexcept
+{
+    try { return memtrack::allocate(bytes); } catch (...) { return nullptr; }
+}
+
+void operator delete(void *pointer, const std::nothrow_t&) noexcept   { memtrack::deallocate(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t&) noexcept { memtrack::deallocate(pointer); }
+
+#endif
@@ -0,0 +1,247 @@
+#include "math/numa.hpp"
+#include "math/memory_tracker.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace numa
+{
+    namespace
+    {
+        // From <linux/mempolicy.h>, which is left out so that nothing depends on kernel headers.
+        const int  MPOL_PREFERRED_MODE  {1};
+        const int  MPOL_BIND_MODE       {2};
+        const int  MPOL_INTERLEAVE_MODE {3};
+        const int  MPOL_F_NODE_FLAG     {1 << 0};
+        const int  MPOL_F_ADDR_FLAG     {1 << 1};
+        const unsigned MPOL_MF_MOVE_FLAG {1 << 1};
+
+        const int MAX_NODES {1024};
+        const int MASK_WORDS { MAX_NODES / (8 * sizeof(unsigned long)) };
+
+        std::vector<int> parseList(const std::string &text)
+        {
+            // The sysfs list format: "0-3,8,10-11".
+            std::vector<int> values;
+            std::stringstream stream(text);
+            std::string range;
+            while (std::getline(stream, range, ','))
+            {
+                const size_t dash { range.find('-') };
+                try
+                {
+                    const int first { std::stoi(range.substr(0, dash)) };
+                    const int last { dash == std::string::npos ? first : std::stoi(range.substr(dash+1)) };
+                    for (int value=first; value<=last; ++value)
+                    {
+                        values.push_back(value);
+                    }
+                }
+                catch (const std::exception&)
+                {
+                    // Blank or malformed entry (such as the trailing newline).
+                }
+            }
+            return values;
+        }
+
+        std::vector<int> readList(const std::string &path)
+        {
+            std::ifstream file(path);
+            std::string text;
+            std::getline(file, text);
+            return parseList(text);
+        }
+
+        std::vector<int> cpusAllowed()
+        {
+            std::vector<int> cpus;
+#ifdef __linux__
+            cpu_set_t allowed;
+            if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+            {
+                for (int cpu=0; cpu<CPU_SETSIZE; ++cpu)
+                {
+                    if (CPU_ISSET(cpu, &allowed))
+                    {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+#endif
+            return cpus;
+        }
+
+#ifdef __linux__
+        bool setPolicy(void *address, size_t bytes, int mode, const std::vector<int> &policyNodes)
+        {
+            // Only whole pages can carry a policy.
+            const uintptr_t pageSize { static_cast<uintptr_t>(sysconf(_SC_PAGESIZE)) };
+            const uintptr_t first { (reinterpret_cast<uintptr_t>(address) + pageSize - 1) & ~(pageSize - 1) };
+            const uintptr_t last { (reinterpret_cast<uintptr_t>(address) + bytes) & ~(pageSize - 1) };
+            if (last <= first)
+            {
+                return false;
+            }
+
+            unsigned long mask[MASK_WORDS] {};
+            for (int node : policyNodes)
+            {
+                if (node >= 0 && node < MAX_NODES)
+                {
+                    mask[node / (8 * sizeof(unsigned long))] |= 1ul << (node % (8 * sizeof(unsigned long)));
+                }
+            }
+            // The kernel reads maxnode-1 bits of the mask.
+            return syscall(SYS_mbind, first, last - first, mode, mask, MAX_NODES + 1, MPOL_MF_MOVE_FLAG) == 0;
+        }
+#endif
+    }
+
+    const std::vector<int>& nodes()
+    {
+        static const std::vector<int> memoryNodes { []()
+        {
+            std::vector<int> found { readList("/sys/devices/system/node/has_memory") };
+            if (found.empty())
+            {
+                found = readList("/sys/devices/system/node/online");
+            }
+            return found.empty() ? std::vector<int> {0} : found;
+        }() };
+        return memoryNodes;
+    }
+
+    int numNodes() { return static_cast<int>(nodes().size()); }
+
+    std::vector<int> cpusOfNode(int node)
+    {
+        return readList("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    }
+
+    int nodeOfCpu(int cpu)
+    {
+        static const std::vector<int> nodeByCpu { []()
+        {
+            std::vector<int> table;
+            for (int node : readList("/sys/devices/system/node/online"))
+            {
+                for (int cpu : cpusOfNode(node))
+                {
+                    table.resize(std::max<size_t>(table.size(), cpu + 1), -1);
+                    table[cpu] = node;
+                }
+            }
+            return table;
+        }() };
+        return cpu >= 0 && cpu < static_cast<int>(nodeByCpu.size()) ? nodeByCpu[cpu] : -1;
+    }
+
+    int currentNode()
+    {
+#ifdef __linux__
+        unsigned cpu {0}, node {0};
+        if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0)
+        {
+            return static_cast<int>(node);
+        }
+#endif
+        return 0;
+    }
+
+    int nodeOfAddress(const void *address)
+    {
+#ifdef __linux__
+        int node {-1};
+        if (syscall(SYS_get_mempolicy, &node, nullptr, 0, address, MPOL_F_NODE_FLAG | MPOL_F_ADDR_FLAG) == 0)
+        {
+            return node;
+        }
+#else
+        (void)address;
+#endif
+        return -1;
+    }
+
+    bool interleave(void *address, size_t bytes)
+    {
+#ifdef __linux__
+        return setPolicy(address, bytes, MPOL_INTERLEAVE_MODE, nodes());
+#else
+        (void)address; (void)bytes;
+        return false;
+#endif
+    }
+
+    bool bindToNode(void *address, size_t bytes, int node)
+    {
+#ifdef __linux__
+        return setPolicy(address, bytes, MPOL_BIND_MODE, {node});
+#else
+        (void)address; (void)bytes; (void)node;
+        return false;
+#endif
+    }
+
+    void placeSharedBuffer(void *address, size_t bytes)
+    {
+        if (bytes >= MIN_PLACEMENT_BYTES && numNodes() > 1)
+        {
+            interleave(address, bytes);
+        }
+    }
+
+    void runOnNode(int node, const std::function<void()> &work)
+    {
+        /*
+        The thread is confined to the node's CPUs and, in case the node has
+        none (memory-only nodes) or they are outside our affinity mask, also
+        prefers the node for its allocations. It is a thread of its own
+        rather than a scheduler worker, which must keep its affinity and
+        policy (see parallel.hpp).
+        */
+
+        const memtrack::Subsystem subsystem { memtrack::currentSubsystem() };
+        std::thread worker([&]()
+        {
+#ifdef __linux__
+            cpu_set_t confined;
+            CPU_ZERO(&confined);
+            int numCpus {0};
+            const std::vector<int> allowed { cpusAllowed() };
+            for (int cpu : cpusOfNode(node))
+            {
+                if (cpu < CPU_SETSIZE && std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                {
+                    CPU_SET(cpu, &confined);
+                    ++numCpus;
+                }
+            }
+            if (numCpus > 0)
+            {
+                pthread_setaffinity_np(pthread_self(), sizeof(confined), &confined);
+            }
+            if (node >= 0 && node < MAX_NODES)
+            {
+                unsigned long mask[MASK_WORDS] {};
+                mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+                syscall(SYS_set_mempolicy, MPOL_PREFERRED_MODE, mask, MAX_NODES + 1);
+            }
+#endif
+            memtrack::Scope scope(subsystem);
+            work();
+        });
+        worker.join();
+    }
+}
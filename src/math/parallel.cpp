@@ -0,0 +1,596 @@
+#include "math/parallel.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/numa.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace parallel
+{
+    namespace
+    {
+        int defaultThreadCount()
+        {
+            const unsigned hardwareThreads { std::thread::hardware_concurrency() };
+            return hardwareThreads > 0 ? static_cast<int>(hardwareThreads) : 1;
+        }
+
+        struct Task
+        {
+            std::function<void()> work;
+            std::atomic<int> *pending;       // The TaskGroup's count of unfinished tasks.
+            memtrack::Subsystem subsystem;   // Allocations are counted as the spawning thread's were.
+        };
+
+        class WorkDeque
+        {
+            /*
+            Chase-Lev work-stealing deque (in the C11 formulation of Le et
+            al., "Correct and efficient work-stealing for weak memory
+            models"). The owning worker pushes and pops at the bottom without
+            locking; thieves take from the top with a compare-and-swap, which
+            only contends when one task is left. Buffers outgrown by push
+            are retired rather than freed, since a thief may still be
+            reading from them.
+            */
+
+            public:
+                WorkDeque()
+                    : m_top(0), m_bottom(0)
+                {
+                    m_buffers.emplace_back(new Buffer(256));
+                    m_buffer = m_buffers.back().get();
+                }
+
+                void push(Task *task)
+                {
+                    const long bottom { m_bottom.load(std::memory_order_relaxed) };
+                    const long top { m_top.load(std::memory_order_acquire) };
+                    Buffer *buffer { m_buffer.load(std::memory_order_relaxed) };
+                    if (bottom - top > buffer->capacity - 1)
+                    {
+                        buffer = grow(buffer, top, bottom);
+                    }
+                    buffer->put(bottom, task);
+                    std::atomic_thread_fence(std::memory_order_release);
+                    m_bottom.store(bottom + 1, std::memory_order_relaxed);
+                }
+
+                Task* pop()
+                {
+                    const long bottom { m_bottom.load(std::memory_order_relaxed) - 1 };
+                    Buffer *buffer { m_buffer.load(std::memory_order_relaxed) };
+                    m_bottom.store(bottom, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    long top { m_top.load(std::memory_order_relaxed) };
+
+                    Task *task { nullptr };
+                    if (top <= bottom)
+                    {
+                        task = buffer->get(bottom);
+                        if (top == bottom)
+                        {
+                            // The last task: race the thieves for it.
+                            if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                            {
+                                task = nullptr;
+                            }
+                            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+                        }
+                    }
+                    else
+                    {
+                        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+                    }
+                    return task;
+                }
+
+                Task* steal()
+                {
+                    long top { m_top.load(std::memory_order_acquire) };
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    const long bottom { m_bottom.load(std::memory_order_acquire) };
+                    if (top >= bottom)
+                    {
+                        return nullptr;
+                    }
+                    Task *task { m_buffer.load(std::memory_order_acquire)->get(top) };
+                    if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    {
+                        return nullptr; // Lost the race to another thief or the owner.
+                    }
+                    return task;
+                }
+
+            private:
+                struct Buffer
+                {
+                    explicit Buffer(long size) : capacity(size), slots(new std::atomic<Task*>[size]) {}
+
+                    Task* get(long index) const       { return slots[index & (capacity-1)].load(std::memory_order_relaxed); }
+                    void  put(long index, Task *task) { slots[index & (capacity-1)].store(task, std::memory_order_relaxed); }
+
+                    const long capacity; // A power of two.
+                    std::unique_ptr<std::atomic<Task*>[]> slots;
+                };
+
+                Buffer* grow(Buffer *buffer, long top, long bottom)
+                {
+                    m_buffers.emplace_back(new Buffer(2 * buffer->capacity));
+                    Buffer *larger { m_buffers.back().get() };
+                    for (long index=top; index<bottom; ++index)
+                    {
+                        larger->put(index, buffer->get(index));
+                    }
+                    m_buffer.store(larger, std::memory_order_release);
+                    return larger;
+                }
+
+                std::atomic<long> m_top;
+                std::atomic<long> m_bottom;
+                std::atomic<Buffer*> m_buffer;
+                std::vector<std::unique_ptr<Buffer>> m_buffers; // Current and retired buffers, touched by the owner only.
+        };
+
+        class Scheduler;
+        thread_local Scheduler *t_scheduler { nullptr }; // Set on the workers, to find their own deque.
+        thread_local int t_workerIndex { -1 };
+        thread_local bool t_serial { false };
+
+        class Scheduler
+        {
+            /*
+            numWorkers threads, one deque each, plus a locked queue for tasks
+            submitted by threads outside the pool. Idle workers spin briefly,
+            then sleep until a submission changes m_epoch.
+            */
+
+            public:
+                Scheduler(int numWorkers, bool pinCores, bool pinNodes, void (*startHook)())
+                    : m_startHook(startHook), m_epoch(0), m_sleepers(0), m_numInjected(0), m_stop(false)
+                {
+                    std::vector<int> cpus;
+#ifdef __linux__
+                    cpu_set_t allowed;
+                    if ((pinCores || pinNodes) && sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+                    {
+                        for (int cpu=0; cpu<CPU_SETSIZE; ++cpu)
+                        {
+                            if (CPU_ISSET(cpu, &allowed))
+                            {
+                                cpus.push_back(cpu);
+                            }
+                        }
+                    }
+#endif
+                    for (int worker=0; worker<numWorkers; ++worker)
+                    {
+                        m_deques.emplace_back(new WorkDeque());
+                    }
+                    for (int worker=0; worker<numWorkers; ++worker)
+                    {
+                        // The caller keeps the first CPU (or node); workers take the next ones round robin.
+                        std::vector<int> workerCpus;
+                        if (pinCores && !cpus.empty())
+                        {
+                            workerCpus.push_back(cpus[(worker+1) % cpus.size()]);
+                        }
+                        else if (pinNodes && !cpus.empty())
+                        {
+                            const int node { numa::nodes()[(worker+1) % numa::numNodes()] };
+                            for (int cpu : numa::cpusOfNode(node))
+                            {
+                                if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end())
+                                {
+                                    workerCpus.push_back(cpu);
+                                }
+                            }
+                        }
+                        m_threads.emplace_back(&Scheduler::workerLoop, this, worker, workerCpus);
+                    }
+                }
+
+                ~Scheduler()
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_stop = true;
+                    }
+                    m_wakeUp.notify_all();
+                    for (std::thread &thread : m_threads)
+                    {
+                        thread.join();
+                    }
+                }
+
+                void submit(Task *task)
+                {
+                    if (t_scheduler == this)
+                    {
+                        m_deques[t_workerIndex]->push(task);
+                    }
+                    else
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        m_injected.push_back(task);
+                        ++m_numInjected;
+                    }
+                    ++m_epoch;
+                    if (m_sleepers > 0)
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex); // So a worker can't miss the wake-up between its check and its wait.
+                        m_wakeUp.notify_one();
+                    }
+                }
+
+                bool runOne()
+                {
+                    Task *task { findTask() };
+                    if (task)
+                    {
+                        execute(task);
+                    }
+                    return task != nullptr;
+                }
+
+            private:
+                void (*m_startHook)();
+                std::vector<std::unique_ptr<WorkDeque>> m_deques;
+                std::vector<std::thread> m_threads;
+
+                std::mutex m_mutex;                  // Guards m_injected and the sleeping.
+                std::condition_variable m_wakeUp;
+                std::deque<Task*> m_injected;        // Tasks from threads outside the pool, oldest first.
+                std::atomic<unsigned> m_epoch;       // Bumped on every submission.
+                std::atomic<int> m_sleepers;
+                std::atomic<int> m_numInjected;
+                std::atomic<bool> m_stop;
+
+                static void execute(Task *task)
+                {
+                    {
+                        memtrack::Scope scope(task->subsystem);
+                        task->work();
+                    }
+                    std::atomic<int> *pending { task->pending };
+                    delete task;
+                    pending->fetch_sub(1, std::memory_order_release); // The group may be gone after this.
+                }
+
+                Task* findTask()
+                {
+                    // Own deque first (newest, cache-warm work), then outside submissions, then steal the oldest.
+                    const int self { t_scheduler == this ? t_workerIndex : -1 };
+                    if (self >= 0)
+                    {
+                        if (Task *task = m_deques[self]->pop())
+                        {
+                            return task;
+                        }
+                    }
+                    if (m_numInjected > 0)
+                    {
+                        std::lock_guard<std::mutex> lock(m_mutex);
+                        if (!m_injected.empty())
+                        {
+                            Task *task { m_injected.front() };
+                            m_injected.pop_front();
+                            --m_numInjected;
+                            return task;
+                        }
+                    }
+                    thread_local unsigned seed { static_cast<unsigned>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1u };
+                    seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5;
+                    const int numDeques { static_cast<int>(m_deques.size()) };
+                    for (int attempt=0; attempt<numDeques; ++attempt)
+                    {
+                        const int victim { static_cast<int>((seed + attempt) % numDeques) };
+                        if (victim != self)
+                        {
+                            if (Task *task = m_deques[victim]->steal())
+                            {
+                                return task;
+                            }
+                        }
+                    }
+                    return nullptr;
+                }
+
+                void workerLoop(int index, std::vector<int> cpus)
+                {
+#ifdef __linux__
+                    if (!cpus.empty())
+                    {
+                        cpu_set_t confined;
+                        CPU_ZERO(&confined);
+                        for (int cpu : cpus)
+                        {
+                            CPU_SET(cpu, &confined);
+                        }
+                        pthread_setaffinity_np(pthread_self(), sizeof(confined), &confined);
+                    }
+#else
+                    (void)cpus;
+#endif
+                    t_scheduler = this;
+                    t_workerIndex = index;
+                    if (m_startHook)
+                    {
+                        m_startHook();
+                    }
+                    int idleRounds {0};
+                    while (!m_stop)
+                    {
+                        if (runOne())
+                        {
+                            idleRounds = 0;
+                            continue;
+                        }
+                        if (++idleRounds < 64)
+                        {
+                            std::this_thread::yield();
+                            continue;
+                        }
+
+                        // Register as a sleeper before the last look, so a submission either
+                        // is found here or sees the sleeper and wakes it.
+                        const unsigned epoch { m_epoch.load() };
+                        ++m_sleepers;
+                        if (!runOne())
+                        {
+                            std::unique_lock<std::mutex> lock(m_mutex);
+                            m_wakeUp.wait(lock, [&]() { return m_stop || m_epoch.load() != epoch; });
+                        }
+                        --m_sleepers;
+                        idleRounds = 0;
+                    }
+                }
+        };
+
+        std::atomic<int> g_numThreads { defaultThreadCount() };
+        std::atomic<bool> g_deterministic { false };
+        std::atomic<bool> g_pin { false };
+        std::atomic<bool> g_pinNodes { false };
+        std::atomic<void (*)()> g_startHook { nullptr };
+
+        // Started on first use. Never destroyed at exit, since its workers may still be running
+        // (and their thread-local state reaching into other translation units) when statics go.
+        std::mutex g_schedulerMutex;                 // Guards starting and stopping the scheduler.
+        std::atomic<Scheduler*> g_scheduler { nullptr };
+
+        Scheduler& scheduler()
+        {
+            Scheduler *active { g_scheduler.load(std::memory_order_acquire) };
+            if (!active)
+            {
+                std::lock_guard<std::mutex> lock(g_schedulerMutex);
+                active = g_scheduler.load();
+                if (!active)
+                {
+                    active = new Scheduler(g_numThreads - 1, g_pin, g_pinNodes, g_startHook);
+                    g_scheduler.store(active, std::memory_order_release);
+                }
+            }
+            return *active;
+        }
+
+        bool runsSerially()
+        {
+            return t_serial || g_numThreads == 1;
+        }
+
+        void runRange(int begin, int end, int grainSize, const std::function<void(int, int)> &body, TaskGroup &group)
+        {
+            // Hand the upper halves to other threads, keep halving the lower one, then run it.
+            while (end - begin > grainSize)
+            {
+                const int middle { begin + (end - begin) / 2 };
+                group.run([middle, end, grainSize, &body, &group]() { runRange(middle, end, grainSize, body, group); });
+                end = middle;
+            }
+            body(begin, end);
+        }
+    }
+
+    int numThreads() { return g_numThreads; }
+
+    void setNumThreads(int numThreads)
+    {
+        numThreads = std::max(1, numThreads);
+        if (numThreads != g_numThreads)
+        {
+            stopWorkers();
+            g_numThreads = numThreads;
+        }
+    }
+
+    void setCorePinning(bool pin)
+    {
+        if (pin != g_pin)
+        {
+            stopWorkers();
+            g_pin = pin;
+        }
+    }
+
+    bool corePinning() { return g_pin; }
+
+    void setNodePinning(bool pin)
+    {
+        if (pin != g_pinNodes)
+        {
+            stopWorkers();
+            g_pinNodes = pin;
+        }
+    }
+
+    bool nodePinning() { return g_pinNodes; }
+
+    void setWorkerStartHook(void (*hook)())
+    {
+        if (hook != g_startHook)
+        {
+            stopWorkers();
+            g_startHook = hook;
+        }
+    }
+
+    void stopWorkers()
+    {
+        std::lock_guard<std::mutex> lock(g_schedulerMutex);
+        delete g_scheduler.exchange(nullptr);
+    }
+
+    void parallelFor(int begin, int end, const std::function<void(int, int)> &body)
+    {
+        const int count { end - begin };
+        const int numPieces { 4 * g_numThreads };
+        parallelFor(begin, end, std::max(1, (count + numPieces - 1) / numPieces), body);
+    }
+
+    void parallelFor(int begin, int end, int grainSize, const std::function<void(int, int)> &body)
+    {
+        if (end <= begin)
+        {
+            return;
+        }
+        grainSize = std::max(1, grainSize);
+        if (end - begin <= grainSize || runsSerially())
+        {
+            body(begin, end);
+            return;
+        }
+
+        TaskGroup group;
+        runRange(begin, end, grainSize, body, group);
+        group.wait();
+    }
+
+    void setDeterministicReductions(bool deterministic) { g_deterministic = deterministic; }
+    bool deterministicReductions() { return g_deterministic; }
+
+    void parallelReduce(int begin, int end, int grainSize, int width,
+                        const std::function<void(int, int, double*)> &accumulate, double *result)
+    {
+        std::fill(result, result + width, 0.0);
+        if (end <= begin || width <= 0)
+        {
+            return;
+        }
+        grainSize = std::max(1, grainSize);
+        const int numBlocks { (end - begin + grainSize - 1) / grainSize };
+
+        if (!g_deterministic)
+        {
+            std::mutex mergeMutex;
+            parallelFor(begin, end, grainSize, [&](int pieceBegin, int pieceEnd)
+            {
+                std::vector<double> partial(width, 0.0);
+                accumulate(pieceBegin, pieceEnd, partial.data());
+                std::lock_guard<std::mutex> lock(mergeMutex);
+                for (int i=0; i<width; ++i)
+                {
+                    result[i] += partial[i];
+                }
+            });
+            return;
+        }
+
+        if (numBlocks == 1)
+        {
+            accumulate(begin, end, result);
+            return;
+        }
+        std::vector<double> partials(static_cast<size_t>(numBlocks) * width, 0.0);
+        parallelFor(0, numBlocks, 1, [&](int blockBegin, int blockEnd)
+        {
+            for (int b=blockBegin; b<blockEnd; ++b)
+            {
+                accumulate(begin + b*grainSize, std::min(end, begin + (b+1)*grainSize), partials.data() + static_cast<size_t>(b)*width);
+            }
+        });
+
+        // Block b absorbs block b+stride at every level where b is a multiple of 2*stride.
+        const int pairGrain { std::max(1, 16384 / width) };
+        for (int stride=1; stride<numBlocks; stride*=2)
+        {
+            const int numPairs { (numBlocks - stride + 2*stride - 1) / (2*stride) };
+            parallelFor(0, numPairs, pairGrain, [&](int pairBegin, int pairEnd)
+            {
+                for (int pair=pairBegin; pair<pairEnd; ++pair)
+                {
+                    double *target { partials.data() + static_cast<size_t>(2*stride*pair)*width };
+                    const double *source { target + static_cast<size_t>(stride)*width };
+                    for (int i=0; i<width; ++i)
+                    {
+                        target[i] += source[i];
+                    }
+                }
+            });
+        }
+        std::copy(partials.begin(), partials.begin() + width, result);
+    }
+
+    TaskGroup::TaskGroup()
+        : m_pending(0)
+    {
+    }
+
+    TaskGroup::~TaskGroup()
+    {
+        wait();
+    }
+
+    void TaskGroup::run(std::function<void()> task)
+    {
+        if (runsSerially())
+        {
+            task();
+            return;
+        }
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        scheduler().submit(new Task { std::move(task), &m_pending, memtrack::currentSubsystem() });
+    }
+
+    void TaskGroup::wait()
+    {
+        /*
+        Runs queued tasks (this group's or anyone's) until the group's are
+        done, so waiting never idles a thread the work may need.
+        */
+
+        if (m_pending.load(std::memory_order_acquire) == 0)
+        {
+            return;
+        }
+        Scheduler &active { scheduler() };
+        while (m_pending.load(std::memory_order_acquire) > 0)
+        {
+            if (!active.runOne())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    SerialScope::SerialScope()
+    {
+        m_wasSerial = t_serial;
+        t_serial = true;
+    }
+
+    SerialScope::~SerialScope()
+    {
+        t_serial = m_wasSerial;
+    }
+}
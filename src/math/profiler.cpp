@@ -0,0 +1,313 @@
+#include "math/profiler.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace profiler
+{
+    namespace
+    {
+        const char *COUNTER_NAMES[NUM_COUNTERS] { "cycles", "instructions", "L1D misses", "LLC misses",
+                                                  "branch misses", "dTLB misses", "task clock" };
+
+        std::atomic<bool> g_enabled { false };
+
+        class CounterSet;
+
+        std::mutex g_mutex;                   // Guards everything below.
+        std::vector<RegionStats> g_regions;
+        std::vector<const CounterSet*> g_counterSets;  // One per thread with open counters.
+        double g_exitedCounts[NUM_COUNTERS] {};        // Final counts of the threads that have exited.
+        bool g_probed { false };              // Counter availability is decided by the first thread to open them.
+        bool g_available[NUM_COUNTERS] {};
+        std::string g_errors[NUM_COUNTERS];
+
+        class CounterSet
+        {
+            /*
+            One perf event per counter for the owning thread. Inherited
+            events would only add a child thread's counts once it exits,
+            which the scheduler's workers don't, so every thread has its own
+            set, registered in g_counterSets. The events aren't grouped, so
+            the values are scaled by enabled/running time in case there are
+            more events than hardware counters.
+            */
+
+            public:
+                CounterSet()
+                {
+                    std::fill(m_fds, m_fds + NUM_COUNTERS, -1);
+                    std::lock_guard<std::mutex> lock(g_mutex);
+                    for (int c=0; c<NUM_COUNTERS; ++c)
+                    {
+                        m_fds[c] = open(static_cast<Counter>(c));
+                        if (!g_probed)
+                        {
+                            g_available[c] = m_fds[c] >= 0;
+                            g_errors[c] = m_fds[c] >= 0 ? "" : std::strerror(errno);
+                        }
+                        else if (m_fds[c] >= 0 && !g_available[c])
+                        {
+                            closeCounter(c);
+                        }
+                    }
+                    g_probed = true;
+                    g_counterSets.push_back(this);
+                }
+
+                ~CounterSet()
+                {
+                    double counts[NUM_COUNTERS];
+                    read(counts);
+                    std::lock_guard<std::mutex> lock(g_mutex);
+                    for (int c=0; c<NUM_COUNTERS; ++c)
+                    {
+                        g_exitedCounts[c] += counts[c];
+                        closeCounter(c);
+                    }
+                    g_counterSets.erase(std::find(g_counterSets.begin(), g_counterSets.end(), this));
+                }
+
+                void read(double counts[NUM_COUNTERS]) const
+                {
+                    for (int c=0; c<NUM_COUNTERS; ++c)
+                    {
+                        counts[c] = 0.0;
+#ifdef __linux__
+                        uint64_t values[3]; // value, time enabled, time running
+                        if (m_fds[c] >= 0 && ::read(m_fds[c], values, sizeof(values)) == sizeof(values) && values[2] > 0)
+                        {
+                            counts[c] = double(values[0]) * (double(values[1]) / double(values[2]));
+                        }
+#endif
+                    }
+                }
+
+            private:
+                int m_fds[NUM_COUNTERS];
+
+                static int open(Counter counter)
+                {
+#ifdef __linux__
+                    perf_event_attr attributes;
+                    std::memset(&attributes, 0, sizeof(attributes));
+                    attributes.size = sizeof(attributes);
+                    attributes.type = PERF_TYPE_HARDWARE;
+                    switch (counter)
+                    {
+                        case CYCLES:        attributes.config = PERF_COUNT_HW_CPU_CYCLES; break;
+                        case INSTRUCTIONS:  attributes.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+                        case LLC_MISSES:    attributes.config = PERF_COUNT_HW_CACHE_MISSES; break;
+                        case BRANCH_MISSES: attributes.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+                        case L1D_MISSES:
+                            attributes.type = PERF_TYPE_HW_CACHE;
+                            attributes.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                            break;
+                        case DTLB_MISSES:
+                            attributes.type = PERF_TYPE_HW_CACHE;
+                            attributes.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                            break;
+                        default:
+                            attributes.type = PERF_TYPE_SOFTWARE;
+                            attributes.config = PERF_COUNT_SW_TASK_CLOCK;
+                    }
+                    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                    attributes.exclude_kernel = 1; // Allowed at perf_event_paranoid 2, the usual default.
+                    attributes.exclude_hv = 1;
+                    return static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+#else
+                    (void)counter;
+                    errno = ENOSYS;
+                    return -1;
+#endif
+                }
+
+                void closeCounter(int c)
+                {
+#ifdef __linux__
+                    if (m_fds[c] >= 0)
+                    {
+                        close(m_fds[c]);
+                    }
+#endif
+                    m_fds[c] = -1;
+                }
+        };
+
+        void openThreadCounters()
+        {
+            thread_local CounterSet counters;
+        }
+
+        void readAllCounters(double counts[NUM_COUNTERS])
+        {
+            std::lock_guard<std::mutex> lock(g_mutex);
+            std::copy(g_exitedCounts, g_exitedCounts + NUM_COUNTERS, counts);
+            for (const CounterSet *counterSet : g_counterSets)
+            {
+                double threadCounts[NUM_COUNTERS];
+                counterSet->read(threadCounts);
+                for (int c=0; c<NUM_COUNTERS; ++c)
+                {
+                    counts[c] += threadCounts[c];
+                }
+            }
+        }
+    }
+
+    void setEnabled(bool enabled)
+    {
+        if (enabled)
+        {
+            openThreadCounters();
+            parallel::setWorkerStartHook(openThreadCounters);
+        }
+        g_enabled = enabled;
+    }
+
+    bool enabled()
+    {
+        return g_enabled;
+    }
+
+    bool counterAvailable(Counter counter)
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        return g_available[counter];
+    }
+
+    std::string counterStatus()
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        if (!g_probed)
+        {
+            return "counters not opened yet";
+        }
+        std::ostringstream status;
+        for (int c=0; c<NUM_COUNTERS; ++c)
+        {
+            const bool reported { std::find(g_errors, g_errors + c, g_errors[c]) != g_errors + c };
+            if (g_available[c] || reported)
+            {
+                continue;
+            }
+            status << (status.tellp() > 0 ? "; " : "") << COUNTER_NAMES[c];
+            for (int other=c+1; other<NUM_COUNTERS; ++other)
+            {
+                if (!g_available[other] && g_errors[other] == g_errors[c])
+                {
+                    status << ", " << COUNTER_NAMES[other];
+                }
+            }
+            status << " unavailable: " << g_errors[c];
+        }
+        return status.tellp() > 0 ? status.str() : "all counters available";
+    }
+
+    std::vector<RegionStats> regions()
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        return g_regions;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        g_regions.clear();
+    }
+
+    void printToConsole()
+    {
+        const std::vector<RegionStats> stats { regions() };
+        bool available[NUM_COUNTERS];
+        for (int c=0; c<NUM_COUNTERS; ++c)
+        {
+            available[c] = counterAvailable(static_cast<Counter>(c));
+        }
+        auto column = [](bool isAvailable, double value, int width)
+        {
+            std::ostringstream text;
+            text << std::setw(width);
+            if (isAvailable) text << std::setprecision(3) << value; else text << "n/a";
+            return text.str();
+        };
+
+        const std::ios::fmtflags flags { std::cout.flags() };
+        const std::streamsize precision { std::cout.precision() };
+        std::cout.unsetf(std::ios::floatfield);
+        std::cout << "Profiled regions (" << counterStatus() << ")" << std::endl
+                  << "  " << std::left << std::setw(38) << "region" << std::right << std::setw(8) << "calls"
+                  << std::setw(10) << "samples" << std::setw(12) << "ms" << std::setw(12) << "us/sample"
+                  << std::setw(7) << "cores" << std::setw(7) << "IPC" << std::setw(14) << "L1D miss/smp"
+                  << std::setw(14) << "LLC miss/smp" << std::setw(14) << "br miss/smp" << std::setw(14) << "dTLB miss/smp" << std::endl;
+        for (const RegionStats &region : stats)
+        {
+            std::cout << "  " << std::left << std::setw(38) << region.name << std::right << std::setw(8) << region.calls
+                      << std::setw(10) << region.samples << std::setw(12) << std::setprecision(4) << region.seconds*1e3
+                      << std::setw(12) << (region.samples ? region.seconds*1e6 / region.samples : 0.0)
+                      << column(available[TASK_CLOCK], region.seconds > 0 ? region.counts[TASK_CLOCK]*1e-9 / region.seconds : 0.0, 7)
+                      << column(available[CYCLES] && available[INSTRUCTIONS], region.ipc(), 7)
+                      << column(available[L1D_MISSES], region.perSample(L1D_MISSES), 14)
+                      << column(available[LLC_MISSES], region.perSample(LLC_MISSES), 14)
+                      << column(available[BRANCH_MISSES], region.perSample(BRANCH_MISSES), 14)
+                      << column(available[DTLB_MISSES], region.perSample(DTLB_MISSES), 14)
+                      << std::endl;
+        }
+        std::cout << std::endl;
+        std::cout.flags(flags);
+        std::cout.precision(precision);
+    }
+
+    Region::Region(const char *name, long samples)
+        : m_name(name), m_samples(samples), m_active(g_enabled)
+    {
+        if (m_active)
+        {
+            openThreadCounters();
+            readAllCounters(m_startCounts);
+            m_start = std::chrono::steady_clock::now();
+        }
+    }
+
+    Region::~Region()
+    {
+        if (!m_active)
+        {
+            return;
+        }
+        const double seconds { std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count() };
+        double counts[NUM_COUNTERS];
+        readAllCounters(counts);
+
+        std::lock_guard<std::mutex> lock(g_mutex);
+        auto region = std::find_if(g_regions.begin(), g_regions.end(),
+                                   [&](const RegionStats &stats) { return stats.name == m_name; });
+        if (region == g_regions.end())
+        {
+            g_regions.push_back(RegionStats { m_name, 0, 0, 0.0, {} });
+            region = g_regions.end() - 1;
+        }
+        region->calls += 1;
+        region->samples += m_samples;
+        region->seconds += seconds;
+        for (int c=0; c<NUM_COUNTERS; ++c)
+        {
+            region->counts[c] += counts[c] - m_startCounts[c];
+        }
+    }
+}
@@ -0,0 +1,87 @@
+#include "math/qgemm.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace linalg
+{
+    namespace
+    {
+        const int QGEMM_NC {64}; // Weight rows per block, reused by every row of A while hot in cache.
+    }
+
+    int32_t dotInt8(const int8_t *a, const int8_t *w, int K)
+    {
+        int k {0};
+        int32_t sum {0};
+
+#ifdef __AVX2__
+        __m256i accumulator { _mm256_setzero_si256() };
+        for (; k+16<=K; k+=16)
+        {
+            const __m256i a16 { _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a+k))) };
+            const __m256i w16 { _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w+k))) };
+            accumulator = _mm256_add_epi32(accumulator, _mm256_madd_epi16(a16, w16));
+        }
+        __m128i half { _mm_add_epi32(_mm256_castsi256_si128(accumulator), _mm256_extracti128_si256(accumulator, 1)) };
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+        sum = _mm_cvtsi128_si32(half);
+#endif
+
+        // Portable path (and tail): widened products in independent lanes, which
+        // the compiler turns into packed multiply-adds on any SIMD target.
+        int32_t lanes[8] {0, 0, 0, 0, 0, 0, 0, 0};
+        for (; k+8<=K; k+=8)
+        {
+            for (int l=0; l<8; ++l)
+            {
+                lanes[l] += static_cast<int16_t>(a[k+l]) * static_cast<int16_t>(w[k+l]);
+            }
+        }
+        for (; k<K; ++k)
+        {
+            sum += static_cast<int32_t>(a[k]) * w[k];
+        }
+        for (int l=0; l<8; ++l)
+        {
+            sum += lanes[l];
+        }
+        return sum;
+    }
+
+    void gemvInt8(int N, int K, const int8_t *a, const int8_t *W, int ldw, int32_t *c)
+    {
+        for (int j=0; j<N; ++j)
+        {
+            c[j] = dotInt8(a, W + static_cast<long>(j)*ldw, K);
+        }
+    }
+
+    void gemmInt8(int M, int N, int K, const int8_t *A, int lda,
+                  const int8_t *W, int ldw, int32_t *C, int ldc)
+    {
+        /*
+        Rows of A are shared out between threads; within a thread, blocks of
+        weight rows are swept across all of its rows of A before moving on.
+        */
+
+        parallel::parallelFor(0, M, [&](int rowBegin, int rowEnd)
+        {
+            for (int j0=0; j0<N; j0+=QGEMM_NC)
+            {
+                const int nc { std::min(QGEMM_NC, N-j0) };
+                for (int i=rowBegin; i<rowEnd; ++i)
+                {
+                    gemvInt8(nc, K, A + static_cast<long>(i)*lda, W + static_cast<long>(j0)*ldw, ldw,
+                             C + static_cast<long>(i)*ldc + j0);
+                }
+            }
+        });
+    }
+}
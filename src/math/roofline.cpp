@@ -0,0 +1,164 @@
+#include "math/roofline.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace roofline
+{
+    namespace
+    {
+        double secondsSince(std::chrono::steady_clock::time_point start)
+        {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        template<typename Body>
+        double bestTime(double seconds, const Body &body)
+        {
+            double best { 1e30 }, total {0.0};
+            for (int repetition=0; repetition<3 || total < seconds; ++repetition)
+            {
+                const auto start { std::chrono::steady_clock::now() };
+                body();
+                const double elapsed { secondsSince(start) };
+                best = std::min(best, elapsed);
+                total += elapsed;
+            }
+            return best;
+        }
+
+        double probeBandwidth(double seconds)
+        {
+            /*
+            STREAM triad a = b + s*c over three 16 MB arrays, each thread
+            working on (and first touching) its own part of them.
+            */
+
+            const int size { 1 << 21 };
+            std::vector<double> a(size), b(size), c(size);
+            parallel::parallelFor(0, size, [&](int begin, int end)
+            {
+                std::fill(a.begin() + begin, a.begin() + end, 0.0);
+                std::fill(b.begin() + begin, b.begin() + end, 1.0);
+                std::fill(c.begin() + begin, c.begin() + end, 2.0);
+            });
+            const double scalar {3.0};
+            const double best { bestTime(seconds, [&]()
+            {
+                parallel::parallelFor(0, size, [&](int begin, int end)
+                {
+                    for (int i=begin; i<end; ++i)
+                    {
+                        a[i] = b[i] + scalar * c[i];
+                    }
+                });
+            }) };
+            return 3.0 * sizeof(double) * size / best * 1e-9;
+        }
+
+        double probeFlops(double seconds)
+        {
+            /*
+            Independent multiply-add chains, enough of them to cover the
+            latency of the floating-point units, which the compiler is free to
+            vectorize and fuse. The chains stay bounded (x -> 0.5x + 0.5).
+            */
+
+            const int numChains {32}, iterations {1 << 16};
+            const int numThreads { parallel::numThreads() };
+            std::atomic<double> sink {0.0};
+            const double best { bestTime(seconds, [&]()
+            {
+                parallel::parallelFor(0, numThreads, [&](int begin, int end)
+                {
+                    for (int t=begin; t<end; ++t)
+                    {
+                        double chains[numChains];
+                        for (int j=0; j<numChains; ++j)
+                        {
+                            chains[j] = 1.0 + j;
+                        }
+                        for (int i=0; i<iterations; ++i)
+                        {
+                            for (int j=0; j<numChains; ++j)
+                            {
+                                chains[j] = chains[j] * 0.5 + 0.5;
+                            }
+                        }
+                        double sum {0.0};
+                        for (int j=0; j<numChains; ++j)
+                        {
+                            sum += chains[j];
+                        }
+                        sink = sink + sum;
+                    }
+                });
+            }) };
+            return 2.0 * numChains * double(iterations) * numThreads / best * 1e-9;
+        }
+    }
+
+    double MachinePeak::attainableGflops(double intensity) const
+    {
+        return std::min(gflops, intensity * gbps);
+    }
+
+    MachinePeak measurePeak(double seconds)
+    {
+        MachinePeak peak;
+        peak.gbps = probeBandwidth(seconds);
+        peak.gflops = probeFlops(seconds);
+        return peak;
+    }
+
+    const MachinePeak& machinePeak()
+    {
+        static std::once_flag measured;
+        static MachinePeak peak;
+        std::call_once(measured, []() { peak = measurePeak(); });
+        return peak;
+    }
+
+    double RooflineReport::fractionOfRoof(const KernelCost &kernel) const
+    {
+        if (kernel.flops <= 0)
+        {
+            return peak.gbps > 0 ? kernel.gbps() / peak.gbps : 0.0;
+        }
+        const double attainable { peak.attainableGflops(kernel.intensity()) };
+        return attainable > 0 ? kernel.gflops() / attainable : 0.0;
+    }
+
+    void RooflineReport::printToConsole() const
+    {
+        const std::ios::fmtflags flags { std::cout.flags() };
+        const std::streamsize precision { std::cout.precision() };
+        std::cout.unsetf(std::ios::floatfield);
+        std::cout << std::setprecision(3)
+                  << "Roofline: peak " << peak.gflops << " GFLOP/s, " << peak.gbps << " GB/s, ridge at "
+                  << peak.ridgeIntensity() << " flop/byte" << std::endl
+                  << "  " << std::left << std::setw(38) << "kernel" << std::right << std::setw(10) << "MFLOP"
+                  << std::setw(10) << "MB" << std::setw(10) << "flop/B" << std::setw(10) << "us"
+                  << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s" << std::setw(9) << "bound"
+                  << std::setw(9) << "% roof" << std::endl;
+        for (const KernelCost &kernel : kernels)
+        {
+            const bool computeBound { kernel.flops > 0 && kernel.intensity() >= peak.ridgeIntensity() };
+            std::cout << "  " << std::left << std::setw(38) << kernel.name << std::right
+                      << std::setw(10) << kernel.flops*1e-6 << std::setw(10) << kernel.bytes*1e-6
+                      << std::setw(10) << kernel.intensity() << std::setw(10) << kernel.seconds*1e6
+                      << std::setw(10) << kernel.gflops() << std::setw(10) << kernel.gbps()
+                      << std::setw(9) << (computeBound ? "compute" : "memory")
+                      << std::setw(8) << 100.0*fractionOfRoof(kernel) << "%" << std::endl;
+        }
+        std::cout << std::endl;
+        std::cout.flags(flags);
+        std::cout.precision(precision);
+    }
+}
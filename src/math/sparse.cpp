@@ -0,0 +1,293 @@
+#include "math/sparse.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <iostream>
+#include <vector>
+
+namespace linalg
+{
+    SparseVector SparseVector::fromDense(const vector<double> &dense)
+    {
+        SparseVector sparse;
+        sparse.size = dense.size();
+        for (int i=0; i<sparse.size; ++i)
+        {
+            if (dense[i] != 0.0)
+            {
+                sparse.indices.push_back(i);
+                sparse.values.push_back(dense[i]);
+            }
+        }
+        return sparse;
+    }
+
+    CSRMatrix::CSRMatrix(const vector<SparseVector> &rows, int first, int count)
+    {
+        m_numRows = count;
+        m_numCols = count > 0 ? rows.at(first).size : 0;
+        m_rowPointers.assign(1, 0);
+        m_rowPointers.reserve(m_numRows + 1);
+        for (int n=first; n<first+count; ++n)
+        {
+            const SparseVector &row { rows.at(n) };
+            if (row.size != m_numCols || row.indices.size() != row.values.size())
+            {
+                cerr << "Sparse row " << n << " doesn't match the other rows of length " << m_numCols << "!" << endl;
+                assert(false);
+            }
+            m_columnIndices.insert(m_columnIndices.end(), row.indices.begin(), row.indices.end());
+            m_values.insert(m_values.end(), row.values.begin(), row.values.end());
+            m_rowPointers.push_back(m_values.size());
+        }
+    }
+
+    CSRMatrix::CSRMatrix(const Matrix<double> &dense)
+    {
+        m_numRows = dense.numRows();
+        m_numCols = dense.numCols();
+        m_rowPointers.assign(1, 0);
+        m_rowPointers.reserve(m_numRows + 1);
+        for (int i=0; i<m_numRows; ++i)
+        {
+            const double *row { dense.data() + static_cast<long>(i)*m_numCols };
+            for (int j=0; j<m_numCols; ++j)
+            {
+                if (row[j] != 0.0)
+                {
+                    m_columnIndices.push_back(j);
+                    m_values.push_back(row[j]);
+                }
+            }
+            m_rowPointers.push_back(m_values.size());
+        }
+    }
+
+    double CSRMatrix::density() const
+    {
+        const double size { static_cast<double>(m_numRows) * m_numCols };
+        return size > 0 ? m_values.size() / size : 0.0;
+    }
+
+    size_t CSRMatrix::bytes() const
+    {
+        return m_rowPointers.size()*sizeof(int) + m_columnIndices.size()*sizeof(int) + m_values.size()*sizeof(double);
+    }
+
+    BSRMatrix::BSRMatrix(const Matrix<double> &dense, int blockSize)
+    {
+        m_numRows   = dense.numRows();
+        m_numCols   = dense.numCols();
+        m_blockSize = std::max(1, blockSize);
+        if (m_blockSize > BSR_MAX_BLOCK)
+        {
+            cerr << "BSR blocks of " << m_blockSize << "x" << m_blockSize << " are larger than the "
+            << BSR_MAX_BLOCK << "x" << BSR_MAX_BLOCK << " maximum!" << endl;
+            assert(false);
+        }
+        const int b { m_blockSize };
+        const int numBlockRows { (m_numRows + b - 1) / b };
+        const int numBlockCols { (m_numCols + b - 1) / b };
+
+        m_blockRowPointers.assign(1, 0);
+        for (int bi=0; bi<numBlockRows; ++bi)
+        {
+            for (int bj=0; bj<numBlockCols; ++bj)
+            {
+                bool isZero {true};
+                for (int i=bi*b; i<std::min(m_numRows, (bi+1)*b) && isZero; ++i)
+                {
+                    for (int j=bj*b; j<std::min(m_numCols, (bj+1)*b); ++j)
+                    {
+                        isZero = isZero && (dense(i,j) == 0.0);
+                    }
+                }
+                if (isZero)
+                {
+                    continue;
+                }
+
+                m_blockColumns.push_back(bj);
+                const size_t offset { m_values.size() };
+                m_values.resize(offset + b*b, 0.0);
+                for (int i=bi*b; i<std::min(m_numRows, (bi+1)*b); ++i)
+                {
+                    for (int j=bj*b; j<std::min(m_numCols, (bj+1)*b); ++j)
+                    {
+                        m_values[offset + (i - bi*b)*b + (j - bj*b)] = dense(i,j);
+                    }
+                }
+            }
+            m_blockRowPointers.push_back(m_blockColumns.size());
+        }
+    }
+
+    double BSRMatrix::density() const
+    {
+        const double size { static_cast<double>(m_numRows) * m_numCols };
+        return size > 0 ? std::min(1.0, m_values.size() / size) : 0.0;
+    }
+
+    size_t BSRMatrix::bytes() const
+    {
+        return m_blockRowPointers.size()*sizeof(int) + m_blockColumns.size()*sizeof(int) + m_values.size()*sizeof(double);
+    }
+
+    void spmv(const CSRMatrix &W, const double *x, double *y)
+    {
+        const int *rowPointers { W.getRowPointers().data() };
+        const int *columns { W.getColumnIndices().data() };
+        const double *values { W.getValues().data() };
+        for (int i=0; i<W.numRows(); ++i)
+        {
+            double sum {0.0};
+            for (int p=rowPointers[i]; p<rowPointers[i+1]; ++p)
+            {
+                sum += values[p] * x[columns[p]];
+            }
+            y[i] = sum;
+        }
+    }
+
+    void spmv(const BSRMatrix &W, const double *x, double *y)
+    {
+        /*
+        Each block row is accumulated in a small local buffer. Only blocks
+        that overhang the last column need a shortened inner loop.
+        */
+
+        const int b { W.getBlockSize() };
+        const int numBlockRows { static_cast<int>(W.getBlockRowPointers().size()) - 1 };
+        double sums[BSR_MAX_BLOCK];
+
+        const int *blockRowPointers { W.getBlockRowPointers().data() };
+        const int *blockColumns { W.getBlockColumns().data() };
+        const double *values { W.getValues().data() };
+        for (int bi=0; bi<numBlockRows; ++bi)
+        {
+            std::fill(sums, sums + b, 0.0);
+            for (int p=blockRowPointers[bi]; p<blockRowPointers[bi+1]; ++p)
+            {
+                const double *block { values + static_cast<long>(p)*b*b };
+                const double *xBlock { x + blockColumns[p]*b };
+                const int width { std::min(b, W.numCols() - blockColumns[p]*b) };
+                for (int r=0; r<b; ++r)
+                {
+                    for (int c=0; c<width; ++c)
+                    {
+                        sums[r] += block[r*b + c] * xBlock[c];
+                    }
+                }
+            }
+            for (int r=0; r<b && bi*b + r<W.numRows(); ++r)
+            {
+                y[bi*b + r] = sums[r];
+            }
+        }
+    }
+
+    namespace
+    {
+        template <class SparseMatrix>
+        void spmmRows(const SparseMatrix &W, const Matrix<double> &X, Matrix<double> &Y)
+        {
+            if (X.numCols() != W.numCols())
+            {
+                cerr << "spmm: samples of length " << X.numCols() << " don't match a sparse matrix with "
+                << W.numCols() << " columns!" << endl;
+                assert(false);
+            }
+            Y.resize(X.numRows(), W.numRows());
+            parallel::parallelFor(0, X.numRows(), [&](int rowBegin, int rowEnd)
+            {
+                for (int n=rowBegin; n<rowEnd; ++n)
+                {
+                    spmv(W, X.data() + static_cast<long>(n)*X.numCols(), Y.data() + static_cast<long>(n)*Y.numCols());
+                }
+            });
+        }
+    }
+
+    void spmm(const CSRMatrix &W, const Matrix<double> &X, Matrix<double> &Y)
+    {
+        spmmRows(W, X, Y);
+    }
+
+    void spmm(const BSRMatrix &W, const Matrix<double> &X, Matrix<double> &Y)
+    {
+        spmmRows(W, X, Y);
+    }
+
+    void spmmSparseInput(const CSRMatrix &X, const Matrix<double> &W, Matrix<double> &Y)
+    {
+        /*
+        Each output is a dot product between a dense weight row and a sparse
+        sample, gathering only the weights at the sample's nonzero indices.
+        */
+
+        if (X.numCols() != W.numCols())
+        {
+            cerr << "spmmSparseInput: samples of length " << X.numCols() << " don't match weights with "
+            << W.numCols() << " columns!" << endl;
+            assert(false);
+        }
+        Y.resize(X.numRows(), W.numRows());
+
+        const int *rowPointers { X.getRowPointers().data() };
+        const int *columns { X.getColumnIndices().data() };
+        const double *values { X.getValues().data() };
+        parallel::parallelFor(0, X.numRows(), [&](int rowBegin, int rowEnd)
+        {
+            for (int n=rowBegin; n<rowEnd; ++n)
+            {
+                double *y { Y.data() + static_cast<long>(n)*Y.numCols() };
+                for (int j=0; j<W.numRows(); ++j)
+                {
+                    const double *w { W.data() + static_cast<long>(j)*W.numCols() };
+                    double sum {0.0};
+                    for (int p=rowPointers[n]; p<rowPointers[n+1]; ++p)
+                    {
+                        sum += w[columns[p]] * values[p];
+                    }
+                    y[j] = sum;
+                }
+            }
+        });
+    }
+
+    void sparseInputGradient(const Matrix<double> &E, const CSRMatrix &X, vector<int> &columns, Matrix<double> &G)
+    {
+        if (E.numRows() != X.numRows())
+        {
+            cerr << "sparseInputGradient: " << E.numRows() << " error rows for " << X.numRows() << " samples!" << endl;
+            assert(false);
+        }
+
+        columns = X.getColumnIndices();
+        std::sort(columns.begin(), columns.end());
+        columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
+
+        const int width { E.numCols() };
+        G.resize(columns.size(), width);
+        std::fill(G.getValues().begin(), G.getValues().end(), 0.0);
+
+        const int *rowPointers { X.getRowPointers().data() };
+        const int *indices { X.getColumnIndices().data() };
+        const double *values { X.getValues().data() };
+        for (int n=0; n<X.numRows(); ++n)
+        {
+            const double *e { E.data() + static_cast<long>(n)*width };
+            for (int p=rowPointers[n]; p<rowPointers[n+1]; ++p)
+            {
+                const int position { static_cast<int>(std::lower_bound(columns.begin(), columns.end(), indices[p]) - columns.begin()) };
+                double *g { G.data() + static_cast<long>(position)*width };
+                const double x { values[p] };
+                for (int j=0; j<width; ++j)
+                {
+                    g[j] += e[j] * x;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,203 @@
+#include "ml_models/DNN/batchnorm_layer.hpp"
+#include "ml_models/DNN/activation.hpp"
+#include "ml_models/DNN/parameters.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+BatchNormLayer::BatchNormLayer(int channels, int spatialSize, Activation activationType, double momentum, double epsilon)
+{
+    m_channels       = channels;
+    m_spatialSize    = spatialSize;
+    m_activationType = activationType;
+    m_momentum       = momentum;
+    m_epsilon        = epsilon;
+
+    memtrack::Scope weightScope(memtrack::Subsystem::WEIGHTS);
+    m_gamma.assign(m_channels, 1.0);
+    m_beta.assign(m_channels, 0.0);
+    m_runningMean.assign(m_channels, 0.0);
+    m_runningVariance.assign(m_channels, 1.0);
+    m_inverseStd.assign(m_channels, 1.0);
+
+    memtrack::Scope gradientScope(memtrack::Subsystem::OPTIMIZER);
+    m_gammaGrads.assign(m_channels, 0.0);
+    m_betaGrads.assign(m_channels, 0.0);
+}
+
+string BatchNormLayer::getName() const
+{
+    ostringstream name;
+    name << "BatchNorm(" << m_channels << "x" << m_spatialSize << ")";
+    return name.str();
+}
+
+vector<double> BatchNormLayer::getFoldedScale() const
+{
+    vector<double> scale(m_channels);
+    for (int c=0; c<m_channels; ++c)
+    {
+        scale[c] = m_gamma[c] / std::sqrt(m_runningVariance[c] + m_epsilon);
+    }
+    return scale;
+}
+
+vector<double> BatchNormLayer::getFoldedShift() const
+{
+    const vector<double> scale { getFoldedScale() };
+    vector<double> shift(m_channels);
+    for (int c=0; c<m_channels; ++c)
+    {
+        shift[c] = m_beta[c] - m_runningMean[c] * scale[c];
+    }
+    return shift;
+}
+
+void BatchNormLayer::normalize(const batchMatrix &input, batchMatrix &output,
+                               const vector<double> &scale, const vector<double> &shift) const
+{
+    output.resize(input.numRows(), getOutputSize());
+    parallel::parallelFor(0, input.numRows(), [&](int sampleBegin, int sampleEnd)
+    {
+        for (int n=sampleBegin; n<sampleEnd; ++n)
+        {
+            for (int c=0; c<m_channels; ++c)
+            {
+                const double *in { input.data() + static_cast<long>(n)*input.numCols() + c*m_spatialSize };
+                double *out { output.data() + static_cast<long>(n)*output.numCols() + c*m_spatialSize };
+                for (int p=0; p<m_spatialSize; ++p)
+                {
+                    out[p] = activation::apply(m_activationType, scale[c]*in[p] + shift[c]);
+                }
+            }
+        }
+    });
+}
+
+void BatchNormLayer::infer(const batchMatrix &input, batchMatrix &output) const
+{
+    normalize(input, output, getFoldedScale(), getFoldedShift());
+}
+
+void BatchNormLayer::forward(const batchMatrix &input, batchMatrix &output, bool updateStatistics)
+{
+    /*
+    The batch mean and variance of each channel come out of one pass over its
+    values: sums of (x - K) and (x - K)^2 with K the channel's first value,
+    which keeps the single-pass variance from cancelling catastrophically.
+    A second pass writes the normalized values and the output together.
+    Channels are independent and are shared out between threads.
+    */
+
+    const int batchSize { input.numRows() };
+    const long count { static_cast<long>(batchSize) * m_spatialSize };
+    output.resize(batchSize, getOutputSize());
+    m_normalized.resize(batchSize, getOutputSize());
+
+    parallel::parallelFor(0, m_channels, [&](int channelBegin, int channelEnd)
+    {
+        for (int c=channelBegin; c<channelEnd; ++c)
+        {
+            const double K { input(0, c*m_spatialSize) };
+            double shiftedSum {0.0};
+            double shiftedSquares {0.0};
+            for (int n=0; n<batchSize; ++n)
+            {
+                const double *in { input.data() + static_cast<long>(n)*input.numCols() + c*m_spatialSize };
+                for (int p=0; p<m_spatialSize; ++p)
+                {
+                    const double d { in[p] - K };
+                    shiftedSum += d;
+                    shiftedSquares += d * d;
+                }
+            }
+            const double mean     { K + shiftedSum / count };
+            const double variance { std::max(0.0, (shiftedSquares - shiftedSum*shiftedSum / count) / count) };
+            const double inverseStd { 1.0 / std::sqrt(variance + m_epsilon) };
+            m_inverseStd[c] = inverseStd;
+
+            for (int n=0; n<batchSize; ++n)
+            {
+                const double *in { input.data() + static_cast<long>(n)*input.numCols() + c*m_spatialSize };
+                double *normalized { m_normalized.data() + static_cast<long>(n)*m_normalized.numCols() + c*m_spatialSize };
+                double *out { output.data() + static_cast<long>(n)*output.numCols() + c*m_spatialSize };
+                for (int p=0; p<m_spatialSize; ++p)
+                {
+                    normalized[p] = (in[p] - mean) * inverseStd;
+                    out[p] = activation::apply(m_activationType, m_gamma[c]*normalized[p] + m_beta[c]);
+                }
+            }
+
+            if (!updateStatistics)
+            {
+                continue;
+            }
+            // Running averages use the unbiased variance estimate.
+            const double unbiasedVariance { count > 1 ? variance * count / (count - 1) : variance };
+            m_runningMean[c]     = m_momentum*m_runningMean[c]     + (1 - m_momentum)*mean;
+            m_runningVariance[c] = m_momentum*m_runningVariance[c] + (1 - m_momentum)*unbiasedVariance;
+        }
+    });
+}
+
+void BatchNormLayer::backward(const batchMatrix &input, const batchMatrix &output,
+                              const batchMatrix &outputGrad, batchMatrix &inputGrad)
+{
+    /*
+    With g = outputGrad (Hadamard) f'(y) and N values per channel:
+        dbeta  = sum(g),  dgamma = sum(g * xhat)
+        dx     = gamma * inverseStd / N * (N*g - dbeta - xhat*dgamma)
+    */
+
+    const int batchSize { input.numRows() };
+    const long count { static_cast<long>(batchSize) * m_spatialSize };
+    inputGrad.resize(batchSize, getInputSize());
+
+    parallel::parallelFor(0, m_channels, [&](int channelBegin, int channelEnd)
+    {
+        for (int c=channelBegin; c<channelEnd; ++c)
+        {
+            double betaGrad {0.0};
+            double gammaGrad {0.0};
+            for (int n=0; n<batchSize; ++n)
+            {
+                const long offset { static_cast<long>(n)*getOutputSize() + c*m_spatialSize };
+                for (int p=0; p<m_spatialSize; ++p)
+                {
+                    const double g { outputGrad.data()[offset+p] * activation::derivativeFromOutput(m_activationType, output.data()[offset+p]) };
+                    betaGrad  += g;
+                    gammaGrad += g * m_normalized.data()[offset+p];
+                }
+            }
+            m_betaGrads[c]  += betaGrad;
+            m_gammaGrads[c] += gammaGrad;
+
+            const double factor { m_gamma[c] * m_inverseStd[c] / count };
+            for (int n=0; n<batchSize; ++n)
+            {
+                const long offset { static_cast<long>(n)*getOutputSize() + c*m_spatialSize };
+                for (int p=0; p<m_spatialSize; ++p)
+                {
+                    const double g { outputGrad.data()[offset+p] * activation::derivativeFromOutput(m_activationType, output.data()[offset+p]) };
+                    inputGrad.data()[offset+p] = factor * (count*g - betaGrad - m_normalized.data()[offset+p]*gammaGrad);
+                }
+            }
+        }
+    });
+}
+
+void BatchNormLayer::update(double learningCoefficient)
+{
+    for (int c=0; c<m_channels; ++c)
+    {
+        m_gamma[c] -= learningCoefficient * m_gammaGrads[c];
+        m_beta[c]  -= learningCoefficient * m_betaGrads[c];
+        m_gammaGrads[c] = 0.0;
+        m_betaGrads[c]  = 0.0;
+    }
+}
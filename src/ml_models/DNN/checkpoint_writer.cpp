@@ -0,0 +1,257 @@
+#include "ml_models/DNN/checkpoint_writer.hpp"
+#include "ml_models/DNN/network.hpp"
+#include "math/memory_tracker.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+    // File layout, in native byte order: magic, training step, number of layers, the layer
+    // sizes, number of parameters, then the parameters as in Network::copyParameters.
+    const char MAGIC[8] { 'S', 'N', 'C', 'K', 'P', 'T', '0', '1' };
+
+    bool syncDirectory(const string &directory)
+    {
+        // Makes the rename itself durable.
+        const int fd { open(directory.c_str(), O_RDONLY) };
+        if (fd < 0)
+        {
+            return false;
+        }
+        const bool synced { fsync(fd) == 0 };
+        close(fd);
+        return synced;
+    }
+
+    bool holdsAllState(const Network &network)
+    {
+        // Whether the dense weights, biases and training step are all there is to restore.
+        string missing;
+        if (network.getNumFeatureLayers() > 0)
+        {
+            missing = "feature layers";
+        }
+        for (int l=0; l<network.getNumLayers() && missing.empty(); ++l)
+        {
+            if (network.getBatchNorm(l))
+            {
+                missing = "batch norm on dense layer " + to_string(l);
+            }
+            else if (l < network.getNumLayers()-1 && network.isPruned(l))
+            {
+                missing = "the pruning mask of weight matrix " + to_string(l);
+            }
+        }
+        if (!missing.empty())
+        {
+            cerr << "Checkpoints hold only dense weights, biases and the training step, not " << missing << endl;
+        }
+        return missing.empty();
+    }
+}
+
+CheckpointWriter::CheckpointWriter(const string &directory, const string &prefix, int numRetained)
+    : m_directory(directory.empty() ? "." : directory), m_prefix(prefix), m_numRetained(std::max(1, numRetained))
+{
+    m_writer = thread(&CheckpointWriter::writeLoop, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_changed.notify_all();
+    m_writer.join();
+}
+
+bool CheckpointWriter::save(const Network &network)
+{
+    if (!holdsAllState(network))
+    {
+        return false;
+    }
+
+    const auto start { chrono::steady_clock::now() };
+    unique_lock<mutex> lock(m_mutex);
+    m_changed.wait(lock, [&]() { return !m_staging[0].busy || !m_staging[1].busy; });
+    const int index { m_staging[0].busy ? 1 : 0 };
+    lock.unlock();
+
+    // The writer only touches busy buffers, so this one is ours until it is queued.
+    Staging &staging { m_staging[index] };
+    {
+        memtrack::Scope scope(memtrack::Subsystem::WEIGHTS);
+        staging.parameters.resize(network.numParameters());
+        staging.layerSizes = network.getLayerSizes();
+    }
+    network.copyParameters(staging.parameters.data());
+    staging.trainingStep = network.getTrainingStep();
+
+    lock.lock();
+    staging.busy = true;
+    m_queue.push_back(index);
+    m_stagingSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    lock.unlock();
+    m_changed.notify_all();
+    return true;
+}
+
+void CheckpointWriter::flush()
+{
+    unique_lock<mutex> lock(m_mutex);
+    m_changed.wait(lock, [&]() { return !m_staging[0].busy && !m_staging[1].busy; });
+}
+
+vector<string> CheckpointWriter::files() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return vector<string>(m_files.begin(), m_files.end());
+}
+
+int CheckpointWriter::numWritten() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_numWritten;
+}
+
+int CheckpointWriter::numFailed() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_numFailed;
+}
+
+double CheckpointWriter::stagingSeconds() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_stagingSeconds;
+}
+
+void CheckpointWriter::writeLoop()
+{
+    unique_lock<mutex> lock(m_mutex);
+    while (true)
+    {
+        m_changed.wait(lock, [&]() { return m_stop || !m_queue.empty(); });
+        if (m_queue.empty())
+        {
+            return; // Stopping, with everything written.
+        }
+        const int index { m_queue.front() };
+        m_queue.pop_front();
+        const Staging &staging { m_staging[index] };
+        const string path { m_directory + "/" + m_prefix + "-" + to_string(staging.trainingStep) + ".ckpt" };
+        lock.unlock();
+
+        const bool written { write(staging, path) };
+
+        lock.lock();
+        if (written)
+        {
+            ++m_numWritten;
+            m_files.erase(std::remove(m_files.begin(), m_files.end(), path), m_files.end()); // Saved twice at the same step.
+            m_files.push_back(path);
+            while (static_cast<int>(m_files.size()) > m_numRetained)
+            {
+                std::remove(m_files.front().c_str());
+                m_files.pop_front();
+            }
+        }
+        else
+        {
+            ++m_numFailed;
+        }
+        m_staging[index].busy = false;
+        m_changed.notify_all();
+    }
+}
+
+bool CheckpointWriter::write(const Staging &staging, const string &path) const
+{
+    const string temporaryPath { path + ".tmp" };
+    FILE *file { fopen(temporaryPath.c_str(), "wb") };
+    if (!file)
+    {
+        cerr << "Could not create checkpoint " << temporaryPath << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    const uint32_t numLayers { static_cast<uint32_t>(staging.layerSizes.size()) };
+    const uint64_t numParameters { staging.parameters.size() };
+    bool ok { fwrite(MAGIC, sizeof(MAGIC), 1, file) == 1
+              && fwrite(&staging.trainingStep, sizeof(staging.trainingStep), 1, file) == 1
+              && fwrite(&numLayers, sizeof(numLayers), 1, file) == 1
+              && fwrite(staging.layerSizes.data(), sizeof(int), numLayers, file) == numLayers
+              && fwrite(&numParameters, sizeof(numParameters), 1, file) == 1
+              && fwrite(staging.parameters.data(), sizeof(double), numParameters, file) == numParameters
+              && fflush(file) == 0
+              && fsync(fileno(file)) == 0 };
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(temporaryPath.c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+        cerr << "Could not write checkpoint " << path << ": " << strerror(errno) << endl;
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+    syncDirectory(m_directory);
+    return true;
+}
+
+bool CheckpointWriter::load(const string &path, Network &network)
+{
+    if (!holdsAllState(network))
+    {
+        return false;
+    }
+
+    FILE *file { fopen(path.c_str(), "rb") };
+    if (!file)
+    {
+        cerr << "Could not open checkpoint " << path << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    char magic[sizeof(MAGIC)];
+    uint64_t trainingStep {0}, numParameters {0};
+    uint32_t numLayers {0};
+    vector<int> layerSizes;
+    vector<double> parameters;
+    bool ok { fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0
+              && fread(&trainingStep, sizeof(trainingStep), 1, file) == 1
+              && fread(&numLayers, sizeof(numLayers), 1, file) == 1
+              && numLayers == network.getLayerSizes().size() };
+    if (ok)
+    {
+        layerSizes.resize(numLayers);
+        ok = fread(layerSizes.data(), sizeof(int), numLayers, file) == numLayers
+             && layerSizes == network.getLayerSizes()
+             && fread(&numParameters, sizeof(numParameters), 1, file) == 1
+             && numParameters == network.numParameters();
+    }
+    if (ok)
+    {
+        memtrack::Scope scope(memtrack::Subsystem::WEIGHTS);
+        parameters.resize(numParameters);
+        ok = fread(parameters.data(), sizeof(double), numParameters, file) == numParameters;
+    }
+    fclose(file);
+
+    if (!ok)
+    {
+        cerr << "Checkpoint " << path << " is unreadable or doesn't fit the network" << endl;
+        return false;
+    }
+    network.loadParameters(parameters.data());
+    network.setTrainingStep(trainingStep);
+    return true;
+}
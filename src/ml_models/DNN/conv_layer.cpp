@@ -0,0 +1,287 @@
+#include "ml_models/DNN/conv_layer.hpp"
+#include "ml_models/DNN/activation.hpp"
+#include "ml_models/DNN/parameters.hpp"
+#include "math/gemm.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/numerical.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Samples per partial gradient in backward(). Fixed, so that deterministic reductions give the same sums for any thread count.
+    const int GRADIENT_GRAIN {8};
+}
+
+Conv2DLayer::Conv2DLayer(int inChannels, int inHeight, int inWidth,
+                         int outChannels, int kernelSize, int stride, int padding,
+                         Activation activationType)
+{
+    m_inChannels  = inChannels;
+    m_inHeight    = inHeight;
+    m_inWidth     = inWidth;
+    m_outChannels = outChannels;
+    m_kernelSize  = kernelSize;
+    m_stride      = stride;
+    m_padding     = padding;
+    m_outHeight   = (inHeight + 2*padding - kernelSize) / stride + 1;
+    m_outWidth    = (inWidth  + 2*padding - kernelSize) / stride + 1;
+    m_activationType = activationType;
+
+    memtrack::Scope weightScope(memtrack::Subsystem::WEIGHTS);
+
+    // Kernels start uniform in [-limit, limit] so activations keep roughly unit scale
+    // regardless of the fan-in; biases start at zero.
+    m_kernels.resize(m_outChannels, columnRows());
+    const double limit { std::sqrt(6.0 / columnRows()) };
+    for (double &weight : m_kernels.getValues())
+    {
+        weight = (2*numerical::randomDouble() - 1) * limit;
+    }
+    m_biases.assign(m_outChannels, 0.0);
+
+    memtrack::Scope gradientScope(memtrack::Subsystem::OPTIMIZER);
+    m_kernelGrads = linalg::Matrix<double>(m_outChannels, columnRows());
+    m_biasGrads.assign(m_outChannels, 0.0);
+}
+
+string Conv2DLayer::getName() const
+{
+    ostringstream name;
+    name << "Conv2D(" << m_inChannels << "x" << m_inHeight << "x" << m_inWidth
+         << " -> " << m_outChannels << "x" << m_outHeight << "x" << m_outWidth
+         << ", k=" << m_kernelSize << ", s=" << m_stride << ", p=" << m_padding << ")";
+    return name.str();
+}
+
+double Conv2DLayer::inferenceFlops(int batchSize) const
+{
+    const double gemmFlops { 2.0 * m_outChannels * columnRows() * columnCols() };
+    return batchSize * (gemmFlops + 2.0 * getOutputSize());
+}
+
+void Conv2DLayer::im2col(const double *image, double *columns) const
+{
+    /*
+    Row r = (c, ky, kx) of the column buffer holds, for every output position,
+    the input pixel that kernel element lands on (zero in the padding).
+    */
+
+    const int outPixels { columnCols() };
+    for (int c=0; c<m_inChannels; ++c)
+    {
+        const double *channel { image + c*m_inHeight*m_inWidth };
+        for (int ky=0; ky<m_kernelSize; ++ky)
+        {
+            for (int kx=0; kx<m_kernelSize; ++kx)
+            {
+                double *row { columns + ((c*m_kernelSize + ky)*m_kernelSize + kx) * outPixels };
+                for (int oy=0; oy<m_outHeight; ++oy)
+                {
+                    const int y { oy*m_stride - m_padding + ky };
+                    double *rowOut { row + oy*m_outWidth };
+                    if (y < 0 || y >= m_inHeight)
+                    {
+                        std::fill(rowOut, rowOut + m_outWidth, 0.0);
+                        continue;
+                    }
+                    for (int ox=0; ox<m_outWidth; ++ox)
+                    {
+                        const int x { ox*m_stride - m_padding + kx };
+                        rowOut[ox] = (x < 0 || x >= m_inWidth) ? 0.0 : channel[y*m_inWidth + x];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Conv2DLayer::col2im(const double *columns, double *image) const
+{
+    /*
+    Adjoint of im2col: every column entry is added back onto the input pixel
+    it was copied from. Overlapping windows therefore accumulate.
+    */
+
+    const int outPixels { columnCols() };
+    for (int c=0; c<m_inChannels; ++c)
+    {
+        double *channel { image + c*m_inHeight*m_inWidth };
+        for (int ky=0; ky<m_kernelSize; ++ky)
+        {
+            for (int kx=0; kx<m_kernelSize; ++kx)
+            {
+                const double *row { columns + ((c*m_kernelSize + ky)*m_kernelSize + kx) * outPixels };
+                for (int oy=0; oy<m_outHeight; ++oy)
+                {
+                    const int y { oy*m_stride - m_padding + ky };
+                    if (y < 0 || y >= m_inHeight)
+                    {
+                        continue;
+                    }
+                    for (int ox=0; ox<m_outWidth; ++ox)
+                    {
+                        const int x { ox*m_stride - m_padding + kx };
+                        if (x >= 0 && x < m_inWidth)
+                        {
+                            channel[y*m_inWidth + x] += row[oy*m_outWidth + ox];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+void Conv2DLayer::infer(const batchMatrix &input, batchMatrix &output) const
+{
+    /*
+    For each sample: unroll with im2col, multiply by the kernel matrix to get
+    (outChannels x outPixels) directly in the output row, then add biases and
+    apply the activation.
+    */
+
+    const int batchSize { input.numRows() };
+    const int outPixels { columnCols() };
+    output.resize(batchSize, getOutputSize());
+
+    const linalg::TensorView<const double> samples { linalg::asView(input) };
+    const linalg::TensorView<double> outputs { linalg::asView(output) };
+    const linalg::TensorView<const double> kernels { linalg::asView(m_kernels) };
+
+    parallel::parallelFor(0, batchSize, [&](int sampleBegin, int sampleEnd)
+    {
+        vector<double> columns(static_cast<size_t>(columnRows()) * outPixels);
+        const linalg::TensorView<const double> columnsView(columns.data(), {columnRows(), outPixels});
+
+        for (int n=sampleBegin; n<sampleEnd; ++n)
+        {
+            im2col(samples.select(0, n).reshape({m_inChannels, m_inHeight, m_inWidth}).data(), columns.data());
+
+            const linalg::TensorView<double> outSample { outputs.select(0, n).reshape({m_outChannels, outPixels}) };
+            linalg::gemm(kernels, columnsView, outSample);
+
+            for (int c=0; c<m_outChannels; ++c)
+            {
+                double *channel { &outSample(c, 0) };
+                for (int p=0; p<outPixels; ++p)
+                {
+                    channel[p] = activation::apply(m_activationType, channel[p] + m_biases[c]);
+                }
+            }
+        }
+    });
+}
+
+void Conv2DLayer::backward(const batchMatrix &input, const batchMatrix &output,
+                           const batchMatrix &outputGrad, batchMatrix &inputGrad)
+{
+    /*
+    With dZ = outputGrad (Hadamard) f'(Z), per sample:
+        kernel gradient += dZ * columns^T
+        bias gradient   += row sums of dZ
+        input gradient   = col2im(kernels^T * dZ)
+    The kernel and bias gradients are a parallel reduction over the samples
+    (deterministic across thread counts when parallel::deterministicReductions()
+    is on); each sample's input gradient is written directly.
+    */
+
+    const int batchSize { input.numRows() };
+    const int outPixels { columnCols() };
+    inputGrad.resize(batchSize, getInputSize());
+    std::fill(inputGrad.getValues().begin(), inputGrad.getValues().end(), 0.0);
+
+    const int kernelSize { m_outChannels * columnRows() };
+    vector<double> gradients(kernelSize + m_outChannels); // Kernel gradients, then bias gradients.
+    const linalg::TensorView<const double> kernels { linalg::asView(m_kernels) };
+
+    parallel::parallelReduce(0, batchSize, GRADIENT_GRAIN, static_cast<int>(gradients.size()), [&](int sampleBegin, int sampleEnd, double *partial)
+    {
+        vector<double> columns(static_cast<size_t>(columnRows()) * outPixels);
+        vector<double> columnGrads(static_cast<size_t>(columnRows()) * outPixels);
+        vector<double> preActivationGrads(static_cast<size_t>(m_outChannels) * outPixels);
+        const linalg::TensorView<const double> columnsView(columns.data(), {columnRows(), outPixels});
+        const linalg::TensorView<double> columnGradsView(columnGrads.data(), {columnRows(), outPixels});
+        const linalg::TensorView<double> gradView(preActivationGrads.data(), {m_outChannels, outPixels});
+        const linalg::TensorView<double> kernelGradView(partial, {m_outChannels, columnRows()});
+        double *biasGrads { partial + kernelSize };
+
+        for (int n=sampleBegin; n<sampleEnd; ++n)
+        {
+            const double *outSample  { output.data() + static_cast<long>(n)*output.numCols() };
+            const double *gradSample { outputGrad.data() + static_cast<long>(n)*outputGrad.numCols() };
+            for (int c=0; c<m_outChannels; ++c)
+            {
+                double channelSum {0.0};
+                for (int p=0; p<outPixels; ++p)
+                {
+                    const int i { c*outPixels + p };
+                    preActivationGrads[i] = gradSample[i] * activation::derivativeFromOutput(m_activationType, outSample[i]);
+                    channelSum += preActivationGrads[i];
+                }
+                biasGrads[c] += channelSum;
+            }
+
+            im2col(input.data() + static_cast<long>(n)*input.numCols(), columns.data());
+            // Transposed operands are just permuted views; gemm picks the layout from the strides.
+            linalg::gemm(gradView, columnsView.transpose(), kernelGradView, 1.0, 1.0);
+            linalg::gemm(kernels.transpose(), gradView, columnGradsView);
+            col2im(columnGrads.data(), inputGrad.data() + static_cast<long>(n)*inputGrad.numCols());
+        }
+    }, gradients.data());
+
+    vector<double> &kernelGrads { m_kernelGrads.getValues() };
+    for (int i=0; i<kernelSize; ++i)
+    {
+        kernelGrads[i] += gradients[i];
+    }
+    for (int c=0; c<m_outChannels; ++c)
+    {
+        m_biasGrads[c] += gradients[kernelSize + c];
+    }
+}
+
+void Conv2DLayer::update(double learningCoefficient)
+{
+    vector<double> &kernels { m_kernels.getValues() };
+    vector<double> &kernelGrads { m_kernelGrads.getValues() };
+    for (size_t i=0; i<kernels.size(); ++i)
+    {
+        kernels[i] -= learningCoefficient * kernelGrads[i];
+        kernelGrads[i] = 0.0;
+    }
+    for (int c=0; c<m_outChannels; ++c)
+    {
+        m_biases[c] -= learningCoefficient * m_biasGrads[c];
+        m_biasGrads[c] = 0.0;
+    }
+}
+
+bool Conv2DLayer::foldAffine(const vector<double> &scale, const vector<double> &shift, Activation activationType)
+{
+    /*
+    f(scale*(W*x + b) + shift) = f((scale*W)*x + (scale*b + shift)), per output
+    channel. Only possible while the convolution itself is linear.
+    */
+
+    if (m_activationType != Activation::LINEAR)
+    {
+        return false;
+    }
+
+    for (int c=0; c<m_outChannels; ++c)
+    {
+        for (int i=0; i<columnRows(); ++i)
+        {
+            m_kernels(c,i) *= scale.at(c);
+        }
+        m_biases[c] = m_biases[c]*scale.at(c) + shift.at(c);
+    }
+    m_activationType = activationType;
+    return true;
+}
@@ -0,0 +1,110 @@
+#include "ml_models/DNN/dense_layer.hpp"
+#include "ml_models/DNN/activation.hpp"
+#include "math/gemm.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/numerical.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+DenseLayer::DenseLayer(int numInputs, int numOutputs, Activation activationType)
+{
+    m_numInputs      = numInputs;
+    m_numOutputs     = numOutputs;
+    m_activationType = activationType;
+
+    memtrack::Scope weightScope(memtrack::Subsystem::WEIGHTS);
+
+    // Uniform in [-limit, limit] for roughly unit-scale activations whatever the fan-in, as in Conv2DLayer.
+    m_weights.resize(m_numOutputs, m_numInputs);
+    const double limit { std::sqrt(6.0 / m_numInputs) };
+    for (double &weight : m_weights.getValues())
+    {
+        weight = (2*numerical::randomDouble() - 1) * limit;
+    }
+    m_biases.assign(m_numOutputs, 0.0);
+
+    memtrack::Scope gradientScope(memtrack::Subsystem::OPTIMIZER);
+    m_weightGrads = linalg::Matrix<double>(m_numOutputs, m_numInputs);
+    m_biasGrads.assign(m_numOutputs, 0.0);
+}
+
+DenseLayer::DenseLayer(const DenseLayer &other)
+    : m_numInputs(other.m_numInputs), m_numOutputs(other.m_numOutputs), m_activationType(other.m_activationType),
+      m_weights(other.m_weights), m_biases(other.m_biases), m_weightGrads(other.m_weightGrads), m_biasGrads(other.m_biasGrads)
+{
+}
+
+string DenseLayer::getName() const
+{
+    ostringstream name;
+    name << "Dense(" << m_numInputs << " -> " << m_numOutputs << ", autodiff)";
+    return name.str();
+}
+
+void DenseLayer::infer(const batchMatrix &input, batchMatrix &output) const
+{
+    linalg::gemm(input, false, m_weights, true, output);
+    for (int n=0; n<output.numRows(); ++n)
+    {
+        double *row { output.data() + static_cast<long>(n)*m_numOutputs };
+        for (int j=0; j<m_numOutputs; ++j)
+        {
+            row[j] = activation::apply(m_activationType, row[j] + m_biases[j]);
+        }
+    }
+}
+
+void DenseLayer::forward(const batchMatrix &input, batchMatrix &output)
+{
+    /*
+    The input is recorded as a parameter too, with m_inputGrads as its
+    gradient, so that backward() also yields the gradient to hand upstream.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+    m_inputGrads.resize(input.numRows(), input.numCols());
+    std::fill(m_inputGrads.getValues().begin(), m_inputGrads.getValues().end(), 0.0);
+
+    m_tape.reset();
+    const autodiff::Var X { m_tape.parameter(input.numRows(), input.numCols(), input.data(), m_inputGrads.data()) };
+    const autodiff::Var W { m_tape.parameter(m_weights, m_weightGrads) };
+    const autodiff::Var b { m_tape.parameter(1, m_numOutputs, m_biases.data(), m_biasGrads.data()) };
+    const autodiff::Var Z { m_tape.addRow(m_tape.matmul(X, W, true), b) };
+    switch (m_activationType)
+    {
+        case Activation::RELU:         m_output = m_tape.relu(Z); break;
+        case Activation::FAST_SIGMOID: m_output = m_tape.softsign(Z); break;
+        case Activation::LINEAR:       m_output = Z; break;
+        case Activation::TANH:
+        default:                       m_output = m_tape.tanh(Z);
+    }
+
+    output.resize(input.numRows(), m_numOutputs);
+    std::copy(m_output.value(), m_output.value() + output.size(), output.data());
+}
+
+void DenseLayer::backward(const batchMatrix &/*input*/, const batchMatrix &/*output*/,
+                          const batchMatrix &outputGrad, batchMatrix &inputGrad)
+{
+    m_tape.backward(m_output, outputGrad.data());
+    memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+    inputGrad = m_inputGrads;
+}
+
+void DenseLayer::update(double learningCoefficient)
+{
+    vector<double> &weights { m_weights.getValues() };
+    vector<double> &weightGrads { m_weightGrads.getValues() };
+    for (size_t i=0; i<weights.size(); ++i)
+    {
+        weights[i] -= learningCoefficient * weightGrads[i];
+        weightGrads[i] = 0.0;
+    }
+    for (int j=0; j<m_numOutputs; ++j)
+    {
+        m_biases[j] -= learningCoefficient * m_biasGrads[j];
+        m_biasGrads[j] = 0.0;
+    }
+}
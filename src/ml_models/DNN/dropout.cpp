@@ -0,0 +1,46 @@
+#include "ml_models/DNN/dropout.hpp"
+#include "math/numerical.hpp"
+#include "math/parallel.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+void DropoutMask::generate(uint64_t seed, uint64_t step, int numRows, int numCols, double rate)
+{
+    /*
+    Word w of row r is built from 16 counter-based draws, each compared
+    lane-wise against the keep threshold in its four 16-bit fields. The
+    loops carry no state between draws, so they vectorize and split
+    across threads freely.
+    */
+
+    m_wordsPerRow = (numCols + 63) / 64;
+    m_bits.resize(static_cast<size_t>(numRows) * m_wordsPerRow);
+    m_keepScale = 1.0 / (1.0 - rate);
+
+    const uint64_t threshold { static_cast<uint64_t>(std::lround((1.0 - rate) * 65536.0)) };
+    const uint64_t key { numerical::counterRandom(seed, step) };
+
+    parallel::parallelFor(0, numRows, [&](int rowBegin, int rowEnd)
+    {
+        for (int r=rowBegin; r<rowEnd; ++r)
+        {
+            for (int w=0; w<m_wordsPerRow; ++w)
+            {
+                const uint64_t counterBase { (static_cast<uint64_t>(r)*m_wordsPerRow + w) * 16 };
+                uint64_t word {0};
+                for (int draw=0; draw<16; ++draw)
+                {
+                    const uint64_t bits { numerical::counterRandom(key, counterBase + draw) };
+                    for (int lane=0; lane<4; ++lane)
+                    {
+                        const uint64_t uniform { (bits >> (16*lane)) & 0xFFFF };
+                        word |= static_cast<uint64_t>(uniform < threshold) << (4*draw + lane);
+                    }
+                }
+                m_bits[r*m_wordsPerRow + w] = word;
+            }
+        }
+    });
+}
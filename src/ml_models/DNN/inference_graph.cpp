@@ -0,0 +1,449 @@
+#include "ml_models/DNN/inference_graph.hpp"
+#include "ml_models/DNN/activation.hpp"
+#include "ml_models/DNN/batchnorm_layer.hpp"
+#include "ml_models/DNN/parameters.hpp"
+#include "math/gemm.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+InferenceGraph::InferenceGraph(const Network &network)
+{
+    /*
+    Builds the unfused graph: every operation predict() performs becomes
+    its own node.
+    */
+
+    for (int i=0; i<network.getNumFeatureLayers(); ++i)
+    {
+        const BatchLayer &layer { network.getFeatureLayer(i) };
+        const BatchNormLayer *batchNorm { dynamic_cast<const BatchNormLayer*>(&layer) };
+        if (batchNorm)
+        {
+            ElementwiseStep affine;
+            affine.op          = GraphOp::AFFINE;
+            affine.values      = batchNorm->getFoldedScale();
+            affine.shifts      = batchNorm->getFoldedShift();
+            affine.spatialSize = batchNorm->getOutputSize() / affine.values.size();
+            addElementwise(GraphOp::AFFINE, batchNorm->getOutputSize(), affine);
+
+            ElementwiseStep activation;
+            activation.op             = GraphOp::ACTIVATION;
+            activation.activationType = batchNorm->getActivationType();
+            addElementwise(GraphOp::ACTIVATION, batchNorm->getOutputSize(), activation);
+            continue;
+        }
+
+        GraphNode node;
+        node.op         = GraphOp::LAYER;
+        node.inputSize  = layer.getInputSize();
+        node.outputSize = layer.getOutputSize();
+        node.layer      = layer.clone();
+        m_nodes.push_back(std::move(node));
+    }
+
+    for (int l=0; l<network.getNumLayers(); ++l)
+    {
+        const Layer &layer { network.getLayer(l) };
+        if (l > 0)
+        {
+            GraphNode node;
+            node.op         = GraphOp::MATMUL;
+            node.inputSize  = network.getLayer(l-1).getSize();
+            node.outputSize = layer.getSize();
+            node.format     = network.getWeightFormat(l-1);
+            switch (node.format)
+            {
+                case linalg::SparseFormat::CSR: node.csrWeights = network.getCSRWeights(l-1); break;
+                case linalg::SparseFormat::BSR: node.bsrWeights = network.getBSRWeights(l-1); break;
+                default: node.weights = network.getWeightMatrix(l-1);
+            }
+            m_nodes.push_back(std::move(node));
+
+            if (const BatchNormLayer *batchNorm { network.getBatchNorm(l) })
+            {
+                ElementwiseStep affine;
+                affine.op          = GraphOp::AFFINE;
+                affine.values      = batchNorm->getFoldedScale();
+                affine.shifts      = batchNorm->getFoldedShift();
+                affine.spatialSize = 1;
+                addElementwise(GraphOp::AFFINE, layer.getSize(), affine);
+            }
+        }
+
+        ElementwiseStep bias;
+        bias.op     = GraphOp::BIAS_ADD;
+        bias.values = layer.getBiases();
+        addElementwise(GraphOp::BIAS_ADD, layer.getSize(), bias);
+
+        ElementwiseStep activation;
+        activation.op             = GraphOp::ACTIVATION;
+        activation.activationType = layer.getActivationType();
+        addElementwise(GraphOp::ACTIVATION, layer.getSize(), activation);
+    }
+}
+
+void InferenceGraph::addElementwise(GraphOp op, int size, const ElementwiseStep &step)
+{
+    GraphNode node;
+    node.op         = op;
+    node.inputSize  = size;
+    node.outputSize = size;
+    node.steps.push_back(step);
+    m_nodes.push_back(std::move(node));
+}
+
+bool InferenceGraph::isIdentity(const ElementwiseStep &step)
+{
+    switch (step.op)
+    {
+        case GraphOp::ACTIVATION:
+            return step.activationType == Activation::LINEAR;
+        case GraphOp::BIAS_ADD:
+            return std::all_of(step.values.begin(), step.values.end(), [](double b) { return b == 0.0; });
+        default:
+            return false;
+    }
+}
+
+void InferenceGraph::fuse()
+{
+    foldBatchNorms();
+    mergeElementwise();
+    fuseMatmulEpilogues();
+}
+
+void InferenceGraph::foldBatchNorms()
+{
+    /*
+    AFFINE, with the ACTIVATION right after it, folds into a preceding
+    feature layer that is still linear: f(s*(W*x + b) + t) = f(s*W*x + s*b + t).
+    */
+
+    for (size_t i=1; i<m_nodes.size(); ++i)
+    {
+        GraphNode &previous { m_nodes[i-1] };
+        if (m_nodes[i].op != GraphOp::AFFINE || previous.op != GraphOp::LAYER)
+        {
+            continue;
+        }
+        const ElementwiseStep &affine { m_nodes[i].steps.front() };
+        const bool hasActivation { i+1 < m_nodes.size() && m_nodes[i+1].op == GraphOp::ACTIVATION };
+        const Activation activationType { hasActivation ? m_nodes[i+1].steps.front().activationType : Activation::LINEAR };
+        if (previous.layer->foldAffine(affine.values, affine.shifts, activationType))
+        {
+            m_nodes.erase(m_nodes.begin() + i, m_nodes.begin() + i + (hasActivation ? 2 : 1));
+            --i;
+        }
+    }
+}
+
+void InferenceGraph::mergeElementwise()
+{
+    /*
+    Each run of consecutive elementwise nodes becomes one ELEMENTWISE node
+    holding their non-identity steps; a run with none left is removed.
+    */
+
+    vector<GraphNode> merged;
+    for (GraphNode &node : m_nodes)
+    {
+        if (!isElementwise(node.op))
+        {
+            merged.push_back(std::move(node));
+            continue;
+        }
+        if (merged.empty() || merged.back().op != GraphOp::ELEMENTWISE)
+        {
+            GraphNode chain;
+            chain.op         = GraphOp::ELEMENTWISE;
+            chain.inputSize  = node.inputSize;
+            chain.outputSize = node.outputSize;
+            merged.push_back(std::move(chain));
+        }
+        for (const ElementwiseStep &step : node.steps)
+        {
+            if (!isIdentity(step))
+            {
+                merged.back().steps.push_back(step);
+            }
+        }
+    }
+
+    m_nodes.clear();
+    for (GraphNode &node : merged)
+    {
+        if (node.op != GraphOp::ELEMENTWISE || !node.steps.empty())
+        {
+            m_nodes.push_back(std::move(node));
+        }
+    }
+}
+
+void InferenceGraph::fuseMatmulEpilogues()
+{
+    for (size_t i=1; i<m_nodes.size(); ++i)
+    {
+        if (m_nodes[i].op == GraphOp::ELEMENTWISE && m_nodes[i-1].op == GraphOp::MATMUL)
+        {
+            m_nodes[i-1].op    = GraphOp::FUSED_MATMUL;
+            m_nodes[i-1].steps = std::move(m_nodes[i].steps);
+            m_nodes.erase(m_nodes.begin() + i);
+            --i;
+        }
+    }
+}
+
+void InferenceGraph::applySteps(const vector<ElementwiseStep> &steps, double *values, int numRows, int numCols,
+                                int ld, int firstCol)
+{
+    /*
+    Runs the whole chain over one row before moving to the next, so each
+    row segment is read from memory once and stays in L1 between steps,
+    while each step is still a simple loop the compiler can vectorize.
+    */
+
+    for (int n=0; n<numRows; ++n)
+    {
+        double *row { values + static_cast<long>(n)*ld };
+        for (const ElementwiseStep &step : steps)
+        {
+            switch (step.op)
+            {
+                case GraphOp::BIAS_ADD:
+                {
+                    const double *biases { step.values.data() + firstCol };
+                    for (int j=0; j<numCols; ++j)
+                    {
+                        row[j] += biases[j];
+                    }
+                    break;
+                }
+                case GraphOp::AFFINE:
+                    for (int j=0; j<numCols; ++j)
+                    {
+                        const int channel { (firstCol + j) / step.spatialSize };
+                        row[j] = step.values[channel] * row[j] + step.shifts[channel];
+                    }
+                    break;
+                case GraphOp::ACTIVATION:
+                    for (int j=0; j<numCols; ++j)
+                    {
+                        row[j] = activation::apply(step.activationType, row[j]);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+void InferenceGraph::predict(const batchMatrix &inputs, batchMatrix &outputs) const
+{
+    /*
+    Runs the nodes in order, alternating between two buffers; elementwise
+    nodes work in place.
+    */
+
+    batchMatrix buffers[2];
+    buffers[0] = inputs;
+    int current {0};
+    const int batchSize { inputs.numRows() };
+
+    for (const GraphNode &node : m_nodes)
+    {
+        batchMatrix &input { buffers[current] };
+        batchMatrix &output { buffers[1-current] };
+        switch (node.op)
+        {
+            case GraphOp::LAYER:
+                node.layer->infer(input, output);
+                current = 1-current;
+                break;
+            case GraphOp::MATMUL:
+            case GraphOp::FUSED_MATMUL:
+            {
+                const bool fused { node.op == GraphOp::FUSED_MATMUL };
+                if (node.format == linalg::SparseFormat::DENSE)
+                {
+                    output.resize(batchSize, node.outputSize);
+                    linalg::GemmEpilogue epilogue;
+                    if (fused)
+                    {
+                        epilogue = [&node](int /*i0*/, int j0, int mc, int nc, double *cTile, int ldc)
+                        {
+                            applySteps(node.steps, cTile, mc, nc, ldc, j0);
+                        };
+                    }
+                    linalg::gemm(false, true, batchSize, node.outputSize, node.inputSize, 1.0,
+                                 input.data(), input.numCols(), node.weights.data(), node.weights.numCols(),
+                                 0.0, output.data(), output.numCols(), epilogue);
+                }
+                else
+                {
+                    // The sparse kernels have no epilogue; the chain still runs as one pass.
+                    if (node.format == linalg::SparseFormat::CSR)
+                    {
+                        linalg::spmm(node.csrWeights, input, output);
+                    }
+                    else
+                    {
+                        linalg::spmm(node.bsrWeights, input, output);
+                    }
+                    if (fused)
+                    {
+                        parallel::parallelFor(0, batchSize, [&](int rowBegin, int rowEnd)
+                        {
+                            applySteps(node.steps, output.data() + static_cast<long>(rowBegin)*output.numCols(),
+                                       rowEnd - rowBegin, output.numCols(), output.numCols(), 0);
+                        });
+                    }
+                }
+                current = 1-current;
+                break;
+            }
+            default:
+                parallel::parallelFor(0, batchSize, [&](int rowBegin, int rowEnd)
+                {
+                    applySteps(node.steps, input.data() + static_cast<long>(rowBegin)*input.numCols(),
+                               rowEnd - rowBegin, input.numCols(), input.numCols(), 0);
+                });
+        }
+    }
+    outputs = std::move(buffers[current]);
+}
+
+size_t InferenceGraph::GraphNode::parameterBytes() const
+{
+    size_t bytes {0};
+    switch (format)
+    {
+        case linalg::SparseFormat::CSR: bytes += csrWeights.bytes(); break;
+        case linalg::SparseFormat::BSR: bytes += bsrWeights.bytes(); break;
+        default: bytes += weights.size() * sizeof(double);
+    }
+    for (const ElementwiseStep &step : steps)
+    {
+        bytes += (step.values.size() + step.shifts.size()) * sizeof(double);
+    }
+    return bytes;
+}
+
+size_t InferenceGraph::trafficBytes(int batchSize) const
+{
+    /*
+    Lower bound on the bytes one batch moves through memory: every node
+    reads its input and writes its output once (elementwise nodes read and
+    write the same buffer) and reads its parameters once. Traffic inside
+    opaque layers, such as im2col buffers, isn't counted.
+    */
+
+    size_t bytes {0};
+    for (const GraphNode &node : m_nodes)
+    {
+        bytes += static_cast<size_t>(batchSize) * (node.inputSize + node.outputSize) * sizeof(double);
+        bytes += node.parameterBytes();
+    }
+    return bytes;
+}
+
+string InferenceGraph::GraphNode::describe() const
+{
+    ostringstream description;
+    switch (op)
+    {
+        case GraphOp::LAYER:        description << layer->getName(); break;
+        case GraphOp::MATMUL:       description << "MatMul"; break;
+        case GraphOp::FUSED_MATMUL: description << "FusedMatMul"; break;
+        case GraphOp::BIAS_ADD:     description << "BiasAdd"; break;
+        case GraphOp::AFFINE:       description << "Affine"; break;
+        case GraphOp::ACTIVATION:   description << "Activation"; break;
+        case GraphOp::ELEMENTWISE:  description << "Elementwise"; break;
+    }
+    description << " (" << inputSize << " -> " << outputSize;
+    if (op == GraphOp::MATMUL || op == GraphOp::FUSED_MATMUL)
+    {
+        description << (format == linalg::SparseFormat::CSR ? ", CSR" : format == linalg::SparseFormat::BSR ? ", BSR" : "");
+    }
+    if (op == GraphOp::ELEMENTWISE || op == GraphOp::FUSED_MATMUL)
+    {
+        description << ", " << steps.size() << " fused step" << (steps.size() == 1 ? "" : "s");
+    }
+    description << ")";
+    return description.str();
+}
+
+void InferenceGraph::printToConsole() const
+{
+    cout << "Inference graph of " << m_nodes.size() << " nodes:" << endl;
+    for (size_t i=0; i<m_nodes.size(); ++i)
+    {
+        cout << "  " << i << ": " << m_nodes[i].describe() << endl;
+    }
+    cout << endl;
+}
+
+namespace
+{
+    template <class Predict>
+    double medianSeconds(int repetitions, Predict predict)
+    {
+        predict(); // warm-up
+        vector<double> seconds(std::max(1, repetitions));
+        for (double &time : seconds)
+        {
+            const auto start { chrono::steady_clock::now() };
+            predict();
+            time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+        std::nth_element(seconds.begin(), seconds.begin() + seconds.size()/2, seconds.end());
+        return seconds[seconds.size()/2];
+    }
+}
+
+FusionReport InferenceGraph::benchmarkFusion(const Network &network, const batchMatrix &inputs, int repetitions)
+{
+    InferenceGraph unfused(network);
+    InferenceGraph fused(network);
+    fused.fuse();
+
+    FusionReport report;
+    report.batchSize   = inputs.numRows();
+    report.nodesBefore = unfused.numNodes();
+    report.nodesAfter  = fused.numNodes();
+    report.bytesBefore = unfused.trafficBytes(report.batchSize);
+    report.bytesAfter  = fused.trafficBytes(report.batchSize);
+
+    batchMatrix unfusedOutputs, fusedOutputs, predictOutputs;
+    report.secondsBefore  = medianSeconds(repetitions, [&]() { unfused.predict(inputs, unfusedOutputs); });
+    report.secondsAfter   = medianSeconds(repetitions, [&]() { fused.predict(inputs, fusedOutputs); });
+    report.predictSeconds = medianSeconds(repetitions, [&]() { network.predict(inputs, predictOutputs); });
+
+    report.maxOutputDifference = 0.0;
+    for (int i=0; i<fusedOutputs.size(); ++i)
+    {
+        report.maxOutputDifference = std::max(report.maxOutputDifference,
+                                              std::abs(fusedOutputs.getValues()[i] - unfusedOutputs.getValues()[i]));
+    }
+    return report;
+}
+
+void FusionReport::printToConsole() const
+{
+    cout << "Fusion report (batch of " << batchSize << ")" << endl
+         << "Graph nodes:     " << nodesBefore << " unfused, " << nodesAfter << " fused" << endl
+         << "Memory traffic:  " << bytesBefore << " B unfused, " << bytesAfter << " B fused ("
+         << (bytesAfter ? double(bytesBefore) / bytesAfter : 0.0) << "x less)" << endl
+         << "Inference time:  " << secondsBefore << " s unfused, " << secondsAfter << " s fused ("
+         << (secondsAfter > 0 ? secondsBefore / secondsAfter : 0.0) << "x), Network::predict " << predictSeconds << " s" << endl
+         << "Max output difference: " << maxOutputDifference << endl << endl;
+}
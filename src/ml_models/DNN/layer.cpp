@@ -91,6 +91,21 @@ vector<double> Layer::getDerivatives() const {
     return derivativesVector;  
 }
 
+vector<double> Layer::getBiases() const {
+    /*
+    Returns the bias of each neuron in the layer.
+    */
+
+    vector<double> biasesVector;
+
+    for (int neuronIndex=0; neuronIndex<m_numNeurons; ++neuronIndex)
+    {
+        biasesVector.push_back(m_neurons.at(neuronIndex).getBias());
+    }
+
+    return biasesVector;
+}
+
 double Layer::getActivationAt(int neuronIndex) const
 {
     return m_neurons.at(neuronIndex).getActivation();
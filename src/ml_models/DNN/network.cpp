@@ -1,10 +1,27 @@
 #include "ml_models/DNN/network.hpp"
+#include "ml_models/DNN/activation.hpp"
+#include "ml_models/DNN/batchnorm_layer.hpp"
+#include "ml_models/DNN/checkpoint_writer.hpp"
 #include "ml_models/DNN/parameters.hpp"
+#include "math/gemm.hpp"
 #include "math/linearalgebra.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/numa.hpp"
 #include "math/numerical.hpp"
+#include "math/parallel.hpp"
+#include "math/profiler.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <ctime>
+#include <deque>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 
@@ -12,14 +29,17 @@ using namespace std;
 
 Network::Network(vector<int> &layerSizes, vector<Activation> &activationTypes)
 {
+    memtrack::Scope scope(memtrack::Subsystem::WEIGHTS);
     m_layerSizes = layerSizes;
     m_numLayers = layerSizes.size();
-    
-    m_errors.resize(m_numLayers-1);
-    for (int l=0; l<m_numLayers-1; ++l)
-    {
-        m_errors.at(l).resize(m_layerSizes.at(l+1));
-    }
+    m_dropoutRates.assign(m_numLayers, 0.0);
+    m_batchNorms.resize(m_numLayers);
+    m_pruning.assign(m_numLayers-1, PruningSchedule());
+    m_pruningMasks.assign(m_numLayers-1, vector<uint8_t>());
+    m_weightFormats.assign(m_numLayers-1, linalg::SparseFormat::DENSE);
+    m_csrWeights.assign(m_numLayers-1, linalg::CSRMatrix());
+    m_bsrWeights.assign(m_numLayers-1, linalg::BSRMatrix());
+    allocateBatchBuffers();
 
     for (int layerNum=0; layerNum<m_numLayers; ++layerNum)
     { 
@@ -38,6 +58,14 @@ Network::Network(vector<int> &layerSizes, vector<Activation> &activationTypes)
             )
         );
 
+        // Spread the weights over [-limit, limit] so that wide layers (such as
+        // convolution features) don't saturate the next layer from the start.
+        const double limit { sqrt(6.0 / layerSizes.at(layerNum)) };
+        for (double &weight : m_weightMatrices.back().getValues())
+        {
+            weight = (2*weight - 1) * limit;
+        }
+
         for (int neuronIndex=0; neuronIndex<m_layers.at(layerNum+1).getSize(); ++neuronIndex)
         { // randomly initialize neuron biases in the hidden and output layers
             m_layers.at(layerNum+1).setBiasAt(neuronIndex, double{numerical::randomDouble()});
@@ -45,6 +73,75 @@ Network::Network(vector<int> &layerSizes, vector<Activation> &activationTypes)
     }
 }
 
+Network::Network(const Network &other)
+{
+    /*
+    Deep copy: parameters, feature layers and settings are copied,
+    minibatch buffers start out empty.
+    */
+
+    m_batchSize      = other.m_batchSize;
+    m_checkpointInterval = other.m_checkpointInterval;
+    m_layerSizes     = other.m_layerSizes;
+    m_numLayers      = other.m_numLayers;
+    m_dropoutRates   = other.m_dropoutRates;
+    m_dropoutSeed    = other.m_dropoutSeed;
+    m_trainingStep   = other.m_trainingStep;
+    m_pruning        = other.m_pruning;
+    m_input          = other.m_input;
+    m_targetOutput   = other.m_targetOutput;
+    restoreParameters(other);
+}
+
+void Network::restoreParameters(const Network &snapshot)
+{
+    /*
+    Copies the learned state of a network with the same structure: weights,
+    biases, batch norms, feature layers, pruning masks and sparse weight copies.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::WEIGHTS);
+    m_layers         = snapshot.m_layers;
+    m_weightMatrices = snapshot.m_weightMatrices;
+    m_pruningMasks   = snapshot.m_pruningMasks;
+    m_weightFormats  = snapshot.m_weightFormats;
+    m_csrWeights     = snapshot.m_csrWeights;
+    m_bsrWeights     = snapshot.m_bsrWeights;
+    m_batchNorms.clear();
+    for (const unique_ptr<BatchNormLayer> &batchNorm : snapshot.m_batchNorms)
+    {
+        m_batchNorms.emplace_back(batchNorm ? new BatchNormLayer(*batchNorm) : nullptr);
+    }
+    m_featureLayers.clear();
+    for (const unique_ptr<BatchLayer> &layer : snapshot.m_featureLayers)
+    {
+        m_featureLayers.push_back(layer->clone());
+    }
+    allocateBatchBuffers();
+}
+
+void Network::allocateBatchBuffers()
+{
+    /*
+    Creates one (empty) minibatch buffer per layer; they are sized on first use.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+    m_errors.assign(m_numLayers-1, batchMatrix());
+    m_activations.assign(m_numLayers, batchMatrix());
+    m_derivatives.assign(m_numLayers, batchMatrix());
+    m_dropoutMasks.assign(m_numLayers, DropoutMask());
+    memtrack::Scope gradientScope(memtrack::Subsystem::OPTIMIZER);
+    m_weightGradients.assign(m_numLayers-1, weightMatrix());
+    m_biasGradients.resize(m_numLayers-1);
+    for (int l=0; l<m_numLayers-1; ++l)
+    {
+        m_biasGradients.at(l).assign(m_layerSizes.at(l+1), 0.0);
+    }
+    m_featureOutputs.assign(m_featureLayers.size(), batchMatrix());
+    m_featureGrads.assign(m_featureLayers.size(), batchMatrix());
+}
+
 void Network::setInput(vector<double> &input)
 {
     /*
@@ -59,175 +156,1228 @@ void Network::setInput(vector<double> &input)
     }
 }
 
+void Network::addFeatureLayer(unique_ptr<BatchLayer> layer)
+{
+    /*
+    Appends a batched layer to the feature stack. Its input size must match
+    the output size of the previous feature layer.
+    */
+
+    if (!m_featureLayers.empty() && m_featureLayers.back()->getOutputSize() != layer->getInputSize())
+    {
+        cerr << "Feature layer " << m_featureLayers.back()->getName() << " outputs " << m_featureLayers.back()->getOutputSize() << " values," << endl
+        << "...but " << layer->getName() << " expects " << layer->getInputSize() << "!" << endl;
+        assert(false);
+    }
+
+    m_featureLayers.push_back(std::move(layer));
+    m_featureOutputs.resize(m_featureLayers.size());
+    m_featureGrads.resize(m_featureLayers.size());
+}
+
+void Network::setBatchSize(int batchSize)
+{
+    m_batchSize = std::max(1, batchSize);
+}
+
+void Network::setDropout(int layerNum, double rate)
+{
+    /*
+    Enables inverted dropout on the activations of a dense layer: during
+    training each one is zeroed with probability 'rate' and the survivors are
+    scaled by 1/(1-rate), so inference needs no rescaling and skips dropout
+    altogether. The output layer can't be dropped.
+    */
+
+    if (layerNum < 0 || layerNum >= m_numLayers-1 || rate < 0.0 || rate >= 1.0)
+    {
+        cerr << "Dropout rate " << rate << " on layer " << layerNum << " isn't valid!" << endl
+        << "...layers 0 to " << m_numLayers-2 << " accept rates in [0, 1)." << endl;
+        assert(false);
+    }
+    m_dropoutRates.at(layerNum) = rate;
+}
+
+void Network::setBatchNorm(int layerNum, bool enabled)
+{
+    /*
+    Batch normalizes the weighted inputs of a dense layer over each
+    minibatch, neuron by neuron, before its biases and activation:
+        A_{l} = f(BN(A_{l-1} * W_{l-1}^T) + b_{l})
+    predict() uses the running statistics, and inferenceModel() folds them
+    into the weight matrix rows and the biases. The batch norm's own
+    parameters aren't part of numParameters() (as with feature layers).
+    */
+
+    if (layerNum < 1 || layerNum >= m_numLayers)
+    {
+        cerr << "Batch norm on layer " << layerNum << " isn't valid!" << endl
+        << "...layers 1 to " << m_numLayers-1 << " can be normalized." << endl;
+        assert(false);
+    }
+    memtrack::Scope scope(memtrack::Subsystem::WEIGHTS);
+    m_batchNorms.at(layerNum).reset(enabled ? new BatchNormLayer(m_layerSizes.at(layerNum), 1) : nullptr);
+}
+
+void Network::setPruning(int layerNum, double finalSparsity, int beginBatch, int endBatch, int frequency, int blockSize)
+{
+    /*
+    Iterative magnitude pruning of the weights from layer layerNum to
+    layerNum+1. Every 'frequency' batches between beginBatch and endBatch
+    (counted from the first batch this network trained on), the blocks with
+    the smallest mean absolute weight are zeroed and stay zeroed, with the
+    pruned fraction rising along the cubic schedule
+        s(t) = finalSparsity * (1 - (1 - (t - beginBatch)/(endBatch - beginBatch))^3)
+    so most of the pruning happens early, while the network can recover.
+    Blocks larger than 1x1 give block-sparse weights that run in BSR format.
+    */
+
+    if (layerNum < 0 || layerNum >= m_numLayers-1 || finalSparsity < 0.0 || finalSparsity >= 1.0
+        || endBatch < beginBatch || frequency < 1 || blockSize < 1 || blockSize > linalg::BSR_MAX_BLOCK)
+    {
+        cerr << "Invalid pruning schedule for the weights of layer " << layerNum << "!" << endl;
+        assert(false);
+    }
+
+    PruningSchedule &schedule { m_pruning.at(layerNum) };
+    schedule.finalSparsity = finalSparsity;
+    schedule.beginBatch    = beginBatch;
+    schedule.endBatch      = endBatch;
+    schedule.frequency     = frequency;
+    schedule.blockSize     = blockSize;
+}
+
+double Network::getWeightDensity(int layerNum) const
+{
+    const double size { double(m_layerSizes.at(layerNum)) * m_layerSizes.at(layerNum+1) };
+    switch (m_weightFormats.at(layerNum))
+    {
+        case linalg::SparseFormat::CSR:
+            return m_csrWeights.at(layerNum).numNonZeros() / size;
+        case linalg::SparseFormat::BSR:
+        {
+            const vector<double> &values { m_bsrWeights.at(layerNum).getValues() };
+            return (values.size() - std::count(values.begin(), values.end(), 0.0)) / size;
+        }
+        default:
+        {
+            const vector<double> &values { m_weightMatrices.at(layerNum).getValues() };
+            return (values.size() - std::count(values.begin(), values.end(), 0.0)) / size;
+        }
+    }
+}
+
+int Network::getInputSize() const
+{
+    return m_featureLayers.empty() ? m_layerSizes.front() : m_featureLayers.front()->getInputSize();
+}
+
+void Network::loadBatch(const vector<vector<vector<double>>> &data, int first, int count)
+{
+    /*
+    Copies the inputs and targets of samples first to first+count-1
+    into the rows of the minibatch matrices.
+    */
+
+    const int inputSize  { getInputSize() };
+    const int outputSize { m_layerSizes.back() };
+    m_batchInput.resize(count, inputSize);
+    m_batchTargets.resize(count, outputSize);
+
+    for (int n=0; n<count; ++n)
+    {
+        const vector<double> &input  { data.at(first+n).at(0) };
+        const vector<double> &target { data.at(first+n).at(1) };
+        std::copy(input.begin(),  input.begin()  + inputSize,  m_batchInput.data()   + n*inputSize);
+        std::copy(target.begin(), target.begin() + outputSize, m_batchTargets.data() + n*outputSize);
+    }
+}
+
+void Network::activateLayer(int layerNum, batchMatrix &values, batchMatrix *derivatives, const DropoutMask *mask) const
+{
+    /*
+    Adds the biases of layer layerNum to each row of 'values' and applies the
+    layer's activation in place, storing the activation derivatives alongside
+    when 'derivatives' is given. With a dropout mask, dropped values and their
+    derivatives are zeroed and kept ones scaled in the same pass, so the
+    backward pass needs no separate masking step.
+    */
+
+    const vector<double> biases { m_layers.at(layerNum).getBiases() };
+    const Activation type { m_layers.at(layerNum).getActivationType() };
+    const int numCols { values.numCols() };
+    if (derivatives)
+    {
+        derivatives->resize(values.numRows(), numCols);
+    }
+
+    for (int n=0; n<values.numRows(); ++n)
+    {
+        double *row { values.data() + static_cast<long>(n)*numCols };
+        double *derivativeRow { derivatives ? derivatives->data() + static_cast<long>(n)*numCols : nullptr };
+        const uint64_t *maskBits { mask ? mask->rowBits(n) : nullptr };
+
+        for (int j=0; j<numCols; ++j)
+        {
+            const double input { row[j] + biases[j] };
+            const double output { activation::apply(type, input) };
+            const double scale { maskBits ? ((maskBits[j/64] >> (j%64)) & 1) * mask->getKeepScale() : 1.0 };
+            row[j] = scale * output;
+            if (derivativeRow)
+            {
+                derivativeRow[j] = scale * activation::derivative(type, input, output);
+            }
+        }
+    }
+}
+
+void Network::normalizeLayer(int layerNum, batchMatrix &values) const
+{
+    const BatchNormLayer *batchNorm { m_batchNorms.at(layerNum).get() };
+    if (!batchNorm)
+    {
+        return;
+    }
+    const vector<double> scale { batchNorm->getFoldedScale() };
+    const vector<double> shift { batchNorm->getFoldedShift() };
+    for (int n=0; n<values.numRows(); ++n)
+    {
+        double *row { values.data() + static_cast<long>(n)*values.numCols() };
+        for (int j=0; j<values.numCols(); ++j)
+        {
+            row[j] = scale[j]*row[j] + shift[j];
+        }
+    }
+}
+
+void Network::activateSparseInput(linalg::CSRMatrix &inputs, const DropoutMask *mask) const
+{
+    /*
+    The input layer's activation on a sparse batch. Input neurons have no
+    bias and every activation maps 0 to 0, so only the stored nonzeros
+    change and the batch stays sparse.
+    */
+
+    const Activation type { m_layers.at(0).getActivationType() };
+    const vector<int> &rowPointers { inputs.getRowPointers() };
+    const vector<int> &columns { inputs.getColumnIndices() };
+    vector<double> &values { inputs.getValues() };
+    for (int n=0; n<inputs.numRows(); ++n)
+    {
+        for (int p=rowPointers[n]; p<rowPointers[n+1]; ++p)
+        {
+            const double scale { mask ? mask->keep(n, columns[p]) * mask->getKeepScale() : 1.0 };
+            values[p] = scale * activation::apply(type, values[p]);
+        }
+    }
+}
+
 void Network::feedForward()
 {
     /*
-    Implements the feedforward algorithm.
+    Implements the feedforward algorithm for the whole minibatch:
+    feature layers first, then for each pair of dense layers
+    A_{l+1} = f(A_l * W_l^T + b_{l+1}).
+    With checkpointing, the activations and derivatives of layers between
+    checkpoints are released as soon as the next layer has been computed.
     */
 
-    for (int layerNum=0; layerNum<(m_layers.size()-1); ++layerNum) // for the input to penultimate layer
+    profiler::Region region("feedForward", m_batchInput.numRows());
+    const batchMatrix *layerInput { &m_batchInput };
+    for (size_t i=0; i<m_featureLayers.size(); ++i)
     {
-        vector<double> currentLayerOutputs { m_layers.at(layerNum).getActivations() };
-        vector<double> nextLayerInputs { m_weightMatrices.at(layerNum) * currentLayerOutputs };
+        m_featureLayers[i]->forward(*layerInput, m_featureOutputs[i]);
+        layerInput = &m_featureOutputs[i];
+    }
 
-        for (int neuronNum=0; neuronNum<nextLayerInputs.size(); ++neuronNum)
-        {// set the inputs of the next layer, with bias
-            m_layers.at(layerNum+1).setInputAt(neuronNum, nextLayerInputs.at(neuronNum));
+    const int batchSize { m_batchTargets.numRows() };
+    for (int layerNum=0; layerNum<m_numLayers-1; ++layerNum)
+    {
+        if (m_dropoutRates.at(layerNum) > 0.0)
+        {
+            m_dropoutMasks.at(layerNum).generate(numerical::counterRandom(m_dropoutSeed, layerNum), m_trainingStep,
+                                                 batchSize, m_layerSizes.at(layerNum), m_dropoutRates.at(layerNum));
         }
+    }
+
+    if (m_sparseBatch)
+    {
+        // Sparse inputs go straight into the first weight matrix; A_0 is never made dense.
+        activateSparseInput(m_sparseBatchInput, dropoutMaskOf(0));
+    }
+    else
+    {
+        m_activations.at(0) = *layerInput;
+        activateLayer(0, m_activations.at(0), &m_derivatives.at(0), dropoutMaskOf(0));
+    }
 
+    for (int layerNum=0; layerNum<m_numLayers-1; ++layerNum) // for the input to penultimate layer
+    {
+        forwardLayer(layerNum);
+        if (!isCheckpoint(layerNum))
+        {
+            releaseLayer(layerNum);
+        }
     }
+    trackBufferBytes();
 }
 
-void Network::backPropagate(bool isNewBatch)
+void Network::forwardLayer(int layerNum, bool recompute)
 {
     /*
-    Implements backpropagation using quadratic cost function,
-    with derivative (activation - target value).
+    Computes the activations and derivatives of layer layerNum+1 from those
+    of layer layerNum (or from the sparse minibatch, for the input layer).
+    Dropout reuses the masks drawn for this minibatch, so recomputing a
+    layer reproduces it exactly; a recomputed batch norm leaves its running
+    statistics alone.
+    */
+
+    if (layerNum == 0 && m_sparseBatch)
+    {
+        linalg::spmmSparseInput(m_sparseBatchInput, m_weightMatrices.at(0), m_activations.at(1));
+    }
+    else
+    {
+        linalg::gemm(m_activations.at(layerNum), false, m_weightMatrices.at(layerNum), true, m_activations.at(layerNum+1));
+    }
+    if (BatchNormLayer *batchNorm { m_batchNorms.at(layerNum+1).get() })
+    {
+        memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+        batchNorm->forward(m_activations.at(layerNum+1), m_batchNormScratch, !recompute);
+        std::swap(m_activations.at(layerNum+1), m_batchNormScratch);
+    }
+    activateLayer(layerNum+1, m_activations.at(layerNum+1), &m_derivatives.at(layerNum+1), dropoutMaskOf(layerNum+1));
+}
+
+const DropoutMask* Network::dropoutMaskOf(int layerNum) const
+{
+    return m_dropoutRates.at(layerNum) > 0.0 ? &m_dropoutMasks.at(layerNum) : nullptr;
+}
+
+bool Network::isCheckpoint(int layerNum) const
+{
+    return layerNum % m_checkpointInterval == 0 || layerNum == m_numLayers-1;
+}
+
+void Network::releaseLayer(int layerNum)
+{
+    m_activations.at(layerNum) = batchMatrix();
+    m_derivatives.at(layerNum) = batchMatrix();
+}
+
+void Network::trackBufferBytes()
+{
+    /*
+    Records the memory held by the dense stack's minibatch buffers
+    (activations, derivatives and errors), keeping the peak.
+    */
+
+    size_t bytes {0};
+    for (int l=0; l<m_numLayers; ++l)
+    {
+        bytes += (m_activations.at(l).size() + m_derivatives.at(l).size()) * sizeof(double);
+    }
+    for (const batchMatrix &error : m_errors)
+    {
+        bytes += error.size() * sizeof(double);
+    }
+    m_peakBufferBytes = std::max(m_peakBufferBytes, bytes);
+}
+
+void Network::setCheckpointInterval(int interval)
+{
+    /*
+    Gradient checkpointing for the dense stack: only every interval-th
+    layer (and the output layer) keeps its activations through the forward
+    pass. backPropagate() recomputes the layers in between one segment at a
+    time, so activation memory falls from L layers to about L/interval +
+    interval, at the cost of roughly one more forward pass. 1 turns it off.
+    */
+
+    m_checkpointInterval = std::max(1, interval);
+}
+
+void Network::setAutoSave(CheckpointWriter *writer, int intervalBatches)
+{
+    m_autoSave = intervalBatches > 0 ? writer : nullptr;
+    m_autoSaveInterval = intervalBatches;
+}
+
+size_t Network::numParameters() const
+{
+    size_t count {0};
+    for (int l=0; l<m_numLayers-1; ++l)
+    {
+        count += size_t(m_layerSizes.at(l+1)) * (m_layerSizes.at(l) + 1);
+    }
+    return count;
+}
+
+void Network::copyParameters(double *destination) const
+{
+    /*
+    Weight matrices are copied whole; the biases are gathered from the
+    neurons. Networks holding some weights in sparse format only (see
+    inferenceModel()) have no dense copy to save.
     */
 
-    // Compute the output error: equal to ( grad the vector of quadratic costs for
-    // each neuron, Hadamard product the vector of derivatives of the output neurons ).
-    vector<double> gradCost;
-    vector<double> output {m_layers.back().getActivations()};
-    vector<double> outputDerivatives {m_layers.back().getDerivatives()};
-    
-    for(int i=0; i<m_layers.back().getSize(); ++i)
+    for (const weightMatrix &weights : m_weightMatrices)
     {
-        gradCost.push_back(output.at(i) - m_targetOutput.at(i));
+        assert(weights.size() > 0);
+        std::copy(weights.data(), weights.data() + weights.size(), destination);
+        destination += weights.size();
     }
-    // Output error
-    if (isNewBatch)
+    for (int layerNum=1; layerNum<m_numLayers; ++layerNum)
     {
-        m_errors.at(m_numLayers-2) = linalg::hadamardProduct(gradCost, outputDerivatives);
+        const Layer &layer { m_layers.at(layerNum) };
+        for (int neuronIndex=0; neuronIndex<layer.getSize(); ++neuronIndex)
+        {
+            *destination++ = layer.getBiasAt(neuronIndex);
+        }
+    }
+}
+
+void Network::loadParameters(const double *source)
+{
+    memtrack::Scope scope(memtrack::Subsystem::WEIGHTS);
+    for (int l=0; l<m_numLayers-1; ++l)
+    {
+        weightMatrix &weights { m_weightMatrices.at(l) };
+        weights.resize(m_layerSizes.at(l+1), m_layerSizes.at(l));
+        std::copy(source, source + weights.size(), weights.data());
+        source += weights.size();
+    }
+    for (int layerNum=1; layerNum<m_numLayers; ++layerNum)
+    {
+        Layer &layer { m_layers.at(layerNum) };
+        for (int neuronIndex=0; neuronIndex<layer.getSize(); ++neuronIndex)
+        {
+            layer.setBiasAt(neuronIndex, *source++);
+        }
+    }
+    refreshSparseWeights();
+}
+
+void Network::predict(const batchMatrix &inputs, batchMatrix &outputs) const
+{
+    /*
+    Inference-only forward pass over a batch of inputs (one per row), leaving
+    the network untouched: feature layers run in inference mode, dropout is
+    skipped, and nothing is kept for backpropagation. Pruned weight matrices
+    are multiplied in their sparse format.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+    batchMatrix features[2];
+    const batchMatrix *layerInput { &inputs };
+    for (size_t i=0; i<m_featureLayers.size(); ++i)
+    {
+        batchMatrix &layerOutput { features[i % 2] };
+        m_featureLayers[i]->infer(*layerInput, layerOutput);
+        layerInput = &layerOutput;
+    }
+
+    batchMatrix activations { *layerInput };
+    activateLayer(0, activations, nullptr);
+    forwardDense(activations, outputs, 0);
+}
+
+void Network::predict(const linalg::CSRMatrix &inputs, batchMatrix &outputs) const
+{
+    /*
+    Inference on sparse inputs: the first layer only reads the weight
+    columns of nonzero inputs. A pruned inference model keeps the first
+    layer only in CSR or BSR, whose columns can't be gathered, so there the
+    batch is expanded to dense rows for the pruned kernel instead.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+    if (!m_featureLayers.empty() || inputs.numCols() != m_layerSizes.front())
+    {
+        cerr << "Sparse inputs of length " << inputs.numCols() << " need a network without feature layers" << endl
+        << "...and " << m_layerSizes.front() << " input neurons!" << endl;
+        assert(false);
+    }
+
+    linalg::CSRMatrix activatedInputs { inputs };
+    activateSparseInput(activatedInputs);
+    batchMatrix activations;
+    if (m_weightMatrices.at(0).size() != 0)
+    {
+        linalg::spmmSparseInput(activatedInputs, m_weightMatrices.at(0), activations);
     }
     else
     {
-        m_errors.at(m_numLayers-2) += linalg::hadamardProduct(gradCost, outputDerivatives);
+        batchMatrix denseInputs(activatedInputs.numRows(), activatedInputs.numCols());
+        const vector<int> &rowPointers { activatedInputs.getRowPointers() };
+        for (int n=0; n<activatedInputs.numRows(); ++n)
+        {
+            for (int p=rowPointers[n]; p<rowPointers[n+1]; ++p)
+            {
+                denseInputs(n, activatedInputs.getColumnIndices()[p]) = activatedInputs.getValues()[p];
+            }
+        }
+        switch (m_weightFormats.at(0))
+        {
+            case linalg::SparseFormat::CSR: linalg::spmm(m_csrWeights.at(0), denseInputs, activations); break;
+            case linalg::SparseFormat::BSR: linalg::spmm(m_bsrWeights.at(0), denseInputs, activations); break;
+            default: assert(false); // Only pruned layers drop their dense copy.
+        }
+    }
+    normalizeLayer(1, activations);
+    activateLayer(1, activations, nullptr);
+    if (m_numLayers == 2)
+    {
+        outputs = std::move(activations);
+        return;
+    }
+    forwardDense(activations, outputs, 1);
+}
+
+void Network::forwardDense(batchMatrix &activations, batchMatrix &outputs, int firstLayer) const
+{
+    /*
+    Takes the activations of layer firstLayer through the remaining dense
+    layers, multiplying pruned weight matrices in their sparse format.
+    'activations' is used as scratch space.
+    */
+
+    for (int layerNum=firstLayer; layerNum<m_numLayers-1; ++layerNum)
+    {
+        switch (m_weightFormats.at(layerNum))
+        {
+            case linalg::SparseFormat::CSR: linalg::spmm(m_csrWeights.at(layerNum), activations, outputs); break;
+            case linalg::SparseFormat::BSR: linalg::spmm(m_bsrWeights.at(layerNum), activations, outputs); break;
+            default: linalg::gemm(activations, false, m_weightMatrices.at(layerNum), true, outputs);
+        }
+        normalizeLayer(layerNum+1, outputs);
+        activateLayer(layerNum+1, outputs, nullptr);
+        if (layerNum < m_numLayers-2)
+        {
+            std::swap(activations, outputs);
+        }
+    }
+}
+
+Evaluation Network::evaluate(const DatasetView &data, int batchSize) const
+{
+    /*
+    Inference-only pass over a dataset in batches of batchSize samples.
+    Batches are shared out between threads; each thread tallies its own
+    confusion matrix and merges it once at the end, and per-batch losses
+    are summed in batch order so the result doesn't depend on the thread
+    count.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+    Evaluation result;
+    const int numClasses { m_layerSizes.back() };
+    const int inputSize { getInputSize() };
+    result.numSamples = data.size();
+    result.confusion.assign(numClasses, vector<int>(numClasses, 0));
+    if (data.size() == 0)
+    {
+        return result;
+    }
+    if (data.featureSize() < inputSize || data.targetSize() != numClasses)
+    {
+        cerr << "Dataset with " << data.featureSize() << " features and " << data.targetSize() << " targets doesn't fit" << endl
+        << "...a network with " << inputSize << " inputs and " << numClasses << " outputs!" << endl;
+        assert(false);
+    }
+
+    batchSize = std::max(1, batchSize);
+    const int numBatches { (data.size() + batchSize - 1) / batchSize };
+    vector<double> batchLosses(numBatches, 0.0);
+    std::mutex mergeMutex;
+    const numa::Replicated<Network> replicas(*this); // On multi-socket machines each thread reads the weights from its own node.
+
+    parallel::parallelFor(0, numBatches, [&](int batchBegin, int batchEnd)
+    {
+        const Network &local { replicas.local() };
+        vector<vector<int>> confusion(numClasses, vector<int>(numClasses, 0));
+        batchMatrix inputs, outputs;
+        for (int b=batchBegin; b<batchEnd; ++b)
+        {
+            const int first { b * batchSize };
+            const int count { std::min(batchSize, data.size() - first) };
+            inputs.resize(count, inputSize);
+            for (int n=0; n<count; ++n)
+            {
+                std::copy(data.features(first+n), data.features(first+n) + inputSize, inputs.data() + n*inputSize);
+            }
+
+            local.predict(inputs, outputs);
+
+            for (int n=0; n<count; ++n)
+            {
+                const double *output { outputs.data() + n*numClasses };
+                const double *target { data.target(first+n) };
+                for (int j=0; j<numClasses; ++j)
+                {
+                    batchLosses[b] += 0.5 * (output[j] - target[j]) * (output[j] - target[j]);
+                }
+                const int predicted { static_cast<int>(std::max_element(output, output + numClasses) - output) };
+                ++confusion[data.label(first+n)][predicted];
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        for (int i=0; i<numClasses; ++i)
+        {
+            for (int j=0; j<numClasses; ++j)
+            {
+                result.confusion[i][j] += confusion[i][j];
+            }
+        }
+    });
+
+    int correct {0};
+    for (int i=0; i<numClasses; ++i)
+    {
+        correct += result.confusion[i][i];
+    }
+    double totalLoss {0.0};
+    for (double loss : batchLosses)
+    {
+        totalLoss += loss;
+    }
+    result.accuracy = double(correct) / result.numSamples;
+    result.loss = totalLoss / result.numSamples;
+    return result;
+}
+
+void Evaluation::printToConsole() const
+{
+    cout << "Evaluated " << numSamples << " samples: accuracy " << accuracy << ", mean cost " << loss << endl;
+    cout << "Confusion matrix (rows: target class, columns: predicted class):" << endl;
+    for (const vector<int> &row : confusion)
+    {
+        for (int count : row)
+        {
+            cout << setw(6) << count;
+        }
+        cout << endl;
+    }
+    cout << endl;
+}
+
+Network Network::inferenceModel() const
+{
+    /*
+    Returns a copy of the network prepared for serving. Every batch norm layer
+    that directly follows a linear feature layer is folded into that layer's
+    weight matrix and biases, and then removed, so it costs nothing at
+    inference time. Dense layer batch norms fold the same way: their scale
+    into the rows of the weight matrix in front and their shift into the
+    layer's biases. Weight matrices that predict() runs sparse keep only
+    their sparse copy, so pruned models take proportionally less memory.
+    */
+
+    Network model(*this);
+    for (size_t i=1; i<model.m_featureLayers.size(); )
+    {
+        const BatchNormLayer *batchNorm { dynamic_cast<const BatchNormLayer*>(model.m_featureLayers[i].get()) };
+        if (batchNorm && model.m_featureLayers[i-1]->foldAffine(batchNorm->getFoldedScale(),
+                                                                 batchNorm->getFoldedShift(),
+                                                                 batchNorm->getActivationType()))
+        {
+            model.m_featureLayers.erase(model.m_featureLayers.begin() + i);
+        }
+        else
+        {
+            ++i;
+        }
     }
-    
 
-    std::cout << "ERRORS:";
-    linalg::print(m_errors.at(m_numLayers-2));
+    for (int layerNum=1; layerNum<model.m_numLayers; ++layerNum)
+    {
+        unique_ptr<BatchNormLayer> &batchNorm { model.m_batchNorms.at(layerNum) };
+        if (!batchNorm)
+        {
+            continue;
+        }
+        const vector<double> scale { batchNorm->getFoldedScale() };
+        const vector<double> shift { batchNorm->getFoldedShift() };
+        weightMatrix &weights { model.m_weightMatrices.at(layerNum-1) };
+        Layer &layer { model.m_layers.at(layerNum) };
+        for (int j=0; j<weights.numRows(); ++j)
+        {
+            double *row { weights.data() + static_cast<long>(j)*weights.numCols() };
+            for (int k=0; k<weights.numCols(); ++k)
+            {
+                row[k] *= scale[j];
+            }
+            layer.setBiasAt(j, layer.getBiasAt(j) + shift[j]);
+        }
+        batchNorm.reset();
+    }
 
-    // Backpropagate the error
-    for(int i=m_numLayers-2; i>0; --i) // m_numLayers should be equal to m_weightMatrices.size()-1
+    model.refreshSparseWeights();
+    for (int l=0; l<model.m_numLayers-1; ++l)
     {
-        linalg::Matrix<double> weights_T { m_weightMatrices.at(i).transpose() };
-        vector<double> thisLayerDerivatives { m_layers.at(i).getDerivatives() };
+        if (model.m_weightFormats.at(l) != linalg::SparseFormat::DENSE)
+        {
+            model.m_weightMatrices.at(l) = weightMatrix();
+            model.m_pruningMasks.at(l).clear();
+        }
+    }
+    model.allocateBatchBuffers();
+    return model;
+}
+
+void Network::backPropagateLayer(int l)
+{
+    /*
+    Weight and bias gradients of matrix l from the error of layer l+1,
+    then the error of layer l (skipped when nothing upstream needs it).
+    */
 
-        vector<double> backpropagatedError { weights_T * m_errors.at(i) };
-        vector<double> thisLayerError {linalg::hadamardProduct(backpropagatedError, thisLayerDerivatives)};
+    const int batchSize { m_batchTargets.numRows() };
+    vector<double> &biasGradients { m_biasGradients.at(l) };
+    std::fill(biasGradients.begin(), biasGradients.end(), 0.0);
+    for (int n=0; n<batchSize; ++n)
+    {
+        for (int j=0; j<m_errors.at(l).numCols(); ++j)
+        {
+            biasGradients[j] += m_errors.at(l)(n,j);
+        }
+    }
 
-        // m_errors goes from 0 to m_numLayers-2, where the first entry is the error in the first hidden layer
-        if (isNewBatch)
+    // The biases come after a batch norm, the weights before it.
+    const batchMatrix *weightedError { &m_errors.at(l) };
+    if (BatchNormLayer *batchNorm { m_batchNorms.at(l+1).get() })
+    {
+        // Its activation is linear, so backward() only reads the shape of its input and output.
+        memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+        batchNorm->backward(m_errors.at(l), m_errors.at(l), m_errors.at(l), m_batchNormScratch);
+        weightedError = &m_batchNormScratch;
+    }
+    const batchMatrix &nextError { *weightedError };
+    {
+        memtrack::Scope scope(memtrack::Subsystem::OPTIMIZER);
+        if (l == 0 && m_sparseBatch)
         {
-            m_errors.at(i-1) = thisLayerError;
+            // Only the columns of nonzero inputs have a gradient.
+            linalg::sparseInputGradient(nextError, m_sparseBatchInput, m_sparseInputColumns, m_sparseInputGradients);
         }
         else
         {
-            m_errors.at(i-1) += thisLayerError;
+            linalg::gemm(nextError, true, m_activations.at(l), false, m_weightGradients.at(l));
         }
+    }
 
-        // linalg::print(m_errors.at(i-1));
-    };
+    if (l == 0 && m_featureLayers.empty())
+    {
+        return; // nothing upstream of the input layer needs its error
+    }
+
+    batchMatrix &thisError { (l > 0) ? m_errors.at(l-1) : m_inputError };
+    linalg::gemm(nextError, false, m_weightMatrices.at(l), false, thisError);
+    const batchMatrix &thisDerivatives { m_derivatives.at(l) };
+    for (int n=0; n<batchSize; ++n)
+    {
+        for (int j=0; j<thisError.numCols(); ++j)
+        {
+            thisError(n,j) *= thisDerivatives(n,j);
+        }
+    }
+}
+
+void Network::backPropagate()
+{
+    /*
+    Implements backpropagation using quadratic cost function,
+    with derivative (activation - target value).
+
+    Output error:       E_L = (A_L - T) Hadamard f'_L
+    Hidden errors:      E_l = (E_{l+1} * W_l) Hadamard f'_l
+    Weight gradients:   dW_l = E_{l+1}^T * A_l, bias gradients are column sums of E_{l+1}.
+    A batch normalized layer's error goes back through its batch norm before
+    it meets the weights (but not the biases, which come after it).
+    The input layer error is handed on to the feature layers, last to first.
+    */
+
+    const int batchSize { m_batchTargets.numRows() };
+    profiler::Region region("backPropagate", batchSize);
+
+    batchMatrix &outputError { m_errors.at(m_numLayers-2) };
+    const batchMatrix &output { m_activations.back() };
+    outputError.resize(batchSize, m_layerSizes.back());
+    for (int n=0; n<batchSize; ++n)
+    {
+        for (int j=0; j<m_layerSizes.back(); ++j)
+        {
+            outputError(n,j) = (output(n,j) - m_batchTargets(n,j)) * m_derivatives.back()(n,j);
+        }
+    }
+
+    // Segments between checkpoints, last first: recompute the layers inside
+    // from the checkpoint below, backpropagate through them, release them.
+    int segmentEnd { m_numLayers-1 };
+    while (segmentEnd > 0)
+    {
+        const int segmentBegin { ((segmentEnd-1) / m_checkpointInterval) * m_checkpointInterval };
+        if (m_checkpointInterval > 1)
+        {
+            clock_t recomputeStart {clock()};
+            for (int l=segmentBegin; l<segmentEnd-1; ++l)
+            {
+                forwardLayer(l, true);
+            }
+            m_recomputeTime += clock() - recomputeStart;
+            trackBufferBytes();
+        }
+
+        for (int l=segmentEnd-1; l>=segmentBegin; --l)
+        {
+            backPropagateLayer(l);
+            if (m_checkpointInterval > 1)
+            {
+                m_errors.at(l) = batchMatrix();
+                releaseLayer(l);
+            }
+        }
+        segmentEnd = segmentBegin;
+    }
+
+    const batchMatrix *outputGrad { &m_inputError };
+    for (int i=static_cast<int>(m_featureLayers.size())-1; i>=0; --i)
+    {
+        const batchMatrix &layerInput { (i > 0) ? m_featureOutputs[i-1] : m_batchInput };
+        m_featureLayers[i]->backward(layerInput, m_featureOutputs[i], *outputGrad, m_featureGrads[i]);
+        outputGrad = &m_featureGrads[i];
+    }
 }
 
 void Network::update()
 {
     /*
-    Using the most recent error, updates the weight matrices
-    and neuron biases.
+    Using the most recent error, updates the weight matrices, neuron biases
+    and feature layer parameters with the minibatch-averaged gradients.
+    Pruned weights stay at zero, and scheduled pruning steps run afterwards.
     */
 
-   for(int l=0; l<m_weightMatrices.size(); ++l)
-   {
-        linalg::Matrix<double> &currentWeightMatrix = m_weightMatrices.at(l);      // weight of connections from layer l to layer l+1
-        vector<double> &currentError = m_errors.at(l);
-        double learningCoefficient {m_LEARNINGRATE / m_BATCHSIZE};
+    double learningCoefficient {m_LEARNINGRATE / m_batchTargets.numRows()};
 
-        // neuron indexing: i in layer l and j in layer l+1
-        int maxj { currentWeightMatrix.numRows()-1 };
-        int i {0}; int j {0};
-        for(double matrixEntry: currentWeightMatrix.getValues())
+    for (int l=0; l<m_weightMatrices.size(); ++l)
+    {
+        if (l == 0 && m_sparseBatch)
         {
-            matrixEntry -= learningCoefficient
-                           * m_layers.at(l).getActivationAt(i) // activation of neuron i in layer l
-                           * m_errors.at(l).at(j);
-            if(j<maxj)
+            vector<double> &weights { m_weightMatrices.at(l).getValues() };
+            const vector<uint8_t> &mask { m_pruningMasks.at(l) };
+            const int numInputs { m_layerSizes.at(0) };
+            for (size_t c=0; c<m_sparseInputColumns.size(); ++c)
             {
-                ++j;
-            } else {
-                double newBias { m_layers.at(l+1).getBiasAt(j)
-                - learningCoefficient
-                * m_errors.at(l).at(j)};
-                m_layers.at(l+1).setBiasAt(j, newBias);
-                
-                j = 0;
-                ++i;
+                const int k { m_sparseInputColumns[c] };
+                const double *columnGradients { m_sparseInputGradients.data() + c*m_sparseInputGradients.numCols() };
+                for (int j=0; j<m_layerSizes.at(1); ++j)
+                {
+                    const double weight { weights[j*numInputs + k] - learningCoefficient * columnGradients[j] };
+                    weights[j*numInputs + k] = mask.empty() ? weight : mask[j*numInputs + k] * weight;
+                }
             }
         }
-   }
+        else
+        {
+            updateWeights(l, learningCoefficient, m_weightGradients.at(l));
+        }
+        updateBiases(l, learningCoefficient, m_biasGradients.at(l));
+    }
+
+    for (unique_ptr<BatchNormLayer> &batchNorm : m_batchNorms)
+    {
+        if (batchNorm)
+        {
+            batchNorm->update(learningCoefficient);
+        }
+    }
+    for (unique_ptr<BatchLayer> &layer : m_featureLayers)
+    {
+        layer->update(learningCoefficient);
+    }
+
+    for (int l=0; l<m_weightMatrices.size(); ++l)
+    {
+        const PruningSchedule &schedule { m_pruning.at(l) };
+        const int batch { static_cast<int>(m_trainingStep) };
+        if (schedule.finalSparsity > 0.0 && batch >= schedule.beginBatch && batch <= schedule.endBatch
+            && ((batch - schedule.beginBatch) % schedule.frequency == 0 || batch == schedule.endBatch))
+        {
+            prune(l);
+        }
+    }
+    ++m_trainingStep;
 }
 
-void Network::train(vector<vector<vector<double>>> trainingData)
+void Network::updateWeights(int l, double learningCoefficient, const weightMatrix &gradients)
+{
+    /*
+    Gradient step on weight matrix l; pruned weights stay at zero.
+    */
+
+    vector<double> &weights { m_weightMatrices.at(l).getValues() };
+    const vector<double> &gradientValues { gradients.getValues() };
+    const vector<uint8_t> &mask { m_pruningMasks.at(l) };
+    if (mask.empty())
+    {
+        for (size_t i=0; i<weights.size(); ++i)
+        {
+            weights[i] -= learningCoefficient * gradientValues[i];
+        }
+    }
+    else
+    {
+        for (size_t i=0; i<weights.size(); ++i)
+        {
+            weights[i] = mask[i] * (weights[i] - learningCoefficient * gradientValues[i]);
+        }
+    }
+}
+
+void Network::updateBiases(int l, double learningCoefficient, const vector<double> &biasGradients)
+{
+    for (int j=0; j<m_layers.at(l+1).getSize(); ++j)
+    {
+        double newBias { m_layers.at(l+1).getBiasAt(j) - learningCoefficient * biasGradients[j] };
+        m_layers.at(l+1).setBiasAt(j, newBias);
+    }
+}
+
+void Network::prune(int layerNum)
+{
+    /*
+    Ranks the blocks of the weight matrix by mean absolute weight and masks
+    the lowest ones until the scheduled sparsity is reached. Blocks pruned
+    earlier have zero weight, so they always stay pruned.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::WEIGHTS);
+    const PruningSchedule &schedule { m_pruning.at(layerNum) };
+    const double progress { schedule.endBatch > schedule.beginBatch
+                            ? double(int(m_trainingStep) - schedule.beginBatch) / (schedule.endBatch - schedule.beginBatch) : 1.0 };
+    const double sparsity { schedule.finalSparsity * (1.0 - std::pow(1.0 - std::min(1.0, progress), 3)) };
+
+    weightMatrix &weights { m_weightMatrices.at(layerNum) };
+    const int rows { weights.numRows() };
+    const int cols { weights.numCols() };
+    const int b { schedule.blockSize };
+    const int blockRows { (rows + b - 1) / b };
+    const int blockCols { (cols + b - 1) / b };
+
+    vector<double> scores(static_cast<size_t>(blockRows) * blockCols, 0.0);
+    for (int i=0; i<rows; ++i)
+    {
+        for (int j=0; j<cols; ++j)
+        {
+            scores[(i/b)*blockCols + j/b] += std::abs(weights(i,j));
+        }
+    }
+    for (int bi=0; bi<blockRows; ++bi)
+    {
+        for (int bj=0; bj<blockCols; ++bj)
+        {
+            const int blockArea { (std::min(rows, (bi+1)*b) - bi*b) * (std::min(cols, (bj+1)*b) - bj*b) };
+            scores[bi*blockCols + bj] /= blockArea;
+        }
+    }
+
+    vector<int> order(scores.size());
+    for (size_t i=0; i<order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    const size_t numPruned { static_cast<size_t>(sparsity * scores.size()) };
+    std::nth_element(order.begin(), order.begin() + numPruned, order.end(),
+                     [&](int x, int y) { return scores[x] < scores[y]; });
+
+    vector<uint8_t> blockKept(scores.size(), 1);
+    for (size_t p=0; p<numPruned; ++p)
+    {
+        blockKept[order[p]] = 0;
+    }
+
+    vector<uint8_t> &mask { m_pruningMasks.at(layerNum) };
+    mask.resize(static_cast<size_t>(rows) * cols);
+    for (int i=0; i<rows; ++i)
+    {
+        for (int j=0; j<cols; ++j)
+        {
+            mask[i*cols + j] = blockKept[(i/b)*blockCols + j/b];
+            weights(i,j) *= mask[i*cols + j];
+        }
+    }
+}
+
+void Network::refreshSparseWeights()
+{
+    /*
+    Weight matrices whose density has dropped below m_SPARSE_DENSITY get a
+    sparse copy that predict() multiplies with instead: BSR for block-pruned
+    matrices, CSR otherwise.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::WEIGHTS);
+    for (int l=0; l<m_numLayers-1; ++l)
+    {
+        const weightMatrix &weights { m_weightMatrices.at(l) };
+        if (weights.size() == 0)
+        {
+            continue; // stored sparse only
+        }
+
+        m_weightFormats.at(l) = linalg::SparseFormat::DENSE;
+        m_csrWeights.at(l) = linalg::CSRMatrix();
+        m_bsrWeights.at(l) = linalg::BSRMatrix();
+        if (getWeightDensity(l) >= m_SPARSE_DENSITY)
+        {
+            continue;
+        }
+
+        if (m_pruning.at(l).blockSize > 1)
+        {
+            m_bsrWeights.at(l) = linalg::BSRMatrix(weights, m_pruning.at(l).blockSize);
+            m_weightFormats.at(l) = linalg::SparseFormat::BSR;
+        }
+        else
+        {
+            m_csrWeights.at(l) = linalg::CSRMatrix(weights);
+            m_weightFormats.at(l) = linalg::SparseFormat::CSR;
+        }
+    }
+}
+
+double Network::batchCost() const
+{
+    /*
+    Quadratic cost 0.5*|A_L - T|^2, averaged over the minibatch.
+    */
+
+    const batchMatrix &output { m_activations.back() };
+    double cost {0.0};
+    for (int n=0; n<output.numRows(); ++n)
+    {
+        for (int j=0; j<output.numCols(); ++j)
+        {
+            const double difference { output(n,j) - m_batchTargets(n,j) };
+            cost += 0.5 * difference * difference;
+        }
+    }
+    return cost / output.numRows();
+}
+
+void Network::train(const vector<vector<vector<double>>> &trainingData)
 {
     /*
     Trains the network on a training set, given data in the appropriate format.
+    The data is consumed in minibatches of m_batchSize samples, with one
+    weight update per minibatch.
     */
 
-    int trainingPass {1};
-    int sampleNum    {1};
+    memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+    if (!m_featureLayers.empty() && m_featureLayers.back()->getOutputSize() != m_layerSizes.front())
+    {
+        cerr << "Feature layers output " << m_featureLayers.back()->getOutputSize() << " values," << endl
+        << "...but the input layer has " << m_layerSizes.front() << " neurons!" << endl;
+        assert(false);
+    }
 
-    for (vector<vector<double>> trainingSample : trainingData) // for each training sample
+    m_sparseBatch = false;
+    m_peakBufferBytes = 0;
+    m_recomputeTime = 0;
+    int batchNum {1};
+
+    for (int first=0; first<trainingData.size(); first+=m_batchSize)
     {
+        const int count { std::min<int>(m_batchSize, trainingData.size() - first) };
+
         clock_t time0 {clock()};
-        /* Set inputs */
-        vector<double> input {trainingSample.at(0)};
-        setInput(input);
+        /* Load minibatch */
+        loadBatch(trainingData, first, count);
         clock_t time1 {clock()};
 
-        /* Current target */
-        vector<double> targetOutput {trainingSample.at(1)};
-        setTarget(targetOutput);
-        clock_t time2 {clock()};
-        /* Feedforward */
-        std::cout << "(PASS : " << trainingPass << ")" << endl;
-        feedForward();
-        clock_t time3 {clock()};
-        // printToConsole();
-        std::cout << "OUTPUT LAYER:";
-        vector<double> layerVector{ m_layers.at(m_numLayers-1).getActivations() };
-        linalg::print(layerVector);
-        std::cout << "Target: [";
-        for (double output : targetOutput)
+        trainBatch(batchNum, time1-time0);
+        ++batchNum;
+    }
+
+    refreshSparseWeights();
+    printMemoryReport();
+}
+
+void Network::train(const vector<linalg::SparseVector> &inputs, const vector<vector<double>> &targets)
+{
+    /*
+    Trains on sparse inputs, stacked into a CSR matrix per minibatch. The
+    first layer then costs time in proportion to the nonzero inputs, in the
+    forward pass and in the weight gradient and update alike.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+    if (!m_featureLayers.empty() || inputs.size() != targets.size()
+        || (!inputs.empty() && inputs.front().size != m_layerSizes.front()))
+    {
+        cerr << "Sparse training needs a network without feature layers, one target per input," << endl
+        << "...and inputs of length " << m_layerSizes.front() << "!" << endl;
+        assert(false);
+    }
+
+    m_sparseBatch = true;
+    m_peakBufferBytes = 0;
+    m_recomputeTime = 0;
+    int batchNum {1};
+    const int outputSize { m_layerSizes.back() };
+
+    for (int first=0; first<inputs.size(); first+=m_batchSize)
+    {
+        const int count { std::min<int>(m_batchSize, inputs.size() - first) };
+
+        clock_t time0 {clock()};
+        /* Load minibatch */
+        m_sparseBatchInput = linalg::CSRMatrix(inputs, first, count);
+        m_batchTargets.resize(count, outputSize);
+        for (int n=0; n<count; ++n)
         {
-            std::cout << " " << output << ",";
+            std::copy(targets.at(first+n).begin(), targets.at(first+n).begin() + outputSize, m_batchTargets.data() + n*outputSize);
         }
-        std::cout << "]"<<endl;
+        clock_t time1 {clock()};
+
+        trainBatch(batchNum, time1-time0);
+        ++batchNum;
+    }
+
+    m_sparseBatch = false;
+    refreshSparseWeights();
+    printMemoryReport();
+}
+
+TrainingHistory Network::trainEpochs(const vector<vector<vector<double>>> &trainingData, const DatasetView &validation,
+                                     int maxEpochs, int patience)
+{
+    /*
+    Trains for up to maxEpochs passes over the training data. At the end of
+    each epoch a snapshot of the network is evaluated on the validation data
+    by a background task, single-threaded, while training carries on; its
+    result is picked up at a later epoch boundary, whenever it is ready.
+    Training stops once 'patience' validated epochs in a row haven't lowered
+    the validation cost, and the best snapshot is restored.
+    */
+
+    struct PendingValidation
+    {
+        int epoch;
+        shared_ptr<const Network> snapshot;
+        std::future<Evaluation> result;
+    };
 
-        /* Backpropagate */
-        clock_t time4 {clock()};
-        backPropagate(sampleNum==1);
-        clock_t time5 {clock()};
+    TrainingHistory history;
+    deque<PendingValidation> pending;
+    shared_ptr<const Network> bestSnapshot;
+    double bestCost { std::numeric_limits<double>::infinity() };
+    int epochsWithoutImprovement {0};
 
-        /* Update weights if end of batch */
-        if (sampleNum == m_BATCHSIZE)
+    auto collect = [&](bool wait)
+    {
+        while (!pending.empty()
+               && (wait || pending.front().result.wait_for(std::chrono::seconds(0)) == std::future_status::ready))
         {
-            update();
-            sampleNum = 0; // new batch, ++sampleNum below resets it to 1 by the end of the training pass
+            PendingValidation &front { pending.front() };
+            const Evaluation evaluation { front.result.get() };
+            history.validation.push_back(evaluation);
+            cout << "Validation after epoch " << front.epoch << ": accuracy " << evaluation.accuracy
+                 << ", mean cost " << evaluation.loss << endl << endl;
+            if (evaluation.loss < bestCost)
+            {
+                bestCost = evaluation.loss;
+                bestSnapshot = front.snapshot;
+                history.bestEpoch = front.epoch;
+                epochsWithoutImprovement = 0;
+            }
+            else
+            {
+                ++epochsWithoutImprovement;
+            }
+            pending.pop_front();
         }
+    };
+
+    for (int epoch=1; epoch<=maxEpochs && epochsWithoutImprovement<patience; ++epoch)
+    {
+        cout << "EPOCH " << epoch << endl;
+        train(trainingData);
+        history.epochsRun = epoch;
+
+        shared_ptr<const Network> snapshot { make_shared<const Network>(*this) };
+        // Its own thread, not a scheduler task that a waiting training thread could pick up (see parallel.hpp).
+        std::future<Evaluation> result { std::async(std::launch::async, [snapshot, &validation]()
+        {
+            parallel::SerialScope serial; // leave the cores to training
+            return snapshot->evaluate(validation);
+        }) };
+        pending.push_back(PendingValidation{epoch, snapshot, std::move(result)});
+        collect(false);
+    }
 
-        ++sampleNum;
-        ++trainingPass;
+    collect(true);
+    history.stoppedEarly = epochsWithoutImprovement >= patience;
+    if (bestSnapshot)
+    {
+        restoreParameters(*bestSnapshot);
+    }
+    history.printToConsole();
+    return history;
+}
 
-        clock_t time6 {clock()};
-        cout<<"Time for setting input: "<<time1-time0<<endl;
-        cout<<"Time for setting target: "<<time2-time1<<endl;
-        cout<<"Time for feedforward: "<<time3-time2<<endl;
-        cout<<"Time for backprop: "<<time5-time4<<endl;
-        cout<<"Time for update: "<<time6-time5<<endl;
-        cout<<"Time for full pass: "<<time6-time0<<endl<<endl;
+void TrainingHistory::printToConsole() const
+{
+    cout << "Trained " << epochsRun << " epochs" << (stoppedEarly ? " (stopped early)" : "")
+         << ", restored the weights of epoch " << bestEpoch << endl;
+    for (size_t i=0; i<validation.size(); ++i)
+    {
+        cout << "  epoch " << i+1 << ": validation accuracy " << validation[i].accuracy
+             << ", mean cost " << validation[i].loss << endl;
     }
+    cout << endl;
+}
+
+void Network::printMemoryReport() const
+{
+    cout<<"Peak activation memory: "<<m_peakBufferBytes<<" bytes";
+    if (m_checkpointInterval > 1)
+    {
+        cout<<" (checkpoint every "<<m_checkpointInterval<<" layers, recompute time: "<<m_recomputeTime<<")";
+    }
+    cout<<endl<<endl;
+}
+
+void Network::trainBatch(int batchNum, clock_t loadTime)
+{
+    clock_t time1 {clock()};
+
+    /* Feedforward */
+    std::cout << "(BATCH : " << batchNum << ")" << endl;
+    feedForward();
+    clock_t time2 {clock()};
+    std::cout << "Mean cost: " << batchCost() << endl;
+
+    /* Backpropagate */
+    clock_t time3 {clock()};
+    backPropagate();
+    clock_t time4 {clock()};
+
+    /* Update weights */
+    update();
+    clock_t time5 {clock()};
+
+    if (m_autoSave && m_trainingStep % m_autoSaveInterval == 0 && !m_autoSave->save(*this))
+    {
+        m_autoSave = nullptr; // The network can't be checkpointed; the reason is on stderr once.
+    }
+
+    cout<<"Time for loading batch: "<<loadTime<<endl;
+    cout<<"Time for feedforward: "<<time2-time1<<endl;
+    cout<<"Time for backprop: "<<time4-time3<<endl;
+    cout<<"Time for update: "<<time5-time4<<endl;
+    cout<<"Time for full pass: "<<time5-time1+loadTime<<endl<<endl;
 }
 
 void Network::printToConsole() const
@@ -237,6 +1387,11 @@ void Network::printToConsole() const
     then the activations of the neurons in subsequent layers.
     */
 
+    for (size_t i=0; i<m_featureLayers.size(); ++i)
+    {
+        std::cout << "FEATURE LAYER " << i << ": " << m_featureLayers[i]->getName() << endl;
+    }
+
     for (int layerIndex=0; layerIndex<m_numLayers; ++layerIndex) {
 
         if (layerIndex==0)
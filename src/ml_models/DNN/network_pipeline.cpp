@@ -0,0 +1,310 @@
+#include "ml_models/DNN/network.hpp"
+#include "ml_models/DNN/parameters.hpp"
+#include "math/gemm.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/parallel.hpp"
+#include "math/spsc_queue.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    struct Microbatch
+    {
+        int index {0};
+        batchMatrix values;       // Activations (forward) or errors (backward) at a stage boundary.
+        batchMatrix derivatives;  // Activation derivatives at the boundary (forward only).
+    };
+
+    using MicrobatchQueue = parallel::SPSCQueue<Microbatch>;
+}
+
+vector<int> Network::pipelineStages(int numStages) const
+{
+    /*
+    Splits the weight matrices into numStages contiguous groups of roughly
+    equal multiply-add counts. Entry s is the first matrix of stage s; a
+    final entry holds the number of matrices.
+    */
+
+    const int numMatrices { m_numLayers-1 };
+    numStages = std::max(1, std::min(numStages, numMatrices));
+    double totalWork {0.0};
+    for (int l=0; l<numMatrices; ++l)
+    {
+        totalWork += double(m_layerSizes.at(l)) * m_layerSizes.at(l+1);
+    }
+
+    vector<int> firstMatrix {0};
+    double work {0.0};
+    for (int l=0; l<numMatrices && int(firstMatrix.size())<numStages; ++l)
+    {
+        work += double(m_layerSizes.at(l)) * m_layerSizes.at(l+1);
+        const int matricesLeft { numMatrices - (l+1) };
+        const int stagesLeft { numStages - int(firstMatrix.size()) };
+        if (matricesLeft >= stagesLeft && (work >= totalWork * firstMatrix.size() / numStages || matricesLeft == stagesLeft))
+        {
+            firstMatrix.push_back(l+1);
+        }
+    }
+    firstMatrix.push_back(numMatrices);
+    return firstMatrix;
+}
+
+PipelineStats Network::trainPipelined(const vector<vector<vector<double>>> &trainingData, int numStages, int numMicrobatches)
+{
+    /*
+    Pipeline-parallel training of the dense stack. The weight matrices are
+    split into contiguous stages, each run by its own thread, and every
+    minibatch is cut into microbatches that flow through the stages over
+    lock-free single-producer/single-consumer queues: activations (with
+    their derivatives) forward, errors backward. Scheduling is GPipe-style:
+    a stage runs the forward pass of all microbatches, then their backward
+    passes as the errors arrive, then updates its own weights, so the
+    result is the same synchronous minibatch SGD as train(). Each stage's
+    weights stay in the cache of the core running it.
+
+    Supports networks without feature layers, batch norm, dropout or pruning
+    schedules (existing pruning masks are respected).
+    */
+
+    bool usesDropout {false};
+    for (double rate : m_dropoutRates)
+    {
+        usesDropout = usesDropout || rate > 0.0;
+    }
+    bool prunes {false};
+    for (const PruningSchedule &schedule : m_pruning)
+    {
+        prunes = prunes || schedule.finalSparsity > 0.0;
+    }
+    bool normalizes {false};
+    for (const unique_ptr<BatchNormLayer> &batchNorm : m_batchNorms)
+    {
+        normalizes = normalizes || batchNorm;
+    }
+    if (!m_featureLayers.empty() || usesDropout || prunes || normalizes)
+    {
+        cerr << "Pipelined training supports dense networks without feature layers, batch norm, dropout or pruning schedules!" << endl;
+        assert(false);
+    }
+
+    const vector<int> stageBounds { pipelineStages(numStages) };
+    numStages = stageBounds.size() - 1;
+    numMicrobatches = std::max(1, numMicrobatches);
+    const int numSamples { static_cast<int>(trainingData.size()) };
+    const int numBatches { (numSamples + m_batchSize - 1) / m_batchSize };
+    const int inputSize { m_layerSizes.front() };
+    const int outputSize { m_layerSizes.back() };
+
+    vector<unique_ptr<MicrobatchQueue>> forwardQueues, backwardQueues; // Queue s links stage s and s+1.
+    for (int s=0; s<numStages-1; ++s)
+    {
+        forwardQueues.emplace_back(new MicrobatchQueue(numMicrobatches));
+        backwardQueues.emplace_back(new MicrobatchQueue(numMicrobatches));
+    }
+
+    PipelineStats stats;
+    stats.firstLayers.assign(stageBounds.begin(), stageBounds.end()-1);
+    stats.busySeconds.assign(numStages, 0.0);
+    stats.stageSeconds.assign(numStages, 0.0);
+
+    auto runStage = [&](int s)
+    {
+        parallel::SerialScope serial; // one core per stage
+        memtrack::Scope scope(memtrack::Subsystem::ACTIVATIONS);
+        const auto stageStart { chrono::steady_clock::now() };
+        double busy {0.0};
+        const int firstMatrix { stageBounds[s] };
+        const int endMatrix { stageBounds[s+1] };
+        const int numLocal { endMatrix - firstMatrix };
+
+        vector<vector<batchMatrix>> activations(numMicrobatches, vector<batchMatrix>(numLocal+1));
+        vector<vector<batchMatrix>> derivatives(numMicrobatches, vector<batchMatrix>(numLocal+1));
+        memtrack::Scope gradientScope(memtrack::Subsystem::OPTIMIZER);
+        vector<weightMatrix> weightGradients(numLocal);
+        vector<vector<double>> biasGradients(numLocal);
+        for (int i=0; i<numLocal; ++i)
+        {
+            biasGradients[i].assign(m_layerSizes.at(firstMatrix+i+1), 0.0);
+            weightGradients[i].resize(m_layerSizes.at(firstMatrix+i+1), m_layerSizes.at(firstMatrix+i));
+        }
+        memtrack::Scope bufferScope(memtrack::Subsystem::ACTIVATIONS);
+
+        for (int batch=0; batch<numBatches; ++batch)
+        {
+            const int first { batch * m_batchSize };
+            const int count { std::min(m_batchSize, numSamples - first) };
+            const int microbatches { std::min(numMicrobatches, count) };
+            auto microFirst = [&](int m) { return first + static_cast<int>(static_cast<long>(count) * m / microbatches); };
+
+            /* Forward passes */
+            for (int m=0; m<microbatches; ++m)
+            {
+                Microbatch input;
+                if (s > 0)
+                {
+                    input = forwardQueues[s-1]->pop();
+                }
+                const auto start { chrono::steady_clock::now() };
+                if (s == 0)
+                {
+                    const int rows { microFirst(m+1) - microFirst(m) };
+                    input.values.resize(rows, inputSize);
+                    for (int n=0; n<rows; ++n)
+                    {
+                        const vector<double> &sample { trainingData.at(microFirst(m)+n).at(0) };
+                        std::copy(sample.begin(), sample.begin() + inputSize, input.values.data() + n*inputSize);
+                    }
+                    activateLayer(0, input.values, &input.derivatives);
+                }
+                activations[m][0]  = std::move(input.values);
+                derivatives[m][0]  = std::move(input.derivatives);
+                for (int i=0; i<numLocal; ++i)
+                {
+                    const int l { firstMatrix + i };
+                    linalg::gemm(activations[m][i], false, m_weightMatrices.at(l), true, activations[m][i+1]);
+                    activateLayer(l+1, activations[m][i+1], &derivatives[m][i+1]);
+                }
+                busy += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                if (s < numStages-1)
+                {
+                    Microbatch output;
+                    output.index       = m;
+                    output.values      = std::move(activations[m][numLocal]);
+                    output.derivatives = std::move(derivatives[m][numLocal]);
+                    forwardQueues[s]->push(std::move(output));
+                }
+            }
+
+            /* Backward passes */
+            double cost {0.0};
+            for (int processed=0; processed<microbatches; ++processed)
+            {
+                Microbatch error;
+                if (s < numStages-1)
+                {
+                    error = backwardQueues[s]->pop();
+                }
+                const auto start { chrono::steady_clock::now() };
+                if (s == numStages-1)
+                {
+                    // Output error E_L = (A_L - T) Hadamard f'_L
+                    error.index = processed;
+                    const batchMatrix &output { activations[processed][numLocal] };
+                    const batchMatrix &outputDerivatives { derivatives[processed][numLocal] };
+                    error.values.resize(output.numRows(), outputSize);
+                    for (int n=0; n<output.numRows(); ++n)
+                    {
+                        const vector<double> &target { trainingData.at(microFirst(processed)+n).at(1) };
+                        for (int j=0; j<outputSize; ++j)
+                        {
+                            const double difference { output(n,j) - target[j] };
+                            cost += 0.5 * difference * difference;
+                            error.values(n,j) = difference * outputDerivatives(n,j);
+                        }
+                    }
+                }
+
+                const int m { error.index };
+                batchMatrix nextError { std::move(error.values) };
+                for (int i=numLocal-1; i>=0; --i)
+                {
+                    const int l { firstMatrix + i };
+                    linalg::gemm(nextError, true, activations[m][i], false, weightGradients[i], 1.0, processed == 0 ? 0.0 : 1.0);
+                    if (processed == 0)
+                    {
+                        std::fill(biasGradients[i].begin(), biasGradients[i].end(), 0.0);
+                    }
+                    for (int n=0; n<nextError.numRows(); ++n)
+                    {
+                        for (int j=0; j<nextError.numCols(); ++j)
+                        {
+                            biasGradients[i][j] += nextError(n,j);
+                        }
+                    }
+                    if (l == 0)
+                    {
+                        break; // nothing upstream of the input layer needs its error
+                    }
+                    batchMatrix thisError;
+                    linalg::gemm(nextError, false, m_weightMatrices.at(l), false, thisError);
+                    for (int n=0; n<thisError.numRows(); ++n)
+                    {
+                        for (int j=0; j<thisError.numCols(); ++j)
+                        {
+                            thisError(n,j) *= derivatives[m][i](n,j);
+                        }
+                    }
+                    nextError = std::move(thisError);
+                }
+                busy += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+                if (s > 0)
+                {
+                    Microbatch upstream;
+                    upstream.index  = m;
+                    upstream.values = std::move(nextError);
+                    backwardQueues[s-1]->push(std::move(upstream));
+                }
+            }
+
+            /* Update this stage's weights */
+            const auto start { chrono::steady_clock::now() };
+            const double learningCoefficient { m_LEARNINGRATE / count };
+            for (int i=0; i<numLocal; ++i)
+            {
+                updateWeights(firstMatrix+i, learningCoefficient, weightGradients[i]);
+                updateBiases(firstMatrix+i, learningCoefficient, biasGradients[i]);
+            }
+            busy += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            if (s == numStages-1)
+            {
+                std::cout << "(BATCH : " << batch+1 << ")" << endl;
+                std::cout << "Mean cost: " << cost / count << endl;
+            }
+        }
+
+        stats.busySeconds[s]  = busy;
+        stats.stageSeconds[s] = chrono::duration<double>(chrono::steady_clock::now() - stageStart).count();
+    };
+
+    const auto start { chrono::steady_clock::now() };
+    vector<thread> stageThreads; // Not scheduler tasks: the stages block on each other (see parallel.hpp).
+    for (int s=1; s<numStages; ++s)
+    {
+        stageThreads.emplace_back(runStage, s);
+    }
+    runStage(0);
+    for (thread &stageThread : stageThreads)
+    {
+        stageThread.join();
+    }
+    stats.wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    m_trainingStep += numBatches;
+    refreshSparseWeights();
+    stats.printToConsole();
+    return stats;
+}
+
+void PipelineStats::printToConsole() const
+{
+    const streamsize precision { cout.precision() };
+    cout << "Pipeline of " << busySeconds.size() << " stages, " << wallSeconds << " s:" << endl;
+    for (size_t s=0; s<busySeconds.size(); ++s)
+    {
+        cout << "  stage " << s << " (from weight matrix " << firstLayers[s] << "): busy " << busySeconds[s]
+             << " s, utilization " << setprecision(3) << (wallSeconds > 0 ? 100.0 * busySeconds[s] / wallSeconds : 0.0) << "%" << setprecision(precision) << endl;
+    }
+    cout << endl;
+}
@@ -0,0 +1,124 @@
+#include "ml_models/DNN/network.hpp"
+#include "math/gemm.hpp"
+#include "math/roofline.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+vector<roofline::KernelCost> Network::layerCosts(int batchSize) const
+{
+    /*
+    One entry per feature layer and per dense weight matrix, in the order
+    predict() runs them. Every layer reads its input and parameters and
+    writes its output once; a dense layer does 2 flops per stored weight
+    and sample, plus its bias and activation (counted as 1 flop each per
+    output) and batch norm (2 more). Work the input layer's activation does
+    isn't counted.
+    */
+
+    vector<roofline::KernelCost> costs;
+    for (const auto &layer : m_featureLayers)
+    {
+        costs.push_back({ layer->getName(), layer->inferenceFlops(batchSize),
+                          sizeof(double) * double(batchSize) * (layer->getInputSize() + layer->getOutputSize())
+                          + layer->parameterBytes(), 0.0 });
+    }
+
+    for (int l=0; l<m_numLayers-1; ++l)
+    {
+        const int inputs { m_layerSizes.at(l) }, outputs { m_layerSizes.at(l+1) };
+        double storedWeights { double(inputs) * outputs }, weightBytes { sizeof(double) * storedWeights };
+        const char *format { "" };
+        switch (m_weightFormats.at(l))
+        {
+            case linalg::SparseFormat::CSR:
+                storedWeights = m_csrWeights.at(l).numNonZeros();
+                weightBytes = m_csrWeights.at(l).bytes();
+                format = ", CSR";
+                break;
+            case linalg::SparseFormat::BSR:
+            {
+                const int blockSize { m_bsrWeights.at(l).getBlockSize() };
+                storedWeights = double(m_bsrWeights.at(l).numBlocks()) * blockSize * blockSize;
+                weightBytes = m_bsrWeights.at(l).bytes();
+                format = ", BSR";
+                break;
+            }
+            default:
+                break;
+        }
+
+        ostringstream name;
+        name << "Dense(" << inputs << " -> " << outputs << format << ")";
+        const double normFlops { m_batchNorms.at(l+1) ? 2.0 * batchSize * outputs : 0.0 };
+        const double normBytes { m_batchNorms.at(l+1) ? m_batchNorms.at(l+1)->parameterBytes() : 0.0 };
+        costs.push_back({ name.str(), 2.0 * batchSize * (storedWeights + outputs) + normFlops,
+                          weightBytes + normBytes + sizeof(double) * (double(batchSize) * (inputs + outputs) + outputs), 0.0 });
+    }
+    return costs;
+}
+
+roofline::RooflineReport Network::rooflineReport(const batchMatrix &inputs, int repetitions) const
+{
+    /*
+    Runs predict()'s steps one layer at a time on 'inputs', timing each;
+    every layer gets the median of its 'repetitions' times. Feature layers
+    run in inference mode and pruned weights in their sparse format, as in
+    predict().
+    */
+
+    roofline::RooflineReport report;
+    report.peak = roofline::machinePeak();
+    report.kernels = layerCosts(inputs.numRows());
+    vector<vector<double>> times(report.kernels.size());
+
+    for (int repetition=0; repetition<std::max(1, repetitions); ++repetition)
+    {
+        size_t kernel {0};
+        auto timed = [&](const std::function<void()> &step)
+        {
+            const auto start { chrono::steady_clock::now() };
+            step();
+            times[kernel++].push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+        };
+
+        batchMatrix features[2];
+        const batchMatrix *layerInput { &inputs };
+        for (size_t i=0; i<m_featureLayers.size(); ++i)
+        {
+            batchMatrix &layerOutput { features[i % 2] };
+            timed([&]() { m_featureLayers[i]->infer(*layerInput, layerOutput); });
+            layerInput = &layerOutput;
+        }
+
+        batchMatrix activations { *layerInput }, outputs;
+        activateLayer(0, activations, nullptr);
+        for (int l=0; l<m_numLayers-1; ++l)
+        {
+            timed([&]()
+            {
+                switch (m_weightFormats.at(l))
+                {
+                    case linalg::SparseFormat::CSR: linalg::spmm(m_csrWeights.at(l), activations, outputs); break;
+                    case linalg::SparseFormat::BSR: linalg::spmm(m_bsrWeights.at(l), activations, outputs); break;
+                    default: linalg::gemm(activations, false, m_weightMatrices.at(l), true, outputs);
+                }
+                normalizeLayer(l+1, outputs);
+                activateLayer(l+1, outputs, nullptr);
+            });
+            std::swap(activations, outputs);
+        }
+    }
+
+    for (size_t k=0; k<times.size(); ++k)
+    {
+        std::sort(times[k].begin(), times[k].end());
+        report.kernels[k].seconds = times[k][times[k].size() / 2];
+    }
+    return report;
+}
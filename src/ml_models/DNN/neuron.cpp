@@ -1,7 +1,6 @@
 #include "ml_models/DNN/neuron.hpp"
+#include "ml_models/DNN/activation.hpp"
 #include "ml_models/DNN/parameters.hpp"
-#include <cmath>
-#include <algorithm>
 
 Neuron::Neuron(double input, Activation type)
 {
@@ -15,6 +14,7 @@ Neuron::Neuron(double input, double bias, Activation type)
 {
     m_input = input;
     m_bias = bias;
+    m_activationType = type;
     activate();
     derive();
 }
@@ -45,48 +45,14 @@ void Neuron::activate() {
     Sets the activation value of the neuron.
     */
 
-   switch(m_activationType)
-   {
-        case Activation::TANH:
-            m_activation = tanh(m_input + m_bias);
-            break;
-        case Activation::RELU:
-            m_activation = std::max(0.0, m_input);
-            break;
-        case Activation::FAST_SIGMOID:
-            m_activation = m_input / (1 + abs(m_input));
-            break;
-        default:
-            m_activation = tanh(m_input + m_bias);
-            break;
-   }
-    
+    m_activation = activation::apply(m_activationType, m_input + m_bias);
 }
 
 void Neuron::derive() {
     /*
     Sets the derivative according to the
     current activation function.
-
-    Fast sigmoid: f'(x) = f(x) * (1 - f(x))
-    d/dx(tanh(x)) = 1 - tanh^2(x)
-
     */
 
-    switch(m_activationType)
-    {
-        case Activation::TANH:
-            m_derivative = 1 - m_activation * m_activation;
-            break;
-        case Activation::RELU:
-            m_activation = m_input>0 ? 1 : 0;
-            break;
-        case Activation::FAST_SIGMOID:
-            m_derivative = m_activation*(1-m_activation);
-            break;
-        default:
-            m_derivative = 1 - m_activation * m_activation;
-            break;
-    }
-    
+    m_derivative = activation::derivative(m_activationType, m_input + m_bias, m_activation);
 }
\ No newline at end of file
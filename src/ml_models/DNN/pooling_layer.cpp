@@ -0,0 +1,194 @@
+#include "ml_models/DNN/pooling_layer.hpp"
+#include "ml_models/DNN/parameters.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+Pool2DLayer::Pool2DLayer(Pooling type, int channels, int inHeight, int inWidth, int poolSize, int stride)
+{
+    m_type      = type;
+    m_channels  = channels;
+    m_inHeight  = inHeight;
+    m_inWidth   = inWidth;
+    m_poolSize  = poolSize;
+    m_stride    = (stride > 0) ? stride : poolSize;
+    m_outHeight = (inHeight - poolSize) / m_stride + 1;
+    m_outWidth  = (inWidth  - poolSize) / m_stride + 1;
+
+    if (poolSize * poolSize > 256)
+    {
+        cerr << "Pooling windows of " << poolSize << "x" << poolSize
+        << " don't fit the one-byte argmax offsets!" << endl;
+        assert(false);
+    }
+}
+
+string Pool2DLayer::getName() const
+{
+    ostringstream name;
+    name << (m_type == Pooling::MAX ? "MaxPool2D(" : "AvgPool2D(")
+         << m_channels << "x" << m_inHeight << "x" << m_inWidth
+         << " -> " << m_channels << "x" << m_outHeight << "x" << m_outWidth
+         << ", k=" << m_poolSize << ", s=" << m_stride << ")";
+    return name.str();
+}
+
+void Pool2DLayer::pool(const batchMatrix &input, batchMatrix &output, uint8_t *argmax) const
+{
+    /*
+    Samples are shared out between threads. Within a sample, each output row
+    is built up one window offset (ky, kx) at a time, so the innermost loop
+    runs across the whole row with branch-free selects that the compiler can
+    vectorize.
+    */
+
+    const int batchSize { input.numRows() };
+    output.resize(batchSize, getOutputSize());
+    const double windowScale { 1.0 / (m_poolSize * m_poolSize) };
+
+    parallel::parallelFor(0, batchSize, [&](int sampleBegin, int sampleEnd)
+    {
+        for (int n=sampleBegin; n<sampleEnd; ++n)
+        {
+            const double *inSample { input.data() + static_cast<long>(n)*input.numCols() };
+            double *outSample { output.data() + static_cast<long>(n)*output.numCols() };
+            uint8_t *argSample { argmax ? argmax + static_cast<long>(n)*output.numCols() : nullptr };
+
+            for (int c=0; c<m_channels; ++c)
+            {
+                const double *channel { inSample + c*m_inHeight*m_inWidth };
+                for (int oy=0; oy<m_outHeight; ++oy)
+                {
+                    double *outRow { outSample + (c*m_outHeight + oy)*m_outWidth };
+                    uint8_t *argRow { argSample ? argSample + (c*m_outHeight + oy)*m_outWidth : nullptr };
+                    std::fill(outRow, outRow + m_outWidth,
+                              m_type == Pooling::MAX ? -std::numeric_limits<double>::infinity() : 0.0);
+
+                    for (int ky=0; ky<m_poolSize; ++ky)
+                    {
+                        const double *inRow { channel + (oy*m_stride + ky)*m_inWidth };
+                        for (int kx=0; kx<m_poolSize; ++kx)
+                        {
+                            const uint8_t offset { static_cast<uint8_t>(ky*m_poolSize + kx) };
+                            if (m_type == Pooling::AVERAGE)
+                            {
+                                for (int ox=0; ox<m_outWidth; ++ox)
+                                {
+                                    outRow[ox] += inRow[ox*m_stride + kx];
+                                }
+                            }
+                            else if (argRow)
+                            {
+                                for (int ox=0; ox<m_outWidth; ++ox)
+                                {
+                                    const double candidate { inRow[ox*m_stride + kx] };
+                                    const bool isLarger { candidate > outRow[ox] };
+                                    outRow[ox] = isLarger ? candidate : outRow[ox];
+                                    argRow[ox] = isLarger ? offset : argRow[ox];
+                                }
+                            }
+                            else
+                            {
+                                for (int ox=0; ox<m_outWidth; ++ox)
+                                {
+                                    outRow[ox] = std::max(outRow[ox], inRow[ox*m_stride + kx]);
+                                }
+                            }
+                        }
+                    }
+
+                    if (m_type == Pooling::AVERAGE)
+                    {
+                        for (int ox=0; ox<m_outWidth; ++ox)
+                        {
+                            outRow[ox] *= windowScale;
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+void Pool2DLayer::infer(const batchMatrix &input, batchMatrix &output) const
+{
+    pool(input, output, nullptr);
+}
+
+void Pool2DLayer::forward(const batchMatrix &input, batchMatrix &output)
+{
+    if (m_type == Pooling::MAX)
+    {
+        m_argmax.resize(static_cast<size_t>(input.numRows()) * getOutputSize());
+        pool(input, output, m_argmax.data());
+    }
+    else
+    {
+        pool(input, output, nullptr);
+    }
+}
+
+void Pool2DLayer::backward(const batchMatrix &input, const batchMatrix &/*output*/,
+                           const batchMatrix &outputGrad, batchMatrix &inputGrad)
+{
+    /*
+    Max pooling routes each output gradient to the recorded winner of its
+    window; average pooling spreads it evenly over the window.
+    */
+
+    const int batchSize { input.numRows() };
+    inputGrad.resize(batchSize, getInputSize());
+    std::fill(inputGrad.getValues().begin(), inputGrad.getValues().end(), 0.0);
+
+    if (m_type == Pooling::MAX && m_argmax.size() != static_cast<size_t>(batchSize) * getOutputSize())
+    {
+        cerr << "Pool2DLayer::backward called without a matching training forward pass!" << endl;
+        assert(false);
+    }
+
+    const double windowScale { 1.0 / (m_poolSize * m_poolSize) };
+
+    parallel::parallelFor(0, batchSize, [&](int sampleBegin, int sampleEnd)
+    {
+        for (int n=sampleBegin; n<sampleEnd; ++n)
+        {
+            const double *gradSample { outputGrad.data() + static_cast<long>(n)*outputGrad.numCols() };
+            double *inGradSample { inputGrad.data() + static_cast<long>(n)*inputGrad.numCols() };
+            const uint8_t *argSample { m_type == Pooling::MAX ? m_argmax.data() + static_cast<long>(n)*getOutputSize() : nullptr };
+
+            for (int c=0; c<m_channels; ++c)
+            {
+                double *channel { inGradSample + c*m_inHeight*m_inWidth };
+                for (int oy=0; oy<m_outHeight; ++oy)
+                {
+                    for (int ox=0; ox<m_outWidth; ++ox)
+                    {
+                        const int i { (c*m_outHeight + oy)*m_outWidth + ox };
+                        double *window { channel + oy*m_stride*m_inWidth + ox*m_stride };
+                        if (m_type == Pooling::MAX)
+                        {
+                            const int offset { argSample[i] };
+                            window[(offset / m_poolSize)*m_inWidth + offset % m_poolSize] += gradSample[i];
+                        }
+                        else
+                        {
+                            for (int ky=0; ky<m_poolSize; ++ky)
+                            {
+                                for (int kx=0; kx<m_poolSize; ++kx)
+                                {
+                                    window[ky*m_inWidth + kx] += gradSample[i] * windowScale;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,268 @@
+#include "ml_models/DNN/quantized_network.hpp"
+#include "ml_models/DNN/activation.hpp"
+#include "ml_models/DNN/parameters.hpp"
+#include "math/gemm.hpp"
+#include "math/qgemm.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+    const int INT8_LIMIT {127}; // Symmetric range [-127, 127]; -128 is never produced.
+
+    int8_t quantize(double value, double inverseScale)
+    {
+        const long level { std::lround(value * inverseScale) };
+        return static_cast<int8_t>(std::max<long>(-INT8_LIMIT, std::min<long>(INT8_LIMIT, level)));
+    }
+
+    double scaleFor(double maxMagnitude)
+    {
+        return maxMagnitude > 0.0 ? maxMagnitude / INT8_LIMIT : 1.0;
+    }
+
+    double maxMagnitude(const batchMatrix &values)
+    {
+        double largest {0.0};
+        for (double value : values.getValues())
+        {
+            largest = std::max(largest, std::abs(value));
+        }
+        return largest;
+    }
+
+    void applyActivation(batchMatrix &values, const vector<double> &biases, Activation type)
+    {
+        for (int n=0; n<values.numRows(); ++n)
+        {
+            double *row { values.data() + static_cast<long>(n)*values.numCols() };
+            for (int j=0; j<values.numCols(); ++j)
+            {
+                row[j] = activation::apply(type, row[j] + biases[j]);
+            }
+        }
+    }
+
+    int argmaxOfRow(const batchMatrix &values, int n)
+    {
+        const double *row { values.data() + static_cast<long>(n)*values.numCols() };
+        return std::max_element(row, row + values.numCols()) - row;
+    }
+}
+
+QuantizedNetwork::QuantizedNetwork(const Network &network, const batchMatrix &calibrationInputs)
+{
+    /*
+    Quantizes the weights row by row, then runs the float dense stack over
+    the calibration inputs to find the input range of every dense layer.
+    */
+
+    const Network model { network.inferenceModel() };
+    for (int i=0; i<model.getNumFeatureLayers(); ++i)
+    {
+        m_featureLayers.push_back(model.getFeatureLayer(i).clone());
+    }
+    m_inputBiases     = model.getLayer(0).getBiases();
+    m_inputActivation = model.getLayer(0).getActivationType();
+
+    batchMatrix activations;
+    runFeatures(calibrationInputs, activations);
+
+    for (int l=0; l<model.getNumLayers()-1; ++l)
+    {
+        // The folded weights carry any batch norm; a sparse inference model keeps no dense copy, so
+        // those fall back to the trained weights, which only match when there was nothing to fold.
+        const bool folded { model.getWeightMatrix(l).size() != 0 };
+        const weightMatrix &weights { folded ? model.getWeightMatrix(l) : network.getWeightMatrix(l) };
+        if (weights.size() == 0)
+        {
+            cerr << "QuantizedNetwork needs the dense weights of layer " << l << "; quantize the trained network, not its inference model!" << endl;
+            assert(false);
+        }
+        assert(folded || network.getBatchNorm(l+1) == nullptr);
+        QuantizedLayer layer;
+        layer.numInputs      = weights.numCols();
+        layer.numOutputs     = weights.numRows();
+        layer.biases         = model.getLayer(l+1).getBiases();
+        layer.activationType = model.getLayer(l+1).getActivationType();
+        layer.inputScale     = scaleFor(maxMagnitude(activations));
+        layer.weights.resize(static_cast<size_t>(layer.numOutputs) * layer.numInputs);
+        layer.weightScales.resize(layer.numOutputs);
+
+        for (int j=0; j<layer.numOutputs; ++j)
+        {
+            const double *row { weights.data() + static_cast<long>(j)*layer.numInputs };
+            double largest {0.0};
+            for (int k=0; k<layer.numInputs; ++k)
+            {
+                largest = std::max(largest, std::abs(row[k]));
+            }
+            layer.weightScales[j] = scaleFor(largest);
+            const double inverseScale { 1.0 / layer.weightScales[j] };
+            for (int k=0; k<layer.numInputs; ++k)
+            {
+                layer.weights[static_cast<long>(j)*layer.numInputs + k] = quantize(row[k], inverseScale);
+            }
+        }
+        m_layers.push_back(layer);
+
+        // Float forward pass through this layer, for the next layer's calibration.
+        batchMatrix next;
+        linalg::gemm(activations, false, weights, true, next);
+        applyActivation(next, layer.biases, layer.activationType);
+        activations = std::move(next);
+    }
+}
+
+QuantizedNetwork::QuantizedNetwork(const QuantizedNetwork &other)
+{
+    for (const unique_ptr<BatchLayer> &layer : other.m_featureLayers)
+    {
+        m_featureLayers.push_back(layer->clone());
+    }
+    m_inputBiases     = other.m_inputBiases;
+    m_inputActivation = other.m_inputActivation;
+    m_layers          = other.m_layers;
+}
+
+void QuantizedNetwork::runFeatures(const batchMatrix &inputs, batchMatrix &activations) const
+{
+    batchMatrix features[2];
+    const batchMatrix *layerInput { &inputs };
+    for (size_t i=0; i<m_featureLayers.size(); ++i)
+    {
+        batchMatrix &layerOutput { features[i % 2] };
+        m_featureLayers[i]->infer(*layerInput, layerOutput);
+        layerInput = &layerOutput;
+    }
+    activations = *layerInput;
+    applyActivation(activations, m_inputBiases, m_inputActivation);
+}
+
+void QuantizedNetwork::predict(const batchMatrix &inputs, batchMatrix &outputs) const
+{
+    /*
+    Each dense layer quantizes its input batch, multiplies it with the int8
+    weights into int32 sums, and rescales those by
+    (input scale * weight row scale) before the bias and activation.
+    */
+
+    batchMatrix activations;
+    runFeatures(inputs, activations);
+    const int batchSize { activations.numRows() };
+
+    vector<int8_t> quantizedInputs;
+    vector<int32_t> sums;
+    for (size_t l=0; l<m_layers.size(); ++l)
+    {
+        const QuantizedLayer &layer { m_layers[l] };
+        quantizedInputs.resize(static_cast<size_t>(batchSize) * layer.numInputs);
+        sums.resize(static_cast<size_t>(batchSize) * layer.numOutputs);
+
+        const double inverseScale { 1.0 / layer.inputScale };
+        const vector<double> &values { activations.getValues() };
+        for (size_t i=0; i<values.size(); ++i)
+        {
+            quantizedInputs[i] = quantize(values[i], inverseScale);
+        }
+
+        if (batchSize == 1)
+        {
+            linalg::gemvInt8(layer.numOutputs, layer.numInputs, quantizedInputs.data(),
+                             layer.weights.data(), layer.numInputs, sums.data());
+        }
+        else
+        {
+            linalg::gemmInt8(batchSize, layer.numOutputs, layer.numInputs, quantizedInputs.data(), layer.numInputs,
+                             layer.weights.data(), layer.numInputs, sums.data(), layer.numOutputs);
+        }
+
+        batchMatrix &layerOutput { (l+1 == m_layers.size()) ? outputs : activations };
+        layerOutput.resize(batchSize, layer.numOutputs);
+        for (int n=0; n<batchSize; ++n)
+        {
+            const int32_t *sumRow { sums.data() + static_cast<long>(n)*layer.numOutputs };
+            double *row { layerOutput.data() + static_cast<long>(n)*layer.numOutputs };
+            for (int j=0; j<layer.numOutputs; ++j)
+            {
+                const double input { sumRow[j] * (static_cast<double>(layer.inputScale) * layer.weightScales[j]) + layer.biases[j] };
+                row[j] = activation::apply(layer.activationType, input);
+            }
+        }
+    }
+}
+
+size_t QuantizedNetwork::getDenseBytes() const
+{
+    size_t bytes {0};
+    for (const QuantizedLayer &layer : m_layers)
+    {
+        bytes += layer.weights.size() * sizeof(int8_t)
+               + layer.weightScales.size() * sizeof(float) + sizeof(float)
+               + layer.biases.size() * sizeof(double);
+    }
+    return bytes;
+}
+
+QuantizationReport QuantizedNetwork::compare(const Network &reference, const batchMatrix &inputs, const batchMatrix &targets) const
+{
+    QuantizationReport report;
+    report.numSamples = inputs.numRows();
+
+    batchMatrix floatOutputs, quantizedOutputs;
+    const auto time0 { chrono::steady_clock::now() };
+    reference.predict(inputs, floatOutputs);
+    const auto time1 { chrono::steady_clock::now() };
+    predict(inputs, quantizedOutputs);
+    const auto time2 { chrono::steady_clock::now() };
+    report.floatSeconds     = chrono::duration<double>(time1 - time0).count();
+    report.quantizedSeconds = chrono::duration<double>(time2 - time1).count();
+
+    int floatCorrect {0}, quantizedCorrect {0};
+    for (int n=0; n<report.numSamples; ++n)
+    {
+        const int label { argmaxOfRow(targets, n) };
+        floatCorrect     += (argmaxOfRow(floatOutputs, n) == label);
+        quantizedCorrect += (argmaxOfRow(quantizedOutputs, n) == label);
+    }
+    report.floatAccuracy     = report.numSamples ? double(floatCorrect) / report.numSamples : 0.0;
+    report.quantizedAccuracy = report.numSamples ? double(quantizedCorrect) / report.numSamples : 0.0;
+
+    report.maxOutputDifference = 0.0;
+    double totalDifference {0.0};
+    for (int i=0; i<floatOutputs.size(); ++i)
+    {
+        const double difference { std::abs(floatOutputs.getValues()[i] - quantizedOutputs.getValues()[i]) };
+        report.maxOutputDifference = std::max(report.maxOutputDifference, difference);
+        totalDifference += difference;
+    }
+    report.meanOutputDifference = floatOutputs.size() ? totalDifference / floatOutputs.size() : 0.0;
+
+    report.floatBytes = 0;
+    for (int l=0; l<reference.getNumLayers()-1; ++l)
+    {
+        report.floatBytes += reference.getWeightMatrix(l).size() * sizeof(double)
+                           + reference.getLayer(l+1).getSize() * sizeof(double);
+    }
+    report.quantizedBytes = getDenseBytes();
+    return report;
+}
+
+void QuantizationReport::printToConsole() const
+{
+    cout << "Quantization report (" << numSamples << " samples)" << endl
+         << "Accuracy:          float " << floatAccuracy << ", int8 " << quantizedAccuracy
+         << " (delta " << quantizedAccuracy - floatAccuracy << ")" << endl
+         << "Output difference: max " << maxOutputDifference << ", mean " << meanOutputDifference << endl
+         << "Dense model size:  float " << floatBytes << " B, int8 " << quantizedBytes << " B ("
+         << (quantizedBytes ? double(floatBytes) / quantizedBytes : 0.0) << "x smaller)" << endl
+         << "Inference time:    float " << floatSeconds << " s, int8 " << quantizedSeconds << " s" << endl << endl;
+}
@@ -1,45 +1,55 @@
-#include "common.hpp"
-#include "KMeans/kmeans.hpp"
-#include "MNIST/mnist_data_handler.hpp"
+#include "data_processing/MNIST/common.hpp"
+#include "ml_models/KMeans/kmeans.hpp"
+#include "data_processing/MNIST/mnist_data_handler.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/parallel.hpp"
 
+#include <atomic>
 #include <cmath>
 #include <cstdlib>
 #include <limits>
 #include <map>
 #include <unordered_set>
 
+namespace
+{
+    // Points per partial centroid sum in iterate(); fixed so deterministic reductions don't depend on the thread count.
+    const int CENTROID_SUM_GRAIN {1024};
+}
+
 KMeans::KMeans(int k)
 {
+    memtrack::Scope scope(memtrack::Subsystem::INDEXES);
     numClusters = k;
-    printf("%d", numClusters);
     m_clusters = new std::vector<cluster_t*>;
     usedIndices = new std::unordered_set<int>;
 }
 
 void KMeans::initClusters()
 {
-    printf("%d", numClusters);
+    memtrack::Scope scope(memtrack::Subsystem::INDEXES);
     for (int i=0; i<numClusters; ++i)
     {
-        int index { rand() % trainingData->size() };
+        int index { static_cast<int>(rand() % trainingData.size()) };
         while (usedIndices->find(index) != usedIndices->end())
         {
-            index =  rand() % trainingData->size();
+            index =  rand() % trainingData.size();
         }
-        m_clusters->push_back(new cluster_t(trainingData->at(index)));
+        m_clusters->push_back(new cluster_t(&trainingData.at(index)));
         usedIndices->insert(index);    
     }
 }
 
 void KMeans::initClustersForEachClass()
 {
+    memtrack::Scope scope(memtrack::Subsystem::INDEXES);
     std::unordered_set<int> usedClasses;
-    for (int i=0; i<trainingData->size(); ++i)
+    for (int i=0; i<trainingData.size(); ++i)
     {
-        if (usedClasses.find(trainingData->at(i)->getLabel()) == usedClasses.end())
+        if (usedClasses.find(trainingData.at(i).getLabel()) == usedClasses.end())
         {
-            m_clusters->push_back(new cluster_t(trainingData->at(i)));
-            usedClasses.insert(trainingData->at(i)->getLabel());
+            m_clusters->push_back(new cluster_t(&trainingData.at(i)));
+            usedClasses.insert(trainingData.at(i).getLabel());
             usedIndices->insert(i);
         }
     }
@@ -47,82 +57,197 @@ void KMeans::initClustersForEachClass()
 
 void KMeans::train()
 {
-    while (usedIndices->size() < trainingData->size() )
+    memtrack::Scope scope(memtrack::Subsystem::INDEXES);
+    while (usedIndices->size() < trainingData.size() )
     {
-        int index { rand() % trainingData->size() };
+        int index { static_cast<int>(rand() % trainingData.size()) };
         while (usedIndices->find(index) != usedIndices->end())
         {
-            index = rand() % trainingData->size();
+            index = rand() % trainingData.size();
         }
         double minDistance { std::numeric_limits<double>::max() };
         int bestCluster {0};
         for (int i=0; i<m_clusters->size(); ++i)
         {
-            double currentDistance {euclideanDistance(m_clusters->at(i)->centroid, trainingData->at(index))};
+            double currentDistance {euclideanDistance(m_clusters->at(i)->centroid, &trainingData.at(index))};
             if (currentDistance < minDistance)
             {
                 minDistance = currentDistance;
                 bestCluster = i;
             }
         }
-        m_clusters->at(bestCluster)->addToCluster(trainingData->at(index));
+        m_clusters->at(bestCluster)->addToCluster(&trainingData.at(index));
         usedIndices->insert(index);
     }
     
 }
 
+double KMeans::iterate()
+{
+    /*
+    Assigns every training point to its nearest centroid (points are shared
+    out between threads), then moves each centroid to the mean of its
+    points and recomputes the cluster's class counts. Clusters left empty
+    keep their centroid.
+    */
+
+    memtrack::Scope scope(memtrack::Subsystem::INDEXES);
+    const int numPoints { static_cast<int>(trainingData.size()) };
+    std::vector<int> assignments(numPoints);
+    std::vector<double> squaredDistances(numPoints);
+    parallel::parallelFor(0, numPoints, [&](int pointBegin, int pointEnd)
+    {
+        for (int n=pointBegin; n<pointEnd; ++n)
+        {
+            double minDistance { std::numeric_limits<double>::max() };
+            for (int i=0; i<m_clusters->size(); ++i)
+            {
+                const double currentDistance { euclideanDistance(m_clusters->at(i)->centroid, &trainingData.at(n)) };
+                if (currentDistance < minDistance)
+                {
+                    minDistance = currentDistance;
+                    assignments[n] = i;
+                }
+            }
+            squaredDistances[n] = minDistance * minDistance;
+        }
+    });
+
+    for (cluster_t *cluster : *m_clusters)
+    {
+        cluster->clusterPoints->clear();
+        cluster->classCounts.clear();
+    }
+    for (int n=0; n<numPoints; ++n)
+    {
+        cluster_t *cluster { m_clusters->at(assignments[n]) };
+        cluster->clusterPoints->push_back(&trainingData.at(n));
+        ++cluster->classCounts[trainingData.at(n).getLabel()];
+    }
+
+    double totalSquaredDistance {0.0};
+    for (double squaredDistance : squaredDistances)
+    {
+        totalSquaredDistance += squaredDistance;
+    }
+
+    // The centroid sums are one parallel reduction over the points, every point adding into its cluster's slot.
+    const int numClusterSlots { static_cast<int>(m_clusters->size()) };
+    const int featureSize { numPoints > 0 ? static_cast<int>(trainingData.front().getFeatureVector().size()) : 0 };
+    std::vector<double> centroidSums(static_cast<size_t>(numClusterSlots) * featureSize);
+    parallel::parallelReduce(0, numPoints, CENTROID_SUM_GRAIN, static_cast<int>(centroidSums.size()), [&](int pointBegin, int pointEnd, double *partial)
+    {
+        for (int n=pointBegin; n<pointEnd; ++n)
+        {
+            const std::vector<double> &features { trainingData.at(n).getFeatureVector() };
+            double *sum { partial + static_cast<size_t>(assignments[n]) * featureSize };
+            for (int d=0; d<featureSize; ++d)
+            {
+                sum[d] += features[d];
+            }
+        }
+    }, centroidSums.data());
+
+    for (int i=0; i<numClusterSlots; ++i)
+    {
+        cluster_t *cluster { m_clusters->at(i) };
+        if (cluster->clusterPoints->empty())
+        {
+            continue;
+        }
+        const double *sum { centroidSums.data() + static_cast<size_t>(i) * featureSize };
+        for (int d=0; d<featureSize; ++d)
+        {
+            (*cluster->centroid)[d] = sum[d] / cluster->clusterPoints->size();
+        }
+        cluster->setModalClass();
+    }
+
+    return numPoints > 0 ? totalSquaredDistance / numPoints : 0.0;
+}
+
+roofline::KernelCost KMeans::iterationCost() const
+{
+    /*
+    The assignment does 3 flops per feature, point and centroid and the
+    update 1 per feature and point. Each streams the training features
+    once (a point's features stay in cache across the centroids, and the
+    centroids across the points); the centroids are read and written once.
+    */
+
+    const double numPoints { double(trainingData.size()) };
+    const double featureSize { trainingData.empty() ? 0.0 : double(trainingData.front().getFeatureVector().size()) };
+    return { "KMeans iteration (k=" + std::to_string(numClusters) + ")",
+             numPoints * featureSize * (3.0 * numClusters + 1.0),
+             sizeof(double) * (2.0 * numPoints * featureSize + 2.0 * numClusters * featureSize), 0.0 };
+}
+
 double KMeans::euclideanDistance(std::vector<double>* centroid, MNISTData* dataPoint)
 {
     double distance {0.0};
+    const std::vector<double> &features { dataPoint->getFeatureVector() };
     for (int i=0; i<centroid->size(); ++i)
     {
-        distance += pow(centroid->at(i)-dataPoint->getFeatureVector()->at(i), 2);
+        const double difference { (*centroid)[i] - features[i] };
+        distance += difference * difference;
     }
     return sqrt(distance);
 }
 
 double KMeans::validate()
 {
-    int correctPredictions {0};
-    for (auto queryPoint : *validationData)
+    std::atomic<int> correctPredictions {0};
+    parallel::parallelFor(0, validationData.size(), [&](int queryBegin, int queryEnd)
     {
-        double minDistance { std::numeric_limits<double>::max() };
-        int bestCluster {0};
-        for (int i=0; i<m_clusters->size(); ++i)
+        int correct {0};
+        for (int n=queryBegin; n<queryEnd; ++n)
         {
-            double currentDistance {euclideanDistance(m_clusters->at(i)->centroid, queryPoint)};
-            if (currentDistance < minDistance)
+            MNISTData* queryPoint { &validationData[n] };
+            double minDistance { std::numeric_limits<double>::max() };
+            int bestCluster {0};
+            for (int i=0; i<m_clusters->size(); ++i)
             {
-                minDistance = currentDistance;
-                bestCluster = i;
+                double currentDistance {euclideanDistance(m_clusters->at(i)->centroid, queryPoint)};
+                if (currentDistance < minDistance)
+                {
+                    minDistance = currentDistance;
+                    bestCluster = i;
+                }
             }
+            if (m_clusters->at(bestCluster)->modalClass == queryPoint->getLabel()) ++correct;
         }
-        if (m_clusters->at(bestCluster)->modalClass == queryPoint->getLabel()) ++correctPredictions;
-    }
-    double performance {100.0*(correctPredictions/validationData->size())};
+        correctPredictions += correct;
+    });
+    double performance {100.0*correctPredictions/validationData.size()};
     printf("Performance at K = %d: %.3f%%", numClusters, performance);
     return performance;
 }
 
 double KMeans::test()
 {
-    double correctPredictions {0};
-    for (auto queryPoint : *testData)
+    std::atomic<int> correctPredictions {0};
+    parallel::parallelFor(0, testData.size(), [&](int queryBegin, int queryEnd)
     {
-        double minDistance { std::numeric_limits<double>::max() };
-        int bestCluster {0};
-        for (int i=0; i<m_clusters->size(); ++i)
+        int correct {0};
+        for (int n=queryBegin; n<queryEnd; ++n)
         {
-            double currentDistance {euclideanDistance(m_clusters->at(i)->centroid, queryPoint)};
-            if (currentDistance < minDistance)
+            MNISTData* queryPoint { &testData[n] };
+            double minDistance { std::numeric_limits<double>::max() };
+            int bestCluster {0};
+            for (int i=0; i<m_clusters->size(); ++i)
             {
-                minDistance = currentDistance;
-                bestCluster = i;
+                double currentDistance {euclideanDistance(m_clusters->at(i)->centroid, queryPoint)};
+                if (currentDistance < minDistance)
+                {
+                    minDistance = currentDistance;
+                    bestCluster = i;
+                }
             }
+            if (m_clusters->at(bestCluster)->modalClass == queryPoint->getLabel()) ++correct;
         }
-        if (m_clusters->at(bestCluster)->modalClass == queryPoint->getLabel()) ++correctPredictions;
-    }
-    double performance {100.0*(correctPredictions/double{testData->size()})};
+        correctPredictions += correct;
+    });
+    double performance {100.0*correctPredictions/testData.size()};
     printf("Test performance at K = %d: %.3f%%", numClusters, performance);
     return performance;
 }
\ No newline at end of file
@@ -1,8 +1,16 @@
-#include "KMeans/kmeans.hpp"
-#include "MNIST/mnist_data_handler.hpp"
+#include "ml_models/KMeans/kmeans.hpp"
+#include "data_processing/MNIST/mnist_data_handler.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 int main()
 {
+    memtrack::dumpAtExit();
+
     MNISTDataHandler* dataHandler = new MNISTDataHandler();
 
     dataHandler->readFeatureVector("data/train-images-idx3-ubyte");
@@ -13,20 +21,30 @@ int main()
     double bestPerformance {0.0};
     int bestK {1};
 
-    for (int k=dataHandler->getClassCounts(); k<dataHandler->getTrainingData()->size()*0.1; ++k)
+    // The k values are tried in parallel, each model's own parallel loops nesting
+    // inside on the same workers.
+    const int firstK { dataHandler->getClassCounts() };
+    const int endK { static_cast<int>(std::ceil(dataHandler->getTrainingData().size()*0.1)) };
+    std::vector<double> performances(std::max(0, endK - firstK), 0.0);
+    parallel::parallelFor(firstK, endK, 1, [&](int kBegin, int kEnd)
+    {
+        for (int k=kBegin; k<kEnd; ++k)
+        {
+            KMeans kmeans(k);
+            kmeans.setTrainingData(dataHandler->getTrainingData());
+            kmeans.setTestData(dataHandler->getTestData());
+            kmeans.setValidationData(dataHandler->getValidationData());
+
+            kmeans.initClusters();
+            kmeans.train();
+            performances[k - firstK] = kmeans.validate();
+        }
+    });
+    for (int k=firstK; k<endK; ++k)
     {
-        KMeans *kmeans = new KMeans(k);
-        kmeans->setTrainingData(dataHandler->getTrainingData());
-        kmeans->setTestData(dataHandler->getTestData());
-        kmeans->setValidationData(dataHandler->getValidationData());
-
-        
-        kmeans->initClusters();
-        kmeans->train();
-        performance = kmeans->validate();
-        if (performance>bestPerformance)
+        if (performances[k - firstK]>bestPerformance)
         {
-            bestPerformance = performance;
+            bestPerformance = performances[k - firstK];
             bestK = k;
         }
     }
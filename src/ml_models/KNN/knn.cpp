@@ -1,6 +1,10 @@
-#include "KNN/knn.hpp"
-#include "MNIST/mnist_data_handler.hpp"
+#include "ml_models/KNN/knn.hpp"
+#include "data_processing/MNIST/mnist_data_handler.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/parallel.hpp"
+#include "math/profiler.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <limits>
 #include <map>
@@ -10,58 +14,71 @@ KNN::KNN(int initialK) { k = initialK; }
 
 void KNN::findKNearest(MNISTData* queryPoint)
 {
-    neighbours = new std::vector<MNISTData*>;
-    double min {std::numeric_limits<double>::max()};
-    double previousMin {min};
-    int index {0};
-    
-    for (int i=0; i<k; ++i)
+    /*
+    Computes the distance from the query to every training point (shared
+    out between threads), then selects the k closest with a partial sort.
+    On multi-socket machines each thread scans the copy of the training
+    features on its own node; the training set mustn't change after the
+    first query.
+    */
+
+    profiler::Region region("KNN::findKNearest");
+    if (!trainingReplicas)
     {
-        if (i==0)
-        {
-            for (int j=0; j<queryPoint->featureVectorSize(); ++j)
-            {
-                double distance {calculateDistance(queryPoint, trainingData->at(j))};
-                trainingData->at(j)->setDistance(distance);
-                if (distance<min)
-                {
-                    min = distance;
-                    index = j;
-                }
-            }
-            neighbours->push_back(trainingData->at(index));
-            previousMin = min;
-            min = std::numeric_limits<double>::max();
-        } else
+        memtrack::Scope datasetScope(memtrack::Subsystem::DATASET);
+        trainingReplicas.reset(new numa::Replicated<std::vector<MNISTData>>(trainingData));
+    }
+    memtrack::Scope scope(memtrack::Subsystem::INDEXES);
+    neighbours.clear();
+    const int numPoints { static_cast<int>(trainingData.size()) };
+    parallel::parallelFor(0, numPoints, [&](int pointBegin, int pointEnd)
+    {
+        const std::vector<MNISTData> &localData { trainingReplicas->local() };
+        for (int j=pointBegin; j<pointEnd; ++j)
         {
-            for (int j=0; j<queryPoint->featureVectorSize(); ++j)
-            {
-                double distance { trainingData->at(j)->getDistance() };
-                if (distance>previousMin && distance < min)
-                {
-                    min = distance;
-                    index = j;
-                }
-            }
-            neighbours->push_back(trainingData->at(index));
-            previousMin = min;
-            min = std::numeric_limits<double>::max();
+            trainingData.at(j).setDistance(calculateDistance(queryPoint, const_cast<MNISTData*>(&localData.at(j))));
         }
+    });
+
+    std::vector<int> order(numPoints);
+    for (int j=0; j<numPoints; ++j)
+    {
+        order[j] = j;
+    }
+    const int numNeighbours { std::min(k, numPoints) };
+    std::partial_sort(order.begin(), order.begin() + numNeighbours, order.end(),
+                      [&](int a, int b) { return trainingData[a].getDistance() < trainingData[b].getDistance(); });
+    for (int i=0; i<numNeighbours; ++i)
+    {
+        neighbours.push_back(&trainingData.at(order[i]));
     }
 }
+
+roofline::KernelCost KNN::queryCost() const
+{
+    /*
+    A subtraction, multiplication and addition per feature and training
+    point; the training features are streamed once, the query stays in cache.
+    */
+
+    const double numPoints { double(trainingData.size()) };
+    const double featureSize { trainingData.empty() ? 0.0 : double(trainingData.front().getFeatureVector().size()) };
+    return { "KNN query (" + std::to_string(trainingData.size()) + " points)", 3.0 * numPoints * featureSize,
+             sizeof(double) * (numPoints * featureSize + featureSize + numPoints), 0.0 };
+}
 void KNN::setK(int value) { k = value; }
 
 int KNN::predictClass()
 {
     std::map<uint8_t, int> classFrequency;
-    for (int i=0; i<neighbours->size(); ++i)
+    for (int i=0; i<neighbours.size(); ++i)
     {
-        if (classFrequency.find(neighbours->at(i)->getLabel()) == classFrequency.end())
+        if (classFrequency.find(neighbours.at(i)->getLabel()) == classFrequency.end())
         {
-            classFrequency[neighbours->at(i)->getLabel()] = 1;
+            classFrequency[neighbours.at(i)->getLabel()] = 1;
         } else
         {
-            ++classFrequency[neighbours->at(i)->getLabel()];
+            ++classFrequency[neighbours.at(i)->getLabel()];
         }  
     }
 
@@ -76,7 +93,6 @@ int KNN::predictClass()
         }
     }
 
-    delete neighbours;
     return best;
 }
 
@@ -90,9 +106,12 @@ double KNN::calculateDistance(MNISTData* queryPoint, MNISTData* input)
 
     double distance {0.0};
     #ifdef EUCLIDEAN
-        for (unsigned i=0; i<queryPoint->featureVectorSize(); ++i)
+        const std::vector<double> &query { queryPoint->getFeatureVector() };
+        const std::vector<double> &features { input->getFeatureVector() };
+        for (unsigned i=0; i<query.size(); ++i)
         {
-            distance += pow(queryPoint->getFeatureVector()->at(i) - input->getFeatureVector()->at(i), 2);
+            const double difference { query[i] - features[i] };
+            distance += difference * difference;
         }
         distance = sqrt(distance);
     
@@ -107,19 +126,20 @@ double KNN::validateModel()
     double currentPerformance {0};
     int count {0};
     int dataIndex {0};
-    for (MNISTData* queryPoint: *validationData)
+    for (MNISTData &query: validationData)
     {
+        MNISTData* queryPoint { &query };
         findKNearest(queryPoint);
         int prediction = predictClass();
         printf("%d -> %d\n", prediction, queryPoint->getLabel());
-        if (prediction = queryPoint->getLabel())
+        if (prediction == queryPoint->getLabel())
         {
             ++count;
         }
         ++dataIndex;
-        printf("Current performance = %.3f%%\n", (double{count}*100/double{dataIndex}));
+        printf("Current performance = %.3f%%\n", (double(count)*100/dataIndex));
     }
-    currentPerformance = double{count}*100/double{validationData->size()};
+    currentPerformance = double(count)*100/validationData.size();
     printf("Overall validation performance for K=%d: %.3f%%\n", k, currentPerformance);
     return currentPerformance;
 }
@@ -127,16 +147,17 @@ double KNN::testModel()
 {
     double currentPerformance {0};
     int count {0};
-    for (MNISTData* queryPoint: *testData)
+    for (MNISTData &query: testData)
     {
+        MNISTData* queryPoint { &query };
         findKNearest(queryPoint);
         int prediction = predictClass();
-        if (prediction = queryPoint->getLabel())
+        if (prediction == queryPoint->getLabel())
         {
             ++count;
         }
     }
-    currentPerformance = double{count}*100/double{validationData->size()};
+    currentPerformance = double(count)*100/testData.size();
     printf("Overall test performance = %.3f%%\n", currentPerformance);
     return currentPerformance;
 }
\ No newline at end of file
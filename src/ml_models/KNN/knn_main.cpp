@@ -1,8 +1,11 @@
-#include "KNN/knn.hpp"
-#include "MNIST/mnist_data_handler.hpp"
+#include "ml_models/KNN/knn.hpp"
+#include "data_processing/MNIST/mnist_data_handler.hpp"
+#include "math/memory_tracker.hpp"
 
 int main()
 {
+    memtrack::dumpAtExit();
+
     MNISTDataHandler* dataHandler = new MNISTDataHandler();
 
     dataHandler->readFeatureVector("data/train-images-idx3-ubyte");
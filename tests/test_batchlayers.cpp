@@ -0,0 +1,880 @@
+#include "ml_models/DNN/batchnorm_layer.hpp"
+#include "ml_models/DNN/checkpoint_writer.hpp"
+#include "ml_models/DNN/conv_layer.hpp"
+#include "ml_models/DNN/dense_layer.hpp"
+#include "ml_models/DNN/dropout.hpp"
+#include "ml_models/DNN/inference_graph.hpp"
+#include "ml_models/DNN/network.hpp"
+#include "ml_models/DNN/parameters.hpp"
+#include "ml_models/DNN/pooling_layer.hpp"
+#include "ml_models/DNN/quantized_network.hpp"
+#include "data_processing/dataset_view.hpp"
+#include "math/matrix.hpp"
+#include "math/parallel.hpp"
+#include "math/sparse.hpp"
+
+#include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+double halfSquaredSum(const batchMatrix &M)
+{
+    double sum {0.0};
+    for (double value : M.getValues())
+    {
+        sum += 0.5 * value * value;
+    }
+    return sum;
+}
+
+vector<vector<vector<double>>> randomSamples(int numSamples, int inputSize, int numClasses)
+{
+    // Uniform random inputs; sample i is of class i % numClasses, with a one-hot target.
+    vector<vector<vector<double>>> samples;
+    for (int i=0; i<numSamples; ++i)
+    {
+        batchMatrix sample(1, inputSize, true);
+        vector<double> target(numClasses, 0.0);
+        target[i % numClasses] = 1.0;
+        samples.push_back({sample.getValues(), target});
+    }
+    return samples;
+}
+
+template <class Training>
+auto quietly(Training training) -> decltype(training())
+{
+    // Runs training() with cout (the per-batch training log) silenced, restoring its state however it exits.
+    struct Silence
+    {
+        ios_base::iostate state { cout.rdstate() };
+        Silence()  { cout.setstate(ios_base::failbit); }
+        ~Silence() { cout.clear(state); }
+    } silence;
+    return training();
+}
+
+void test_conv2DGradients()
+{
+    /*
+    Checks Conv2DLayer::backward against central finite differences of
+    the cost 0.5*|output|^2, for both the input and the kernel gradients.
+    */
+    const double h {1e-6};
+    Conv2DLayer conv(2, 5, 5, 3, 3, 1, 1, Activation::TANH);
+
+    batchMatrix input(2, conv.getInputSize(), true);
+    batchMatrix output, inputGrad;
+    conv.forward(input, output);
+    conv.backward(input, output, output, inputGrad); // d(cost)/d(output) = output
+
+    double maxInputError {0.0};
+    for (int n=0; n<input.numRows(); ++n)
+    {
+        for (int i=0; i<input.numCols(); ++i)
+        {
+            batchMatrix shifted {input};
+            shifted(n,i) += h;
+            batchMatrix plus;
+            conv.infer(shifted, plus);
+            shifted(n,i) -= 2*h;
+            batchMatrix minus;
+            conv.infer(shifted, minus);
+            const double numerical { (halfSquaredSum(plus) - halfSquaredSum(minus)) / (2*h) };
+            maxInputError = max(maxInputError, abs(numerical - inputGrad(n,i)));
+        }
+    }
+
+    // update(1) subtracts the accumulated gradient, which recovers it from the kernels.
+    linalg::Matrix<double> kernelsBefore {conv.getKernels()};
+    vector<double> biasesBefore {conv.getBiases()};
+    conv.update(1.0);
+    linalg::Matrix<double> kernelGrads {kernelsBefore};
+    for (int i=0; i<kernelGrads.size(); ++i)
+    {
+        kernelGrads.getValues()[i] -= conv.getKernels().getValues()[i];
+    }
+    conv.getKernels() = kernelsBefore;
+    conv.getBiases() = biasesBefore;
+
+    double maxKernelError {0.0};
+    for (int i=0; i<kernelsBefore.size(); ++i)
+    {
+        conv.getKernels().getValues()[i] += h;
+        batchMatrix plus;
+        conv.infer(input, plus);
+        conv.getKernels().getValues()[i] -= 2*h;
+        batchMatrix minus;
+        conv.infer(input, minus);
+        conv.getKernels().getValues()[i] += h;
+        const double numerical { (halfSquaredSum(plus) - halfSquaredSum(minus)) / (2*h) };
+        maxKernelError = max(maxKernelError, abs(numerical - kernelGrads.getValues()[i]));
+    }
+
+    cout << conv.getName() << endl;
+    cout << "Max input gradient error:  " << maxInputError << endl;
+    cout << "Max kernel gradient error: " << maxKernelError << endl << endl;
+    assert(maxInputError < 1e-6);
+    assert(maxKernelError < 1e-6);
+}
+
+void test_denseLayerGradients()
+{
+    /*
+    DenseLayer takes its gradients from the autodiff tape: they must match
+    central finite differences of 0.5*|output|^2, and training it in front
+    of a network must, after the first minibatch, reuse the tape's arena
+    rather than grow it.
+    */
+    const double h {1e-6};
+    DenseLayer dense(7, 5, Activation::FAST_SIGMOID);
+
+    batchMatrix input(3, 7, true);
+    batchMatrix output, inputGrad;
+    dense.forward(input, output);
+    dense.backward(input, output, output, inputGrad); // d(cost)/d(output) = output
+
+    double maxInputError {0.0};
+    for (int n=0; n<input.numRows(); ++n)
+    {
+        for (int i=0; i<input.numCols(); ++i)
+        {
+            batchMatrix shifted {input}, plus, minus;
+            shifted(n,i) += h;
+            dense.infer(shifted, plus);
+            shifted(n,i) -= 2*h;
+            dense.infer(shifted, minus);
+            maxInputError = max(maxInputError, abs((halfSquaredSum(plus) - halfSquaredSum(minus)) / (2*h) - inputGrad(n,i)));
+        }
+    }
+
+    // update(1) subtracts the accumulated gradient, which recovers it from the weights.
+    const linalg::Matrix<double> weightsBefore {dense.getWeights()};
+    const vector<double> biasesBefore {dense.getBiases()};
+    dense.update(1.0);
+    linalg::Matrix<double> weightGrads {weightsBefore};
+    for (int i=0; i<weightGrads.size(); ++i)
+    {
+        weightGrads.getValues()[i] -= dense.getWeights().getValues()[i];
+    }
+    dense.getWeights() = weightsBefore;
+    dense.getBiases() = biasesBefore;
+
+    double maxWeightError {0.0};
+    for (int i=0; i<weightsBefore.size(); ++i)
+    {
+        batchMatrix plus, minus;
+        dense.getWeights().getValues()[i] += h;
+        dense.infer(input, plus);
+        dense.getWeights().getValues()[i] -= 2*h;
+        dense.infer(input, minus);
+        dense.getWeights().getValues()[i] += h;
+        maxWeightError = max(maxWeightError, abs((halfSquaredSum(plus) - halfSquaredSum(minus)) / (2*h) - weightGrads.getValues()[i]));
+    }
+
+    vector<int> layerSizes {6, 8, 3};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new DenseLayer(10, 6, Activation::RELU)));
+    network.setBatchSize(8);
+    quietly([&]() { network.train(randomSamples(8, 10, 3)); });
+    const DenseLayer &trained { static_cast<const DenseLayer&>(network.getFeatureLayer(0)) };
+    const size_t capacity { trained.getTape().getArena().capacity() };
+    quietly([&]() { network.train(randomSamples(64, 10, 3)); });
+
+    cout << dense.getName() << endl;
+    cout << "Max input gradient error:  " << maxInputError << endl;
+    cout << "Max weight gradient error: " << maxWeightError << endl;
+    cout << "Tape: " << trained.getTape().numNodes() << " nodes, arena " << capacity << " bytes" << endl << endl;
+    assert(maxInputError < 1e-6 && maxWeightError < 1e-6);
+    assert(capacity > 0 && trained.getTape().getArena().capacity() == capacity);
+}
+
+void test_pool2DGradients(Pooling type)
+{
+    /*
+    Checks Pool2DLayer::backward (argmax scatter for max pooling, even spread
+    for average pooling) against central finite differences.
+    */
+    const double h {1e-6};
+    Pool2DLayer pool(type, 2, 6, 6, 2);
+
+    batchMatrix input(3, pool.getInputSize(), true);
+    batchMatrix output, inputGrad;
+    pool.forward(input, output);
+    pool.backward(input, output, output, inputGrad);
+
+    double maxError {0.0};
+    for (int n=0; n<input.numRows(); ++n)
+    {
+        for (int i=0; i<input.numCols(); ++i)
+        {
+            batchMatrix shifted {input};
+            shifted(n,i) += h;
+            batchMatrix plus;
+            pool.infer(shifted, plus);
+            shifted(n,i) -= 2*h;
+            batchMatrix minus;
+            pool.infer(shifted, minus);
+            const double numerical { (halfSquaredSum(plus) - halfSquaredSum(minus)) / (2*h) };
+            maxError = max(maxError, abs(numerical - inputGrad(n,i)));
+        }
+    }
+
+    cout << pool.getName() << endl;
+    cout << "Max input gradient error: " << maxError << endl << endl;
+    assert(maxError < 1e-6);
+}
+
+void test_batchNormGradients()
+{
+    /*
+    Checks BatchNormLayer::backward against central finite differences of
+    the training-mode forward pass (batch statistics depend on every input).
+    */
+    const double h {1e-6};
+    BatchNormLayer batchNorm(3, 4, Activation::TANH);
+
+    batchMatrix input(5, batchNorm.getInputSize(), true);
+    batchMatrix output, inputGrad;
+    batchNorm.forward(input, output);
+    batchNorm.backward(input, output, output, inputGrad);
+
+    double maxError {0.0};
+    for (int n=0; n<input.numRows(); ++n)
+    {
+        for (int i=0; i<input.numCols(); ++i)
+        {
+            BatchNormLayer probe {batchNorm};
+            batchMatrix shifted {input};
+            shifted(n,i) += h;
+            batchMatrix plus;
+            probe.forward(shifted, plus);
+            shifted(n,i) -= 2*h;
+            batchMatrix minus;
+            probe.forward(shifted, minus);
+            const double numerical { (halfSquaredSum(plus) - halfSquaredSum(minus)) / (2*h) };
+            maxError = max(maxError, abs(numerical - inputGrad(n,i)));
+        }
+    }
+
+    cout << batchNorm.getName() << endl;
+    cout << "Max input gradient error: " << maxError << endl << endl;
+    assert(maxError < 1e-6);
+}
+
+void test_batchNormFolding()
+{
+    /*
+    After a little training, the inference model with batch norm folded into
+    the convolution must predict the same outputs as the original network.
+    */
+    vector<int> layerSizes {3*4*4, 4, 2};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new Conv2DLayer(1, 6, 6, 3, 3, 1, 0, Activation::LINEAR)));
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new BatchNormLayer(3, 16, Activation::RELU)));
+    network.setBatchSize(4);
+
+    const vector<vector<vector<double>>> trainingData { randomSamples(16, 36, 2) };
+    quietly([&]() { network.train(trainingData); });
+
+    Network folded { network.inferenceModel() };
+    batchMatrix inputs(8, 36, true);
+    batchMatrix expected, outputs;
+    network.predict(inputs, expected);
+    folded.predict(inputs, outputs);
+
+    double maxError {0.0};
+    for (int i=0; i<expected.size(); ++i)
+    {
+        maxError = max(maxError, abs(expected.getValues()[i] - outputs.getValues()[i]));
+    }
+    cout << "Original network:" << endl;
+    network.printToConsole();
+    cout << "Inference model:" << endl;
+    folded.printToConsole();
+    cout << "Max difference after folding batch norm: " << maxError << endl << endl;
+    assert(maxError < 1e-12);
+}
+
+void test_denseBatchNormFolding()
+{
+    /*
+    Batch norm on a dense layer sits between the product and the bias; the
+    inference model folds it into the rows of that layer's weights and its
+    biases, and must then predict what the original network does, as must
+    the inference graph built from the original.
+    */
+    vector<int> layerSizes {10, 16, 8, 3};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::RELU, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.setBatchNorm(1);
+    network.setBatchNorm(2);
+    network.setBatchSize(8);
+
+    const vector<vector<vector<double>>> trainingData { randomSamples(32, 10, 3) };
+    quietly([&]() { network.train(trainingData); });
+
+    Network folded { network.inferenceModel() };
+    assert(folded.getBatchNorm(1) == nullptr && folded.getBatchNorm(2) == nullptr);
+    InferenceGraph graph(network);
+    graph.fuse();
+
+    batchMatrix inputs(8, 10, true);
+    batchMatrix expected, outputs, graphOutputs;
+    network.predict(inputs, expected);
+    folded.predict(inputs, outputs);
+    graph.predict(inputs, graphOutputs);
+
+    double maxError {0.0}, graphError {0.0};
+    for (int i=0; i<expected.size(); ++i)
+    {
+        maxError   = max(maxError,   abs(expected.getValues()[i] - outputs.getValues()[i]));
+        graphError = max(graphError, abs(expected.getValues()[i] - graphOutputs.getValues()[i]));
+    }
+    cout << "Max difference after folding dense batch norm: " << maxError << ", inference graph " << graphError << endl << endl;
+    assert(maxError < 1e-9 && graphError < 1e-9);
+}
+
+void test_fusedInferenceGraph()
+{
+    /*
+    The unfused and fused graphs must both reproduce Network::predict. The
+    first batch norm folds into the convolution; the second, after pooling,
+    can't, and becomes part of an elementwise chain instead.
+    */
+    vector<int> layerSizes {3*2*2, 8, 2};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new Conv2DLayer(1, 6, 6, 3, 3, 1, 0, Activation::LINEAR)));
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new BatchNormLayer(3, 16, Activation::RELU)));
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new Pool2DLayer(Pooling::MAX, 3, 4, 4, 2)));
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new BatchNormLayer(3, 4, Activation::TANH)));
+    network.setBatchSize(4);
+
+    const vector<vector<vector<double>>> trainingData { randomSamples(16, 36, 2) };
+    quietly([&]() { network.train(trainingData); });
+
+    InferenceGraph unfused(network);
+    InferenceGraph fused(network);
+    fused.fuse();
+    unfused.printToConsole();
+    fused.printToConsole();
+
+    batchMatrix inputs(8, 36, true);
+    batchMatrix expected, unfusedOutputs, fusedOutputs;
+    network.predict(inputs, expected);
+    unfused.predict(inputs, unfusedOutputs);
+    fused.predict(inputs, fusedOutputs);
+
+    double unfusedError {0.0}, fusedError {0.0};
+    for (int i=0; i<expected.size(); ++i)
+    {
+        unfusedError = max(unfusedError, abs(expected.getValues()[i] - unfusedOutputs.getValues()[i]));
+        fusedError   = max(fusedError,   abs(expected.getValues()[i] - fusedOutputs.getValues()[i]));
+    }
+    cout << "Max difference from predict(): unfused " << unfusedError << ", fused " << fusedError << endl << endl;
+    assert(unfusedError == 0.0 && fusedError < 1e-12);
+    assert(unfused.numNodes() == 14 && fused.numNodes() < unfused.numNodes());
+    assert(fused.trafficBytes(8) < unfused.trafficBytes(8));
+    InferenceGraph::benchmarkFusion(network, inputs, 3).printToConsole();
+}
+
+void test_dropoutMask()
+{
+    /*
+    Masks must keep close to 1-rate of the values, come out identical for the
+    same (seed, step) and differ between steps.
+    */
+    const int rows {64}, cols {300};
+    const double rate {0.3};
+    DropoutMask mask, repeat, nextStep;
+    mask.generate(42, 7, rows, cols, rate);
+    repeat.generate(42, 7, rows, cols, rate);
+    nextStep.generate(42, 8, rows, cols, rate);
+
+    int kept {0}, differences {0};
+    bool identical {true};
+    for (int n=0; n<rows; ++n)
+    {
+        for (int j=0; j<cols; ++j)
+        {
+            kept += mask.keep(n,j);
+            identical = identical && (mask.keep(n,j) == repeat.keep(n,j));
+            differences += (mask.keep(n,j) != nextStep.keep(n,j));
+        }
+    }
+    const double keptFraction { double(kept) / (rows*cols) };
+    cout << "Dropout kept fraction: " << keptFraction << " (expected " << 1-rate << ")" << endl;
+    cout << "Mask bits changed between steps: " << differences << endl << endl;
+    assert(abs(keptFraction - (1-rate)) < 0.02);
+    assert(identical);
+    assert(differences > rows*cols/4);
+    assert(abs(mask.getKeepScale() - 1/(1-rate)) < 1e-12);
+}
+
+void test_quantizedNetwork()
+{
+    /*
+    The int8 model must track the float model it was quantized from closely,
+    in under a quarter of the dense storage (biases stay in double).
+    */
+    vector<int> layerSizes {2*4*4, 16, 3};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new Conv2DLayer(1, 6, 6, 2, 3, 1, 0, Activation::LINEAR)));
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new BatchNormLayer(2, 16, Activation::RELU)));
+    network.setBatchSize(8);
+
+    const vector<vector<vector<double>>> trainingData { randomSamples(32, 36, 3) };
+    quietly([&]() { network.train(trainingData); });
+
+    batchMatrix calibration(64, 36, true);
+    QuantizedNetwork quantized(network, calibration);
+
+    batchMatrix inputs(32, 36, true);
+    batchMatrix targets(32, 3);
+    for (int n=0; n<32; ++n)
+    {
+        targets(n, n%3) = 1.0;
+    }
+    QuantizationReport report { quantized.compare(network, inputs, targets) };
+    report.printToConsole();
+    assert(report.maxOutputDifference < 0.05);
+    assert(report.quantizedBytes * 4 < report.floatBytes);
+}
+
+void test_pruning()
+{
+    /*
+    Following the schedule, 90% of the first-layer weights must be zero by
+    its last step, predictions must switch to the CSR kernel, and the
+    inference model must drop the dense copy and still predict the same,
+    from dense inputs and sparse ones.
+    */
+    vector<int> layerSizes {100, 40, 4};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::RELU, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.setBatchSize(4);
+    network.setPruning(0, 0.9, 0, 10, 2);
+
+    const vector<vector<vector<double>>> trainingData { randomSamples(48, 100, 4) };
+    quietly([&]() { network.train(trainingData); });
+
+    batchMatrix inputs(16, 100, true);
+    batchMatrix sparseOutputs;
+    network.predict(inputs, sparseOutputs);
+    Network model { network.inferenceModel() };
+    batchMatrix modelOutputs;
+    model.predict(inputs, modelOutputs);
+
+    cout << "Pruned first-layer density: " << network.getWeightDensity(0) << endl << endl;
+    assert(abs(network.getWeightDensity(0) - 0.1) < 1e-9);
+    assert(network.getWeightFormat(0) == linalg::SparseFormat::CSR);
+    assert(network.getWeightFormat(1) == linalg::SparseFormat::DENSE);
+    assert(model.getWeightMatrix(0).size() == 0);
+
+    double maxError {0.0};
+    for (int i=0; i<sparseOutputs.size(); ++i)
+    {
+        maxError = max(maxError, abs(sparseOutputs.getValues()[i] - modelOutputs.getValues()[i]));
+    }
+    assert(maxError < 1e-12);
+
+    // Sparse inputs reach the pruned first layer of the inference model through its CSR copy.
+    vector<linalg::SparseVector> sparseInputs;
+    for (int n=0; n<inputs.numRows(); ++n)
+    {
+        vector<double> sample(inputs.data() + n*100, inputs.data() + (n+1)*100);
+        for (int k=n%3; k<100; k+=3)
+        {
+            sample[k] = 0.0;
+            inputs(n, k) = 0.0;
+        }
+        sparseInputs.push_back(linalg::SparseVector::fromDense(sample));
+    }
+    batchMatrix denseInputOutputs, sparseInputOutputs;
+    network.predict(inputs, denseInputOutputs);
+    model.predict(linalg::CSRMatrix(sparseInputs, 0, inputs.numRows()), sparseInputOutputs);
+    assert(sparseInputOutputs.numRows() == inputs.numRows() && sparseInputOutputs.numCols() == 4);
+    for (int i=0; i<denseInputOutputs.size(); ++i)
+    {
+        maxError = max(maxError, abs(denseInputOutputs.getValues()[i] - sparseInputOutputs.getValues()[i]));
+    }
+    cout << "Max difference of the pruned inference model, dense and sparse inputs: " << maxError << endl << endl;
+    assert(maxError < 1e-12);
+}
+
+void test_sparseInputTraining()
+{
+    /*
+    Training on sparse inputs must give the same weights and predictions
+    as training a copy of the network on the same inputs stored densely.
+    */
+    vector<int> layerSizes {200, 12, 3};
+    vector<Activation> activationTypes {Activation::RELU, Activation::TANH, Activation::TANH};
+    Network denseNetwork(layerSizes, activationTypes);
+    denseNetwork.setBatchSize(5);
+    Network sparseNetwork(denseNetwork);
+
+    vector<vector<vector<double>>> trainingData;
+    vector<linalg::SparseVector> sparseInputs;
+    vector<vector<double>> targets;
+    for (int i=0; i<30; ++i)
+    {
+        batchMatrix sample(1, 200, true);
+        for (int k=0; k<200; ++k)
+        {
+            if ((k*7 + i) % 10 < 8) { sample(0,k) = 0.0; }
+        }
+        targets.push_back({double(i%3 == 0), double(i%3 == 1), double(i%3 == 2)});
+        trainingData.push_back({sample.getValues(), targets.back()});
+        sparseInputs.push_back(linalg::SparseVector::fromDense(sample.getValues()));
+    }
+    quietly([&]()
+    {
+        denseNetwork.train(trainingData);
+        sparseNetwork.train(sparseInputs, targets);
+    });
+
+    double maxError {0.0};
+    for (int l=0; l<2; ++l)
+    {
+        const vector<double> &dense { denseNetwork.getWeightMatrix(l).getValues() };
+        const vector<double> &sparse { sparseNetwork.getWeightMatrix(l).getValues() };
+        for (size_t i=0; i<dense.size(); ++i)
+        {
+            maxError = max(maxError, abs(dense[i] - sparse[i]));
+        }
+    }
+
+    batchMatrix inputs(8, 200);
+    for (int n=0; n<8; ++n)
+    {
+        std::copy(trainingData[n][0].begin(), trainingData[n][0].end(), inputs.data() + n*200);
+    }
+    batchMatrix denseOutputs, sparseOutputs;
+    denseNetwork.predict(inputs, denseOutputs);
+    sparseNetwork.predict(linalg::CSRMatrix(sparseInputs, 0, 8), sparseOutputs);
+    for (int i=0; i<denseOutputs.size(); ++i)
+    {
+        maxError = max(maxError, abs(denseOutputs.getValues()[i] - sparseOutputs.getValues()[i]));
+    }
+    cout << "Max difference between sparse and dense input training: " << maxError << endl << endl;
+    assert(maxError < 1e-10);
+}
+
+void test_checkpointing()
+{
+    /*
+    Checkpointed training recomputes the dropped activations, dropout masks
+    included, so it must end with exactly the same weights while holding
+    fewer activations at its peak.
+    */
+    vector<int> layerSizes {20, 64, 64, 64, 64, 64, 4};
+    vector<Activation> activationTypes(layerSizes.size(), Activation::TANH);
+    Network network(layerSizes, activationTypes);
+    network.setBatchSize(16);
+    network.setDropout(2, 0.2);
+    Network checkpointed(network);
+    checkpointed.setCheckpointInterval(3);
+
+    const vector<vector<vector<double>>> trainingData { randomSamples(64, 20, 4) };
+    quietly([&]()
+    {
+        network.train(trainingData);
+        checkpointed.train(trainingData);
+    });
+
+    double maxError {0.0};
+    for (int l=0; l<network.getNumLayers()-1; ++l)
+    {
+        const vector<double> &expected { network.getWeightMatrix(l).getValues() };
+        const vector<double> &actual { checkpointed.getWeightMatrix(l).getValues() };
+        for (size_t i=0; i<expected.size(); ++i)
+        {
+            maxError = max(maxError, abs(expected[i] - actual[i]));
+        }
+    }
+    cout << "Peak activation memory: " << network.getPeakActivationBytes() << " bytes, "
+         << checkpointed.getPeakActivationBytes() << " with checkpoints" << endl;
+    cout << "Max weight difference with checkpointing: " << maxError << endl << endl;
+    assert(maxError == 0.0);
+    assert(checkpointed.getPeakActivationBytes() < network.getPeakActivationBytes());
+}
+
+void test_evaluate()
+{
+    /*
+    evaluate() must agree with predict() sample by sample, and give the
+    same result whatever the thread count and batch size.
+    */
+    vector<int> layerSizes {10, 8, 3};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+
+    vector<vector<vector<double>>> data;
+    for (int i=0; i<103; ++i)
+    {
+        batchMatrix sample(1, 10, true);
+        data.push_back({sample.getValues(), {double(i%3 == 0), double(i%3 == 1), double(i%3 == 2)}});
+    }
+    const DatasetView view(data);
+
+    int correct {0};
+    for (int i=0; i<view.size(); ++i)
+    {
+        batchMatrix input(1, 10), output;
+        std::copy(view.features(i), view.features(i) + 10, input.data());
+        network.predict(input, output);
+        correct += (std::max_element(output.data(), output.data() + 3) - output.data()) == view.label(i);
+    }
+
+    const int threads { parallel::numThreads() };
+    parallel::setNumThreads(4);
+    const Evaluation evaluation { network.evaluate(view, 16) };
+    parallel::setNumThreads(1);
+    const Evaluation serial { network.evaluate(view, 16) };
+    parallel::setNumThreads(threads);
+    const Evaluation slice { network.evaluate(view.slice(100, 50), 7) };
+
+    evaluation.printToConsole();
+    assert(evaluation.numSamples == 103 && slice.numSamples == 3);
+    assert(abs(evaluation.accuracy - double(correct) / 103) < 1e-12);
+    assert(evaluation.loss == serial.loss && evaluation.confusion == serial.confusion);
+}
+
+void test_earlyStopping()
+{
+    /*
+    Every epoch must be validated, and the network must end up with the
+    weights of the epoch with the lowest validation cost.
+    */
+    vector<int> layerSizes {6, 16, 2};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.setBatchSize(4);
+
+    vector<vector<vector<double>>> trainingData, validationData;
+    for (int i=0; i<40; ++i)
+    {
+        batchMatrix sample(1, 6, true);
+        const double label { double(sample(0,0) + sample(0,1) > 1.0) };
+        (i < 24 ? trainingData : validationData).push_back({sample.getValues(), {label, 1-label}});
+    }
+
+    const TrainingHistory history { quietly([&]()
+    {
+        return network.trainEpochs(trainingData, DatasetView(validationData), 25, 2);
+    }) };
+    history.printToConsole();
+
+    double bestCost { history.validation.front().loss };
+    for (const Evaluation &evaluation : history.validation)
+    {
+        bestCost = min(bestCost, evaluation.loss);
+    }
+    assert(int(history.validation.size()) == history.epochsRun);
+    assert(history.validation.at(history.bestEpoch-1).loss == bestCost);
+    assert(network.evaluate(DatasetView(validationData)).loss == bestCost);
+}
+
+void test_pipelinedTraining()
+{
+    /*
+    Pipelined training runs the same minibatch updates as train(), only with
+    the gradients summed over microbatches, so the weights may differ by
+    rounding alone. Stages must cover every weight matrix in order.
+    */
+    vector<int> layerSizes {12, 48, 32, 32, 24, 3};
+    vector<Activation> activationTypes(layerSizes.size(), Activation::TANH);
+    Network network(layerSizes, activationTypes);
+    network.setBatchSize(20);
+    Network pipelined(network);
+
+    const vector<vector<vector<double>>> trainingData { randomSamples(90, 12, 3) };
+    quietly([&]() { network.train(trainingData); });
+    const PipelineStats stats { quietly([&]() { return pipelined.trainPipelined(trainingData, 3, 4); }) };
+    stats.printToConsole();
+
+    assert(stats.firstLayers.size() == 3 && stats.firstLayers.front() == 0);
+    assert(std::is_sorted(stats.firstLayers.begin(), stats.firstLayers.end()));
+    double maxError {0.0};
+    for (int l=0; l<network.getNumLayers()-1; ++l)
+    {
+        const vector<double> &expected { network.getWeightMatrix(l).getValues() };
+        const vector<double> &actual { pipelined.getWeightMatrix(l).getValues() };
+        for (size_t i=0; i<expected.size(); ++i)
+        {
+            maxError = max(maxError, abs(expected[i] - actual[i]));
+        }
+        for (int j=0; j<layerSizes.at(l+1); ++j)
+        {
+            maxError = max(maxError, abs(network.getLayer(l+1).getBiasAt(j) - pipelined.getLayer(l+1).getBiasAt(j)));
+        }
+    }
+    cout << "Max parameter difference with pipelining: " << maxError << endl << endl;
+    assert(maxError < 1e-9);
+}
+
+void test_rooflineReport()
+{
+    /*
+    Analytic layer costs of a small conv net, and a measured report with
+    one timed entry per layer placed under the machine's roofline.
+    */
+    vector<int> layerSizes {3*2*2, 8, 2};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new Conv2DLayer(1, 6, 6, 3, 3, 1, 0, Activation::RELU)));
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new Pool2DLayer(Pooling::MAX, 3, 4, 4, 2)));
+
+    const int batchSize {5};
+    const vector<roofline::KernelCost> costs { network.layerCosts(batchSize) };
+    assert(costs.size() == 4);
+    assert(costs[0].flops == batchSize * (2.0*3*9*16 + 2.0*3*16));            // im2col GEMM, bias and activation
+    assert(costs[0].bytes == 8.0 * (batchSize*(36 + 48) + 3*9 + 3));
+    assert(costs[1].flops == batchSize * 12.0 * 4 && costs[1].bytes == 8.0 * batchSize * (48 + 12));
+    assert(costs[2].flops == 2.0 * batchSize * (12*8 + 8));
+    assert(costs[2].bytes == 8.0 * (12*8 + batchSize*(12 + 8) + 8));
+    assert(costs[3].flops == 2.0 * batchSize * (8*2 + 2));
+
+    batchMatrix inputs(batchSize, 36, true);
+    const roofline::RooflineReport report { network.rooflineReport(inputs, 3) };
+    report.printToConsole();
+    assert(report.peak.gflops > 0.0 && report.peak.gbps > 0.0);
+    assert(report.kernels.size() == costs.size());
+    for (const roofline::KernelCost &kernel : report.kernels)
+    {
+        assert(kernel.seconds > 0.0 && report.fractionOfRoof(kernel) > 0.0);
+        (void)kernel;
+    }
+}
+
+void test_checkpointWriter()
+{
+    /*
+    Checkpoints saved during training reach the disk in the background,
+    only the newest ones are retained, and loading the last one into a
+    fresh network restores the trained weights, biases and step exactly.
+    A checkpoint for other layer sizes must be refused, as must networks
+    with state checkpoints don't hold.
+    */
+    vector<int> layerSizes {6, 16, 2};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.setBatchSize(4);
+
+    const vector<vector<vector<double>>> trainingData { randomSamples(32, 6, 2) };
+
+    CheckpointWriter writer(".", "test_checkpoint", 2);
+    network.setAutoSave(&writer, 2);
+    quietly([&]() { network.train(trainingData); }); // 8 minibatches, so 4 checkpoints
+    writer.flush();
+
+    const vector<string> files { writer.files() };
+    assert(writer.numWritten() == 4 && writer.numFailed() == 0);
+    assert(files.size() == 2 && files.back() == "./test_checkpoint-8.ckpt");
+    assert(fopen("./test_checkpoint-4.ckpt", "rb") == nullptr); // Deleted as no longer retained.
+
+    Network restored(layerSizes, activationTypes);
+    assert(CheckpointWriter::load(files.back(), restored));
+    vector<double> trained(network.numParameters()), loaded(restored.numParameters());
+    network.copyParameters(trained.data());
+    restored.copyParameters(loaded.data());
+    assert(trained == loaded);
+    assert(restored.getTrainingStep() == network.getTrainingStep());
+
+    vector<int> otherSizes {6, 8, 2};
+    Network other(otherSizes, activationTypes);
+    assert(!CheckpointWriter::load(files.back(), other));
+
+    Network normalized(layerSizes, activationTypes);
+    normalized.setBatchNorm(1);
+    assert(!writer.save(normalized) && !CheckpointWriter::load(files.back(), normalized));
+    Network convolutional(layerSizes, activationTypes);
+    convolutional.addFeatureLayer(unique_ptr<BatchLayer>(new Pool2DLayer(Pooling::MAX, 6, 2, 2, 2)));
+    assert(!writer.save(convolutional) && !CheckpointWriter::load(files.back(), convolutional));
+    Network pruned(layerSizes, activationTypes);
+    pruned.setBatchSize(4);
+    pruned.setPruning(0, 0.5, 0, 1);
+    quietly([&]() { pruned.train(vector<vector<vector<double>>>(trainingData.begin(), trainingData.begin()+4)); });
+    assert(pruned.isPruned(0));
+    assert(!writer.save(pruned) && !CheckpointWriter::load(files.back(), pruned));
+    assert(writer.numWritten() == 4);
+
+    for (const string &file : files)
+    {
+        std::remove(file.c_str());
+    }
+    cout<<"Checkpoints: "<<writer.numWritten()<<" written, "<<writer.stagingSeconds()*1e6<<" us of training time spent staging"<<endl<<endl;
+}
+
+void test_deterministicTraining()
+{
+    /*
+    With deterministic reductions the conv gradients are summed in the same
+    order for any thread count, so training the same network on 1, 3 and 8
+    threads must give bitwise-identical weights. The dense parameters
+    depend on the conv kernels from the second minibatch on, so comparing
+    them covers both.
+    */
+    vector<int> layerSizes {3*4*4, 10, 2};
+    vector<Activation> activationTypes {Activation::LINEAR, Activation::TANH, Activation::TANH};
+    Network network(layerSizes, activationTypes);
+    network.addFeatureLayer(unique_ptr<BatchLayer>(new Conv2DLayer(1, 6, 6, 3, 3, 1, 0, Activation::TANH)));
+    network.setBatchSize(40); // Several gradient blocks per minibatch.
+
+    const vector<vector<vector<double>>> trainingData { randomSamples(160, 36, 2) };
+
+    const int previousThreads { parallel::numThreads() };
+    const bool previousMode { parallel::deterministicReductions() };
+    parallel::setDeterministicReductions(true);
+    vector<vector<double>> parameters;
+    for (int numThreads : {1, 3, 8})
+    {
+        parallel::setNumThreads(numThreads);
+        Network copy(network);
+        quietly([&]() { copy.train(trainingData); });
+        parameters.emplace_back(copy.numParameters());
+        copy.copyParameters(parameters.back().data());
+    }
+    parallel::setDeterministicReductions(previousMode);
+    parallel::setNumThreads(previousThreads);
+
+    assert(parameters[0] != vector<double>(parameters[0].size(), 0.0));
+    assert(parameters[1] == parameters[0] && parameters[2] == parameters[0]);
+    cout<<"Deterministic training: "<<parameters[0].size()<<" parameters identical on 1, 3 and 8 threads"<<endl<<endl;
+}
+
+int main()
+{
+    test_conv2DGradients();
+    test_denseLayerGradients();
+    test_pool2DGradients(Pooling::MAX);
+    test_pool2DGradients(Pooling::AVERAGE);
+    test_batchNormGradients();
+    test_batchNormFolding();
+    test_denseBatchNormFolding();
+    test_fusedInferenceGraph();
+    test_dropoutMask();
+    test_quantizedNetwork();
+    test_pruning();
+    test_sparseInputTraining();
+    test_checkpointing();
+    test_checkpointWriter();
+    test_deterministicTraining();
+    test_evaluate();
+    test_earlyStopping();
+    test_pipelinedTraining();
+    test_rooflineReport();
+
+    return 0;
+}
@@ -1,6 +1,23 @@
+#include "math/autodiff.hpp"
+#include "math/autotune.hpp"
+#include "math/gemm.hpp"
+#include "math/hugepages.hpp"
 #include "math/matrix.hpp"
+#include "math/memory_tracker.hpp"
+#include "math/numa.hpp"
+#include "math/parallel.hpp"
 #include "math/linearalgebra.hpp"
+#include "math/profiler.hpp"
+#include "math/qgemm.hpp"
+#include "math/sparse.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
 #include <vector>
 
 using namespace std;
@@ -73,12 +90,610 @@ void test_hadamardProduct()
     cout<<endl;
 }
 
+void test_gemm()
+{
+    /*
+    Blocked GEMM against the naive product, with shapes that straddle
+    the tile sizes and with transposed operands.
+    */
+    linalg::Matrix<double> A(70, 300, true);
+    linalg::Matrix<double> B(300, 260, true);
+    linalg::Matrix<double> expected = A*B;
+
+    linalg::Matrix<double> C;
+    linalg::gemm(A, false, B, false, C);
+    linalg::Matrix<double> AT = A.transpose();
+    linalg::Matrix<double> BT = B.transpose();
+    linalg::Matrix<double> CT;
+    linalg::gemm(AT, true, BT, true, CT);
+
+    double maxError {0.0};
+    for (int i=0; i<expected.numRows(); ++i)
+    {
+        for (int j=0; j<expected.numCols(); ++j)
+        {
+            maxError = max(maxError, abs(C(i,j) - expected(i,j)));
+            maxError = max(maxError, abs(CT(i,j) - expected(i,j)));
+        }
+    }
+    cout<<"Max GEMM error against naive product: "<<maxError<<endl<<endl;
+    assert(maxError < 1e-9);
+}
+
+void test_gemmAutotuning()
+{
+    /*
+    Every tiling, the 4-row kernel included, must give bitwise the default
+    product. Autotuning tunes a new shape class once, saves it to the cache
+    next to other machines' entries, and loads it back when re-enabled
+    instead of tuning again.
+    */
+    const int M {37}, N {50}, K {29};
+    linalg::Matrix<double> A(M, K, true), B(K, N, true);
+    linalg::Matrix<double> expected, C;
+    linalg::gemm(A, false, B, false, expected);
+
+    const linalg::GemmTiling tilings[] { {16, 64, 8, 0, 1}, {8, 16, 16, 1, 4}, {64, 32, 256, 2, 4} };
+    for (const linalg::GemmTiling &tiling : tilings)
+    {
+        C.resize(M, N);
+        linalg::gemm(tiling, false, false, M, N, K, 1.0, A.data(), K, B.data(), N, 0.0, C.data(), N);
+        assert(C.getValues() == expected.getValues());
+    }
+
+    const string cachePath { "test_kernels.tsv" };
+    const string otherLine { "Other CPU (hardware threads: 4)\tNN:8x8x8\t8 8 8 1 1" };
+    ofstream(cachePath) << otherLine << endl;
+    autotune::setCachePath(cachePath);
+    autotune::setEnabled(true);
+    assert(autotune::numCached() == 0);
+    linalg::gemm(A, false, B, false, C);
+    assert(C.getValues() == expected.getValues());
+    assert(autotune::numTuned() == 1 && autotune::numCached() == 1);
+
+    ifstream cache(cachePath);
+    string line;
+    bool otherKept {false}, ours {false};
+    while (getline(cache, line))
+    {
+        otherKept = otherKept || line == otherLine;
+        ours = ours || line.find(autotune::cpuModel() + "\t" + autotune::shapeClass(false, false, M, N, K) + "\t") == 0;
+    }
+    assert(otherKept && ours);
+    assert(autotune::shapeClass(false, false, M, N, K) == "NN:64x64x32" && autotune::shapeClass(false, true, 1, 2000, 784) == "NT:1x>1024x1024");
+
+    autotune::setEnabled(false);
+    autotune::setEnabled(true); // Reloads the cache.
+    assert(autotune::numCached() == 1);
+    linalg::gemm(A, false, B, false, C);
+    assert(autotune::numTuned() == 1);
+    assert(C.getValues() == expected.getValues());
+    autotune::gemmTiling(false, true, M, N, K); // The same sizes with B transposed are another class.
+    assert(autotune::numTuned() == 2 && autotune::numCached() == 2);
+
+    const linalg::GemmTiling tuned { autotune::gemmTiling(false, false, M, N, K) };
+    autotune::setEnabled(false);
+    autotune::setCachePath("");
+    std::remove(cachePath.c_str());
+    cout<<"Autotuned gemm for "<<autotune::cpuModel()<<": mc "<<tuned.mc<<", nc "<<tuned.nc<<", kc "<<tuned.kc
+        <<", threads "<<tuned.threads<<", rows per pass "<<tuned.rowsPerPass<<endl<<endl;
+}
+
+void test_gemmInt8()
+{
+    /*
+    Int8 GEMM and GEMV must match the integer reference exactly, including
+    extreme values and lengths that leave a tail after the vector loop.
+    */
+    const int M {5}, N {70}, K {203};
+    vector<int8_t> A(M*K), W(N*K);
+    for (int i=0; i<M*K; ++i) { A[i] = static_cast<int8_t>((i*37) % 255 - 127); }
+    for (int i=0; i<N*K; ++i) { W[i] = static_cast<int8_t>((i*91) % 255 - 127); }
+    A[0] = W[0] = -127;
+
+    vector<int32_t> C(M*N), c(N);
+    linalg::gemmInt8(M, N, K, A.data(), K, W.data(), K, C.data(), N);
+    linalg::gemvInt8(N, K, A.data(), W.data(), K, c.data());
+
+    int mismatches {0};
+    for (int i=0; i<M; ++i)
+    {
+        for (int j=0; j<N; ++j)
+        {
+            int32_t expected {0};
+            for (int k=0; k<K; ++k)
+            {
+                expected += static_cast<int32_t>(A[i*K+k]) * W[j*K+k];
+            }
+            mismatches += (C[i*N+j] != expected);
+            mismatches += (i == 0 && c[j] != expected);
+        }
+    }
+    cout<<"Int8 GEMM mismatches against reference: "<<mismatches<<endl<<endl;
+    assert(mismatches == 0);
+}
+
+void test_sparseProducts()
+{
+    /*
+    CSR and BSR products against the dense GEMM, on a mostly-zero matrix
+    whose shape doesn't divide into the BSR blocks.
+    */
+    linalg::Matrix<double> W(37, 203, true);
+    for (int i=0; i<W.size(); ++i)
+    {
+        if ((i*7) % 10 < 8) { W.getValues()[i] = 0.0; }
+    }
+    linalg::Matrix<double> X(9, 203, true);
+    linalg::Matrix<double> expected;
+    linalg::gemm(X, false, W, true, expected);
+
+    const linalg::CSRMatrix csr(W);
+    const linalg::BSRMatrix bsr(W, 4);
+    linalg::Matrix<double> csrProduct, bsrProduct;
+    linalg::spmm(csr, X, csrProduct);
+    linalg::spmm(bsr, X, bsrProduct);
+    vector<double> y(W.numRows());
+    linalg::spmv(csr, X.data(), y.data());
+
+    double maxError {0.0};
+    for (int i=0; i<expected.numRows(); ++i)
+    {
+        for (int j=0; j<expected.numCols(); ++j)
+        {
+            maxError = max(maxError, abs(csrProduct(i,j) - expected(i,j)));
+            maxError = max(maxError, abs(bsrProduct(i,j) - expected(i,j)));
+        }
+    }
+    for (int j=0; j<W.numRows(); ++j)
+    {
+        maxError = max(maxError, abs(y[j] - expected(0,j)));
+    }
+    cout<<"CSR density "<<csr.density()<<", "<<csr.bytes()<<" bytes against "<<W.size()*sizeof(double)<<" dense"<<endl;
+    cout<<"Max sparse product error against GEMM: "<<maxError<<endl<<endl;
+    assert(maxError < 1e-12);
+    assert(abs(csr.density() - 0.2) < 0.01);
+}
+
+void test_sparseInputProducts()
+{
+    /*
+    Products with sparse samples against the dense GEMM: the forward
+    product X * W^T, and the compacted weight gradient E^T * X.
+    */
+    linalg::Matrix<double> X(6, 150, true);
+    for (int i=0; i<X.size(); ++i)
+    {
+        if ((i*13) % 10 < 9) { X.getValues()[i] = 0.0; }
+    }
+    linalg::Matrix<double> W(20, 150, true);
+    linalg::Matrix<double> E(6, 20, true);
+    linalg::Matrix<double> expectedY, expectedG;
+    linalg::gemm(X, false, W, true, expectedY);
+    linalg::gemm(E, true, X, false, expectedG);
+
+    vector<linalg::SparseVector> rows;
+    for (int n=0; n<X.numRows(); ++n)
+    {
+        rows.push_back(linalg::SparseVector::fromDense(vector<double>(X.data() + n*150, X.data() + (n+1)*150)));
+    }
+    const linalg::CSRMatrix sparseX(rows, 0, rows.size());
+    linalg::Matrix<double> Y, G;
+    vector<int> columns;
+    linalg::spmmSparseInput(sparseX, W, Y);
+    linalg::sparseInputGradient(E, sparseX, columns, G);
+
+    double maxError {0.0};
+    for (int i=0; i<Y.size(); ++i)
+    {
+        maxError = max(maxError, abs(Y.getValues()[i] - expectedY.getValues()[i]));
+    }
+    vector<bool> covered(150, false);
+    for (size_t c=0; c<columns.size(); ++c)
+    {
+        covered[columns[c]] = true;
+        for (int j=0; j<20; ++j)
+        {
+            maxError = max(maxError, abs(G(c,j) - expectedG(j,columns[c])));
+        }
+    }
+    for (int k=0; k<150; ++k)
+    {
+        for (int j=0; j<20 && !covered[k]; ++j)
+        {
+            maxError = max(maxError, abs(expectedG(j,k)));
+        }
+    }
+    cout<<"Sparse input columns touched: "<<columns.size()<<" of 150"<<endl;
+    cout<<"Max sparse input product error against GEMM: "<<maxError<<endl<<endl;
+    assert(maxError < 1e-12);
+}
+
+namespace
+{
+    autodiff::Var autodiffCost(autodiff::Tape &tape, const linalg::Matrix<double> &X, const linalg::Matrix<double> &T,
+                        vector<linalg::Matrix<double>> &params, vector<linalg::Matrix<double>> &grads)
+    {
+        /*
+        Two-layer network with a gated skip connection, recorded on the tape:
+            H    = tanh(X W1^T + b1)
+            G    = sigmoid(H W2 + b2) * relu(H) - 0.5 H
+            cost = 0.5 |G W3 - T|^2
+        */
+        tape.reset();
+        autodiff::Var x  { tape.constant(X) };
+        autodiff::Var W1 { tape.parameter(params[0], grads[0]) };
+        autodiff::Var b1 { tape.parameter(params[1], grads[1]) };
+        autodiff::Var W2 { tape.parameter(params[2], grads[2]) };
+        autodiff::Var b2 { tape.parameter(params[3], grads[3]) };
+        autodiff::Var W3 { tape.parameter(params[4], grads[4]) };
+        autodiff::Var H  { tape.tanh(tape.addRow(tape.matmul(x, W1, true), b1)) };
+        autodiff::Var G  { tape.subtract(tape.hadamard(tape.sigmoid(tape.addRow(tape.matmul(H, W2), b2)), tape.relu(H)),
+                                         tape.scale(H, 0.5)) };
+        return tape.halfSumSquares(tape.subtract(tape.matmul(G, W3), tape.constant(T)));
+    }
+}
+
+void test_autodiffGradients()
+{
+    /*
+    Tape gradients against central differences, and a second step after
+    reset() reusing the arena without growing it.
+    */
+    linalg::Matrix<double> X(5, 4, true);
+    linalg::Matrix<double> T(5, 3, true);
+    vector<linalg::Matrix<double>> params { linalg::Matrix<double>(6, 4, true), linalg::Matrix<double>(1, 6, true),
+                                            linalg::Matrix<double>(6, 6, true), linalg::Matrix<double>(1, 6, true),
+                                            linalg::Matrix<double>(6, 3, true) };
+    vector<linalg::Matrix<double>> grads(params.size());
+    vector<linalg::Matrix<double>> unused(params.size());
+
+    autodiff::Tape tape(4096);
+    tape.backward(autodiffCost(tape, X, T, params, grads));
+    const size_t bytesUsed { tape.getArena().bytesUsed() };
+    const size_t capacity { tape.getArena().capacity() };
+    const size_t numNodes { tape.numNodes() };
+
+    const double h {1e-6};
+    double maxError {0.0};
+    for (size_t p=0; p<params.size(); ++p)
+    {
+        for (int i=0; i<params[p].size(); ++i)
+        {
+            const double original { params[p].getValues()[i] };
+            params[p].getValues()[i] = original + h;
+            const double plus { autodiffCost(tape, X, T, params, unused)(0,0) };
+            params[p].getValues()[i] = original - h;
+            const double minus { autodiffCost(tape, X, T, params, unused)(0,0) };
+            params[p].getValues()[i] = original;
+            maxError = max(maxError, abs((plus - minus) / (2*h) - grads[p].getValues()[i]));
+        }
+    }
+    cout<<"Tape of "<<numNodes<<" nodes, "<<bytesUsed<<" arena bytes in use of "<<capacity<<endl;
+    cout<<"Max autodiff gradient error against central differences: "<<maxError<<endl<<endl;
+    assert(maxError < 1e-7);
+    assert(tape.getArena().bytesUsed() == bytesUsed && tape.getArena().capacity() == capacity);
+}
+
+void test_profilerRegions()
+{
+    /*
+    Regions record only while profiling is enabled, nested regions report
+    inclusive totals, and counters the machine doesn't expose are reported
+    rather than failing (there is no PMU in most containers and VMs).
+    */
+    linalg::Matrix<double> A(64, 64, true), B(64, 64, true), C(64, 64);
+    {
+        profiler::Region region("disabled");
+        linalg::gemm(A, false, B, false, C);
+    }
+    profiler::setEnabled(true);
+    for (int i=0; i<3; ++i)
+    {
+        profiler::Region outer("outer", 64);
+        profiler::Region inner("inner", 64);
+        linalg::gemm(A, false, B, false, C);
+    }
+    profiler::setEnabled(false);
+    profiler::printToConsole();
+
+    const vector<profiler::RegionStats> regions { profiler::regions() };
+    assert(regions.size() == 2);
+    assert(regions[0].name == "inner" && regions[1].name == "outer");
+    assert(regions[1].calls == 3 && regions[1].samples == 192);
+    assert(regions[1].seconds >= regions[0].seconds && regions[0].seconds > 0.0);
+    for (int c=0; c<profiler::NUM_COUNTERS; ++c)
+    {
+        const profiler::Counter counter { static_cast<profiler::Counter>(c) };
+        assert(profiler::counterAvailable(counter) || regions[1].counts[c] == 0.0);
+        (void)counter;
+    }
+    if (profiler::counterAvailable(profiler::INSTRUCTIONS))
+    {
+        assert(regions[1].counts[profiler::INSTRUCTIONS] >= regions[0].counts[profiler::INSTRUCTIONS]);
+        assert(regions[0].counts[profiler::INSTRUCTIONS] > 2.0*64*64*64*3 / 8); // At least one instruction per 4-wide FMA
+    }
+    profiler::reset();
+    assert(profiler::regions().empty());
+}
+
+void test_memoryTracking()
+{
+    /*
+    Allocations count against the innermost scope, also on parallelFor's
+    workers, frees against the subsystem they were allocated under, and
+    peaks remember the most held at once. Without SCRATCHNET_MEMTRACK
+    only the scopes are kept, and the counts stay at zero; the
+    test_linearalgebra_memtrack variant checks the counts.
+    */
+    using memtrack::Subsystem;
+    const size_t before { memtrack::usage(Subsystem::INDEXES).currentBytes };
+    (void)before;
+    memtrack::resetPeaks();
+    vector<double> *outer;
+    {
+        memtrack::Scope scope(Subsystem::INDEXES);
+        outer = new vector<double>(1000);
+        {
+            memtrack::Scope inner(Subsystem::OPTIMIZER);
+            assert(memtrack::currentSubsystem() == Subsystem::OPTIMIZER);
+        }
+        assert(memtrack::currentSubsystem() == Subsystem::INDEXES);
+    }
+    assert(memtrack::currentSubsystem() == Subsystem::OTHER);
+    assert(!memtrack::enabled() || memtrack::usage(Subsystem::INDEXES).currentBytes >= before + 1000*sizeof(double));
+    delete outer; // Freed outside the scope, still counted against INDEXES.
+    assert(memtrack::usage(Subsystem::INDEXES).currentBytes == before);
+    assert(!memtrack::enabled() || memtrack::usage(Subsystem::INDEXES).peakBytes >= before + 1000*sizeof(double));
+
+    const int previousThreads { parallel::numThreads() };
+    parallel::setNumThreads(4);
+    vector<Subsystem> seen(8, Subsystem::OTHER);
+    {
+        memtrack::Scope scope(Subsystem::INDEXES);
+        parallel::parallelFor(0, 8, [&](int begin, int end)
+        {
+            for (int i=begin; i<end; ++i)
+            {
+                seen[i] = memtrack::currentSubsystem();
+                vector<double> scratch(4096);
+            }
+        });
+    }
+    parallel::setNumThreads(previousThreads);
+    for (Subsystem subsystem : seen)
+    {
+        assert(subsystem == Subsystem::INDEXES);
+        (void)subsystem;
+    }
+    assert(memtrack::usage(Subsystem::INDEXES).currentBytes == before);
+    assert(!memtrack::enabled() || memtrack::usage(Subsystem::INDEXES).peakBytes >= before + 4096*sizeof(double));
+    assert(memtrack::totalUsage().peakBytes >= memtrack::usage(Subsystem::INDEXES).peakBytes);
+    memtrack::printToConsole();
+}
+
+void test_workStealingScheduler()
+{
+    /*
+    Ranges are covered exactly once in pieces no longer than the grain,
+    nested parallel calls and task groups complete (tasks spawning more
+    tasks than a deque initially holds), and a SerialScope keeps the work
+    on the calling thread.
+    */
+    const int previousThreads { parallel::numThreads() };
+    parallel::setNumThreads(4);
+
+    vector<int> visits(10000, 0);
+    std::atomic<int> oversized {0};
+    parallel::parallelFor(0, 10000, 64, [&](int begin, int end)
+    {
+        oversized += (end - begin > 64);
+        for (int i=begin; i<end; ++i)
+        {
+            ++visits[i];
+        }
+    });
+    assert(oversized == 0);
+    assert(std::count(visits.begin(), visits.end(), 1) == 10000);
+
+    std::atomic<long> nestedSum {0};
+    parallel::parallelFor(0, 16, 1, [&](int outerBegin, int outerEnd)
+    {
+        for (int k=outerBegin; k<outerEnd; ++k)
+        {
+            parallel::parallelFor(0, 1000, [&](int begin, int end)
+            {
+                long sum {0};
+                for (int i=begin; i<end; ++i)
+                {
+                    sum += i;
+                }
+                nestedSum += sum;
+            });
+        }
+    });
+    assert(nestedSum == 16L * 999 * 1000 / 2);
+
+    std::atomic<int> tasksRun {0};
+    {
+        parallel::TaskGroup group;
+        for (int t=0; t<4; ++t)
+        {
+            group.run([&]()
+            {
+                parallel::TaskGroup inner;
+                for (int i=0; i<1000; ++i)
+                {
+                    inner.run([&]() { ++tasksRun; });
+                }
+                inner.wait();
+            });
+        }
+        group.wait();
+        assert(tasksRun == 4000);
+    }
+
+    int calls {0};
+    {
+        parallel::SerialScope serial;
+        parallel::parallelFor(0, 1000, 1, [&](int begin, int end)
+        {
+            ++calls;
+            assert(begin == 0 && end == 1000);
+            (void)begin; (void)end;
+        });
+    }
+    assert(calls == 1);
+
+    parallel::setCorePinning(true);
+    std::atomic<int> pinnedVisits {0};
+    parallel::parallelFor(0, 100, 1, [&](int begin, int end) { pinnedVisits += end - begin; });
+    parallel::setCorePinning(false);
+    assert(pinnedVisits == 100);
+
+    parallel::setNumThreads(previousThreads);
+    cout<<"Work-stealing scheduler: "<<tasksRun<<" nested tasks and "<<nestedSum<<" nested sum"<<endl<<endl;
+}
+
+void test_numaPlacement()
+{
+    /*
+    The topology is consistent (at least one node, the current node among
+    them), a large matrix is usable after placement and its pages are on
+    known nodes, replicas read the same values as the original, and node
+    pinning leaves the scheduler working. On a single node Replicated must
+    not copy at all.
+    */
+    const vector<int> &nodes { numa::nodes() };
+    assert(!nodes.empty() && numa::numNodes() == static_cast<int>(nodes.size()));
+    assert(std::find(nodes.begin(), nodes.end(), numa::currentNode()) != nodes.end() || numa::numNodes() == 1);
+
+    linalg::Matrix<double> large(1024, 1024);
+    assert(large.size() * sizeof(double) >= numa::MIN_PLACEMENT_BYTES);
+    assert(std::all_of(large.getValues().begin(), large.getValues().end(), [](double v) { return v == 0.0; }));
+    large(1023, 1023) = 1.0;
+    const int node { numa::nodeOfAddress(&large(512, 0)) };
+    assert(node == -1 || std::find(nodes.begin(), nodes.end(), node) != nodes.end());
+
+    const vector<double> original(1000, 2.5);
+    const numa::Replicated<vector<double>> replicas(original);
+    assert(replicas.local() == original);
+    assert(replicas.numCopies() == numa::numNodes());
+    if (numa::numNodes() == 1)
+    {
+        assert(&replicas.local() == &original);
+    }
+
+    int ranOn {-2};
+    numa::runOnNode(nodes.front(), [&]() { ranOn = numa::currentNode(); });
+    assert(ranOn >= 0);
+
+    parallel::setNodePinning(true);
+    std::atomic<int> visits {0};
+    parallel::parallelFor(0, 100, 1, [&](int begin, int end) { visits += end - begin; });
+    parallel::setNodePinning(false);
+    assert(visits == 100);
+
+    cout<<"NUMA placement: "<<numa::numNodes()<<" node(s), large matrix on node "<<node<<endl<<endl;
+}
+
+void test_hugePages()
+{
+    /*
+    Huge page buffers are 2 MB aligned, zeroed and writable whether or not
+    the kernel grants huge pages; advice needs at least one whole huge page
+    in the range; large matrices stay zero-initialized. Whether huge pages
+    are actually granted depends on the machine, so it is only reported.
+    */
+    const size_t bytes { 3 * hugepages::HUGE_PAGE_BYTES + 12345 };
+    char *buffer { static_cast<char*>(hugepages::allocate(bytes)) };
+    assert(reinterpret_cast<uintptr_t>(buffer) % hugepages::HUGE_PAGE_BYTES == 0);
+    assert(std::all_of(buffer, buffer + bytes, [](char c) { return c == 0; }));
+    std::fill(buffer, buffer + bytes, 7);
+    assert(buffer[bytes-1] == 7);
+    const size_t huge { hugepages::hugeBytes(buffer, bytes) };
+    assert(huge <= bytes + hugepages::HUGE_PAGE_BYTES);
+    hugepages::deallocate(buffer, bytes);
+
+    vector<char> small(hugepages::HUGE_PAGE_BYTES);
+    assert(!hugepages::advise(small.data() + 1, small.size() - 1)); // No whole aligned huge page inside.
+
+    hugepages::setEnabled(false);
+    linalg::Matrix<double> plain(1024, 1024);
+    hugepages::setEnabled(true);
+    linalg::Matrix<double> large(1024, 1024);
+    assert(std::all_of(large.getValues().begin(), large.getValues().end(), [](double v) { return v == 0.0; }));
+    assert(std::all_of(plain.getValues().begin(), plain.getValues().end(), [](double v) { return v == 0.0; }));
+
+    cout<<"Huge pages ("<<hugepages::systemMode()<<"): "<<(huge >> 20)<<" MB of a "<<(bytes >> 20)<<" MB buffer, "
+        <<(hugepages::hugeBytes(large.data(), large.size()*sizeof(double)) >> 20)<<" MB of an 8 MB matrix"<<endl<<endl;
+}
+
+void test_deterministicReduction()
+{
+    /*
+    parallelReduce must sum correctly in both modes, and in deterministic
+    mode give the same bits for any thread count. The values span many
+    magnitudes so that a different summation order would show.
+    */
+    const int numValues {100000}, width {3};
+    vector<double> values(numValues);
+    for (int i=0; i<numValues; ++i)
+    {
+        values[i] = std::pow(10.0, (i*7919) % 17 - 8) * (i % 2 ? 1.0 : -0.5);
+    }
+    const auto accumulate = [&](int begin, int end, double *partial)
+    {
+        for (int i=begin; i<end; ++i)
+        {
+            partial[0] += values[i];
+            partial[1] += 1.0;
+            partial[2] += values[i] * values[i];
+        }
+    };
+
+    const int previousThreads { parallel::numThreads() };
+    const bool previousMode { parallel::deterministicReductions() };
+    double fast[width];
+    parallel::setDeterministicReductions(false);
+    parallel::parallelReduce(0, numValues, 1000, width, accumulate, fast);
+    assert(fast[1] == numValues);
+
+    vector<vector<double>> results;
+    parallel::setDeterministicReductions(true);
+    for (int numThreads : {1, 3, 8})
+    {
+        parallel::setNumThreads(numThreads);
+        results.emplace_back(width);
+        parallel::parallelReduce(0, numValues, 1000, width, accumulate, results.back().data());
+    }
+    parallel::setDeterministicReductions(previousMode);
+    parallel::setNumThreads(previousThreads);
+
+    assert(results[1] == results[0] && results[2] == results[0]);
+    assert(results[0][1] == numValues);
+    assert(std::abs(results[0][0] - fast[0]) <= 1e-9 * std::abs(fast[0]));
+    cout<<"Deterministic reduction: sum "<<results[0][0]<<" on 1, 3 and 8 threads"<<endl<<endl;
+}
+
 int main()
 {
     test_matrixMultiplication();
     test_matrixVectorMultiplication();
     test_transposeMatrix();
     test_hadamardProduct();
+    test_gemm();
+    test_gemmAutotuning();
+    test_gemmInt8();
+    test_sparseProducts();
+    test_sparseInputProducts();
+    test_autodiffGradients();
+    test_profilerRegions();
+    test_memoryTracking();
+    test_workStealingScheduler();
+    test_deterministicReduction();
+    test_numaPlacement();
+    test_hugePages();
 
     return 0;
 }
\ No newline at end of file
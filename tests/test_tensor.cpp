@@ -0,0 +1,88 @@
+#include "math/gemm.hpp"
+#include "math/matrix.hpp"
+#include "math/tensor.hpp"
+
+#include <assert.h>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+void test_views()
+{
+    /*
+    Slices, selects, transposes and reshapes share storage with the tensor.
+    */
+    linalg::Tensor<double> T({2, 3, 4});
+    for (long i=0; i<T.size(); ++i)
+    {
+        T.data()[i] = i;
+    }
+
+    linalg::TensorView<double> batch { T.view() };
+    linalg::TensorView<double> sample { batch.select(0, 1) };   // 3 x 4
+    linalg::TensorView<double> columns { sample.slice(1, 1, 3) }; // 3 x 2
+    linalg::TensorView<double> sampleT { sample.transpose() };    // 4 x 3
+    linalg::TensorView<double> flat { sample.reshape({12}) };
+
+    cout << "T(1,2,3) = " << T(1,2,3) << ", sample(2,3) = " << sample(2,3)
+         << ", columns(2,1) = " << columns(2,1) << ", sampleT(3,2) = " << sampleT(3,2)
+         << ", flat(11) = " << flat(11) << endl;
+    assert(sample(2,3) == 23 && columns(2,1) == 22 && sampleT(3,2) == 23 && flat(11) == 23);
+
+    sampleT(0,0) = -1; // writes through to the tensor
+    assert(T(1,0,0) == -1);
+
+    cout << "sample contiguous: " << sample.isContiguous()
+         << ", columns contiguous: " << columns.isContiguous()
+         << ", transpose contiguous: " << sampleT.isContiguous() << endl;
+    assert(sample.isContiguous() && !columns.isContiguous() && !sampleT.isContiguous());
+
+    linalg::Tensor<double> copy { linalg::contiguous(columns) };
+    assert(copy(2,1) == 22 && copy.view().isContiguous());
+    cout << endl;
+}
+
+void test_gemmOnViews()
+{
+    /*
+    Transposed and sliced views go through gemm without copies and
+    give the same product as the Matrix overload.
+    */
+    linalg::Matrix<double> A(40, 30, true);
+    linalg::Matrix<double> B(50, 40, true);
+    linalg::Matrix<double> expected;
+    linalg::gemm(A, true, B, true, expected); // A^T B^T is 30 x 50
+
+    linalg::Matrix<double> C(30, 50);
+    linalg::gemm(linalg::asView(A).transpose(), linalg::asView(B).transpose(), linalg::asView(C));
+
+    // A row slice of the result, written through a view of C.
+    linalg::Matrix<double> D(30, 50);
+    linalg::gemm(linalg::asView(A).transpose().slice(0, 5, 10), linalg::asView(B).transpose(),
+                 linalg::asView(D).slice(0, 5, 10));
+
+    double maxError {0.0};
+    for (int i=0; i<30; ++i)
+    {
+        for (int j=0; j<50; ++j)
+        {
+            maxError = max(maxError, abs(C(i,j) - expected(i,j)));
+            if (i >= 5 && i < 10)
+            {
+                maxError = max(maxError, abs(D(i,j) - expected(i,j)));
+            }
+        }
+    }
+    cout << "Max error of gemm on transposed views: " << maxError << endl << endl;
+    assert(maxError < 1e-12);
+}
+
+int main()
+{
+    test_views();
+    test_gemmOnViews();
+
+    return 0;
+}